@@ -1,4 +1,6 @@
+#include <algorithm>
 #include <bitset>
+#include <cstring>
 #include <fstream>
 #include <stdexcept> //std::runtime_error
 #include <utility>   //std::swap
@@ -7,13 +9,48 @@ using std::endl;
 #include "APS2.h"
 #include "APS2Datagram.h"
 
+namespace {
+
+// CSR registers the firmware updates by itself so they bypass the register
+// cache
+bool is_volatile_register(uint32_t addr) {
+  switch (addr) {
+  case PLL_STATUS_ADDR:
+  case PHASE_COUNT_A_ADDR:
+  case PHASE_COUNT_B_ADDR:
+  case CACHE_STATUS_ADDR:
+  case DAC_BIST_CHA_PH1_ADDR:
+  case DAC_BIST_CHA_PH2_ADDR:
+  case DAC_BIST_CHB_PH1_ADDR:
+  case DAC_BIST_CHB_PH2_ADDR:
+  case DMA_STATUS_ADDR:
+  case SATA_STATUS_ADDR:
+  case UPTIME_SECONDS_ADDR:
+  case UPTIME_NANOSECONDS_ADDR:
+  case TEMPERATURE_ADDR:
+    return true;
+  default:
+    return false;
+  }
+}
+
+} // namespace
+
 APS2::APS2()
     : legacy_firmware{false}, ipAddr_{""}, connected_{false}, channels_(2),
-      samplingRate_{0} {};
+      samplingRate_{0}, registerCacheEnabled_{false},
+      registerCacheValid_{false}, shadowRegisters_(NUM_CSR_REGISTERS, 0),
+      waveformMemory_(2, APS2MemoryAllocator(WF_LIBRARY_SIZE)),
+      waveformEntries_(2), sequenceMemory_(SEQ_REGION_SIZE),
+      loadedSequenceHash_{0}, loadedWaveformHashes_(2, 0) {};
 
 APS2::APS2(string deviceSerial)
     : legacy_firmware{false}, ipAddr_{deviceSerial}, connected_{false},
-      samplingRate_{0} {
+      samplingRate_{0}, registerCacheEnabled_{false},
+      registerCacheValid_{false}, shadowRegisters_(NUM_CSR_REGISTERS, 0),
+      waveformMemory_(2, APS2MemoryAllocator(WF_LIBRARY_SIZE)),
+      waveformEntries_(2), sequenceMemory_(SEQ_REGION_SIZE),
+      loadedSequenceHash_{0}, loadedWaveformHashes_(2, 0) {
   channels_.reserve(2);
   for (size_t ct = 0; ct < 2; ct++)
     channels_.push_back(Channel(ct));
@@ -49,15 +86,24 @@ void APS2::connect(shared_ptr<APS2Ethernet> &&ethernetRM) {
 
     LOG(plog::info) << ipAddr_ << " opened connection to device";
 
+    if (registerCacheEnabled_) {
+      resync_register_cache();
+    }
+
     // TODO: restore state information from file
   }
 }
 
 void APS2::disconnect() {
   LOG(plog::debug) << ipAddr_ << " APS2::disconnect";
+  // let any queued uploads finish before dropping the connection
+  wait_async();
   if (connected_) {
     ethernetRM_->disconnect(ipAddr_);
     connected_ = false;
+    registerCacheValid_ = false;
+    // someone else may load the waveform memory before we reconnect
+    forget_uploads(MEMORY_ADDR, SEQ_OFFSET + SEQ_REGION_SIZE);
     LOG(plog::info) << ipAddr_ << " closed connection to device";
 
     // Release reference to ethernet RM
@@ -67,6 +113,7 @@ void APS2::disconnect() {
 }
 
 void APS2::reset(APS2_RESET_MODE mode) {
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
   LOG(plog::debug) << ipAddr_ << " APS2::reset";
 
   APS2Command cmd;
@@ -88,6 +135,8 @@ void APS2::reset(APS2_RESET_MODE mode) {
   }
 
   // Send the command
+  registerCacheValid_ = false;
+  forget_uploads(MEMORY_ADDR, SEQ_OFFSET + SEQ_REGION_SIZE);
   ethernetRM_->send(ipAddr_, {{cmd, addr, {}}});
 
   // we expect to loose the connection at this point...
@@ -110,8 +159,11 @@ APS2_STATUS APS2::init(const bool &forceReload, const int &bitFileNum) {
     LOG(plog::info) << ipAddr_ << " initializing APS2";
 
     // toggle the OSERDES reset for firmware < v4.3
-    set_register_bit(RESETS_ADDR, {IO_CHA_RST_BIT, IO_CHB_RST_BIT});
-    clear_register_bit(RESETS_ADDR, {IO_CHA_RST_BIT, IO_CHB_RST_BIT});
+    APS2Transaction txn;
+    txn.set_bits(RESETS_ADDR, {IO_CHA_RST_BIT, IO_CHB_RST_BIT});
+    txn.barrier();
+    txn.clear_bits(RESETS_ADDR, {IO_CHA_RST_BIT, IO_CHB_RST_BIT});
+    commit(txn);
 
     // align DAC data clock boundaries
     setup_DACs();
@@ -137,6 +189,7 @@ void APS2::setup_DACs() {
 }
 
 APSStatusBank_t APS2::read_status_registers() {
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
   LOG(plog::debug) << ipAddr_ << " APS2::read_status_registers";
   // Query with the status request command
   APS2Command cmd;
@@ -295,39 +348,35 @@ void APS2::write_bitfile(const string &bitFile, uint32_t start_addr,
   // Now validate bitfile data
   bitfile_writing_task = VALIDATING;
   bitfile_writing_task_progress = 0;
-  uint32_t end_addr = start_addr + 4 * bitfile_words.size();
-  uint32_t addr = start_addr;
-  do {
-    uint16_t read_length;
-    // Read up to 1kB at a time because of ApsMsgProc limitations
-    if ((end_addr - addr) >= (1 << 10)) {
-      read_length = 256;
-    } else {
-      read_length = (end_addr - addr) / 4;
-    }
-
-    vector<uint32_t> check_vec;
+  // Read back in large blocks so the reads stay pipelined while still
+  // reporting progress
+  const size_t block_words = 64 * MAX_READ_WORDS;
+  vector<uint32_t> check_vec(block_words);
+  size_t offset = 0;
+  while (offset < bitfile_words.size()) {
+    uint32_t read_length = std::min(block_words, bitfile_words.size() - offset);
+    uint32_t addr = start_addr + 4 * offset;
     switch (media) {
     case BITFILE_MEDIA_DRAM:
-      check_vec = read_configuration_SDRAM(addr, read_length);
+      read_configuration_SDRAM(addr, read_length, check_vec.data());
       break;
     case BITFILE_MEDIA_EPROM:
-      check_vec = read_flash(addr, read_length);
+      read_flash(addr, read_length, check_vec.data());
       break;
     }
 
-    for (size_t ct = 0; ct < read_length; ct++) {
-      if (check_vec[ct] != bitfile_words[(addr - start_addr) / 4]) {
-        throw APS2_BITFILE_VALIDATION_FAILURE;
-      }
-      addr += 4;
+    if (!std::equal(check_vec.begin(), check_vec.begin() + read_length,
+                    bitfile_words.begin() + offset)) {
+      throw APS2_BITFILE_VALIDATION_FAILURE;
     }
+    offset += read_length;
     bitfile_writing_task_progress =
-        static_cast<double>(addr - start_addr) / (end_addr - start_addr);
-  } while (addr < end_addr);
+        static_cast<double>(offset) / bitfile_words.size();
+  }
 }
 
 void APS2::program_bitfile(uint32_t addr) {
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
   // Program the bitfile from configuration SDRAM at the specified address
   // FPGA will reset so connection will be dropped
   LOG(plog::debug) << ipAddr_ << " APS2::program_bitfile";
@@ -354,59 +403,150 @@ void APS2::set_sampleRate(const unsigned int &freq) {
 
 unsigned int APS2::get_sampleRate() {
   LOG(plog::debug) << ipAddr_ << " APS2::get_sampleRate";
-  samplingRate_ = get_PLL_freq();
+  // With the register cache on trust the rate we last read or set rather
+  // than walking the PLL registers again
+  if (!registerCacheValid_ || samplingRate_ == 0) {
+    samplingRate_ = get_PLL_freq();
+  }
   return samplingRate_;
 }
 
 void APS2::clear_channel_data() {
   LOG(plog::info) << ipAddr_ << " clearing all channel data for APS2 "
                     << ipAddr_;
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
   for (auto &ch : channels_) {
     ch.clear_data();
   }
+  std::fill(loadedWaveformHashes_.begin(), loadedWaveformHashes_.end(), 0);
 }
 
 void APS2::load_sequence_file(const string &seqFile) {
   /*
    * Load a sequence file from a binary file
+   *
+   * The file is mapped rather than read and each section is streamed to the
+   * device straight from the mapped pages while the operating system reads
+   * the next one ahead, so disk and network work at the same time. Version
+   * 2 files are found by their magic; anything else is read as version 1.
    */
   try {
     LOG(plog::info) << ipAddr_ << " opening sequence file: " << seqFile;
-
-    // Read the header information
-    char junk[100];
-    uint64_t buff_length;
-    uint16_t num_chans;
-
-    std::fstream file(seqFile, std::ios::binary | std::ios::in);
-    if( !file ) throw APS2_SEQFILE_FAIL;
-
-    file.read(junk, 12); // Don't need this info
-    file.read(reinterpret_cast<char *> (&num_chans), sizeof(uint16_t));
+    std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
+    APS2MappedFile file(seqFile);
+    if (APS2SequenceFile::is_v2(file)) {
+      load_sequence_sections(file);
+      return;
+    }
+    auto layout = APS2SequenceFile::read_v1_layout(file);
+    size_t num_chans = layout.waveforms.size();
 
     // Start anew
     clear_channel_data();
 
-    // Read the instructions
-    file.read(reinterpret_cast<char *> (&buff_length), sizeof(uint64_t));
-    vector<uint64_t> instructions;
-    instructions.resize(buff_length);
-    file.read(reinterpret_cast<char *> (instructions.data()), buff_length*sizeof(uint64_t));
-    write_sequence(instructions);
-
-    // Read the waveforms
-    vector<int16_t> waveform;
-    for (int chanct = 0; chanct < num_chans; chanct++) {
-      file.read(reinterpret_cast<char *> (&buff_length), sizeof(uint64_t));
-      waveform.resize(buff_length);
-      file.read(reinterpret_cast<char *> (waveform.data()), buff_length*sizeof(int16_t));
-      set_waveform(chanct, waveform);
+    // have the disk start on the first waveform while the instructions go
+    if (num_chans > 0) {
+      file.prefetch(layout.waveforms[0].first, SEQFILE_READAHEAD_BYTES);
+    }
+    write_sequence(file, layout.instructions.first,
+                   layout.instructions.second);
+
+    for (size_t chanct = 0; chanct < num_chans; chanct++) {
+      write_channel_waveform(static_cast<int>(chanct), file,
+                             layout.waveforms[chanct].first,
+                             layout.waveforms[chanct].second);
     }
   } catch (...) {
     throw APS2_SEQFILE_FAIL;
   }
 }
 
+void APS2::load_sequence_sections(const APS2MappedFile &file) {
+  /*
+   * Load a version 2 sequence file
+   *
+   * Its payloads are already in the device format so they go to the device
+   * as they are. A section whose hash matches what the device was last
+   * loaded with is skipped without its pages even being read; the others
+   * are checked against their hash before they are sent.
+   */
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
+  auto sections = APS2SequenceFile::read_sections(file);
+  const APS2SequenceSection *instructions = nullptr;
+  vector<const APS2SequenceSection *> waveforms(NUM_ANALOG_CHANNELS, nullptr);
+  vector<const APS2SequenceSection *> markers(NUM_ANALOG_CHANNELS, nullptr);
+  for (const auto &section : sections) {
+    switch (section.type) {
+    case APS2SectionType::INSTRUCTIONS:
+      instructions = &section;
+      break;
+    case APS2SectionType::WAVEFORM:
+      check_channel_num(section.channel);
+      waveforms[section.channel] = &section;
+      break;
+    case APS2SectionType::MARKERS:
+      check_channel_num(section.channel);
+      markers[section.channel] = &section;
+      break;
+    case APS2SectionType::METADATA:
+      LOG(plog::debug) << ipAddr_ << " sequence file metadata: "
+                          << string(reinterpret_cast<const char *>(
+                                        file.data() + section.offset),
+                                    section.count);
+      break;
+    }
+  }
+  auto check_hash = [&](const APS2SequenceSection &section) {
+    APS2ContentHash hash;
+    hash.update(file.data() + section.offset, section.numBytes);
+    if (hash.digest() != section.hash) {
+      LOG(plog::error) << ipAddr_ << " damaged section in sequence file";
+      throw APS2_SEQFILE_FAIL;
+    }
+  };
+
+  if (instructions && instructions->hash == loadedSequenceHash_) {
+    LOG(plog::debug) << ipAddr_ << " sequence unchanged since last load";
+  } else if (instructions) {
+    // checked before any of it is sent so a damaged file leaves the device
+    // running what it had
+    file.prefetch(instructions->offset, instructions->numBytes);
+    check_hash(*instructions);
+    write_sequence(file, instructions->offset, instructions->count);
+    loadedSequenceHash_ = instructions->hash;
+  }
+
+  for (int ch = 0; ch < NUM_ANALOG_CHANNELS; ch++) {
+    const APS2SequenceSection *wf = waveforms[ch];
+    if (!wf) {
+      channels_[ch].clear_data();
+      loadedWaveformHashes_[ch] = 0;
+      continue;
+    }
+    if (wf->hash == loadedWaveformHashes_[ch]) {
+      LOG(plog::debug) << ipAddr_ << " waveform on channel " << ch
+                          << " unchanged since last load";
+      continue;
+    }
+    file.prefetch(wf->offset, wf->numBytes);
+    check_hash(*wf);
+    const uint8_t *marks = nullptr;
+    if (markers[ch]) {
+      if (markers[ch]->count != wf->count) {
+        throw APS2_SEQFILE_FAIL;
+      }
+      check_hash(*markers[ch]);
+      marks = file.data() + markers[ch]->offset;
+    }
+    // payloads start on a page so the words are aligned
+    channels_[ch].set_packed_waveform(
+        reinterpret_cast<const uint32_t *>(file.data() + wf->offset),
+        wf->count, marks);
+    write_channel_waveform(ch);
+    loadedWaveformHashes_[ch] = wf->hash;
+  }
+}
+
 void APS2::check_channel_num(int chan) const {
   if (chan < 0 || chan >= NUM_ANALOG_CHANNELS) {
     LOG(plog::error) << ipAddr_ << " invalid DAC " << chan;
@@ -416,11 +556,13 @@ void APS2::check_channel_num(int chan) const {
 
 void APS2::set_channel_enabled(int dac, bool enable) {
   check_channel_num(dac);
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
   channels_[dac].set_enabled(enable);
 }
 
 bool APS2::get_channel_enabled(int dac) const {
   check_channel_num(dac);
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
   return channels_[dac].get_enabled();
 }
 
@@ -439,18 +581,17 @@ void APS2::set_channel_offset(int dac, float offset) {
   // Scale offset to Q0.13 fixed point
   int16_t offset_fixed = offset * MAX_WF_AMP;
 
-  // read the current value
-  uint32_t val = read_memory(CHANNEL_OFFSET_ADDR, 1)[0];
-
   // Overwrite the upper/lower word
+  APS2Transaction txn;
   if (dac == 0) {
     // Top half
-    val = (static_cast<uint32_t>(offset_fixed) << 16) | (val & 0xffff);
+    txn.write_masked(CHANNEL_OFFSET_ADDR,
+                     static_cast<uint32_t>(offset_fixed) << 16, 0xffff0000);
   } else {
     // Bottom half
-    val = (val & 0xffff0000) | (offset_fixed & 0xffff);
+    txn.write_masked(CHANNEL_OFFSET_ADDR, offset_fixed & 0xffff, 0xffff);
   }
-  write_memory(CHANNEL_OFFSET_ADDR, val);
+  commit(txn);
 }
 
 float APS2::get_channel_offset(int dac) const {
@@ -470,9 +611,8 @@ void APS2::set_channel_scale(int dac, float scale) {
   check_channel_num(dac);
   // write register for future getting
   uint32_t reg_addr = dac == 0 ? CH_A_SCALE_ADDR : CH_B_SCALE_ADDR;
-  write_memory(reg_addr, reinterpret_cast<uint32_t &>(scale));
   // update correction matrix
-  update_correction_matrix();
+  update_correction_matrix(reg_addr, reinterpret_cast<uint32_t &>(scale));
 }
 
 float APS2::get_channel_scale(int dac) const {
@@ -483,10 +623,9 @@ float APS2::get_channel_scale(int dac) const {
 }
 
 void APS2::set_mixer_amplitude_imbalance(float amp) {
-  // write register for future getting
-  write_memory(MIXER_AMP_IMBALANCE_ADDR, reinterpret_cast<uint32_t &>(amp));
-  // update correction matrix
-  update_correction_matrix();
+  // write register for future getting and update correction matrix
+  update_correction_matrix(MIXER_AMP_IMBALANCE_ADDR,
+                           reinterpret_cast<uint32_t &>(amp));
 }
 
 float APS2::get_mixer_amplitude_imbalance() {
@@ -495,10 +634,9 @@ float APS2::get_mixer_amplitude_imbalance() {
 }
 
 void APS2::set_mixer_phase_skew(float skew) {
-  // write register for future getting
-  write_memory(MIXER_PHASE_SKEW_ADDR, reinterpret_cast<uint32_t &>(skew));
-  // update correction matrix
-  update_correction_matrix();
+  // write register for future getting and update correction matrix
+  update_correction_matrix(MIXER_PHASE_SKEW_ADDR,
+                           reinterpret_cast<uint32_t &>(skew));
 }
 
 float APS2::get_mixer_phase_skew() {
@@ -545,17 +683,20 @@ vector<float> APS2::get_mixer_correction_matrix() {
   return correction_matrix;
 }
 
-void APS2::update_correction_matrix() {
+void APS2::update_correction_matrix(uint32_t addr, uint32_t value) {
   // Update the 2x2 correction matrix assuming an mixer amplitude imbalance,
   // phase skew and independent channel scales
   // [i_scale, 0;0, q_scale] * [amp, amp*tan(phi); 0, 1/cos(phi)] =
   // [i_scale*amp, i_scale*amp*tan(phi); 0, q_scale*1/cos(phi)]}
-  float amp_imbalance =
-      reinterpret_cast<float &>(read_memory(MIXER_AMP_IMBALANCE_ADDR, 1)[0]);
-  float phase_skew =
-      reinterpret_cast<float &>(read_memory(MIXER_PHASE_SKEW_ADDR, 1)[0]);
-  float i_scale = reinterpret_cast<float &>(read_memory(CH_A_SCALE_ADDR, 1)[0]);
-  float q_scale = reinterpret_cast<float &>(read_memory(CH_B_SCALE_ADDR, 1)[0]);
+  // the scale, imbalance and skew registers are adjacent so read them at once
+  // and substitute the one being set
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
+  auto regs = read_memory(CH_A_SCALE_ADDR, 4);
+  regs[(addr - CH_A_SCALE_ADDR) / 4] = value;
+  float i_scale = reinterpret_cast<float &>(regs[0]);
+  float q_scale = reinterpret_cast<float &>(regs[1]);
+  float amp_imbalance = reinterpret_cast<float &>(regs[2]);
+  float phase_skew = reinterpret_cast<float &>(regs[3]);
 
   // calculate matrix terms and convert to Q2.13 fixed point
   int32_t correction_matrix_00 =
@@ -566,30 +707,55 @@ void APS2::update_correction_matrix() {
   int32_t correction_matrix_11 = static_cast<int32_t>(
       q_scale / cos(phase_skew) * CORRECTION_MATRIX_SCALING);
 
-  // Slot into registers and write to memory
+  // Slot into registers and write them with the new setting in one burst
   uint32_t row0, row1;
   row0 = (correction_matrix_00 << 16) | (correction_matrix_01 & 0xffff);
-  write_memory(CORRECTION_MATRIX_ROW0_ADDR, row0);
   row1 = (correction_matrix_10 << 16) | (correction_matrix_11 & 0xffff);
-  write_memory(CORRECTION_MATRIX_ROW1_ADDR, row1);
+  APS2Transaction txn;
+  txn.write(addr, value);
+  txn.write(CORRECTION_MATRIX_ROW0_ADDR, row0);
+  txn.write(CORRECTION_MATRIX_ROW1_ADDR, row1);
+  commit(txn);
+}
+
+void APS2::set_waveform(int dac, const float *data, size_t numPts) {
+  check_channel_num(dac);
+  // held until the upload is done so a queued setter cannot change the
+  // channel in between
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
+  channels_[dac].set_waveform(data, numPts);
+  write_channel_waveform(dac);
+}
+
+void APS2::set_waveform(int dac, const int16_t *data, size_t numPts) {
+  check_channel_num(dac);
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
+  channels_[dac].set_waveform(data, numPts);
+  write_channel_waveform(dac);
 }
 
 void APS2::set_markers(const int &dac, const vector<uint8_t> &data) {
-  channels_[dac].set_markers(data);
+  set_markers(dac, data.data(), data.size());
+}
+
+void APS2::set_markers(int dac, const uint8_t *data, size_t numPts) {
+  check_channel_num(dac);
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
+  channels_[dac].set_markers(data, numPts);
   // write the waveform data again to add packed marker data
-  write_waveform(dac, channels_[dac].prep_waveform());
+  write_channel_waveform(dac);
 }
 
 void APS2::set_trigger_source(const APS2_TRIGGER_SOURCE &triggerSource) {
   LOG(plog::debug) << ipAddr_ << " setting trigger source to "
                      << triggerSource;
 
-  uint32_t regVal = read_memory(CONTROL_REG_ADDR, 1)[0];
-
   // Set the trigger source bits
-  regVal = (regVal & ~(3 << TRIGSRC_BIT)) |
-           (static_cast<uint32_t>(triggerSource) << TRIGSRC_BIT);
-  write_memory(CONTROL_REG_ADDR, regVal);
+  APS2Transaction txn;
+  txn.write_masked(CONTROL_REG_ADDR,
+                   static_cast<uint32_t>(triggerSource) << TRIGSRC_BIT,
+                   3 << TRIGSRC_BIT);
+  commit(txn);
 }
 
 APS2_TRIGGER_SOURCE APS2::get_trigger_source() {
@@ -640,43 +806,52 @@ double APS2::get_trigger_interval() {
 void APS2::trigger() {
   // Apply a software trigger by toggling the trigger line
   LOG(plog::debug) << ipAddr_ << " APS2::trigger";
-  uint32_t regVal = read_memory(CONTROL_REG_ADDR, 1)[0];
-  LOG(plog::verbose) << ipAddr_ << " SEQ_CONTROL register was "
-                      << hexn<8> << regVal;
-  regVal ^= (1 << SOFT_TRIG_BIT);
-  LOG(plog::verbose) << ipAddr_ << " setting SEQ_CONTROL register to "
-                      << hexn<8> << regVal;
-  write_memory(CONTROL_REG_ADDR, regVal);
+  APS2Transaction txn;
+  txn.toggle_bits(CONTROL_REG_ADDR, {SOFT_TRIG_BIT});
+  commit(txn);
 }
 
 void APS2::run() {
   LOG(plog::debug) << ipAddr_ << " APS2::run";
+  // Read the control register along with releasing the cache so the later
+  // steps are plain writes
+  APS2Transaction txn;
+  size_t control = txn.read(CONTROL_REG_ADDR);
   if (host_type == APS) {
     LOG(plog::debug) << ipAddr_ << " releasing the cache controller...";
-    set_register_bit(CACHE_CONTROL_ADDR, {CACHE_ENABLE_BIT});
+    txn.set_bits(CACHE_CONTROL_ADDR, {CACHE_ENABLE_BIT});
+  }
+  commit(txn);
+  uint32_t regVal = txn.result(control);
+  if (host_type == APS) {
     std::this_thread::sleep_for(std::chrono::milliseconds(1));
   }
+
   LOG(plog::debug) << ipAddr_
                       << " releasing pulse sequencer state machine...";
-  set_register_bit(CONTROL_REG_ADDR, {SM_ENABLE_BIT});
+  regVal |= (1 << SM_ENABLE_BIT);
+  write_memory(CONTROL_REG_ADDR, regVal);
   std::this_thread::sleep_for(std::chrono::milliseconds(1));
 
   LOG(plog::debug) << ipAddr_ << " enabling trigger...";
-  set_register_bit(CONTROL_REG_ADDR, {TRIGGER_ENABLE_BIT});
+  regVal |= (1 << TRIGGER_ENABLE_BIT);
+  write_memory(CONTROL_REG_ADDR, regVal);
 }
 
 void APS2::stop() {
   LOG(plog::debug) << ipAddr_ << " APS2::stop";
+  APS2Transaction txn;
   switch (host_type) {
   case APS:
     // hold the cache in reset
-    clear_register_bit(CACHE_CONTROL_ADDR, {CACHE_ENABLE_BIT});
+    txn.clear_bits(CACHE_CONTROL_ADDR, {CACHE_ENABLE_BIT});
     break;
   case TDM:
     break;
   }
   // Put the sequencer and trigger back in reset
-  clear_register_bit(CONTROL_REG_ADDR, {SM_ENABLE_BIT, TRIGGER_ENABLE_BIT});
+  txn.clear_bits(CONTROL_REG_ADDR, {SM_ENABLE_BIT, TRIGGER_ENABLE_BIT});
+  commit(txn);
 }
 
 APS2_RUN_STATE APS2::get_runState() { return runState; }
@@ -701,7 +876,9 @@ void APS2::set_run_mode(const APS2_RUN_MODE &mode) {
     throw APS2_UNKNOWN_RUN_MODE;
   }
   // set SSB frequency
-  instructions[0] |= read_memory(WF_SSB_FREQ_ADDR, 1)[0];
+  instructions[0] = APS2Instruction::modulator(
+      APS2Instruction::ModulatorOp::SET_FREQUENCY, 0x1,
+      read_memory(WF_SSB_FREQ_ADDR, 1)[0]);
 
   // inject waveform lengths into the instructions
   size_t wf_length_a, wf_length_b;
@@ -715,36 +892,38 @@ void APS2::set_run_mode(const APS2_RUN_MODE &mode) {
   // insert marker instructions on MK 1/MK 2 for TRIG_WAVEFORM
   if (mode == TRIG_WAVEFORM) {
     if (wf_length_a > 0) {
-      instructions.insert(goto_entry,
-                          0x1000000100000000 | (wf_length_a / 4 - 1));
+      instructions.insert(goto_entry, APS2Instruction::marker(
+                                          0, true, wf_length_a / 4 - 1, false));
       goto_entry = std::prev(instructions.end());
     }
     if (wf_length_b > 0) {
-      instructions.insert(goto_entry,
-                          0x1400000100000000 | (wf_length_b / 4 - 1));
+      instructions.insert(goto_entry, APS2Instruction::marker(
+                                          1, true, wf_length_b / 4 - 1, false));
       goto_entry = std::prev(instructions.end());
     }
   }
+  using APS2Instruction::waveform;
   if (wf_length_a == wf_length_b) {
     // single broadcast wf instruction with write flag high
     instructions.insert(goto_entry,
-                        0x0d00000000000000L | ((wf_length_a / 4 - 1) << 24));
+                        waveform(APS2Instruction::BOTH_CHANNELS, 0,
+                                 wf_length_a / 4 - 1, true));
   } else if (wf_length_b == 0) {
     // single wf instruction to a with write flag high
-    instructions.insert(goto_entry,
-                        0x0500000000000000L | ((wf_length_a / 4 - 1) << 24));
+    instructions.insert(goto_entry, waveform(APS2Instruction::CHANNEL_A, 0,
+                                             wf_length_a / 4 - 1, true));
   } else if (wf_length_a == 0) {
     // single wf instruction to b with write flag high
-    instructions.insert(goto_entry,
-                        0x0900000000000000L | ((wf_length_b / 4 - 1) << 24));
+    instructions.insert(goto_entry, waveform(APS2Instruction::CHANNEL_B, 0,
+                                             wf_length_b / 4 - 1, true));
   } else {
     // wf instruction to with write flag low; wf insruction to b with write flag
     // high
-    instructions.insert(goto_entry,
-                        0x0400000000000000L | ((wf_length_a / 4 - 1) << 24));
+    instructions.insert(goto_entry, waveform(APS2Instruction::CHANNEL_A, 0,
+                                             wf_length_a / 4 - 1, false));
     goto_entry = std::prev(instructions.end());
-    instructions.insert(goto_entry,
-                        0x0900000000000000L | ((wf_length_b / 4 - 1) << 24));
+    instructions.insert(goto_entry, waveform(APS2Instruction::CHANNEL_B, 0,
+                                             wf_length_b / 4 - 1, true));
   }
 
   LOG(plog::debug) << ipAddr_ << " writing waveform mode sequence:";
@@ -785,11 +964,98 @@ void APS2::write_memory(const uint32_t &addr, const uint32_t &data) {
 }
 
 void APS2::write_memory(const uint32_t &addr, const vector<uint32_t> &data) {
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
   /* APS2::write_memory
   * addr = start byte of address space
   * data = vector<uint32_t> data
   */
 
+  // Swap to network byte order once and send views into the swapped buffer so
+  // large waveform uploads are not copied again per datagram
+  APS2PreparedWrite prepared(addr, data);
+  write_prepared(prepared);
+  update_register_cache(addr, data.data(), data.size());
+}
+
+APS2PreparedWrite::APS2PreparedWrite(uint32_t addr,
+                                     const vector<uint32_t> &data)
+    : APS2PreparedWrite(addr, vector<uint32_t>(data)) {}
+
+APS2PreparedWrite::APS2PreparedWrite(uint32_t addr, vector<uint32_t> &&data)
+    : addr(addr), numWords(data.size()), networkData(std::move(data)) {
+  for (auto &val : networkData) {
+    val = htonl(val);
+  }
+  datagrams = range(0, numWords);
+}
+
+vector<APS2DatagramView> APS2PreparedWrite::range(size_t offset,
+                                                  size_t numWords) const {
+  return datagrams_for(addr + 4 * offset, networkData.data() + offset,
+                       numWords);
+}
+
+vector<APS2DatagramView>
+APS2PreparedWrite::datagrams_for(uint32_t addr, const uint32_t *networkData,
+                                 size_t numWords) {
+  APS2Command cmd;
+  cmd.ack = 1;
+  cmd.cmd = static_cast<uint32_t>(
+      APS_COMMANDS::USERIO_ACK); // TODO: take out when all TCP comms
+  return APS2DatagramView::chunk(
+      cmd, addr, networkData, numWords,
+      0xfffc); // max chunk_size is limited by 128bit data alignment in SDRAM
+}
+
+void APS2::write_prepared(const APS2PreparedWrite &prepared) {
+  write_prepared(prepared, 0, prepared.numWords);
+}
+
+void APS2::write_prepared(const APS2PreparedWrite &prepared, size_t offset,
+                          size_t numWords) {
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
+  check_memory_write(prepared.addr + 4 * offset, numWords);
+
+  try {
+    if (offset == 0 && numWords == prepared.numWords) {
+      ethernetRM_->send(ipAddr_, prepared.datagrams);
+    } else {
+      ethernetRM_->send(ipAddr_, prepared.range(offset, numWords));
+    }
+  } catch (...) {
+    // we no longer know what the registers hold
+    registerCacheValid_ = false;
+    throw;
+  }
+}
+
+template <typename F>
+void APS2::write_streamed(uint32_t addr, size_t numWords, F fill) {
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
+  check_memory_write(addr, numWords);
+
+  // Convert and send a chunk at a time so only one chunk of network order
+  // words ever exists; each send returns once its datagrams are acknowledged
+  // so the buffer can be refilled
+  vector<uint32_t> chunk(std::min(numWords, UPLOAD_CHUNK_WORDS));
+  for (size_t offset = 0; offset < numWords; offset += chunk.size()) {
+    size_t count = std::min(numWords - offset, chunk.size());
+    fill(offset, count, chunk.data());
+    for (size_t ct = 0; ct < count; ct++) {
+      chunk[ct] = htonl(chunk[ct]);
+    }
+    try {
+      ethernetRM_->send(ipAddr_, APS2PreparedWrite::datagrams_for(
+                                     addr + 4 * offset, chunk.data(), count));
+    } catch (...) {
+      // we no longer know what the registers hold
+      registerCacheValid_ = false;
+      throw;
+    }
+  }
+}
+
+void APS2::check_memory_write(uint32_t addr, size_t numWords) {
   // Memory writes to SDRAM need to be 16 byte aligned and padded to a multiple
   // of 16 bytes (4 words)
   if (addr < MEMORY_ADDR + 0x40000000) {
@@ -799,45 +1065,118 @@ void APS2::write_memory(const uint32_t &addr, const vector<uint32_t> &data) {
                                        "address not aligned to 16 bytes";
       throw APS2_UNALIGNED_MEMORY_ACCESS;
     }
-    if ((data.size() % 4) != 0) {
+    if ((numWords % 4) != 0) {
       LOG(plog::error) << ipAddr_ << " attempted to write "
                                        "waveform/instruction SDRAM with data "
                                        "not a multiple of 16 bytes";
       throw APS2_UNALIGNED_MEMORY_ACCESS;
     }
+    // whatever was last uploaded there no longer holds
+    forget_uploads(addr, 4 * uint64_t(numWords));
   }
-
-  // Convert to datagrams and send
-  APS2Command cmd;
-  cmd.ack = 1;
-  cmd.cmd = static_cast<uint32_t>(
-      APS_COMMANDS::USERIO_ACK); // TODO: take out when all TCP comms
-  auto dgs = APS2Datagram::chunk(
-      cmd, addr, data,
-      0xfffc); // max chunk_size is limited by 128bit data alignment in SDRAM
-  ethernetRM_->send(ipAddr_, dgs);
 }
 
 vector<uint32_t> APS2::read_memory(uint32_t addr, uint32_t numWords) const {
-  // TODO: handle numWords that require mulitple requests
+  vector<uint32_t> data(numWords);
+  read_memory(addr, numWords, data.data());
+  return data;
+}
 
-  // Send the read request
+void APS2::read_memory(uint32_t addr, uint32_t numWords,
+                       uint32_t *data) const {
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
+  if (registers_cached(addr, numWords)) {
+    auto first = shadowRegisters_.begin() + (addr - CSR_AXI_OFFSET) / 4;
+    std::copy(first, first + numWords, data);
+    return;
+  }
   APS2Command cmd;
-  cmd.r_w = 1;
   cmd.cmd = static_cast<uint32_t>(
       APS_COMMANDS::USERIO_ACK); // TODO: take out when all TCP comms
-  cmd.cnt = numWords;
-  ethernetRM_->send(ipAddr_, {{cmd, addr, {}}});
+  read_pipelined(cmd, addr, numWords, data);
+  update_register_cache(addr, data, numWords);
+}
 
-  // Read the response
-  // We expect a single datagram back
-  auto result = ethernetRM_->read(ipAddr_, COMMS_TIMEOUT);
-  // TODO: error checking
-  return result.payload;
+void APS2::read_pipelined(APS2Command cmd, uint32_t addr, uint32_t numWords,
+                          uint32_t *data) const {
+  LOG(plog::debug) << ipAddr_ << " APS2::read_pipelined " << numWords
+                     << " words from " << hexn<8> << addr;
+  // Split into requests the message processor can serve
+  cmd.r_w = 1;
+  vector<APS2Datagram> requests;
+  for (uint32_t offset = 0; offset < numWords; offset += MAX_READ_WORDS) {
+    cmd.cnt = std::min(numWords - offset, MAX_READ_WORDS);
+    requests.push_back({cmd, addr + 4 * offset, {}});
+  }
+  send_read_requests(requests, data);
+}
+
+void APS2::send_read_requests(const vector<APS2Datagram> &requests,
+                              uint32_t *data) const {
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
+  // Keep up to READ_PIPELINE_DEPTH requests in flight. Responses come back in
+  // request order so each lands at the next offset in data.
+  size_t sent = 0;
+  for (size_t ct = 0; ct < requests.size(); ct++) {
+    size_t window_end = std::min(requests.size(), ct + READ_PIPELINE_DEPTH);
+    if (sent < window_end) {
+      ethernetRM_->send(ipAddr_,
+                        vector<APS2Datagram>(requests.begin() + sent,
+                                             requests.begin() + window_end));
+      sent = window_end;
+    }
+
+    APS2Datagram result;
+    try {
+      result = ethernetRM_->read(ipAddr_, COMMS_TIMEOUT);
+    } catch (APS2_STATUS) {
+      // the stream stopped somewhere inside a response
+      ethernetRM_->reconnect_tcp(ipAddr_);
+      throw;
+    }
+    if (result.payload.size() != requests[ct].cmd.cnt) {
+      LOG(plog::error) << ipAddr_
+                         << " read response unexpected size: expected "
+                         << requests[ct].cmd.cnt << ", got "
+                         << result.payload.size();
+      // the responses to the requests behind it are still coming
+      ethernetRM_->drain_responses(ipAddr_, sent - ct - 1);
+      throw APS2_COMMS_ERROR;
+    }
+    data = std::copy(result.payload.begin(), result.payload.end(), data);
+    ethernetRM_->recycle(ipAddr_, std::move(result.payload));
+  }
+}
+
+std::future<void> APS2::write_memory_async(uint32_t addr,
+                                           vector<uint32_t> data) {
+  return run_async([this, addr, data]() { write_memory(addr, data); });
+}
+
+std::future<vector<uint32_t>> APS2::read_memory_async(uint32_t addr,
+                                                      uint32_t numWords) {
+  return run_async(
+      [this, addr, numWords]() { return read_memory(addr, numWords); });
 }
 
+std::future<void> APS2::write_SPI_async(vector<uint32_t> msg) {
+  return run_async([this, msg]() mutable { write_SPI(msg); });
+}
+
+std::future<uint32_t> APS2::read_SPI_async(CHIPCONFIG_IO_TARGET target,
+                                           uint16_t addr) {
+  return run_async([this, target, addr]() { return read_SPI(target, addr); });
+}
+
+std::future<void> APS2::write_sequence_async(vector<uint64_t> data) {
+  return run_async([this, data]() { write_sequence(data); });
+}
+
+void APS2::wait_async() { asyncQueue_.wait_idle(); }
+
 void APS2::write_configuration_SDRAM(uint32_t addr,
                                      const vector<uint32_t> &data) {
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
   LOG(plog::debug) << ipAddr_ << " APS2::write_configuration_SDRAM";
   // Write data to configuratoin SDRAM
 
@@ -874,24 +1213,23 @@ void APS2::write_configuration_SDRAM(uint32_t addr,
 
 vector<uint32_t> APS2::read_configuration_SDRAM(uint32_t addr,
                                                 uint32_t num_words) {
+  vector<uint32_t> data(num_words);
+  read_configuration_SDRAM(addr, num_words, data.data());
+  return data;
+}
+
+void APS2::read_configuration_SDRAM(uint32_t addr, uint32_t num_words,
+                                    uint32_t *data) {
   LOG(plog::debug) << ipAddr_ << " APS2::read_configuration_SDRAM";
-  // Send the read request
   APS2Command cmd;
-  cmd.r_w = 1;
   cmd.sel = 1;
   cmd.cmd = static_cast<uint32_t>(APS_COMMANDS::FPGACONFIG_ACK);
-  cmd.cnt = num_words;
-  ethernetRM_->send(ipAddr_, {{cmd, addr, {}}});
-
-  // Read the response
-  // We expect a single datagram back
-  auto result = ethernetRM_->read(ipAddr_, COMMS_TIMEOUT);
-  // TODO: error checking
-  return result.payload;
+  read_pipelined(cmd, addr, num_words, data);
 }
 
 // SPI read/write
 void APS2::write_SPI(vector<uint32_t> &msg) {
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
   LOG(plog::debug) << ipAddr_ << " APS2::write_SPI";
 
   // push on "end of message"
@@ -912,6 +1250,7 @@ void APS2::write_SPI(vector<uint32_t> &msg) {
 
 uint32_t APS2::read_SPI(const CHIPCONFIG_IO_TARGET &target,
                         const uint16_t &addr) {
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
   // reads a single byte from the target SPI device
   LOG(plog::debug) << ipAddr_ << " APS2::read_SPI";
 
@@ -985,6 +1324,7 @@ uint32_t APS2::read_SPI(const CHIPCONFIG_IO_TARGET &target,
 
 // Flash read/write
 void APS2::write_flash(uint32_t addr, vector<uint32_t> &data) {
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
   LOG(plog::debug) << ipAddr_ << " APS2::write_flash";
 
   // Flash writes must be 256 byte aligned and written in 256 byte chunks
@@ -1022,6 +1362,7 @@ void APS2::write_flash(uint32_t addr, vector<uint32_t> &data) {
 }
 
 void APS2::erase_flash(uint32_t start_addr, uint32_t num_bytes) {
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
   LOG(plog::debug) << ipAddr_ << " APS2::erase_flash";
   bitfile_writing_task = ERASING;
   bitfile_writing_task_progress = 0;
@@ -1059,6 +1400,10 @@ void APS2::erase_flash(uint32_t start_addr, uint32_t num_bytes) {
           LOG(plog::error) << ipAddr_
                              << " flash erase timed out. Retrying...";
           tryct++;
+          if (tryct < 5) {
+            APS2Metrics::add(ethernetRM_->get_metrics(ipAddr_)->retries, 1);
+          }
+          continue;
         } else {
           throw status;
         }
@@ -1079,21 +1424,16 @@ void APS2::erase_flash(uint32_t start_addr, uint32_t num_bytes) {
 }
 
 vector<uint32_t> APS2::read_flash(uint32_t addr, uint32_t num_words) {
-  // TODO: handle reads that require multiple packets
+  vector<uint32_t> data(num_words);
+  read_flash(addr, num_words, data.data());
+  return data;
+}
 
-  // Send the read request
+void APS2::read_flash(uint32_t addr, uint32_t num_words, uint32_t *data) {
   APS2Command cmd;
-  cmd.r_w = 1;
   cmd.sel = 1;
   cmd.cmd = static_cast<uint32_t>(APS_COMMANDS::EPROMIO);
-  cmd.cnt = num_words;
-  ethernetRM_->send(ipAddr_, {{cmd, addr, {}}});
-
-  // Read the response
-  // We expect a single datagram back
-  auto result = ethernetRM_->read(ipAddr_, COMMS_TIMEOUT);
-  // TODO: error checking
-  return result.payload;
+  read_pipelined(cmd, addr, num_words, data);
 }
 
 void APS2::write_macip_flash(const uint64_t &mac, const uint32_t &ip_addr,
@@ -1628,6 +1968,7 @@ void APS2::set_DAC_SD(const int &dac, const uint8_t &sd) {
 }
 
 void APS2::run_chip_config(uint32_t addr /* default = 0 */) {
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
   LOG(plog::info) << ipAddr_ << " running chip config from address "
                     << hexn<8> << addr;
   // construct the chip config command
@@ -1954,70 +2295,251 @@ bool APS2::run_DAC_BIST(const int &dac, const vector<int16_t> &testVec,
 
 void APS2::set_register_bit(const uint32_t &addr,
                             std::initializer_list<size_t> bits) {
-  std::bitset<32> reg_val(read_memory(addr, 1).front());
-  LOG(plog::debug) << "Updating 0x" << std::hex << addr << " From 0x" << reg_val.to_ulong();
-  for (auto bit : bits) {
-    reg_val.set(bit);
-  }
-  LOG(plog::debug) << "Updating 0x" << std::hex << addr << " To 0x" << reg_val.to_ulong() ;
-  write_memory(addr, reg_val.to_ulong());
+  APS2Transaction txn;
+  txn.set_bits(addr, bits);
+  commit(txn);
 }
 
 void APS2::clear_register_bit(const uint32_t &addr,
                               std::initializer_list<size_t> bits) {
-  std::bitset<32> reg_val(read_memory(addr, 1).front());
-  LOG(plog::debug) << "Updating 0x" << std::hex << addr << " From 0x" << reg_val.to_ulong();
-  for (auto bit : bits) {
-    reg_val.reset(bit);
+  APS2Transaction txn;
+  txn.clear_bits(addr, bits);
+  commit(txn);
+}
+
+void APS2::commit(APS2Transaction &txn) {
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
+  if (txn.empty()) {
+    return;
+  }
+
+  // Read every register the transaction depends on, and the register cache
+  // cannot supply, in one pipelined burst
+  std::map<uint32_t, uint32_t> deviceValues;
+  vector<uint32_t> addrs;
+  for (auto addr : txn.registers_to_read()) {
+    if (register_cached(addr)) {
+      deviceValues[addr] = shadowRegisters_[(addr - CSR_AXI_OFFSET) / 4];
+    } else {
+      addrs.push_back(addr);
+    }
+  }
+  vector<APS2Datagram> requests;
+  APS2Command cmd;
+  cmd.r_w = 1;
+  cmd.cmd = static_cast<uint32_t>(APS_COMMANDS::USERIO_ACK);
+  cmd.cnt = 1;
+  for (auto addr : addrs) {
+    requests.push_back({cmd, addr, {}});
+  }
+  vector<uint32_t> values(addrs.size());
+  send_read_requests(requests, values.data());
+  for (size_t ct = 0; ct < addrs.size(); ct++) {
+    deviceValues[addrs[ct]] = values[ct];
+    update_register_cache(addrs[ct], &values[ct], 1);
+  }
+
+  // Then send the merged writes together
+  vector<APS2Datagram> writes;
+  cmd.r_w = 0;
+  cmd.ack = 1;
+  for (auto &write : txn.resolve(deviceValues)) {
+    LOG(plog::debug) << ipAddr_ << " updating " << hexn<8> << write.first
+                       << " to " << hexn<8> << write.second;
+    writes.push_back({cmd, write.first, {write.second}});
+  }
+  if (!writes.empty()) {
+    try {
+      ethernetRM_->send(ipAddr_, writes);
+    } catch (...) {
+      registerCacheValid_ = false;
+      throw;
+    }
+  }
+  for (auto &write : writes) {
+    update_register_cache(write.addr, write.payload.data(), 1);
   }
-  LOG(plog::debug) << "Updating 0x" << std::hex << addr << " To 0x" << reg_val.to_ulong() << std::dec;
-  write_memory(addr, reg_val.to_ulong());
 }
 
-void APS2::write_waveform(const int &ch, const vector<int16_t> &wf) {
-  /*Write waveform data to FPGA memory
-   * ch = channel (0-1)
-   * wf = bits 0-13: signed 14-bit waveform data, bits 14-15: marker data
-   */
+void APS2::set_register_cache(bool enable) {
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
+  LOG(plog::debug) << ipAddr_ << " APS2::set_register_cache " << enable;
+  registerCacheEnabled_ = enable;
+  if (enable && connected_) {
+    resync_register_cache();
+  } else {
+    registerCacheValid_ = false;
+  }
+}
 
-  // disable/reset cache
-  clear_register_bit(CACHE_CONTROL_ADDR, {CACHE_ENABLE_BIT});
+bool APS2::get_register_cache() const { return registerCacheEnabled_; }
 
-  uint32_t startAddr =
-      (ch == 0) ? MEMORY_ADDR + WFA_OFFSET : MEMORY_ADDR + WFB_OFFSET;
-  LOG(plog::debug) << ipAddr_ << " loading waveform of length " << wf.size()
-                      << " at address " << hexn<8> << startAddr;
-  vector<uint32_t> packed_data;
-  for (size_t ct = 0; ct < wf.size(); ct += 2) {
-    packed_data.push_back(((uint32_t)wf[ct + 1] << 16) | (uint16_t)wf[ct]);
+void APS2::resync_register_cache() {
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
+  LOG(plog::debug) << ipAddr_ << " APS2::resync_register_cache";
+  registerCacheValid_ = false;
+  if (!registerCacheEnabled_ || host_type != APS) {
+    return;
   }
+  // Fill the whole register file in one go then refresh the sample rate
+  read_memory(CSR_AXI_OFFSET, NUM_CSR_REGISTERS, shadowRegisters_.data());
+  samplingRate_ = get_PLL_freq();
+  registerCacheValid_ = true;
+}
 
-  // SDRAM writes must be multiples of 16 bytes
-  int pad_words = (4 - (packed_data.size() % 4)) % 4;
-  if (pad_words) {
-    LOG(plog::debug) << ipAddr_ << " padding waveform write with "
-                        << std::dec << pad_words << " words";
-    packed_data.resize(packed_data.size() + pad_words, 0xffffffff);
+std::shared_ptr<APS2Metrics> APS2::get_transport_metrics() const {
+  if (!ethernetRM_) {
+    throw APS2_UNCONNECTED;
   }
+  return ethernetRM_->get_metrics(ipAddr_);
+}
 
+bool APS2::register_cached(uint32_t addr) const {
+  return registerCacheValid_ && addr >= CSR_AXI_OFFSET &&
+         addr < CSR_AXI_OFFSET + 4 * NUM_CSR_REGISTERS && (addr & 0x3) == 0 &&
+         !is_volatile_register(addr);
+}
 
-  write_memory(startAddr, packed_data);
+bool APS2::registers_cached(uint32_t addr, uint32_t numWords) const {
+  for (uint32_t ct = 0; ct < numWords; ct++) {
+    if (!register_cached(addr + 4 * ct)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void APS2::update_register_cache(uint32_t addr, const uint32_t *data,
+                                 uint32_t numWords) const {
+  uint64_t end = addr + 4 * static_cast<uint64_t>(numWords);
+  if (!registerCacheValid_ || end <= CSR_AXI_OFFSET ||
+      addr >= CSR_AXI_OFFSET + 4 * NUM_CSR_REGISTERS) {
+    return;
+  }
+  for (uint32_t ct = 0; ct < numWords; ct++, addr += 4) {
+    if (register_cached(addr)) {
+      shadowRegisters_[(addr - CSR_AXI_OFFSET) / 4] = data[ct];
+    }
+  }
+}
+
+void APS2::write_waveform(
+    int ch, const vector<uint64_t> &hashes, size_t numWords, size_t length,
+    const std::function<void(size_t, size_t)> &write_range) {
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
+  // the channel's waveform takes over the whole region
+  if (!waveformEntries_[ch].empty()) {
+    LOG(plog::debug) << ipAddr_ << " dropping " << waveformEntries_[ch].size()
+                        << " named waveforms on channel " << ch;
+    waveformEntries_[ch].clear();
+    waveformMemory_[ch].clear();
+  }
+  loadedWaveformHashes_[ch] = 0;
+  Channel &channel = channels_[ch];
+  if (channel.upload_current(hashes, length)) {
+    LOG(plog::debug) << ipAddr_ << " waveform on channel " << ch
+                        << " unchanged since last upload";
+    return;
+  }
+  // only send the blocks that changed since the last upload
+  auto ranges = hashes.empty()
+                    ? vector<std::pair<size_t, size_t>>{{0, numWords}}
+                    : channel.dirty_ranges(hashes, numWords);
+
+  // disable/reset cache
+  clear_register_bit(CACHE_CONTROL_ADDR, {CACHE_ENABLE_BIT});
+
+  LOG(plog::debug) << ipAddr_ << " loading waveform of length " << length
+                      << " at address " << hexn<8> << waveform_addr(ch)
+                      << " in " << std::dec << ranges.size() << " ranges";
+  for (const auto &range : ranges) {
+    write_range(range.first, range.second);
+  }
 
   // write the length register
   uint32_t length_addr = (ch == 0) ? CH_A_WF_LENGTH_ADDR : CH_B_WF_LENGTH_ADDR;
-  write_memory(length_addr, wf.size());
+  write_memory(length_addr, length);
 
   // enable cache
   set_register_bit(CACHE_CONTROL_ADDR, {CACHE_ENABLE_BIT});
+  channel.set_uploaded(hashes, length);
 }
 
-void APS2::write_sequence(const vector<uint64_t> &data) {
-  LOG(plog::debug) << ipAddr_ << " loading sequence of length "
-                      << data.size();
-
+void APS2::write_channel_waveform(int ch) {
+  /*Write waveform data to FPGA memory
+   * ch = channel (0-1)
+   * words hold two samples each, bits 0-13: signed 14-bit waveform data,
+   * bits 14-15: marker data; streamed from the channel's packed words
+   */
+  const auto &packed = channels_[ch].packed_waveform();
+  write_waveform(ch, Channel::block_hashes(packed), packed.size(),
+                 channels_[ch].get_length(),
+                 [this, ch, &packed](size_t offset, size_t numWords) {
+                   write_streamed(waveform_addr(ch) + 4 * offset, numWords,
+                                  [&](size_t chunkOffset, size_t count,
+                                      uint32_t *out) {
+                                    std::copy_n(packed.begin() + offset +
+                                                    chunkOffset,
+                                                count, out);
+                                  });
+                 });
+}
+
+void APS2::write_channel_waveform(int ch, const APS2MappedFile &file,
+                                  size_t offset, size_t numPts) {
+  check_channel_num(ch);
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
+  // the arrays all start on an even byte so the samples are aligned
+  const int16_t *data = reinterpret_cast<const int16_t *>(file.data() + offset);
+  Channel &channel = channels_[ch];
+  channel.resize_waveform(numPts);
+  const uint8_t *markers =
+      channel.markers_.empty() ? nullptr : channel.markers_.data();
+  bool clippedHigh = false, clippedLow = false;
+
+  // what the words will hold is only known once they are packed so all of
+  // them are sent
+  write_waveform(
+      ch, {}, channel.packed_.size(), channel.get_length(),
+      [&](size_t rangeOffset, size_t numWords) {
+        write_streamed(
+            waveform_addr(ch) + 4 * rangeOffset, numWords,
+            [&](size_t chunkOffset, size_t count, uint32_t *out) {
+              size_t word = rangeOffset + chunkOffset;
+              size_t first = std::min(2 * word, numPts);
+              size_t last = std::min(2 * (word + count), numPts);
+              bool high, low;
+              Channel::pack_samples(data + first,
+                                    markers ? markers + first : nullptr,
+                                    last - first, &channel.packed_[word],
+                                    high, low);
+              clippedHigh |= high;
+              clippedLow |= low;
+              if (2 * (word + count) >= numPts) {
+                // past the last sample; the padding is only a few words
+                channel.pad_waveform(numPts);
+              }
+              std::copy_n(channel.packed_.begin() + word, count, out);
+              // keep the disk ahead of the upload
+              file.prefetch(offset + sizeof(int16_t) * last,
+                            SEQFILE_READAHEAD_BYTES);
+            });
+      });
+  Channel::warn_clipped(clippedHigh, clippedLow);
+  channel.set_uploaded(Channel::block_hashes(channel.packed_),
+                       channel.get_length());
+}
+
+uint32_t APS2::waveform_addr(int ch) {
+  return (ch == 0) ? MEMORY_ADDR + WFA_OFFSET : MEMORY_ADDR + WFB_OFFSET;
+}
+
+vector<uint32_t> APS2::pack_sequence(const uint64_t *data,
+                                     size_t numInstructions) {
   // pack into uint32_t vector
   vector<uint32_t> packed_instructions;
-  for (size_t ct = 0; ct < data.size(); ct++) {
+  packed_instructions.reserve(2 * numInstructions + 4);
+  for (size_t ct = 0; ct < numInstructions; ct++) {
     packed_instructions.push_back(static_cast<uint32_t>(data[ct] & 0xffffffff));
     packed_instructions.push_back(static_cast<uint32_t>(data[ct] >> 32));
   }
@@ -2025,30 +2547,321 @@ void APS2::write_sequence(const vector<uint64_t> &data) {
   // SDRAM writes must be multiples of 16 bytes
   int pad_words = (4 - (packed_instructions.size() % 4)) % 4;
   if (pad_words) {
-    LOG(plog::debug) << ipAddr_ << " padding instruction write with "
-                        << std::dec << pad_words << " words";
+    LOG(plog::debug) << "Padding instruction write with " << std::dec
+                        << pad_words << " words";
     packed_instructions.resize(packed_instructions.size() + pad_words,
                                0xffffffff);
   }
 
+  int addr = 0;
+  for ( auto d : packed_instructions) {
+    LOG(plog::debug) << "W Sequence[" << addr++ <<"] = 0x" << std::hex << d;
+  }
+  return packed_instructions;
+}
+
+vector<std::future<void>>
+APS2::set_waveform_many(const vector<APS2 *> &devices, int dac,
+                        Channel &&channel) {
+  if (devices.empty()) {
+    return {};
+  }
+  devices[0]->check_channel_num(dac);
+  size_t length = channel.get_length();
+  auto hashes = std::make_shared<const vector<uint64_t>>(
+      Channel::block_hashes(channel.packed_waveform()));
+  auto prepared = std::make_shared<const APS2PreparedWrite>(
+      waveform_addr(dac), channel.packed_waveform());
+  auto shared_channel = std::make_shared<const Channel>(std::move(channel));
+
+  vector<std::future<void>> results;
+  for (auto aps : devices) {
+    results.push_back(aps->run_async(
+        [aps, dac, length, prepared, hashes, shared_channel]() {
+          // held from taking over the waveform until it is uploaded
+          std::lock_guard<std::recursive_mutex> comms_guard(aps->comms_lock_);
+          Channel &own = aps->channels_[dac];
+          own.copy_waveform(*shared_channel);
+          if (own.markers_ == shared_channel->markers_) {
+            aps->write_waveform(
+                dac, *hashes, prepared->numWords, length,
+                [aps, &prepared](size_t offset, size_t numWords) {
+                  aps->write_prepared(*prepared, offset, numWords);
+                });
+          } else {
+            aps->write_channel_waveform(dac);
+          }
+        }));
+  }
+  return results;
+}
+
+vector<std::future<void>>
+APS2::write_sequence_many(const vector<APS2 *> &devices,
+                          const vector<uint64_t> &data) {
+  return write_sequence_many(devices, data.data(), data.size());
+}
+
+vector<std::future<void>>
+APS2::write_sequence_many(const vector<APS2 *> &devices, const uint64_t *data,
+                          size_t numInstructions) {
+  auto prepared = std::make_shared<const APS2PreparedWrite>(
+      MEMORY_ADDR + SEQ_OFFSET, pack_sequence(data, numInstructions));
+  vector<std::future<void>> results;
+  for (auto aps : devices) {
+    results.push_back(
+        aps->run_async([aps, prepared]() { aps->write_sequence(*prepared); }));
+  }
+  return results;
+}
+
+void APS2::write_sequence(const vector<uint64_t> &data) {
+  write_sequence(data.data(), data.size());
+}
+
+void APS2::write_sequence(const uint64_t *data, size_t numInstructions) {
+  // SDRAM writes must be multiples of 16 bytes so pad with 0xffffffff
+  size_t numWords = 4 * ((2 * numInstructions + 3) / 4);
+  write_sequence_memory(numWords, [&]() {
+    write_streamed(MEMORY_ADDR + SEQ_OFFSET, numWords,
+                   [&](size_t offset, size_t count, uint32_t *out) {
+                     for (size_t ct = 0; ct < count; ct++) {
+                       size_t word = offset + ct;
+                       out[ct] = (word < 2 * numInstructions)
+                                     ? static_cast<uint32_t>(
+                                           data[word / 2] >> (32 * (word % 2)))
+                                     : 0xffffffff;
+                     }
+                   });
+  });
+}
+
+void APS2::write_sequence(const APS2MappedFile &file, size_t offset,
+                          size_t numInstructions) {
+  // The file holds the instructions little endian so their bytes are already
+  // the packed words in order
+  const uint8_t *data = file.data() + offset;
+  size_t numWords = 4 * ((2 * numInstructions + 3) / 4);
+  file.prefetch(offset, SEQFILE_READAHEAD_BYTES);
+  write_sequence_memory(numWords, [&]() {
+    write_streamed(
+        MEMORY_ADDR + SEQ_OFFSET, numWords,
+        [&](size_t chunkOffset, size_t count, uint32_t *out) {
+          size_t available =
+              (chunkOffset < 2 * numInstructions)
+                  ? std::min(count, 2 * numInstructions - chunkOffset)
+                  : 0;
+          std::memcpy(out, data + 4 * chunkOffset, 4 * available);
+          std::fill(out + available, out + count, 0xffffffff);
+          // keep the disk ahead of the upload
+          file.prefetch(offset + 4 * (chunkOffset + count),
+                        SEQFILE_READAHEAD_BYTES);
+        });
+  });
+}
+
+void APS2::write_sequence(const APS2PreparedWrite &prepared) {
+  write_sequence_memory(prepared.numWords,
+                        [&]() { write_prepared(prepared); });
+}
+
+void APS2::write_sequence_memory(size_t numWords,
+                                 const std::function<void()> &write) {
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
+  LOG(plog::debug) << ipAddr_ << " loading sequence of " << numWords
+                      << " words";
+  // the sequence takes over the whole region
+  sequenceEntries_.clear();
+  sequenceMemory_.clear();
+  loadedSequenceHash_ = 0;
+
   // disable/reset cache
   if (host_type == APS) {
     clear_register_bit(CACHE_CONTROL_ADDR, {CACHE_ENABLE_BIT});
   }
 
-  int addr = 0;
-  for ( auto d : packed_instructions) {
-    LOG(plog::debug) << "W Sequence[" << addr++ <<"] = 0x" << std::hex << d;
+  write();
+
+  //read_sequence(MEMORY_ADDR + SEQ_OFFSET, packed_instructions.size());
+
+  // enable cache
+  if (host_type == APS) {
+    set_register_bit(CACHE_CONTROL_ADDR, {CACHE_ENABLE_BIT});
   }
+}
 
-  write_memory(MEMORY_ADDR + SEQ_OFFSET, packed_instructions);
+uint32_t APS2::add_waveform(int dac, const string &name, const float *data,
+                            size_t numPts, const uint8_t *markers) {
+  check_channel_num(dac);
+  Channel channel(dac);
+  if (markers != nullptr) {
+    channel.set_markers(markers, numPts);
+  }
+  channel.set_waveform(data, numPts);
+  return add_waveform(dac, name, channel);
+}
 
-  //read_sequence(MEMORY_ADDR + SEQ_OFFSET, packed_instructions.size());
+uint32_t APS2::add_waveform(int dac, const string &name, const int16_t *data,
+                            size_t numPts, const uint8_t *markers) {
+  check_channel_num(dac);
+  Channel channel(dac);
+  if (markers != nullptr) {
+    channel.set_markers(markers, numPts);
+  }
+  channel.set_waveform(data, numPts);
+  return add_waveform(dac, name, channel);
+}
+
+uint32_t APS2::add_waveform(int dac, const string &name,
+                            const Channel &channel) {
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
+  uint32_t length_addr =
+      (dac == 0) ? CH_A_WF_LENGTH_ADDR : CH_B_WF_LENGTH_ADDR;
+  size_t offset = write_entry(waveform_addr(dac), waveformMemory_[dac],
+                              waveformEntries_[dac], name,
+                              channel.packed_waveform(), length_addr);
+  // 4 samples of 2 bytes each
+  return offset / 8;
+}
+
+void APS2::remove_waveform(int dac, const string &name) {
+  check_channel_num(dac);
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
+  remove_entry(waveformMemory_[dac], waveformEntries_[dac], name);
+}
+
+uint32_t APS2::get_waveform_address(int dac, const string &name) const {
+  check_channel_num(dac);
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
+  return find_entry(waveformEntries_[dac], name).offset / 8;
+}
+
+uint32_t APS2::add_sequence_segment(const string &name, const uint64_t *data,
+                                    size_t numInstructions) {
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
+  size_t offset = write_entry(MEMORY_ADDR + SEQ_OFFSET, sequenceMemory_,
+                              sequenceEntries_, name,
+                              pack_sequence(data, numInstructions), 0);
+  // 8 bytes an instruction
+  return offset / 8;
+}
 
+void APS2::remove_sequence_segment(const string &name) {
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
+  remove_entry(sequenceMemory_, sequenceEntries_, name);
+}
+
+uint32_t APS2::get_sequence_segment_address(const string &name) const {
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
+  return find_entry(sequenceEntries_, name).offset / 8;
+}
+
+APS2MemoryUsage APS2::get_waveform_memory_usage(int dac) const {
+  check_channel_num(dac);
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
+  return waveformMemory_[dac].usage();
+}
+
+APS2MemoryUsage APS2::get_sequence_memory_usage() const {
+  std::lock_guard<std::recursive_mutex> comms_guard(comms_lock_);
+  return sequenceMemory_.usage();
+}
+
+size_t APS2::write_entry(uint32_t regionAddr, APS2MemoryAllocator &memory,
+                         MemoryEntries &entries, const string &name,
+                         const vector<uint32_t> &packed,
+                         uint32_t lengthAddr) {
+  auto it = entries.find(name);
+  if (it == entries.end()) {
+    size_t offset = memory.allocate(4 * packed.size());
+    it = entries.emplace(name, MemoryEntry{offset, packed.size(), {}}).first;
+  } else {
+    size_t offset = memory.reallocate(it->second.offset, 4 * packed.size());
+    if (offset != it->second.offset) {
+      it->second.offset = offset;
+      it->second.uploadedBlocks.clear();
+    }
+    it->second.numWords = packed.size();
+  }
+  MemoryEntry &entry = it->second;
+
+  auto hashes = Channel::block_hashes(packed);
+  auto ranges =
+      Channel::dirty_ranges(entry.uploadedBlocks, hashes, packed.size());
+  if (ranges.empty()) {
+    LOG(plog::debug) << ipAddr_ << " " << name
+                        << " unchanged since last upload";
+    entry.uploadedBlocks = std::move(hashes);
+    return entry.offset;
+  }
+
+  uint32_t addr = regionAddr + entry.offset;
+  LOG(plog::debug) << ipAddr_ << " loading " << name << " of "
+                      << packed.size() << " words at address " << hexn<8>
+                      << addr << " in " << std::dec << ranges.size()
+                      << " ranges";
+  // disable/reset cache
+  if (host_type == APS) {
+    clear_register_bit(CACHE_CONTROL_ADDR, {CACHE_ENABLE_BIT});
+  }
+  for (const auto &range : ranges) {
+    write_streamed(addr + 4 * range.first, range.second,
+                   [&](size_t offset, size_t count, uint32_t *out) {
+                     std::copy_n(packed.begin() + range.first + offset,
+                                 count, out);
+                   });
+  }
+  if (lengthAddr != 0) {
+    // two samples a word
+    write_memory(lengthAddr, static_cast<uint32_t>(memory.extent() / 2));
+  }
   // enable cache
   if (host_type == APS) {
     set_register_bit(CACHE_CONTROL_ADDR, {CACHE_ENABLE_BIT});
   }
+  entry.uploadedBlocks = std::move(hashes);
+  return entry.offset;
+}
+
+const APS2::MemoryEntry &APS2::find_entry(const MemoryEntries &entries,
+                                          const string &name) {
+  auto it = entries.find(name);
+  if (it == entries.end()) {
+    throw APS2_UNKNOWN_MEMORY_ENTRY;
+  }
+  return it->second;
+}
+
+void APS2::remove_entry(APS2MemoryAllocator &memory, MemoryEntries &entries,
+                        const string &name) {
+  // the device memory is left as it is until something else is put there
+  memory.release(find_entry(entries, name).offset);
+  entries.erase(name);
+}
+
+void APS2::forget_uploads(uint32_t addr, uint64_t numBytes) {
+  auto overlaps = [addr, numBytes](uint64_t start, uint64_t size) {
+    return addr < start + size && addr + numBytes > start;
+  };
+  auto forget_entries = [&](uint32_t regionAddr, MemoryEntries &entries) {
+    for (auto &kv : entries) {
+      if (overlaps(regionAddr + kv.second.offset, 4 * kv.second.numWords)) {
+        kv.second.uploadedBlocks.clear();
+      }
+    }
+  };
+  for (int ch = 0; ch < NUM_ANALOG_CHANNELS; ch++) {
+    uint32_t region = waveform_addr(ch);
+    if (overlaps(region, WF_REGION_SIZE)) {
+      channels_[ch].invalidate_upload();
+      loadedWaveformHashes_[ch] = 0;
+    }
+    forget_entries(region, waveformEntries_[ch]);
+  }
+  forget_entries(MEMORY_ADDR + SEQ_OFFSET, sequenceEntries_);
+  if (overlaps(MEMORY_ADDR + SEQ_OFFSET, SEQ_REGION_SIZE)) {
+    loadedSequenceHash_ = 0;
+  }
 }
 
 void APS2::read_sequence(const uint32_t addr, uint32_t num_words) {
@@ -7,15 +7,46 @@
 #ifndef APS2_H
 #define APS2_H
 
+#include <functional>
+#include <future>
+#include <map>
 #include <memory>
 using std::shared_ptr;
+#include <mutex>
 #include <assert.h>
 
 #include "APS2Ethernet.h"
+#include "APS2MappedFile.h"
+#include "APS2MemoryAllocator.h"
+#include "APS2SequenceFile.h"
 #include "APS2_enums.h"
+#include "APS2TaskQueue.h"
+#include "APS2Transaction.h"
 #include "APS2_errno.h"
 #include "Channel.h"
 
+// A memory write swapped to network byte order and split into datagrams once
+// so the same buffers can be sent to several APS2s. The datagrams point into
+// networkData so it cannot be copied.
+struct APS2PreparedWrite {
+  APS2PreparedWrite(uint32_t addr, const vector<uint32_t> &data);
+  // Swaps the caller's buffer in place rather than copying it
+  APS2PreparedWrite(uint32_t addr, vector<uint32_t> &&data);
+  APS2PreparedWrite(APS2PreparedWrite const &) = delete;
+
+  // Datagrams for just numWords words starting offset words in
+  vector<APS2DatagramView> range(size_t offset, size_t numWords) const;
+  // Datagrams writing numWords network order words to addr
+  static vector<APS2DatagramView> datagrams_for(uint32_t addr,
+                                                const uint32_t *networkData,
+                                                size_t numWords);
+
+  uint32_t addr;
+  size_t numWords;
+  vector<uint32_t> networkData;
+  vector<APS2DatagramView> datagrams;
+};
+
 class APS2 {
 
 public:
@@ -77,23 +108,49 @@ public:
   float get_mixer_phase_skew();
   void set_mixer_correction_matrix(const vector<float> &);
   vector<float> get_mixer_correction_matrix();
-  void update_correction_matrix();
+  // Set one of the scale, imbalance or skew registers and the matrix with it
+  void update_correction_matrix(uint32_t, uint32_t);
 
   template <typename T>
   void set_waveform(const int &dac, const vector<T> &data) {
-    channels_[dac].set_waveform(data);
-    write_waveform(dac, channels_[dac].prep_waveform());
+    set_waveform(dac, data.data(), data.size());
   }
+  // The caller's samples are read once into the channel and streamed to the
+  // device from there; no copy of the caller's buffer is made
+  void set_waveform(int, const float *, size_t);
+  void set_waveform(int, const int16_t *, size_t);
 
   void set_markers(const int &, const vector<uint8_t> &);
+  void set_markers(int, const uint8_t *, size_t);
 
   void set_run_mode(const APS2_RUN_MODE &);
   void set_waveform_frequency(float);
   float get_waveform_frequency();
 
   void write_sequence(const vector<uint64_t> &);
+  void write_sequence(const uint64_t *, size_t);
   void clear_channel_data();
 
+  // Named waveforms and sequence segments placed one at a time in the
+  // waveform and instruction memory. Adding under a name already in use
+  // replaces that entry, in place while it still fits, and only the blocks
+  // that differ from what the device holds are uploaded. The address
+  // returned is in quad-samples for WAVEFORM instructions or in instructions
+  // for GOTO, CALL and PREFETCH; the sequencer starts at instruction 0 so
+  // add the entry point first. set_waveform and write_sequence take over the
+  // whole region again and drop the entries in it.
+  uint32_t add_waveform(int, const string &, const float *, size_t,
+                        const uint8_t *markers = nullptr);
+  uint32_t add_waveform(int, const string &, const int16_t *, size_t,
+                        const uint8_t *markers = nullptr);
+  void remove_waveform(int, const string &);
+  uint32_t get_waveform_address(int, const string &) const;
+  uint32_t add_sequence_segment(const string &, const uint64_t *, size_t);
+  void remove_sequence_segment(const string &);
+  uint32_t get_sequence_segment_address(const string &) const;
+  APS2MemoryUsage get_waveform_memory_usage(int) const;
+  APS2MemoryUsage get_sequence_memory_usage() const;
+
   void load_sequence_file(const string &);
   void read_sequence(const uint32_t addr, uint32_t num_words);
 
@@ -114,18 +171,86 @@ public:
   void write_memory(const uint32_t &addr, const vector<uint32_t> &data);
   void write_memory(const uint32_t &addr, const uint32_t &data);
   vector<uint32_t> read_memory(uint32_t, uint32_t) const;
+  void read_memory(uint32_t, uint32_t, uint32_t *) const;
+  // Send a batch of CSR reads and read-modify-writes in at most two round
+  // trips
+  void commit(APS2Transaction &);
+
+  // Opt-in write-through cache of the CSR register file. Reads of registers
+  // only the host changes are then served locally; status registers the
+  // firmware updates are always read from the device.
+  void set_register_cache(bool);
+  bool get_register_cache() const;
+  // Re-read the cached registers, e.g. after another client changed them
+  void resync_register_cache();
+
+  // Transport counters and latency histograms kept by the ethernet interface
+  std::shared_ptr<APS2Metrics> get_transport_metrics() const;
 
   // SPI read/write
   void write_SPI(vector<uint32_t> &);
   uint32_t read_SPI(const CHIPCONFIG_IO_TARGET &, const uint16_t &);
 
+  // Asynchronous variants run in order on a per-device worker thread so
+  // uploads to several APS2s can overlap. The futures carry the result or the
+  // APS2_STATUS thrown.
+  template <typename F>
+  auto run_async(F task) -> std::future<decltype(task())> {
+    return asyncQueue_.submit(task);
+  }
+  std::future<void> write_memory_async(uint32_t, vector<uint32_t>);
+  std::future<vector<uint32_t>> read_memory_async(uint32_t, uint32_t);
+  std::future<void> write_SPI_async(vector<uint32_t>);
+  std::future<uint32_t> read_SPI_async(CHIPCONFIG_IO_TARGET, uint16_t);
+  template <typename T>
+  std::future<void> set_waveform_async(int dac, vector<T> data) {
+    return run_async([this, dac, data]() { set_waveform(dac, data); });
+  }
+  std::future<void> write_sequence_async(vector<uint64_t>);
+  // Block until all queued asynchronous operations have finished
+  void wait_async();
+
+  // Upload the same waveform or sequence to several APS2s. The data is
+  // prepared, packed and swapped to network byte order once and the same
+  // buffers are streamed to every device from its async worker. Devices
+  // whose markers differ from the first device's prepare their own waveform.
+  template <typename T>
+  static vector<std::future<void>>
+  set_waveform_many(const vector<APS2 *> &devices, int dac,
+                    const vector<T> &data) {
+    return set_waveform_many(devices, dac, data.data(), data.size());
+  }
+  template <typename T>
+  static vector<std::future<void>>
+  set_waveform_many(const vector<APS2 *> &devices, int dac, const T *data,
+                    size_t numPts) {
+    if (devices.empty()) {
+      return {};
+    }
+    devices[0]->check_channel_num(dac);
+    Channel channel(dac);
+    {
+      std::lock_guard<std::recursive_mutex> comms_guard(
+          devices[0]->comms_lock_);
+      channel.markers_ = devices[0]->channels_[dac].markers_;
+    }
+    channel.set_waveform(data, numPts);
+    return set_waveform_many(devices, dac, std::move(channel));
+  }
+  static vector<std::future<void>>
+  write_sequence_many(const vector<APS2 *> &, const vector<uint64_t> &);
+  static vector<std::future<void>>
+  write_sequence_many(const vector<APS2 *> &, const uint64_t *, size_t);
+
   // Configuration SDRAM read/write
   void write_configuration_SDRAM(uint32_t addr, const vector<uint32_t> &data);
   vector<uint32_t> read_configuration_SDRAM(uint32_t, uint32_t);
+  void read_configuration_SDRAM(uint32_t, uint32_t, uint32_t *);
 
   // Flash read/write
   void write_flash(uint32_t, vector<uint32_t> &);
   vector<uint32_t> read_flash(uint32_t, uint32_t);
+  void read_flash(uint32_t, uint32_t, uint32_t *);
   std::atomic<APS2_BITFILE_WRITING_TASK> bitfile_writing_task;
   std::atomic<double> bitfile_writing_task_progress;
 
@@ -154,12 +279,57 @@ public:
 private:
   string ipAddr_;
   bool connected_;
+  // guarded by comms_lock_, held from a change to a channel until it is
+  // uploaded
   vector<Channel> channels_;
   shared_ptr<APS2Ethernet> ethernetRM_;
   unsigned samplingRate_;
   MACAddr macAddr_;
 
+  // CSR shadow registers; guarded by comms_lock_
+  bool registerCacheEnabled_;
+  mutable bool registerCacheValid_;
+  mutable vector<uint32_t> shadowRegisters_;
+  bool register_cached(uint32_t) const;
+  bool registers_cached(uint32_t, uint32_t) const;
+  void update_register_cache(uint32_t, const uint32_t *, uint32_t) const;
+
+  // Entries added with add_waveform and add_sequence_segment; guarded by
+  // comms_lock_
+  struct MemoryEntry {
+    // bytes from the start of the region
+    size_t offset;
+    size_t numWords;
+    // block hashes of what the device holds there; empty if unknown
+    vector<uint64_t> uploadedBlocks;
+  };
+  typedef std::map<string, MemoryEntry> MemoryEntries;
+  vector<APS2MemoryAllocator> waveformMemory_;
+  vector<MemoryEntries> waveformEntries_;
+  APS2MemoryAllocator sequenceMemory_;
+  MemoryEntries sequenceEntries_;
+  uint32_t add_waveform(int, const string &, const Channel &);
+  // Allocate or resize the entry, send the blocks of packed that changed and
+  // return its offset; a waveform region's length register (lengthAddr, 0
+  // for none) is set to cover every entry
+  size_t write_entry(uint32_t regionAddr, APS2MemoryAllocator &,
+                     MemoryEntries &, const string &,
+                     const vector<uint32_t> &packed, uint32_t lengthAddr);
+  static const MemoryEntry &find_entry(const MemoryEntries &, const string &);
+  void remove_entry(APS2MemoryAllocator &, MemoryEntries &, const string &);
+  // Forget what was uploaded to device memory that [addr, addr + numBytes)
+  // overlaps
+  void forget_uploads(uint32_t addr, uint64_t numBytes);
+
+  // Hashes of the version 2 sequence file sections the device memory holds,
+  // 0 if it holds anything else; guarded by comms_lock_
+  uint64_t loadedSequenceHash_;
+  vector<uint64_t> loadedWaveformHashes_;
+  void load_sequence_sections(const APS2MappedFile &);
+
   void erase_flash(uint32_t, uint32_t);
+  void read_pipelined(APS2Command, uint32_t, uint32_t, uint32_t *) const;
+  void send_read_requests(const vector<APS2Datagram> &, uint32_t *) const;
 
   vector<uint32_t> build_DAC_SPI_msg(const CHIPCONFIG_IO_TARGET &,
                                      const vector<SPI_AddrData_t> &);
@@ -190,7 +360,36 @@ private:
   void set_register_bit(const uint32_t &, std::initializer_list<size_t>);
   void clear_register_bit(const uint32_t &, std::initializer_list<size_t>);
 
-  void write_waveform(const int &, const vector<int16_t> &);
+  // Sends, with write_range, the word ranges of a waveform whose block
+  // hashes differ from the channel's last upload; all of it without hashes
+  void write_waveform(int, const vector<uint64_t> &hashes, size_t numWords,
+                      size_t length,
+                      const std::function<void(size_t, size_t)> &write_range);
+  void write_channel_waveform(int);
+  // Set and send a channel's waveform from the int16 samples of a version 1
+  // sequence file, packing each chunk just before it is sent
+  void write_channel_waveform(int, const APS2MappedFile &, size_t offset,
+                              size_t numPts);
+  void write_sequence(const APS2PreparedWrite &);
+  // Stream instructions straight from a mapped sequence file
+  void write_sequence(const APS2MappedFile &, size_t offset,
+                      size_t numInstructions);
+  void write_prepared(const APS2PreparedWrite &);
+  void write_prepared(const APS2PreparedWrite &, size_t offset,
+                      size_t numWords);
+  // Write numWords words, fill(offset, count, out) supplying them in host
+  // order a chunk at a time
+  template <typename F>
+  void write_streamed(uint32_t addr, size_t numWords, F fill);
+  // SDRAM alignment rules and forgetting overwritten waveform uploads
+  void check_memory_write(uint32_t addr, size_t numWords);
+  void write_sequence_memory(size_t numWords,
+                             const std::function<void()> &write);
+
+  static uint32_t waveform_addr(int);
+  static vector<uint32_t> pack_sequence(const uint64_t *, size_t);
+  static vector<std::future<void>>
+  set_waveform_many(const vector<APS2 *> &, int, Channel &&);
 
   int write_memory_map(const uint32_t &wfA = WFA_OFFSET,
                        const uint32_t &wfB = WFB_OFFSET,
@@ -198,6 +397,13 @@ private:
 
   int save_state_file(string &);
   int read_state_file(string &);
+
+  // Serializes request/response exchanges with the device between the
+  // caller's thread and the async worker
+  mutable std::recursive_mutex comms_lock_;
+  // Declared last so queued operations finish before anything else is torn
+  // down
+  APS2TaskQueue asyncQueue_;
   //int write_state_to_hdf5(H5::H5File &, const string &);
   //int read_state_from_hdf5(H5::H5File &, const string &);
 
@@ -7,8 +7,15 @@
 // Original author: Colm Ryan
 // Copyright 2016 Raytheon BBN Technologies
 
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+
 #include "APS2Datagram.h"
 
+#include <algorithm>
 #include <iostream>
 #include <iterator>
 
@@ -60,6 +67,52 @@ vector<uint32_t> APS2Datagram::data() const {
   return data;
 }
 
+APS2DatagramView::APS2DatagramView(APS2Command cmd, uint32_t addr,
+                                   const uint32_t *payload,
+                                   size_t payload_size)
+    : cmd{cmd}, addr{addr}, header{htonl(cmd.packed), htonl(addr)},
+      payload{payload}, payload_size{payload_size} {}
+
+APS2Datagram APS2DatagramView::to_datagram() const {
+  APS2Datagram dg{cmd, addr, vector<uint32_t>(payload, payload + payload_size)};
+  for (auto &val : dg.payload) {
+    val = ntohl(val);
+  }
+  return dg;
+}
+
+vector<APS2DatagramView>
+APS2DatagramView::chunk(APS2Command cmd, uint32_t addr,
+                        const vector<uint32_t> &data, uint16_t chunk_size) {
+  return chunk(cmd, addr, data.data(), data.size(), chunk_size);
+}
+
+vector<APS2DatagramView>
+APS2DatagramView::chunk(APS2Command cmd, uint32_t addr, const uint32_t *data,
+                        size_t numWords, uint16_t chunk_size) {
+  // Same chunking as APS2Datagram::chunk but pointing into data rather than
+  // copying it; data should come from to_network_order
+  vector<APS2DatagramView> chunks;
+  chunks.reserve((numWords + chunk_size - 1) / chunk_size);
+  size_t offset = 0;
+  while (offset < numWords) {
+    size_t cur_chunk_size =
+        std::min(numWords - offset, static_cast<size_t>(chunk_size));
+    cmd.cnt = cur_chunk_size;
+    chunks.emplace_back(cmd, addr, data + offset, cur_chunk_size);
+    offset += cur_chunk_size;
+    addr += 4 * cur_chunk_size; // increment AXI byte address
+  }
+  return chunks;
+}
+
+vector<uint32_t> APS2DatagramView::to_network_order(const vector<uint32_t> &data) {
+  vector<uint32_t> swapped(data.size());
+  std::transform(data.begin(), data.end(), swapped.begin(),
+                 [](uint32_t val) { return htonl(val); });
+  return swapped;
+}
+
 void APS2Datagram::check_ack(const APS2Datagram &ack,
                              bool legacy_firmware) const {
 
@@ -78,4 +78,27 @@ public:
   void check_ack(const APS2Datagram &, bool legacy_firmware) const;
 };
 
+// Non-owning datagram over a payload that is already in network byte order so
+// it can be written to a socket as a header + payload buffer sequence without
+// copying. The payload must outlive the view.
+class APS2DatagramView {
+public:
+  APS2DatagramView(APS2Command, uint32_t, const uint32_t *, size_t);
+
+  APS2Command cmd;
+  uint32_t addr;
+  uint32_t header[2]; // command and address words in network byte order
+  const uint32_t *payload;
+  size_t payload_size;
+
+  // Host byte order copy of the datagram for the UDP fallback
+  APS2Datagram to_datagram() const;
+
+  static vector<APS2DatagramView> chunk(APS2Command, uint32_t,
+                                        const vector<uint32_t> &, uint16_t);
+  static vector<APS2DatagramView> chunk(APS2Command, uint32_t,
+                                        const uint32_t *, size_t, uint16_t);
+  static vector<uint32_t> to_network_order(const vector<uint32_t> &);
+};
+
 #endif // APS2DATAGRAM_H_
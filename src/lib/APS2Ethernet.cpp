@@ -3,6 +3,10 @@
 // Original authors: Colm Ryan, Blake Johnson, Brian Donovan
 // Copyright 2016, Raytheon BBN Technologies
 
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <limits>
 #include <unordered_map>
 using std::unordered_map;
 #include <queue>
@@ -22,13 +26,54 @@ using std::queue;
 #include <ifaddrs.h>
 #endif
 
-APS2Ethernet::APS2Ethernet() : udp_socket_old_(ios_), udp_socket_(ios_) {
+#ifdef __linux__
+#include <poll.h>
+#include <sys/socket.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+namespace {
+
+// Completion handler for a socket operation that runs on the device's strand
+// and fulfils a future so the caller can wait on it with a timeout
+std::function<void(std::error_code, size_t)>
+strand_completion(asio::io_service::strand &strand,
+                  std::future<size_t> &result) {
+  auto promise = std::make_shared<std::promise<size_t>>();
+  result = promise->get_future();
+  return strand.wrap([promise](std::error_code ec, size_t bytes) {
+    if (ec) {
+      promise->set_exception(
+          std::make_exception_ptr(std::system_error(ec)));
+    } else {
+      promise->set_value(bytes);
+    }
+  });
+}
+
+// Devices are identified in traces by their IPv4 address
+uint32_t trace_address(const string &ipAddr) {
+  asio::error_code ec;
+  auto addr = asio::ip::address_v4::from_string(ipAddr, ec);
+  return ec ? 0 : addr.to_ulong();
+}
+
+} // namespace
+
+APS2Ethernet::APS2Ethernet() : APS2Ethernet(UDP_PORT_OLD, UDP_PORT) {}
+
+APS2Ethernet::APS2Ethernet(uint16_t udpPortOld, uint16_t udpPort,
+                           size_t numIoThreads)
+    : udp_socket_old_(ios_), udp_socket_(ios_), udpStrand_(ios_),
+      ackWindow_{DEFAULT_ACK_WINDOW}, tracing_{false} {
   LOG(plog::debug) << "APS2Ethernet::APS2Ethernet";
 
-  // Bind the old UDP socket at local port bb4e
+  // Bind the old UDP socket at local port bb4e (or another port when talking
+  // to a stand-in device on the same host)
   try {
     udp_socket_old_.open(udp::v4());
-    udp_socket_old_.bind(udp::endpoint(udp::v4(), UDP_PORT_OLD));
+    udp_socket_old_.bind(udp::endpoint(udp::v4(), udpPortOld));
   } catch (...) {
     throw APS2_SOCKET_FAILURE;
   }
@@ -36,7 +81,7 @@ APS2Ethernet::APS2Ethernet() : udp_socket_old_(ios_), udp_socket_(ios_) {
   // Bind UDP socket at local port bb4f
   try {
     udp_socket_.open(udp::v4());
-    udp_socket_.bind(udp::endpoint(udp::v4(), UDP_PORT));
+    udp_socket_.bind(udp::endpoint(udp::v4(), udpPort));
   } catch (...) {
     throw APS2_SOCKET_FAILURE;
   }
@@ -45,91 +90,179 @@ APS2Ethernet::APS2Ethernet() : udp_socket_old_(ios_), udp_socket_(ios_) {
   udp_socket_old_.set_option(asio::socket_base::broadcast(true));
   udp_socket_.set_option(asio::socket_base::broadcast(true));
 
-  // Move the io_service to a background thread
-  // Give it something to chew on so that it doesn't return from the background
-  // thread
-  asio::io_service::work work(ios_);
-  receiveThread_ = std::thread([this]() { ios_.run(); });
+  // Start the receivers before the pool so the io_service always has work
+  setup_udp_receive(udp_socket_old_, rxBatchOld_);
+  setup_udp_receive(udp_socket_, rxBatch_);
 
-  setup_udp_receive(udp_socket_old_, received_udp_data_old_,
-                    remote_udp_endpoint_old_);
-  setup_udp_receive(udp_socket_, received_udp_data_, remote_udp_endpoint_);
+  // Service socket completions on a pool of background threads
+  numIoThreads = std::max(numIoThreads, static_cast<size_t>(1));
+  LOG(plog::debug) << "Starting " << numIoThreads << " io thread"
+                      << (numIoThreads > 1 ? "s" : "");
+  for (size_t ct = 0; ct < numIoThreads; ct++) {
+    ioThreads_.emplace_back([this]() { ios_.run(); });
+  }
 }
 
 APS2Ethernet::~APS2Ethernet() {
   LOG(plog::debug) << "Cleaning up ethernet interface";
-  udp_socket_.cancel();
+  // Stop the io threads before closing the sockets so a receive handler
+  // cannot restart on a socket as it is torn down
+  ios_.stop();
+  for (auto &ioThread : ioThreads_) {
+    ioThread.join();
+  }
   udp_socket_.close();
-  udp_socket_old_.cancel();
   udp_socket_old_.close();
-  ios_.stop();
-  receiveThread_.join();
-}
-
-void APS2Ethernet::setup_udp_receive(udp::socket &sock, uint8_t *buf,
-                                     udp::endpoint &remote_endpoint) {
-  // Receive UDP packets and pass off to sorter
-  sock.async_receive_from(asio::buffer(buf, 2048), remote_endpoint,
-                          [this, &sock, buf, &remote_endpoint](
-                              std::error_code ec, std::size_t bytesReceived) {
-                            // If there is anything to look at hand it off to
-                            // the sorter
-                            if (!ec && bytesReceived > 0) {
-                              vector<uint8_t> packetData(buf,
-                                                         buf + bytesReceived);
-                              sorter_lock_.lock();
-                              sort_packet(packetData, remote_endpoint);
-                              sorter_lock_.unlock();
-                            }
-
-                            // Start the receiver again
-                            setup_udp_receive(sock, buf, remote_endpoint);
-                          });
-}
-
-void APS2Ethernet::sort_packet(const vector<uint8_t> &packetData,
+}
+
+void APS2Ethernet::setup_udp_receive(udp::socket &sock,
+                                     UDPReceiveBatch &batch) {
+  // Receive UDP packets and pass off to sorter. Both sockets complete on the
+  // UDP strand so the sorter never runs concurrently with itself.
+#ifdef __linux__
+  // Wait for the socket to become readable and then drain it in batches
+  sock.async_receive(
+      asio::null_buffers(),
+      udpStrand_.wrap([this, &sock, &batch](std::error_code ec, std::size_t) {
+        if (!ec) {
+          drain_udp(sock, batch);
+        }
+
+        // Start the receiver again
+        setup_udp_receive(sock, batch);
+      }));
+#else
+  sock.async_receive_from(
+      asio::buffer(batch.data[0]), batch.senders[0],
+      udpStrand_.wrap([this, &sock, &batch](std::error_code ec,
+                                            std::size_t bytesReceived) {
+        // If there is anything to look at hand it off to the sorter
+        if (!ec && bytesReceived > 0) {
+          sort_packet(batch.data[0], bytesReceived, batch.senders[0]);
+        }
+
+        // Start the receiver again
+        setup_udp_receive(sock, batch);
+      }));
+#endif
+}
+
+void APS2Ethernet::drain_udp(udp::socket &sock, UDPReceiveBatch &batch) {
+#ifdef __linux__
+  // Pull up to a batch of datagrams per syscall until the socket is empty
+  mmsghdr msgs[UDPReceiveBatch::SIZE];
+  iovec iovs[UDPReceiveBatch::SIZE];
+  int received;
+  do {
+    for (size_t ct = 0; ct < UDPReceiveBatch::SIZE; ct++) {
+      iovs[ct].iov_base = batch.data[ct];
+      iovs[ct].iov_len = sizeof(batch.data[ct]);
+      std::memset(&msgs[ct], 0, sizeof(mmsghdr));
+      msgs[ct].msg_hdr.msg_name = batch.senders[ct].data();
+      msgs[ct].msg_hdr.msg_namelen = batch.senders[ct].capacity();
+      msgs[ct].msg_hdr.msg_iov = &iovs[ct];
+      msgs[ct].msg_hdr.msg_iovlen = 1;
+    }
+    received = recvmmsg(sock.native_handle(), msgs, UDPReceiveBatch::SIZE,
+                        MSG_DONTWAIT, nullptr);
+    for (int ct = 0; ct < received; ct++) {
+      batch.senders[ct].resize(msgs[ct].msg_hdr.msg_namelen);
+      if (msgs[ct].msg_len > 0) {
+        sort_packet(batch.data[ct], msgs[ct].msg_len, batch.senders[ct]);
+      }
+    }
+  } while (received == static_cast<int>(UDPReceiveBatch::SIZE));
+#endif
+}
+
+void APS2Ethernet::sort_packet(const uint8_t *packetData, size_t packetSize,
                                const udp::endpoint &sender) {
-  // If we have the endpoint address then add it to the queue otherwise check to
-  // see if it is an enumerate response
-  string senderIP = sender.address().to_string();
-  if (msgQueues_.find(senderIP) == msgQueues_.end()) {
-    // Are seeing an enumerate status response
-    // Old UDP port sends status response
-    if ((sender.port() == 0xbb4e) && (packetData.size() == 84)) {
-      devInfo_[senderIP].endpoint = sender;
-      // Turn the byte array into a packet to extract the MAC address and
-      // firmware version
-      // MAC not strictly necessary as we could just use the broadcast MAC
-      // address
-      APS2EthernetPacket packet = APS2EthernetPacket(packetData);
-      devInfo_[senderIP].macAddr = packet.header.src;
-      APSStatusBank_t statusRegs;
-      std::copy(packet.payload.begin(), packet.payload.end(), statusRegs.array);
-      LOG(plog::debug) << "Adding device info for IP " << senderIP
-                          << " ; MAC addresss "
-                          << devInfo_[senderIP].macAddr.to_string()
-                          << " ; firmware version "
-                          << hexn<4> << statusRegs.userFirmwareVersion;
-    }
-    // New UDP port sends "I am an APS2"
-    else if ((sender.port() == 0xbb4f) && (packetData.size() == 12)) {
-      string response = string(packetData.begin(), packetData.end());
-      LOG(plog::debug) << "Enumerate response string " << response;
-      if (response.compare("I am an APS2") == 0) {
-        devInfo_[senderIP].supports_tcp = true;
-        LOG(plog::debug) << "Adding device info for IP " << senderIP;
+  // If the sender is a connected device push the packet onto its queue
+  // otherwise check to see if it is an enumerate response
+  if (sender.address().is_v4()) {
+    auto senderAddr = sender.address().to_v4().to_ulong();
+    for (auto &kv : rxQueuesByAddr_) {
+      if (kv.first == senderAddr) {
+        if (!kv.second->push(packetData, packetSize)) {
+          LOG(plog::warning) << "Receive queue full for IP "
+                               << sender.address().to_string()
+                               << "; dropping packet";
+        }
+        return;
       }
     }
+  }
+
+  string senderIP = sender.address().to_string();
+  std::lock_guard<std::mutex> lock(sorter_lock_);
+  // Are seeing an enumerate status response
+  // Old UDP port sends status response
+  if ((sender.port() == 0xbb4e) && (packetSize == 84)) {
+    devInfo_[senderIP].endpoint = sender;
+    // Turn the byte array into a packet to extract the MAC address and
+    // firmware version
+    // MAC not strictly necessary as we could just use the broadcast MAC
+    // address
+    APS2EthernetPacket packet(packetData, packetSize);
+    devInfo_[senderIP].macAddr = packet.header.src;
+    APSStatusBank_t statusRegs;
+    std::copy(packet.payload.begin(), packet.payload.end(), statusRegs.array);
+    LOG(plog::debug) << "Adding device info for IP " << senderIP
+                     << " ; MAC addresss "
+                     << devInfo_[senderIP].macAddr.to_string()
+                     << " ; firmware version "
+                     << hexn<4> << statusRegs.userFirmwareVersion;
+  }
+  // New UDP port sends "I am an APS2"
+  else if ((sender.port() == 0xbb4f) && (packetSize == 12)) {
+    string response = string(packetData, packetData + packetSize);
+    LOG(plog::debug) << "Enumerate response string " << response;
+    if (response.compare("I am an APS2") == 0) {
+      devInfo_[senderIP].supports_tcp = true;
+      LOG(plog::debug) << "Adding device info for IP " << senderIP;
+    }
   } else {
-    // Turn the byte array into an APS2EthernetPacket
-    LOG(plog::verbose) << "Recevied UDP packet to be sorted from IP "
-                        << senderIP;
-    APS2EthernetPacket packet = APS2EthernetPacket(packetData);
-    // Grab a lock and push the packet into the message queue
-    msgQueue_lock_.lock();
-    msgQueues_[senderIP].emplace(packet);
-    msgQueue_lock_.unlock();
+    return;
+  }
+  devInfo_cv_.notify_all();
+}
+
+bool APS2Ethernet::wait_for_devices(std::unique_lock<std::mutex> &lock,
+                                    std::function<bool()> complete,
+                                    std::function<bool()> settled,
+                                    std::chrono::steady_clock::time_point
+                                        deadline) {
+  if (!devInfo_cv_.wait_until(lock, deadline, complete)) {
+    return false;
   }
+  // TCP firmware answers on both ports but the two replies can arrive any
+  // time apart, so only the deadline tells a device heard on the legacy port
+  // alone from legacy firmware
+  devInfo_cv_.wait_until(lock, deadline, settled);
+  return true;
+}
+
+void APS2Ethernet::register_rx_queue(const string &ip_addr_str,
+                                     std::shared_ptr<APS2RxQueue> rxQueue) {
+  // Swap the queue into the sorter's lookup table on the UDP strand so the
+  // receive path never needs a lock. A null queue removes the device.
+  auto addr = asio::ip::address_v4::from_string(ip_addr_str).to_ulong();
+  std::promise<void> registered;
+  udpStrand_.post([this, addr, rxQueue, &registered]() {
+    auto it = std::find_if(
+        rxQueuesByAddr_.begin(), rxQueuesByAddr_.end(),
+        [addr](const std::pair<uint32_t, std::shared_ptr<APS2RxQueue>> &kv) {
+          return kv.first == addr;
+        });
+    if (it != rxQueuesByAddr_.end()) {
+      rxQueuesByAddr_.erase(it);
+    }
+    if (rxQueue) {
+      rxQueuesByAddr_.emplace_back(addr, rxQueue);
+    }
+    registered.set_value();
+  });
+  registered.get_future().wait();
 }
 
 /* PUBLIC methods */
@@ -241,6 +374,53 @@ vector<std::pair<string, string>> APS2Ethernet::get_local_IPs() {
 }
 
 set<string> APS2Ethernet::enumerate() {
+  // Wait the full time since we do not know how many devices to expect
+  return enumerate(std::numeric_limits<size_t>::max(), ENUMERATE_TIMEOUT);
+}
+
+set<string> APS2Ethernet::enumerate(const set<string> &expected,
+                                    std::chrono::milliseconds maxWait,
+                                    DiscoveryCallback callback) {
+  return enumerate_until(
+      [this, &expected]() {
+        return std::all_of(expected.begin(), expected.end(),
+                           [this](const string &ip) {
+                             return devInfo_.find(ip) != devInfo_.end();
+                           });
+      },
+      [this, &expected]() {
+        return std::all_of(expected.begin(), expected.end(),
+                           [this](const string &ip) {
+                             auto it = devInfo_.find(ip);
+                             return it != devInfo_.end() &&
+                                    it->second.supports_tcp;
+                           });
+      },
+      maxWait, callback, expected);
+}
+
+set<string> APS2Ethernet::enumerate(size_t expectedCount,
+                                    std::chrono::milliseconds maxWait,
+                                    DiscoveryCallback callback) {
+  return enumerate_until(
+      [this, expectedCount]() { return devInfo_.size() >= expectedCount; },
+      // any legacy device among those counted waits out the deadline unless
+      // enough others report TCP support
+      [this, expectedCount]() {
+        return static_cast<size_t>(std::count_if(
+                   devInfo_.begin(), devInfo_.end(),
+                   [](const std::pair<const string, EthernetDevInfo> &kv) {
+                     return kv.second.supports_tcp;
+                   })) >= expectedCount;
+      },
+      maxWait, callback, {});
+}
+
+set<string> APS2Ethernet::enumerate_until(std::function<bool()> complete,
+                                          std::function<bool()> settled,
+                                          std::chrono::milliseconds maxWait,
+                                          DiscoveryCallback callback,
+                                          const set<string> &unicastTargets) {
   /*
    * Look for all APS units that respond to the broadcast packet
    */
@@ -264,25 +444,59 @@ set<string> APS2Ethernet::enumerate() {
       LOG(plog::error) << "Invalid IP address: " << ec.message();
       continue;
     }
-    // Put together the broadcast status request
-    APS2EthernetPacket broadcastPacket =
-        APS2EthernetPacket::create_broadcast_packet();
     addrv4 broadcastAddr = addrv4::broadcast(addrv4::from_string(IP.first),
                                              addrv4::from_string(IP.second));
     LOG(plog::debug) << "Sending enumerate broadcasts out on: "
                         << broadcastAddr.to_string();
-    // Try the old port
-    udp::endpoint broadCastEndPoint(broadcastAddr, UDP_PORT_OLD);
-    udp_socket_old_.send_to(asio::buffer(broadcastPacket.serialize()),
-                            broadCastEndPoint);
-    // And the new
-    broadCastEndPoint.port(UDP_PORT);
-    uint8_t enumerate_request = 0x01;
-    udp_socket_.send_to(asio::buffer(&enumerate_request, 1), broadCastEndPoint);
+    send_enumerate_request(broadcastAddr);
   }
 
-  // Wait 100ms for response
-  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  // Known devices are also asked directly so they answer even when they are
+  // not on a local subnet
+  for (auto ip : unicastTargets) {
+    asio::error_code ec;
+    auto addr = asio::ip::address_v4::from_string(ip, ec);
+    if (ec) {
+      LOG(plog::error) << "Invalid IP address: " << ip;
+      throw APS2_INVALID_IP_ADDR;
+    }
+    send_enumerate_request(addr);
+  }
+
+  // Wait for the responses to come in. Devices are reported from this thread
+  // once their transport is known, so the callback never holds up the
+  // receive path and may call back into the driver: TCP devices as soon as
+  // they say so and the rest when the wait is over.
+  auto deadline = std::chrono::steady_clock::now() + maxWait;
+  set<string> reported;
+  auto unreported = [this, &reported](bool all) {
+    vector<string> ips;
+    for (auto &kv : devInfo_) {
+      if ((all || kv.second.supports_tcp) && !reported.count(kv.first)) {
+        ips.push_back(kv.first);
+      }
+    }
+    return ips;
+  };
+  auto report = [&callback, &reported](std::unique_lock<std::mutex> &lock,
+                                       const vector<string> &ips) {
+    reported.insert(ips.begin(), ips.end());
+    if (callback && !ips.empty()) {
+      lock.unlock();
+      for (auto &ip : ips) {
+        callback(ip);
+      }
+      lock.lock();
+    }
+  };
+  auto done = [&complete, &settled]() { return complete() && settled(); };
+
+  std::unique_lock<std::mutex> lock(sorter_lock_);
+  while (devInfo_cv_.wait_until(lock, deadline, [&]() {
+    return done() || !unreported(false).empty();
+  }) && !done()) {
+    report(lock, unreported(false));
+  }
 
   set<string> deviceSerials;
   for (auto kv : devInfo_) {
@@ -291,18 +505,72 @@ set<string> APS2Ethernet::enumerate() {
                       << " TCP support";
     deviceSerials.insert(kv.first);
   }
+  report(lock, unreported(true));
   return deviceSerials;
 }
 
+void APS2Ethernet::send_enumerate_request(const asio::ip::address_v4 &addr) {
+  // Try the old port with a status request for old firmware devices
+  APS2EthernetPacket statusRequest =
+      APS2EthernetPacket::create_broadcast_packet();
+  udp::endpoint endpoint(addr, UDP_PORT_OLD);
+  udp_socket_old_.send_to(asio::buffer(statusRequest.serialize()), endpoint);
+  // And the new
+  endpoint.port(UDP_PORT);
+  uint8_t enumerate_request = 0x01;
+  udp_socket_.send_to(asio::buffer(&enumerate_request, 1), endpoint);
+}
+
+EthernetDevInfo APS2Ethernet::get_dev_info(const string &ipAddr) {
+  // Enumerate responses can add devices at any time so take a copy under the
+  // lock. Unknown devices get default info as before.
+  std::lock_guard<std::mutex> lock(sorter_lock_);
+  auto it = devInfo_.find(ipAddr);
+  return it != devInfo_.end() ? it->second : EthernetDevInfo();
+}
+
+APS2Ethernet::TCPConnection
+APS2Ethernet::get_tcp_connection(const string &ipAddr) {
+  // Devices may connect and disconnect from other threads so take our own
+  // references under the lock
+  std::lock_guard<std::mutex> lock(connections_lock_);
+  auto connection = tcp_connections_.find(ipAddr);
+  if (connection == tcp_connections_.end()) {
+    LOG(plog::error) << ipAddr << " has no TCP connection; is it connected?";
+    throw APS2_UNCONNECTED;
+  }
+  return connection->second;
+}
+
+APS2Ethernet::UDPConnection
+APS2Ethernet::get_udp_connection(const string &ipAddr) {
+  {
+    std::lock_guard<std::mutex> lock(connections_lock_);
+    auto connection = udp_connections_.find(ipAddr);
+    if (connection != udp_connections_.end()) {
+      return connection->second;
+    }
+  }
+  return {nullptr, get_metrics(ipAddr)};
+}
+
 void APS2Ethernet::reset_maps() {
-  devInfo_.clear();
-  msgQueues_.clear();
+  {
+    std::lock_guard<std::mutex> lock(sorter_lock_);
+    devInfo_.clear();
+  }
+  std::lock_guard<std::mutex> lock(connections_lock_);
+  for (auto &kv : udp_connections_) {
+    register_rx_queue(kv.first, nullptr);
+  }
+  udp_connections_.clear();
 }
 
 void APS2Ethernet::connect(string ip_addr_str) {
   LOG(plog::debug) << ip_addr_str << " APS2Ethernet::connect";
 
   // Check whether we have device info and if not send a ping
+  std::unique_lock<std::mutex> lock(sorter_lock_);
   if (devInfo_.find(ip_addr_str) == devInfo_.end()) {
     LOG(plog::debug) << "No device info for " << ip_addr_str
                        << " ; sending enumerate request";
@@ -315,50 +583,54 @@ void APS2Ethernet::connect(string ip_addr_str) {
       LOG(plog::error) << "Invalid IP address: " << ec.message();
       throw APS2_INVALID_IP_ADDR;
     }
-    // Try the old port
-    // Put together the status request for old firmware devices
-    APS2EthernetPacket broadcastPacket =
-        APS2EthernetPacket::create_broadcast_packet();
-    udp::endpoint endpoint(ip_addr, UDP_PORT_OLD);
-    udp_socket_old_.send_to(asio::buffer(broadcastPacket.serialize()),
-                            endpoint);
-    // And the new
-    endpoint.port(UDP_PORT);
-    uint8_t enumerate_request = 0x01;
-    udp_socket_.send_to(asio::buffer(&enumerate_request, 1), endpoint);
-
-    // Wait 100ms for response
-    std::this_thread::sleep_for(std::chrono::milliseconds(100));
-
-    // Check again
-    if (devInfo_.find(ip_addr_str) == devInfo_.end()) {
+    send_enumerate_request(ip_addr);
+
+    // Wait for the response
+    bool found = wait_for_devices(
+        lock,
+        [this, &ip_addr_str]() {
+          return devInfo_.find(ip_addr_str) != devInfo_.end();
+        },
+        [this, &ip_addr_str]() { return devInfo_[ip_addr_str].supports_tcp; },
+        std::chrono::steady_clock::now() + ENUMERATE_TIMEOUT);
+    if (!found) {
       LOG(plog::error) << "APS2 failed to respond at " << ip_addr_str;
       throw APS2_NO_DEVICE_FOUND;
     }
   }
+  bool supports_tcp = devInfo_[ip_addr_str].supports_tcp;
+  lock.unlock();
+
+  if (supports_tcp) {
+    auto sock = open_tcp(ip_addr_str);
+    std::lock_guard<std::mutex> lock(connections_lock_);
+    tcp_connections_[ip_addr_str] = {
+        sock, std::make_shared<asio::io_service::strand>(ios_),
+        get_metrics(ip_addr_str)};
+  } else {
+    // Resolve the receive queue once here so the asio thread can sort
+    // packets by address
+    auto rxQueue = std::make_shared<APS2RxQueue>();
+    std::lock_guard<std::mutex> lock(connections_lock_);
+    udp_connections_[ip_addr_str] = {rxQueue, get_metrics(ip_addr_str)};
+    register_rx_queue(ip_addr_str, rxQueue);
+  }
+}
 
-  if (devInfo_[ip_addr_str].supports_tcp) {
-    // C++14
-    // tcp_sockets_.insert(ip_addr_str, std::make_shared<tcp::socket>(ios_));
-    // lowly C++11
-    std::shared_ptr<tcp::socket> sock(new tcp::socket(ios_));
-    LOG(plog::debug) << ip_addr_str << " trying to connect to TCP port";
+std::shared_ptr<tcp::socket> APS2Ethernet::open_tcp(const string &ip_addr_str) {
+  std::shared_ptr<tcp::socket> sock(new tcp::socket(ios_));
+  LOG(plog::debug) << ip_addr_str << " trying to connect to TCP port";
 
-    try {
-      tcp_connect(ip_addr_str, sock);
-    } catch (APS2_STATUS status) {
-      LOG(plog::warning) << "Failed to connect. Resetting APS2 TCP and retrying";
-      reset_tcp(ip_addr_str);
-      std::this_thread::sleep_for(std::chrono::milliseconds(100));
-      tcp_connect(ip_addr_str, sock);
-    }
-
-    tcp_sockets_.insert(std::make_pair(ip_addr_str, sock));
-  } else {
-    msgQueue_lock_.lock();
-    msgQueues_[ip_addr_str] = queue<APS2EthernetPacket>();
-    msgQueue_lock_.unlock();
+  try {
+    tcp_connect(ip_addr_str, sock);
+  } catch (APS2_STATUS status) {
+    LOG(plog::warning) << "Failed to connect. Resetting APS2 TCP and retrying";
+    APS2Metrics::add(get_metrics(ip_addr_str)->retries, 1);
+    reset_tcp(ip_addr_str);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    tcp_connect(ip_addr_str, sock);
   }
+  return sock;
 }
 
 void APS2Ethernet::tcp_connect(string ip_addr_str, std::shared_ptr<tcp::socket> sock) {
@@ -376,24 +648,78 @@ void APS2Ethernet::tcp_connect(string ip_addr_str, std::shared_ptr<tcp::socket>
                        << " with error: " << e.what();
     throw APS2_FAILED_TO_CONNECT;
   }
+  // Pipelined read requests are small so send them straight away rather than
+  // holding them until the previous segment is acknowledged
+  sock->set_option(tcp::no_delay(true));
 }
 
 void APS2Ethernet::disconnect(string ip_addr_str) {
   LOG(plog::debug) << ip_addr_str << " APS2Ethernet::disconnect";
-  if (devInfo_[ip_addr_str].supports_tcp) {
-    if (tcp_sockets_.find(ip_addr_str) != tcp_sockets_.end()) {
+  bool supports_tcp = get_dev_info(ip_addr_str).supports_tcp;
+  std::lock_guard<std::mutex> lock(connections_lock_);
+  if (supports_tcp) {
+    auto connection = tcp_connections_.find(ip_addr_str);
+    if (connection != tcp_connections_.end()) {
       LOG(plog::debug) << ip_addr_str << " cancelling and closing socket";
-      tcp_sockets_[ip_addr_str]->cancel();
-      tcp_sockets_[ip_addr_str]->close();
-      tcp_sockets_.erase(ip_addr_str);
+      connection->second.socket->cancel();
+      connection->second.socket->close();
+      tcp_connections_.erase(connection);
     }
   } else {
-    msgQueue_lock_.lock();
-    msgQueues_.erase(ip_addr_str);
-    msgQueue_lock_.unlock();
+    if (udp_connections_.find(ip_addr_str) != udp_connections_.end()) {
+      register_rx_queue(ip_addr_str, nullptr);
+      udp_connections_.erase(ip_addr_str);
+    }
+  }
+}
+
+void APS2Ethernet::drain_responses(const string &ipAddr, size_t numPending) {
+  LOG(plog::debug) << ipAddr << " dropping " << numPending
+                      << " responses still in flight";
+  try {
+    for (size_t ct = 0; ct < numPending; ct++) {
+      read(ipAddr, DRAIN_TIMEOUT);
+    }
+  } catch (APS2_STATUS) {
+    // whatever is left of them could arrive at any time
+    if (get_dev_info(ipAddr).supports_tcp) {
+      reconnect_tcp(ipAddr);
+    }
   }
 }
 
+void APS2Ethernet::reconnect_tcp(const string &ipAddr) {
+  LOG(plog::warning) << ipAddr << " TCP stream out of step; reconnecting";
+  {
+    std::lock_guard<std::mutex> lock(connections_lock_);
+    auto it = tcp_connections_.find(ipAddr);
+    if (it == tcp_connections_.end()) {
+      return;
+    }
+    // aborts anything still waiting on the old stream
+    asio::error_code ec;
+    it->second.socket->cancel(ec);
+    it->second.socket->close(ec);
+  }
+  std::shared_ptr<tcp::socket> sock;
+  try {
+    sock = open_tcp(ipAddr);
+  } catch (APS2_STATUS) {
+    // leave the closed socket so later exchanges fail rather than hang; the
+    // caller is already reporting the original failure
+    LOG(plog::error) << ipAddr << " failed to reconnect";
+    return;
+  }
+  std::lock_guard<std::mutex> lock(connections_lock_);
+  auto it = tcp_connections_.find(ipAddr);
+  if (it == tcp_connections_.end()) {
+    // disconnected meanwhile
+    sock->close();
+    return;
+  }
+  it->second.socket = sock;
+}
+
 void APS2Ethernet::reset_tcp(const string &ip_addr_str) {
   // Make sure it is a valid IP
   typedef asio::ip::address_v4 addrv4;
@@ -411,51 +737,26 @@ void APS2Ethernet::reset_tcp(const string &ip_addr_str) {
 
 void APS2Ethernet::send(string ipAddr, const vector<APS2Datagram> &datagrams) {
   LOG(plog::debug) << "APS2Ethernet::send";
-  if (devInfo_[ipAddr].supports_tcp) {
-    LOG(plog::debug) << "Sending " << datagrams.size() << " datagram"
-                        << (datagrams.size() > 1 ? "s" : "") << " over TCP";
-
-    size_t ct = 0;
+  if (get_dev_info(ipAddr).supports_tcp) {
+    // Swap all the payloads to network byte order in one buffer and send
+    // views into it
+    size_t total_size = 0;
     for (const auto &dg : datagrams) {
-      // Swap to network byte order for firmware
-      auto data = dg.data();
-      for (auto &val : data) {
-        val = htonl(val);
-      }
-      ct++;
-      LOG(plog::verbose) << ipAddr << " sending datagram " << ct << " of "
-                          << datagrams.size() << " with command word "
-                          << hexn<8> << dg.cmd.packed << " to address "
-                          << hexn<8> << dg.addr << " with payload size "
-                          << std::dec << dg.payload.size() << " for total size "
-                          << data.size();
-
-      std::future<size_t> write_result = asio::async_write(
-          *tcp_sockets_[ipAddr], asio::buffer(data), asio::use_future);
-
-      // Make sure the write was successful
-      if (write_result.wait_for(COMMS_TIMEOUT) == std::future_status::timeout) {
-        LOG(plog::error) << ipAddr << " write timed out";
-        throw APS2_COMMS_ERROR;
-      }
-      try {
-        size_t bytes_written = write_result.get();
-        LOG(plog::verbose) << ipAddr << " wrote " << bytes_written
-                            << " bytes for datagram " << ct << " of "
-                            << datagrams.size();
-      } catch (std::system_error e) {
-        LOG(plog::error) << ipAddr
-                           << " write errored with message: " << e.what();
-        throw APS2_COMMS_ERROR;
-      }
-
-      // if necessary, check the ack
-      if (dg.cmd.ack) {
-        auto ack = read(ipAddr, COMMS_TIMEOUT);
-        dg.check_ack(ack, false);
+      total_size += dg.payload.size();
+    }
+    vector<uint32_t> network_data;
+    network_data.reserve(total_size);
+    vector<APS2DatagramView> views;
+    views.reserve(datagrams.size());
+    for (const auto &dg : datagrams) {
+      size_t offset = network_data.size();
+      for (auto val : dg.payload) {
+        network_data.push_back(htonl(val));
       }
+      views.emplace_back(dg.cmd, dg.addr, network_data.data() + offset,
+                         dg.payload.size());
     }
-
+    send_tcp(ipAddr, views);
   } else {
     LOG(plog::debug) << "Sending " << datagrams.size() << " datagram"
                         << (datagrams.size() > 1 ? "s" : "") << " over UDP";
@@ -474,16 +775,144 @@ void APS2Ethernet::send(string ipAddr, const vector<APS2Datagram> &datagrams) {
         send(ipAddr, packets[0], false);
       } else {
         ack_every = packets.size() >= 20 ? 20 : packets.size();
-        send(ipAddr, packets, ack_every);
+        send(ipAddr, std::move(packets), ack_every);
       }
     }
   }
 }
 
+void APS2Ethernet::send(string ipAddr,
+                        const vector<APS2DatagramView> &datagrams) {
+  LOG(plog::debug) << "APS2Ethernet::send";
+  if (get_dev_info(ipAddr).supports_tcp) {
+    send_tcp(ipAddr, datagrams);
+  } else {
+    // UDP packets are serialized with their own headers so fall back to
+    // copies
+    vector<APS2Datagram> dgs;
+    dgs.reserve(datagrams.size());
+    for (const auto &dg : datagrams) {
+      dgs.push_back(dg.to_datagram());
+    }
+    send(ipAddr, dgs);
+  }
+}
+
+void APS2Ethernet::send_tcp(const string &ipAddr,
+                            const vector<APS2DatagramView> &datagrams) {
+  LOG(plog::debug) << "Sending " << datagrams.size() << " datagram"
+                      << (datagrams.size() > 1 ? "s" : "") << " over TCP";
+
+  // Keep up to ackWindow_ acknowledged datagrams in flight. The APS2 acks
+  // datagrams in the order it receives them so match acks against the
+  // oldest unacknowledged datagram.
+  size_t window = std::max(get_ack_window(), static_cast<size_t>(1));
+  // resolve the socket, strand and metrics once rather than per datagram
+  auto connection = get_tcp_connection(ipAddr);
+  tcp::socket &sock = *connection.socket;
+  auto &strand = *connection.strand;
+  auto &metrics = connection.metrics;
+  BlockedTimer blocked(metrics->sendBlockedNs);
+  auto trace = get_trace();
+  uint32_t traceAddr = trace ? trace_address(ipAddr) : 0;
+  std::deque<size_t> unacked;
+  std::deque<std::chrono::steady_clock::time_point> sendTimes;
+  auto check_oldest_ack = [&]() {
+    const APS2DatagramView &dg = datagrams[unacked.front()];
+    // a failed read leaves the stream somewhere unknown
+    bool streamLost = true;
+    try {
+      auto ack = read(ipAddr, COMMS_TIMEOUT);
+      streamLost = false;
+      metrics->ackLatency.record(std::chrono::steady_clock::now() -
+                                 sendTimes.front());
+      APS2Datagram{dg.cmd, dg.addr, {}}.check_ack(ack, false);
+    } catch (APS2_STATUS status) {
+      LOG(plog::error) << ipAddr << " acknowledge failed for datagram "
+                         << unacked.front() + 1 << " of "
+                         << datagrams.size() << " with command word "
+                         << hexn<8> << dg.cmd.packed << " to address "
+                         << hexn<8> << dg.addr << std::dec << " with "
+                         << unacked.size() - 1
+                         << " more datagrams awaiting acknowledge";
+      // leave the stream ready for the next exchange
+      if (streamLost) {
+        reconnect_tcp(ipAddr);
+      } else {
+        drain_responses(ipAddr, unacked.size() - 1);
+      }
+      throw;
+    }
+    unacked.pop_front();
+    sendTimes.pop_front();
+  };
+
+  size_t ct = 0;
+  for (const auto &dg : datagrams) {
+    ct++;
+    LOG(plog::verbose) << ipAddr << " sending datagram " << ct << " of "
+                        << datagrams.size() << " with command word "
+                        << hexn<8> << dg.cmd.packed << " to address "
+                        << hexn<8> << dg.addr << " with payload size "
+                        << std::dec << dg.payload_size;
+
+    // Gather the header and payload straight from the caller's buffers
+    std::array<asio::const_buffer, 2> buffers = {
+        {asio::buffer(dg.header),
+         asio::buffer(dg.payload, 4 * dg.payload_size)}};
+    std::future<size_t> write_result;
+    auto sendTime = std::chrono::steady_clock::now();
+    asio::async_write(sock, buffers, strand_completion(strand, write_result));
+
+    // Make sure the write was successful
+    if (write_result.wait_for(COMMS_TIMEOUT) == std::future_status::timeout) {
+      LOG(plog::error) << ipAddr << " write timed out";
+      APS2Metrics::add(metrics->timeouts, 1);
+      // the datagram may be half sent
+      reconnect_tcp(ipAddr);
+      throw APS2_COMMS_ERROR;
+    }
+    try {
+      size_t bytes_written = write_result.get();
+      LOG(plog::verbose) << ipAddr << " wrote " << bytes_written
+                          << " bytes for datagram " << ct << " of "
+                          << datagrams.size();
+      APS2Metrics::add(metrics->bytesSent, bytes_written);
+      APS2Metrics::add(metrics->datagramsSent, 1);
+      if (trace) {
+        trace->record(traceAddr, APS2TraceDirection::SENT,
+                      APS2TraceTransport::TCP, dg.cmd, dg.addr, dg.payload,
+                      dg.payload_size, true);
+      }
+    } catch (std::system_error e) {
+      LOG(plog::error) << ipAddr
+                         << " write errored with message: " << e.what();
+      reconnect_tcp(ipAddr);
+      throw APS2_COMMS_ERROR;
+    }
+
+    // if necessary, queue up the ack check and block once the window is full
+    if (dg.cmd.ack) {
+      unacked.push_back(ct - 1);
+      sendTimes.push_back(sendTime);
+      if (unacked.size() >= window) {
+        check_oldest_ack();
+      }
+    }
+  }
+
+  // drain the remaining acks
+  while (!unacked.empty()) {
+    check_oldest_ack();
+  }
+}
+
 int APS2Ethernet::send(string serial, APS2EthernetPacket msg,
                        bool checkResponse) {
-  msg.header.dest = devInfo_[serial].macAddr;
-  send_chunk(serial, vector<APS2EthernetPacket>(1, msg), !checkResponse);
+  msg.header.dest = get_dev_info(serial).macAddr;
+  vector<APS2EthernetPacket> chunk(1, msg);
+  send_chunk(serial, chunk.begin(), chunk.end(), !checkResponse,
+             *get_udp_connection(serial).metrics);
   return 0;
 }
 
@@ -501,33 +930,32 @@ int APS2Ethernet::send(string serial, vector<APS2EthernetPacket> msg,
   bool verbose = (msg[0].header.command.cmd ==
                   static_cast<uint32_t>(APS_COMMANDS::EPROMIO));
 
-  vector<APS2EthernetPacket> buffer(ackEvery);
+  // insert the target MAC address - not really necessary anymore because
+  // UDP does filtering
+  MACAddr destMAC = get_dev_info(serial).macAddr;
+  auto metrics = get_udp_connection(serial).metrics;
 
   while (iter != msg.end()) {
 
-    // Copy the next chunk into a buffer
+    // Work on the next chunk in place; msg is already our own copy
     auto endPoint = iter + ackEvery;
     if (endPoint > msg.end()) {
       endPoint = msg.end();
     }
     auto chunkSize = std::distance(iter, endPoint);
-    buffer.resize(chunkSize);
-    std::copy(iter, endPoint, buffer.begin());
 
-    for (auto &packet : buffer) {
-      // insert the target MAC address - not really necessary anymore because
-      // UDP does filtering
-      packet.header.dest = devInfo_[serial].macAddr;
+    for (auto packet = iter; packet != endPoint; ++packet) {
+      packet->header.dest = destMAC;
       // NOACK sets the top bit of the command nibble of the command word
-      packet.header.command.cmd |= (1 << 3);
+      packet->header.command.cmd |= (1 << 3);
     }
 
     // Apply acknowledge flag to last element of chunk
     if (!noACK) {
-      buffer.back().header.command.cmd &= ~(1 << 3);
+      (endPoint - 1)->header.command.cmd &= ~(1 << 3);
     }
 
-    send_chunk(serial, buffer, noACK);
+    send_chunk(serial, iter, endPoint, noACK, *metrics);
     std::advance(iter, chunkSize);
 
     if (verbose && (std::distance(msg.begin(), iter) % 1000 == 0)) {
@@ -539,53 +967,187 @@ int APS2Ethernet::send(string serial, vector<APS2EthernetPacket> msg,
   return 0;
 }
 
-void APS2Ethernet::send_chunk(string serial, vector<APS2EthernetPacket> chunk,
-                              bool noACK) {
+void APS2Ethernet::send_chunk(const string &serial,
+                              vector<APS2EthernetPacket>::iterator first,
+                              vector<APS2EthernetPacket>::iterator last,
+                              bool noACK, APS2Metrics &metrics) {
   LOG(plog::debug) << "APS2Ethernet::send_chunk";
+  BlockedTimer blocked(metrics.sendBlockedNs);
+
+  // Serialize the whole chunk back to back into one buffer that is reused
+  // from call to call so a chunk costs no allocations
+  thread_local vector<uint8_t> txBuffer;
+  thread_local vector<size_t> packetSizes;
+  size_t totalBytes = 0;
+  for (auto packet = first; packet != last; ++packet) {
+    totalBytes += packet->numBytes();
+  }
+  if (txBuffer.size() < totalBytes) {
+    txBuffer.resize(totalBytes);
+  }
+  packetSizes.clear();
 
-  unsigned seqNum{0};
-
-  seqNum = 0;
-  for (auto packet : chunk) {
-    packet.header.seqNum = seqNum;
-    seqNum++;
+  uint16_t seqNum = 0;
+  uint8_t *insertPt = txBuffer.data();
+  for (auto packet = first; packet != last; ++packet) {
+    packet->header.seqNum = seqNum++;
     LOG(plog::verbose) << "Packet command: "
-                        << packet.header.command.to_string();
-    udp_socket_old_.send_to(asio::buffer(packet.serialize()),
-                            devInfo_[serial].endpoint);
-    // sleep to make the driver compatible with newer versions of Windows
-    // std::this_thread::sleep_for(std::chrono::microseconds(100));
+                        << packet->header.command.to_string();
+    packetSizes.push_back(packet->serialize_into(insertPt));
+    insertPt += packetSizes.back();
+  }
+
+  auto sendTime = std::chrono::steady_clock::now();
+  send_udp_batch(get_dev_info(serial).endpoint, txBuffer.data(), packetSizes,
+                 metrics);
+  APS2Metrics::add(metrics.bytesSent, totalBytes);
+  APS2Metrics::add(metrics.datagramsSent, packetSizes.size());
+  auto trace = get_trace();
+  if (trace) {
+    uint32_t traceAddr = trace_address(serial);
+    for (auto packet = first; packet != last; ++packet) {
+      APS2Command cmd;
+      cmd.packed = packet->header.command.packed;
+      trace->record(traceAddr, APS2TraceDirection::SENT,
+                    APS2TraceTransport::UDP, cmd, packet->header.addr,
+                    packet->payload.data(), packet->payload.size());
+    }
   }
 
+  auto &lastPacket = *(last - 1);
   if (noACK)
     return;
 
   // Wait for acknowledge from final packet in chunk and error check
   auto ack = read(serial, COMMS_TIMEOUT);
+  metrics.ackLatency.record(std::chrono::steady_clock::now() - sendTime);
   APS2Datagram dg;
-  dg.cmd.packed = chunk.back().header.command.packed;
-  dg.addr = chunk.back().header.addr;
+  dg.cmd.packed = lastPacket.header.command.packed;
+  dg.addr = lastPacket.header.addr;
   dg.check_ack(ack, true);
 }
 
+void APS2Ethernet::send_udp_batch(const udp::endpoint &endpoint,
+                                  const uint8_t *data,
+                                  const vector<size_t> &packetSizes,
+                                  APS2Metrics &metrics) {
+#ifdef __linux__
+  // Hand the whole batch to the kernel in as few syscalls as possible
+  thread_local vector<mmsghdr> msgs;
+  thread_local vector<iovec> iovs;
+  size_t numPackets = packetSizes.size();
+  msgs.resize(numPackets);
+  iovs.resize(numPackets);
+  for (size_t ct = 0; ct < numPackets; ct++) {
+    iovs[ct].iov_base = const_cast<uint8_t *>(data);
+    iovs[ct].iov_len = packetSizes[ct];
+    data += packetSizes[ct];
+    std::memset(&msgs[ct], 0, sizeof(mmsghdr));
+    msgs[ct].msg_hdr.msg_name =
+        const_cast<void *>(static_cast<const void *>(endpoint.data()));
+    msgs[ct].msg_hdr.msg_namelen = endpoint.size();
+    msgs[ct].msg_hdr.msg_iov = &iovs[ct];
+    msgs[ct].msg_hdr.msg_iovlen = 1;
+  }
+
+  // asio leaves the socket non-blocking for the receiver so wait for room in
+  // the send buffer when it fills, but no longer than any other exchange
+  int fd = udp_socket_old_.native_handle();
+  size_t sent = 0;
+  while (sent < numPackets) {
+    int result = sendmmsg(fd, msgs.data() + sent, numPackets - sent, 0);
+    if (result < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        auto deadline = std::chrono::steady_clock::now() + COMMS_TIMEOUT;
+        int ready;
+        do {
+          auto remaining =
+              std::chrono::duration_cast<std::chrono::milliseconds>(
+                  deadline - std::chrono::steady_clock::now());
+          pollfd pfd = {fd, POLLOUT, 0};
+          ready = poll(&pfd, 1,
+                       static_cast<int>(std::max<std::chrono::milliseconds::rep>(
+                           remaining.count(), 0)));
+        } while (ready < 0 && errno == EINTR);
+        if (ready == 0) {
+          LOG(plog::error) << endpoint.address().to_string()
+                           << " UDP send buffer stayed full; send timed out";
+          APS2Metrics::add(metrics.timeouts, 1);
+          throw APS2_COMMS_ERROR;
+        }
+        if (ready < 0) {
+          LOG(plog::error) << "UDP send wait failed with error: "
+                           << strerror(errno);
+          throw APS2_COMMS_ERROR;
+        }
+        continue;
+      }
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG(plog::error) << "UDP send failed with error: " << strerror(errno);
+      throw APS2_COMMS_ERROR;
+    }
+    sent += result;
+  }
+  LOG(plog::verbose) << "Sent " << numPackets << " packets in one batch";
+#else
+  for (auto packetSize : packetSizes) {
+    udp_socket_old_.send_to(asio::buffer(data, packetSize), endpoint);
+    data += packetSize;
+    // sleep to make the driver compatible with newer versions of Windows
+    // std::this_thread::sleep_for(std::chrono::microseconds(100));
+  }
+#endif
+}
+
 APS2Datagram APS2Ethernet::read(string ipAddr,
                                 std::chrono::milliseconds timeout) {
   LOG(plog::debug) << "APS2Ethernet::read";
-  if (devInfo_[ipAddr].supports_tcp) {
+  bool supports_tcp = get_dev_info(ipAddr).supports_tcp;
+  TCPConnection tcpConnection;
+  UDPConnection udpConnection;
+  if (supports_tcp) {
+    tcpConnection = get_tcp_connection(ipAddr);
+  } else {
+    udpConnection = get_udp_connection(ipAddr);
+  }
+  auto &metrics = supports_tcp ? tcpConnection.metrics : udpConnection.metrics;
+  BlockedTimer blocked(metrics->readBlockedNs);
+  if (supports_tcp) {
     // Read datagram from socket
     vector<uint32_t> buf;
+    tcp::socket &sock = *tcpConnection.socket;
+    auto &strand = *tcpConnection.strand;
 
+    // Large responses can arrive over several segments so wait for the whole
+    // buffer rather than whatever the first receive returns
     auto read_with_timeout = [&]() {
-      std::future<size_t> read_result = tcp_sockets_[ipAddr]->async_receive(
-          asio::buffer(buf), asio::use_future);
-      if (read_result.wait_for(timeout) == std::future_status::timeout) {
-        LOG(plog::error) << "TCP receive timed out!";
-        throw APS2_RECEIVE_TIMEOUT;
+      std::future<size_t> read_result;
+      asio::async_read(sock, asio::buffer(buf),
+                       strand_completion(strand, read_result));
+      bool timedOut =
+          read_result.wait_for(timeout) == std::future_status::timeout;
+      if (timedOut) {
+        // The read fills buf so it must be over before buf goes or another
+        // read starts. Cancel it on the strand it completes on and wait; it
+        // may still have finished first.
+        strand.post([&sock]() {
+          asio::error_code ec;
+          sock.cancel(ec);
+        });
+        read_result.wait();
       }
       try {
         size_t bytes_read = read_result.get();
         LOG(plog::verbose) << ipAddr << " read " << bytes_read << " bytes from stream";
+        APS2Metrics::add(metrics->bytesReceived, bytes_read);
       } catch (std::system_error e) {
+        if (timedOut) {
+          LOG(plog::error) << "TCP receive timed out!";
+          APS2Metrics::add(metrics->timeouts, 1);
+          throw APS2_RECEIVE_TIMEOUT;
+        }
         LOG(plog::error) << ipAddr
                            << " read errored with message: " << e.what();
         throw APS2_COMMS_ERROR;
@@ -626,54 +1188,140 @@ APS2Datagram APS2Ethernet::read(string ipAddr,
     LOG(plog::verbose) << "Read APS2Datagram " << hexn<8> << cmd.packed << " "
                         << hexn<8> << addr << " and payload length " << std::dec
                         << buf.size();
+    APS2Metrics::add(metrics->datagramsReceived, 1);
+    metrics->readLatency.record(blocked.elapsed());
+    auto trace = get_trace();
+    if (trace) {
+      trace->record(trace_address(ipAddr), APS2TraceDirection::RECEIVED,
+                    APS2TraceTransport::TCP, cmd, addr, buf.data(),
+                    buf.size());
+    }
     return {cmd, addr, buf};
 
   } else {
     // The packets should already be in the queue
-    auto pkt = receive(ipAddr, 1, timeout.count()).front();
+    vector<APS2EthernetPacket> packets;
+    try {
+      packets = receive(ipAddr, udpConnection.rxQueue, 1, timeout.count());
+    } catch (APS2_STATUS status) {
+      if (status == APS2_RECEIVE_TIMEOUT) {
+        APS2Metrics::add(metrics->timeouts, 1);
+      }
+      throw;
+    }
+    auto &pkt = packets.front();
+    APS2Metrics::add(metrics->bytesReceived, pkt.numBytes());
+    APS2Metrics::add(metrics->datagramsReceived, 1);
+    metrics->readLatency.record(blocked.elapsed());
     // strip off the ethernet header
     APS2Command cmd;
     cmd.packed = pkt.header.command.packed;
+    auto trace = get_trace();
+    if (trace) {
+      trace->record(trace_address(ipAddr), APS2TraceDirection::RECEIVED,
+                    APS2TraceTransport::UDP, cmd, pkt.header.addr,
+                    pkt.payload.data(), pkt.payload.size());
+    }
     LOG(plog::verbose) << "Read APS2Datagram " << hexn<8> << cmd.packed << " "
                         << hexn<8> << pkt.header.addr << " and payload length "
                         << std::dec << pkt.payload.size();
-    return {cmd, pkt.header.addr, pkt.payload};
+    return {cmd, pkt.header.addr, std::move(pkt.payload)};
+  }
+}
+
+void APS2Ethernet::recycle(const string &ipAddr, vector<uint32_t> &&payload) {
+  std::shared_ptr<APS2RxQueue> rxQueue;
+  {
+    std::lock_guard<std::mutex> lock(connections_lock_);
+    auto connection = udp_connections_.find(ipAddr);
+    if (connection == udp_connections_.end()) {
+      return;
+    }
+    rxQueue = connection->second.rxQueue;
+  }
+  rxQueue->recycle(std::move(payload));
+}
+
+void APS2Ethernet::set_ack_window(size_t window) {
+  LOG(plog::debug) << "Setting TCP acknowledge window to " << window;
+  ackWindow_ = window;
+}
+
+size_t APS2Ethernet::get_ack_window() const { return ackWindow_; }
+
+size_t APS2Ethernet::get_io_threads() const { return ioThreads_.size(); }
+
+void APS2Ethernet::start_trace(const string &filename) {
+  LOG(plog::info) << "Recording APS2 traffic to " << filename;
+  auto trace = std::make_shared<APS2TraceWriter>(filename);
+  std::lock_guard<std::mutex> lock(trace_lock_);
+  std::atomic_store(&trace_, trace);
+  tracing_ = true;
+}
+
+void APS2Ethernet::stop_trace() {
+  std::shared_ptr<APS2TraceWriter> trace;
+  {
+    std::lock_guard<std::mutex> lock(trace_lock_);
+    tracing_ = false;
+    trace = std::atomic_exchange(&trace_, trace);
+  }
+  // the writer flushes once senders still holding it are done
+  if (trace) {
+    LOG(plog::info) << "Stopped recording APS2 traffic";
   }
 }
 
+std::shared_ptr<APS2TraceWriter> APS2Ethernet::get_trace() {
+  if (!tracing_.load(std::memory_order_relaxed)) {
+    return nullptr;
+  }
+  return std::atomic_load(&trace_);
+}
+
+std::shared_ptr<APS2Metrics> APS2Ethernet::get_metrics(const string &ipAddr) {
+  std::lock_guard<std::mutex> lock(metrics_lock_);
+  auto &metrics = metrics_[ipAddr];
+  if (!metrics) {
+    metrics = std::make_shared<APS2Metrics>();
+  }
+  return metrics;
+}
+
 vector<APS2EthernetPacket>
 APS2Ethernet::receive(string serial, size_t numPackets, size_t timeoutMS) {
   // Read the packets coming back in up to the timeout
   // Defaults: receive(string serial, size_t numPackets = 1, size_t timeoutMS =
   // 1000);
   LOG(plog::debug) << "APS2Ethernet::receive";
-  std::chrono::time_point<std::chrono::steady_clock> start, end;
+  return receive(serial, get_udp_connection(serial).rxQueue, numPackets,
+                 timeoutMS);
+}
 
-  start = std::chrono::steady_clock::now();
-  size_t elapsedTime = 0;
+vector<APS2EthernetPacket>
+APS2Ethernet::receive(const string &serial,
+                      const std::shared_ptr<APS2RxQueue> &rxQueue,
+                      size_t numPackets, size_t timeoutMS) {
+  if (!rxQueue) {
+    LOG(plog::error) << serial << " has no receive queue; is it connected?";
+    throw APS2_RECEIVE_TIMEOUT;
+  }
+  auto deadline =
+      std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMS);
 
+  // Each packet is parsed in place, into a payload buffer recycled from an
+  // earlier read where there is one
   vector<APS2EthernetPacket> outVec;
-
-  while (elapsedTime < timeoutMS) {
-    if (!msgQueues_[serial].empty()) {
-      msgQueue_lock_.lock();
-      outVec.push_back(msgQueues_[serial].front());
-      msgQueues_[serial].pop();
-      msgQueue_lock_.unlock();
-      LOG(plog::verbose) << "Received packet command: "
-                          << outVec.back().header.command.to_string();
-      if (outVec.size() == numPackets) {
-        LOG(plog::verbose) << "Received " << numPackets << " packets from "
-                            << serial;
-        return outVec;
-      }
+  outVec.reserve(numPackets);
+  while (outVec.size() < numPackets) {
+    outVec.emplace_back();
+    if (!rxQueue->pop(outVec.back(), deadline)) {
+      throw APS2_RECEIVE_TIMEOUT;
     }
-    std::this_thread::sleep_for(std::chrono::milliseconds(10));
-    end = std::chrono::steady_clock::now();
-    elapsedTime =
-        std::chrono::duration_cast<std::chrono::milliseconds>(end - start)
-            .count();
+    LOG(plog::verbose) << "Received packet command: "
+                        << outVec.back().header.command.to_string();
   }
-
-  throw APS2_RECEIVE_TIMEOUT;
+  LOG(plog::verbose) << "Received " << numPackets << " packets from "
+                      << serial;
+  return outVec;
 }
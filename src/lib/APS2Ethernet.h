@@ -6,13 +6,18 @@
 #ifndef APS2ETHERNET_H
 #define APS2ETHERNET_H
 
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
 #include <future>
 #include <memory>
 #include <unordered_map>
 using std::unordered_map;
 #include <queue>
 using std::queue;
+#include <thread>
 
 #include "asio.hpp"
 #include <asio/use_future.hpp>
@@ -21,8 +26,12 @@ using asio::ip::tcp;
 
 #include "APS2Datagram.h"
 #include "APS2EthernetPacket.h"
+#include "APS2Metrics.h"
+#include "APS2RxQueue.h"
+#include "APS2Trace.h"
 #include "APS2_errno.h"
 #include "MACAddr.h"
+#include "constants.h"
 
 struct EthernetDevInfo {
   MACAddr macAddr;
@@ -36,21 +45,66 @@ public:
   APS2Ethernet &operator=(APS2Ethernet &rhs) { return rhs; };
 
   APS2Ethernet();
+  // numIoThreads sets the size of the pool servicing socket completions;
+  // completions for each device stay ordered on a per-device strand
+  APS2Ethernet(uint16_t udpPortOld, uint16_t udpPort,
+               size_t numIoThreads = DEFAULT_IO_THREADS);
   ~APS2Ethernet();
   void init();
+
+  // Called on the enumerating thread with the IP address of each newly
+  // discovered device once its transport is known; it may call back into the
+  // driver, e.g. to connect to the device
+  typedef std::function<void(const string &)> DiscoveryCallback;
+
   set<string> enumerate();
+  // Return as soon as every expected device, or the expected number of
+  // devices, has answered rather than always waiting the full timeout.
+  // Expected devices are also asked directly in case they are off subnet.
+  set<string> enumerate(const set<string> &expected,
+                        std::chrono::milliseconds maxWait,
+                        DiscoveryCallback = nullptr);
+  set<string> enumerate(size_t expectedCount, std::chrono::milliseconds maxWait,
+                        DiscoveryCallback = nullptr);
   void connect(string serial);
   void disconnect(string serial);
   void reset_tcp(const string &);
+  // After a failed exchange read and drop the numPending responses still on
+  // their way so the next read gets its own; reconnects if they do not all
+  // arrive
+  void drain_responses(const string &, size_t numPending);
+  // Replace a TCP connection whose stream is no longer in step with what was
+  // sent
+  void reconnect_tcp(const string &);
   void send(string, const vector<APS2Datagram> &);
+  void send(string, const vector<APS2DatagramView> &);
   int send(string serial, APS2EthernetPacket msg, bool checkResponse = true);
   int send(string serial, vector<APS2EthernetPacket> msg,
            unsigned ackEvery = 1);
 
   APS2Datagram read(string, std::chrono::milliseconds);
+  // Hand back the payload of a read once done with it; legacy UDP devices
+  // parse later responses into it rather than allocating
+  void recycle(const string &, vector<uint32_t> &&payload);
   vector<APS2EthernetPacket> receive(string serial, size_t numPackets = 1,
                                      size_t timeoutMS = 2000);
 
+  // Maximum number of acknowledged TCP datagrams in flight before blocking on
+  // the oldest acknowledge
+  void set_ack_window(size_t);
+  size_t get_ack_window() const;
+
+  size_t get_io_threads() const;
+
+  // Transport counters for a device; these are kept across reconnects until
+  // reset
+  std::shared_ptr<APS2Metrics> get_metrics(const string &);
+
+  // Record every datagram and packet to and from all devices to a trace file
+  // until stopped; starting a new trace ends the previous one
+  void start_trace(const string &filename);
+  void stop_trace();
+
 private:
   APS2Ethernet(APS2Ethernet const &) = delete;
 
@@ -60,31 +114,95 @@ private:
   // structs
   unordered_map<string, EthernetDevInfo> devInfo_;
 
-  unordered_map<string, queue<APS2EthernetPacket>> msgQueues_;
+  // What transfers to a connected device use, resolved once when it connects
+  // so sends and reads take one lookup rather than one per table
+  struct TCPConnection {
+    std::shared_ptr<tcp::socket> socket;
+    std::shared_ptr<asio::io_service::strand> strand;
+    std::shared_ptr<APS2Metrics> metrics;
+  };
+  struct UDPConnection {
+    std::shared_ptr<APS2RxQueue> rxQueue;
+    std::shared_ptr<APS2Metrics> metrics;
+  };
+
+  // Connected legacy UDP devices. udp_connections_ is used from the caller's
+  // side; rxQueuesByAddr_ holds the same receive queues resolved to IPv4
+  // addresses and is only touched on udpStrand_
+  unordered_map<string, UDPConnection> udp_connections_;
+  // guards the connection maps so devices can connect in parallel
+  std::mutex connections_lock_;
+  vector<std::pair<uint32_t, std::shared_ptr<APS2RxQueue>>> rxQueuesByAddr_;
+  unordered_map<string, std::shared_ptr<APS2Metrics>> metrics_;
+  std::mutex metrics_lock_;
+  void register_rx_queue(const string &, std::shared_ptr<APS2RxQueue>);
 
   vector<std::pair<string, string>> get_local_IPs();
   void reset_maps();
+  void send_enumerate_request(const asio::ip::address_v4 &);
+  EthernetDevInfo get_dev_info(const string &);
+  TCPConnection get_tcp_connection(const string &);
+  // A device not connected gets no receive queue but still its metrics
+  UDPConnection get_udp_connection(const string &);
+  // settled only asks after the devices complete waits for, so a stray
+  // legacy board on the subnet does not hold up the return
+  set<string> enumerate_until(std::function<bool()> complete,
+                              std::function<bool()> settled,
+                              std::chrono::milliseconds maxWait,
+                              DiscoveryCallback,
+                              const set<string> &unicastTargets);
+  // Wait for complete, then until settled holds or the deadline passes
+  bool wait_for_devices(std::unique_lock<std::mutex> &,
+                        std::function<bool()> complete,
+                        std::function<bool()> settled,
+                        std::chrono::steady_clock::time_point deadline);
 
   // ASIO service and sockets
   asio::io_service ios_;
   udp::socket udp_socket_old_;
   udp::socket udp_socket_;
-  unordered_map<string, std::shared_ptr<tcp::socket>> tcp_sockets_;
+  // Completions for each TCP device run in order on its connection's strand
+  // while different devices complete in parallel on the io thread pool. The
+  // UDP receivers share one strand since they feed the same sorter.
+  unordered_map<string, TCPConnection> tcp_connections_;
+  asio::io_service::strand udpStrand_;
+
+  // storage for a burst of received UDP packets and their senders so each
+  // wakeup can drain everything waiting on the socket
+  struct UDPReceiveBatch {
+    static const size_t SIZE = 16;
+    uint8_t data[SIZE][2048];
+    udp::endpoint senders[SIZE];
+  };
+  UDPReceiveBatch rxBatchOld_;
+  UDPReceiveBatch rxBatch_;
+
+  void setup_udp_receive(udp::socket &, UDPReceiveBatch &);
+  void drain_udp(udp::socket &, UDPReceiveBatch &);
+  void sort_packet(const uint8_t *, size_t, const udp::endpoint &);
+  void send_chunk(const string &, vector<APS2EthernetPacket>::iterator,
+                  vector<APS2EthernetPacket>::iterator, bool, APS2Metrics &);
+  vector<APS2EthernetPacket> receive(const string &,
+                                     const std::shared_ptr<APS2RxQueue> &,
+                                     size_t numPackets, size_t timeoutMS);
+  void send_udp_batch(const udp::endpoint &, const uint8_t *,
+                      const vector<size_t> &, APS2Metrics &);
+  void tcp_connect(string, std::shared_ptr<tcp::socket>);
+  std::shared_ptr<tcp::socket> open_tcp(const string &);
+  void send_tcp(const string &, const vector<APS2DatagramView> &);
 
-  // storage for received UDP packets and remote endpoints
-  uint8_t received_udp_data_old_[2048];
-  uint8_t received_udp_data_[2048];
-  udp::endpoint remote_udp_endpoint_old_;
-  udp::endpoint remote_udp_endpoint_;
+  std::atomic<size_t> ackWindow_;
 
-  void setup_udp_receive(udp::socket &, uint8_t *, udp::endpoint &);
-  void sort_packet(const vector<uint8_t> &, const udp::endpoint &);
-  void send_chunk(string, vector<APS2EthernetPacket>, bool);
-  void tcp_connect(string, std::shared_ptr<tcp::socket>);
+  // tracing_ keeps the check cheap when no trace is being recorded
+  std::atomic<bool> tracing_;
+  std::shared_ptr<APS2TraceWriter> trace_;
+  std::mutex trace_lock_;
+  std::shared_ptr<APS2TraceWriter> get_trace();
 
-  std::thread receiveThread_;
-  std::mutex msgQueue_lock_;
+  vector<std::thread> ioThreads_;
+  // guards devInfo_; signalled on every enumerate response
   std::mutex sorter_lock_;
+  std::condition_variable devInfo_cv_;
 };
 
 #endif
@@ -25,23 +25,30 @@ APS2EthernetPacket::APS2EthernetPacket(const MACAddr &destMAC,
     : header{destMAC, srcMAC, APS_PROTO, 0, command, addr}, payload(0){};
 
 APS2EthernetPacket::APS2EthernetPacket(const vector<uint8_t> &packetData) {
+  parse(packetData.data(), packetData.size());
+}
+
+APS2EthernetPacket::APS2EthernetPacket(const uint8_t *packetData,
+                                       size_t packetSize) {
+  parse(packetData, packetSize);
+}
+
+void APS2EthernetPacket::parse(const uint8_t *packetData, size_t packetSize) {
   /*
-  Create a packet from a byte array returned by pcap.
+  Fill in the packet from a received byte array.
   */
   // Helper function to turn two network bytes into a uint16_t or uint32_t
   // assuming big-endian network byte order
-  auto bytes2uint16 = [&packetData](size_t offset) -> uint16_t {
+  auto bytes2uint16 = [packetData](size_t offset) -> uint16_t {
     return (packetData[offset] << 8) + packetData[offset + 1];
   };
-  auto bytes2uint32 = [&packetData](size_t offset) -> uint32_t {
+  auto bytes2uint32 = [packetData](size_t offset) -> uint32_t {
     return (packetData[offset] << 24) + (packetData[offset + 1] << 16) +
            (packetData[offset + 2] << 8) + packetData[offset + 3];
   };
 
-  std::copy(packetData.begin(), packetData.begin() + 6,
-            header.dest.addr.begin());
-  std::copy(packetData.begin() + 6, packetData.begin() + 12,
-            header.src.addr.begin());
+  std::copy(packetData, packetData + 6, header.dest.addr.begin());
+  std::copy(packetData + 6, packetData + 12, header.src.addr.begin());
   header.frameType = bytes2uint16(12);
   header.seqNum = bytes2uint16(14);
   header.command.packed = bytes2uint32(16);
@@ -57,64 +64,69 @@ APS2EthernetPacket::APS2EthernetPacket(const vector<uint8_t> &packetData) {
     myOffset = 20;
   }
   payload.clear();
-  payload.reserve((packetData.size() - myOffset) / 4);
-  while (myOffset < packetData.size()) {
+  if (packetSize > myOffset) {
+    payload.reserve((packetSize - myOffset) / 4);
+  }
+  while (myOffset + 4 <= packetSize) {
     payload.push_back(bytes2uint32(myOffset));
     myOffset += 4;
   }
 }
 
 vector<uint8_t> APS2EthernetPacket::serialize() const {
+  vector<uint8_t> outVec(numBytes());
+  serialize_into(outVec.data());
+  return outVec;
+}
+
+size_t APS2EthernetPacket::serialize_into(uint8_t *outBuf) const {
   /*
-   * Serialize a packet to a vector of bytes for transmission.
+   * Serialize a packet to bytes for transmission.
    * Handle host to network byte ordering here
    */
-  vector<uint8_t> outVec;
-  outVec.resize(numBytes(), 0);
+  size_t packetSize = numBytes();
+  uint8_t *insertPt = outBuf;
 
   // Push on the destination and source mac address
-  auto insertPt = outVec.begin();
-  std::copy(header.dest.addr.begin(), header.dest.addr.end(), insertPt);
-  insertPt += 6;
-  std::copy(header.src.addr.begin(), header.src.addr.end(), insertPt);
-  insertPt += 6;
+  insertPt = std::copy(header.dest.addr.begin(), header.dest.addr.end(),
+                       insertPt);
+  insertPt = std::copy(header.src.addr.begin(), header.src.addr.end(),
+                       insertPt);
 
   // Push on ethernet protocol
   uint16_t myuint16;
   uint8_t *start;
   start = reinterpret_cast<uint8_t *>(&myuint16);
   myuint16 = htons(header.frameType);
-  std::copy(start, start + 2, insertPt);
-  insertPt += 2;
+  insertPt = std::copy(start, start + 2, insertPt);
 
   // Sequence number
   myuint16 = htons(header.seqNum);
-  std::copy(start, start + 2, insertPt);
-  insertPt += 2;
+  insertPt = std::copy(start, start + 2, insertPt);
 
   // Command
   // TODO: command count field
   uint32_t myuint32;
   start = reinterpret_cast<uint8_t *>(&myuint32);
   myuint32 = htonl(header.command.packed);
-  std::copy(start, start + 4, insertPt);
-  insertPt += 4;
+  insertPt = std::copy(start, start + 4, insertPt);
 
   // Address
   if (needs_address(APS_COMMANDS(header.command.cmd))) {
     myuint32 = htonl(header.addr);
-    std::copy(start, start + 4, insertPt);
-    insertPt += 4;
+    insertPt = std::copy(start, start + 4, insertPt);
   }
 
   // Data
   for (auto word : payload) {
     myuint32 = htonl(word);
-    std::copy(start, start + 4, insertPt);
-    insertPt += 4;
+    insertPt = std::copy(start, start + 4, insertPt);
   }
 
-  return outVec;
+  // Zero pad short packets up to the minimum frame size
+  std::fill(insertPt, outBuf + packetSize, 0);
+
+  return packetSize;
 }
 
 size_t APS2EthernetPacket::numBytes() const {
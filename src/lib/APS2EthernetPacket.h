@@ -26,10 +26,17 @@ public:
                      const uint32_t &);
 
   APS2EthernetPacket(const vector<uint8_t> &);
+  APS2EthernetPacket(const uint8_t *, size_t);
+
+  // Parse received bytes in place, reusing the payload's storage
+  void parse(const uint8_t *, size_t);
 
   static const size_t NUM_HEADER_BYTES = 24;
 
   vector<uint8_t> serialize() const;
+  // Serialize into a caller provided buffer of at least numBytes() and return
+  // the number of bytes written
+  size_t serialize_into(uint8_t *) const;
   size_t numBytes() const;
 
   static APS2EthernetPacket create_broadcast_packet();
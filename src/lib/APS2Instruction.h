@@ -0,0 +1,168 @@
+// Encoders for the 64 bit APS2 sequencer instructions
+//
+// One constexpr function per op code of doc/instruction-set.rst builds the
+// instruction word from typed fields. Every field is checked against its width
+// by throwing APS2_INSTRUCTION_FIELD_OVERFLOW, which a constant expression
+// cannot do, so an instruction built into a constexpr value with a field too
+// wide fails to compile and costs nothing at run time. Built from run time
+// values the check costs a compare a field.
+//
+// Copyright 2016, Raytheon BBN Technologies
+
+#ifndef APS2INSTRUCTION_H
+#define APS2INSTRUCTION_H
+
+#include <cstdint>
+
+#include "APS2_errno.h"
+
+namespace APS2Instruction {
+
+enum class Opcode : uint64_t {
+  WAVEFORM = 0x0,
+  MARKER = 0x1,
+  WAIT = 0x2,
+  LOAD_REPEAT = 0x3,
+  REPEAT = 0x4,
+  CMP = 0x5,
+  GOTO = 0x6,
+  CALL = 0x7,
+  RETURN = 0x8,
+  SYNC = 0x9,
+  MODULATOR = 0xA,
+  LOAD_CMP = 0xB,
+  PREFETCH = 0xC
+};
+
+// Op codes of the waveform and marker engines in payload bits 47-46; markers
+// have no prefetch
+enum class EngineOp : uint64_t {
+  PLAY = 0x0,
+  WAIT_FOR_TRIG = 0x1,
+  WAIT_FOR_SYNC = 0x2,
+  PREFETCH = 0x3
+};
+
+enum class CmpOp : uint64_t {
+  EQUAL = 0x0,
+  NOT_EQUAL = 0x1,
+  GREATER_THAN = 0x2,
+  LESS_THAN = 0x3
+};
+
+enum class ModulatorOp : uint64_t {
+  MODULATE = 0x0,
+  RESET_PHASE = 0x1,
+  WAIT_FOR_TRIG = 0x2,
+  SET_FREQUENCY = 0x3,
+  WAIT_FOR_SYNC = 0x4,
+  SET_PHASE = 0x5,
+  UPDATE_FRAME = 0x7
+};
+
+// Waveform engine select bits
+const uint64_t CHANNEL_A = 0x1;
+const uint64_t CHANNEL_B = 0x2;
+const uint64_t BOTH_CHANNELS = CHANNEL_A | CHANNEL_B;
+
+// value placed at bit shift of a width bit field
+constexpr uint64_t field(uint64_t value, unsigned width, unsigned shift) {
+  return value < (uint64_t(1) << width)
+             ? value << shift
+             : throw APS2_INSTRUCTION_FIELD_OVERFLOW;
+}
+
+// Header in bits 63-56: op code, engine select and the write flag that sends
+// a group of WAVEFORM and MARKER instructions to their engines
+constexpr uint64_t header(Opcode op, uint64_t engine, bool write) {
+  return field(static_cast<uint64_t>(op), 4, 60) | field(engine, 2, 58) |
+         field(write, 1, 56);
+}
+
+// Play count quad-samples from the quad-sample address on the engines
+// selected, or hold the sample at address for count quad-samples as a
+// time/amplitude pair
+constexpr uint64_t waveform(uint64_t engines, uint64_t address, uint64_t count,
+                            bool write, bool timeAmplitude = false) {
+  return header(Opcode::WAVEFORM, engines, write) |
+         field(static_cast<uint64_t>(EngineOp::PLAY), 2, 46) |
+         field(timeAmplitude, 1, 45) | field(count, 21, 24) |
+         field(address, 24, 0);
+}
+
+// Fill the pending waveform cache bank of the engines selected from the
+// quad-sample address
+constexpr uint64_t waveform_prefetch(uint64_t engines, uint64_t address,
+                                     bool write) {
+  return header(Opcode::WAVEFORM, engines, write) |
+         field(static_cast<uint64_t>(EngineOp::PREFETCH), 2, 46) |
+         field(address, 24, 0);
+}
+
+// Hold marker channel in state for count quad-samples then output the four
+// sample transition word
+constexpr uint64_t marker(uint64_t channel, bool state, uint64_t count,
+                          bool write, uint64_t transition = 0) {
+  return header(Opcode::MARKER, channel, write) |
+         field(static_cast<uint64_t>(EngineOp::PLAY), 2, 46) |
+         field(transition, 4, 33) | field(state, 1, 32) |
+         field(count, 32, 0);
+}
+
+// Have the waveform and marker engines wait for a trigger
+constexpr uint64_t wait(bool write = true) {
+  return header(Opcode::WAIT, 0, write) |
+         field(static_cast<uint64_t>(EngineOp::WAIT_FOR_TRIG), 2, 46);
+}
+
+// Halt dispatch until the engines have run everything queued
+constexpr uint64_t sync(bool write = true) {
+  return header(Opcode::SYNC, 0, write) |
+         field(static_cast<uint64_t>(EngineOp::WAIT_FOR_SYNC), 2, 46);
+}
+
+// Run the following section count + 1 times
+constexpr uint64_t load_repeat(uint64_t count) {
+  return header(Opcode::LOAD_REPEAT, 0, false) | field(count, 16, 0);
+}
+
+constexpr uint64_t repeat(uint64_t address) {
+  return header(Opcode::REPEAT, 0, false) | field(address, 26, 0);
+}
+
+// Condition the next GOTO, CALL or RETURN on the comparison register
+constexpr uint64_t cmp(CmpOp op, uint64_t mask) {
+  return header(Opcode::CMP, 0, false) |
+         field(static_cast<uint64_t>(op), 2, 8) | field(mask, 8, 0);
+}
+
+constexpr uint64_t load_cmp() { return header(Opcode::LOAD_CMP, 0, false); }
+
+// goto and return are keywords
+constexpr uint64_t goto_(uint64_t address) {
+  return header(Opcode::GOTO, 0, false) | field(address, 26, 0);
+}
+
+constexpr uint64_t call(uint64_t address) {
+  return header(Opcode::CALL, 0, false) | field(address, 26, 0);
+}
+
+constexpr uint64_t return_() { return header(Opcode::RETURN, 0, false); }
+
+// Fill the subroutine cache with the 128 instructions from address
+constexpr uint64_t prefetch(uint64_t address) {
+  return header(Opcode::PREFETCH, 0, false) | field(address, 26, 0);
+}
+
+// Apply op to the NCOs with a bit set in ncoSelect; phases and frequencies
+// are UQ2.28 portions of a circle
+constexpr uint64_t modulator(ModulatorOp op, uint64_t ncoSelect,
+                             uint64_t payload = 0, bool write = true) {
+  return header(Opcode::MODULATOR, 0, write) |
+         field(static_cast<uint64_t>(op), 3, 45) | field(ncoSelect, 4, 40) |
+         field(payload, 32, 0);
+}
+
+} // namespace APS2Instruction
+
+#endif
@@ -0,0 +1,117 @@
+// Read-only memory map of a file such as a sequence file
+//
+// Copyright 2016, Raytheon BBN Technologies
+
+#include "APS2MappedFile.h"
+
+#include <algorithm>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "APS2_errno.h"
+
+#ifdef _WIN32
+
+APS2MappedFile::APS2MappedFile(const string &filename)
+    : data_{nullptr}, size_{0}, file_{INVALID_HANDLE_VALUE},
+      mapping_{nullptr} {
+  file_ = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                      OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+  LARGE_INTEGER size;
+  if (file_ == INVALID_HANDLE_VALUE || !GetFileSizeEx(file_, &size)) {
+    unmap();
+    throw APS2_SEQFILE_FAIL;
+  }
+  size_ = static_cast<size_t>(size.QuadPart);
+  if (size_ == 0) {
+    return;
+  }
+  mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping_ != nullptr) {
+    data_ = static_cast<const uint8_t *>(
+        MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+  }
+  if (data_ == nullptr) {
+    unmap();
+    throw APS2_SEQFILE_FAIL;
+  }
+}
+
+void APS2MappedFile::unmap() {
+  if (data_ != nullptr) {
+    UnmapViewOfFile(data_);
+    data_ = nullptr;
+  }
+  if (mapping_ != nullptr) {
+    CloseHandle(mapping_);
+    mapping_ = nullptr;
+  }
+  if (file_ != INVALID_HANDLE_VALUE) {
+    CloseHandle(file_);
+    file_ = INVALID_HANDLE_VALUE;
+  }
+}
+
+void APS2MappedFile::prefetch(size_t, size_t) const {
+  // the sequential scan hint already reads ahead
+}
+
+#else
+
+APS2MappedFile::APS2MappedFile(const string &filename)
+    : data_{nullptr}, size_{0}, fd_{-1} {
+  fd_ = open(filename.c_str(), O_RDONLY);
+  struct stat info;
+  if (fd_ < 0 || fstat(fd_, &info) != 0) {
+    unmap();
+    throw APS2_SEQFILE_FAIL;
+  }
+  size_ = static_cast<size_t>(info.st_size);
+  if (size_ == 0) {
+    return;
+  }
+  void *addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+  if (addr == MAP_FAILED) {
+    unmap();
+    throw APS2_SEQFILE_FAIL;
+  }
+  data_ = static_cast<const uint8_t *>(addr);
+  madvise(addr, size_, MADV_SEQUENTIAL);
+}
+
+void APS2MappedFile::unmap() {
+  if (data_ != nullptr) {
+    munmap(const_cast<uint8_t *>(data_), size_);
+    data_ = nullptr;
+  }
+  if (fd_ >= 0) {
+    close(fd_);
+    fd_ = -1;
+  }
+}
+
+void APS2MappedFile::prefetch(size_t offset, size_t numBytes) const {
+  if (data_ == nullptr || offset >= size_) {
+    return;
+  }
+  // madvise wants a page aligned start
+  size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  size_t start = offset - offset % page;
+  size_t end = std::min(size_, offset + numBytes);
+  madvise(const_cast<uint8_t *>(data_) + start, end - start, MADV_WILLNEED);
+}
+
+#endif
+
+APS2MappedFile::~APS2MappedFile() { unmap(); }
+
+const uint8_t *APS2MappedFile::data() const { return data_; }
+
+size_t APS2MappedFile::size() const { return size_; }
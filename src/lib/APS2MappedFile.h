@@ -0,0 +1,44 @@
+// Read-only memory map of a file such as a sequence file
+//
+// Pages are read from disk as they are first touched. prefetch asks the
+// operating system to start reading a range in the background so the disk can
+// work on the next part of the file while the current part is uploaded.
+//
+// Copyright 2016, Raytheon BBN Technologies
+
+#ifndef APS2MAPPEDFILE_H
+#define APS2MAPPEDFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+using std::string;
+
+class APS2MappedFile {
+public:
+  // Throws APS2_SEQFILE_FAIL if the file cannot be opened or mapped
+  APS2MappedFile(const string &filename);
+  ~APS2MappedFile();
+  APS2MappedFile(const APS2MappedFile &) = delete;
+  APS2MappedFile &operator=(const APS2MappedFile &) = delete;
+
+  const uint8_t *data() const;
+  size_t size() const;
+
+  // Start reading numBytes from offset in the background; clipped to the file
+  void prefetch(size_t offset, size_t numBytes) const;
+
+private:
+  void unmap();
+
+  const uint8_t *data_;
+  size_t size_;
+#ifdef _WIN32
+  void *file_;
+  void *mapping_;
+#else
+  int fd_;
+#endif
+};
+
+#endif
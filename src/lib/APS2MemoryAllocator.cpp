@@ -0,0 +1,142 @@
+// Host-side first-fit allocator over one waveform or instruction SDRAM region
+//
+// Copyright 2016, Raytheon BBN Technologies
+
+#include "APS2MemoryAllocator.h"
+
+#include <algorithm>
+#include <iterator>
+
+#include "APS2_errno.h"
+
+double APS2MemoryUsage::fragmentation() const {
+  size_t freeBytes = totalBytes - usedBytes;
+  if (freeBytes == 0) {
+    return 0;
+  }
+  return 1.0 - static_cast<double>(largestFreeBytes) / freeBytes;
+}
+
+APS2MemoryAllocator::APS2MemoryAllocator(size_t size, size_t alignment)
+    : size_{size - size % alignment}, alignment_{alignment} {
+  clear();
+}
+
+size_t APS2MemoryAllocator::allocate(size_t numBytes) {
+  size_t needed = round_up(numBytes);
+  for (const auto &block : free_) {
+    if (block.second >= needed) {
+      size_t offset = block.first;
+      take_free(offset, needed);
+      allocated_[offset] = needed;
+      return offset;
+    }
+  }
+  throw APS2_MEMORY_FULL;
+}
+
+size_t APS2MemoryAllocator::reallocate(size_t offset, size_t numBytes) {
+  auto it = allocated_.find(offset);
+  if (it == allocated_.end()) {
+    throw APS2_UNKNOWN_MEMORY_ENTRY;
+  }
+  size_t needed = round_up(numBytes);
+  size_t current = it->second;
+  if (needed <= current) {
+    if (needed < current) {
+      it->second = needed;
+      insert_free(offset + needed, current - needed);
+    }
+    return offset;
+  }
+  auto next = free_.find(offset + current);
+  if (next != free_.end() && current + next->second >= needed) {
+    take_free(offset + current, needed - current);
+    it->second = needed;
+    return offset;
+  }
+
+  // move it, putting it back where it was if it fits nowhere else
+  release(offset);
+  try {
+    return allocate(numBytes);
+  } catch (...) {
+    take_free(offset, current);
+    allocated_[offset] = current;
+    throw;
+  }
+}
+
+void APS2MemoryAllocator::release(size_t offset) {
+  auto it = allocated_.find(offset);
+  if (it == allocated_.end()) {
+    throw APS2_UNKNOWN_MEMORY_ENTRY;
+  }
+  size_t numBytes = it->second;
+  allocated_.erase(it);
+  insert_free(offset, numBytes);
+}
+
+void APS2MemoryAllocator::clear() {
+  allocated_.clear();
+  free_.clear();
+  if (size_ > 0) {
+    free_[0] = size_;
+  }
+}
+
+size_t APS2MemoryAllocator::extent() const {
+  if (allocated_.empty()) {
+    return 0;
+  }
+  auto last = allocated_.rbegin();
+  return last->first + last->second;
+}
+
+APS2MemoryUsage APS2MemoryAllocator::usage() const {
+  APS2MemoryUsage usage{size_, 0, 0, allocated_.size(), free_.size()};
+  for (const auto &block : allocated_) {
+    usage.usedBytes += block.second;
+  }
+  for (const auto &block : free_) {
+    usage.largestFreeBytes = std::max(usage.largestFreeBytes, block.second);
+  }
+  return usage;
+}
+
+size_t APS2MemoryAllocator::round_up(size_t numBytes) const {
+  // zero length entries still get an address of their own
+  if (numBytes == 0) {
+    return alignment_;
+  }
+  return alignment_ * ((numBytes + alignment_ - 1) / alignment_);
+}
+
+void APS2MemoryAllocator::insert_free(size_t offset, size_t numBytes) {
+  auto next = free_.lower_bound(offset);
+  if (next != free_.end() && offset + numBytes == next->first) {
+    numBytes += next->second;
+    next = free_.erase(next);
+  }
+  if (next != free_.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == offset) {
+      prev->second += numBytes;
+      return;
+    }
+  }
+  free_[offset] = numBytes;
+}
+
+void APS2MemoryAllocator::take_free(size_t offset, size_t numBytes) {
+  auto block = std::prev(free_.upper_bound(offset));
+  size_t start = block->first;
+  size_t end = block->first + block->second;
+  free_.erase(block);
+  if (start < offset) {
+    free_[start] = offset - start;
+  }
+  if (offset + numBytes < end) {
+    free_[offset + numBytes] = end - offset - numBytes;
+  }
+}
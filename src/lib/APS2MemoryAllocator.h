@@ -0,0 +1,59 @@
+// Host-side first-fit allocator over one waveform or instruction SDRAM region
+//
+// The APS2 only sees raw memory; which parts of it hold what is tracked here
+// so named waveforms and sequence segments can be added, replaced and removed
+// one at a time. Offsets are bytes from the start of the region and every
+// allocation starts and ends on an SDRAM word so it can be written directly.
+//
+// Copyright 2016, Raytheon BBN Technologies
+
+#ifndef APS2MEMORYALLOCATOR_H
+#define APS2MEMORYALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+
+struct APS2MemoryUsage {
+  size_t totalBytes;
+  size_t usedBytes;
+  size_t largestFreeBytes;
+  size_t numAllocations;
+  size_t numFreeBlocks;
+
+  // Share of the free memory outside the largest free block, i.e. that a
+  // single allocation cannot use
+  double fragmentation() const;
+};
+
+class APS2MemoryAllocator {
+public:
+  APS2MemoryAllocator(size_t size, size_t alignment = 16);
+
+  // Offset of the first free block big enough; throws APS2_MEMORY_FULL
+  size_t allocate(size_t numBytes);
+  // Resize an allocation, in place if it shrinks or the free memory after it
+  // is big enough and otherwise wherever it fits. The contents are not kept.
+  size_t reallocate(size_t offset, size_t numBytes);
+  void release(size_t offset);
+  void clear();
+
+  // End of the highest allocation
+  size_t extent() const;
+  APS2MemoryUsage usage() const;
+
+private:
+  size_t size_;
+  size_t alignment_;
+  // offset -> size of each free block and each allocation
+  std::map<size_t, size_t> free_;
+  std::map<size_t, size_t> allocated_;
+
+  size_t round_up(size_t numBytes) const;
+  // Return a block to the free list merging it with its neighbours
+  void insert_free(size_t offset, size_t numBytes);
+  // Carve a block out of the free block holding it
+  void take_free(size_t offset, size_t numBytes);
+};
+
+#endif
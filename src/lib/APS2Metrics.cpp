@@ -0,0 +1,48 @@
+// Transport counters and latency histograms for one APS2
+//
+// Copyright 2016, Raytheon BBN Technologies
+
+#include "APS2Metrics.h"
+
+LatencyHistogram::LatencyHistogram() { reset(); }
+
+void LatencyHistogram::record(std::chrono::nanoseconds latency) {
+  counts_[bucket(latency)].fetch_add(1, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::snapshot(uint64_t *counts) const {
+  for (size_t ct = 0; ct < counts_.size(); ct++) {
+    counts[ct] = counts_[ct].load(std::memory_order_relaxed);
+  }
+}
+
+void LatencyHistogram::reset() {
+  for (auto &count : counts_) {
+    count.store(0, std::memory_order_relaxed);
+  }
+}
+
+size_t LatencyHistogram::bucket(std::chrono::nanoseconds latency) {
+  auto us = std::chrono::duration_cast<std::chrono::microseconds>(latency)
+                .count();
+  // bucket is one more than the position of the highest set bit with
+  // anything too long for the rest landing in the last
+  size_t idx = 0;
+  while (us > 0 && idx < LATENCY_HISTOGRAM_BUCKETS - 1) {
+    us >>= 1;
+    idx++;
+  }
+  return idx;
+}
+
+APS2Metrics::APS2Metrics() { reset(); }
+
+void APS2Metrics::reset() {
+  for (auto counter : {&bytesSent, &bytesReceived, &datagramsSent,
+                       &datagramsReceived, &timeouts, &retries,
+                       &sendBlockedNs, &readBlockedNs}) {
+    counter->store(0, std::memory_order_relaxed);
+  }
+  ackLatency.reset();
+  readLatency.reset();
+}
@@ -0,0 +1,81 @@
+// Transport counters and latency histograms for one APS2
+//
+// Everything is a relaxed atomic so the send and receive paths of several
+// threads can update the counters without taking a lock; a snapshot taken
+// while traffic is flowing is consistent per counter but not across them.
+//
+// Copyright 2016, Raytheon BBN Technologies
+
+#ifndef APS2METRICS_H
+#define APS2METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+#include "constants.h"
+
+// Fixed log2 buckets in microseconds: bucket 0 counts latencies under 1us,
+// bucket i those in [2^(i-1), 2^i) us and the last bucket everything longer
+class LatencyHistogram {
+public:
+  LatencyHistogram();
+
+  void record(std::chrono::nanoseconds latency);
+  void snapshot(uint64_t *counts) const;
+  void reset();
+
+  static size_t bucket(std::chrono::nanoseconds latency);
+
+private:
+  std::array<std::atomic<uint64_t>, LATENCY_HISTOGRAM_BUCKETS> counts_;
+};
+
+struct APS2Metrics {
+  APS2Metrics();
+
+  std::atomic<uint64_t> bytesSent;
+  std::atomic<uint64_t> bytesReceived;
+  std::atomic<uint64_t> datagramsSent;
+  std::atomic<uint64_t> datagramsReceived;
+  std::atomic<uint64_t> timeouts;
+  std::atomic<uint64_t> retries;
+  // time callers spent blocked sending (including waiting on acknowledges)
+  // and reading
+  std::atomic<uint64_t> sendBlockedNs;
+  std::atomic<uint64_t> readBlockedNs;
+
+  // from a datagram going out to its acknowledge coming back
+  LatencyHistogram ackLatency;
+  // from starting a read to the whole datagram arriving
+  LatencyHistogram readLatency;
+
+  void reset();
+
+  static void add(std::atomic<uint64_t> &counter, uint64_t value) {
+    counter.fetch_add(value, std::memory_order_relaxed);
+  }
+};
+
+// Adds the time from construction to destruction to a blocked time counter so
+// early exits on errors are counted too
+class BlockedTimer {
+public:
+  explicit BlockedTimer(std::atomic<uint64_t> &counter)
+      : counter_(counter), start_(std::chrono::steady_clock::now()) {}
+  ~BlockedTimer() { APS2Metrics::add(counter_, elapsed().count()); }
+
+  std::chrono::nanoseconds elapsed() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start_);
+  }
+
+private:
+  BlockedTimer(BlockedTimer const &) = delete;
+  std::atomic<uint64_t> &counter_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+#endif
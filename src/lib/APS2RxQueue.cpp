@@ -0,0 +1,67 @@
+// Per-device queue of received UDP packets
+//
+// Copyright 2016, Raytheon BBN Technologies
+
+#include "APS2RxQueue.h"
+
+#include <algorithm>
+
+const size_t APS2RxQueue::DEPTH;
+const size_t APS2RxQueue::MAX_PACKET_SIZE;
+
+APS2RxQueue::APS2RxQueue()
+    : slots_(DEPTH), head_{0}, tail_{0}, waiting_{false}, dropped_{0} {}
+
+bool APS2RxQueue::push(const uint8_t *data, size_t size) {
+  size_t tail = tail_.load(std::memory_order_relaxed);
+  if (tail - head_.load(std::memory_order_acquire) == DEPTH) {
+    dropped_++;
+    return false;
+  }
+  Slot &slot = slots_[tail & (DEPTH - 1)];
+  slot.size = std::min(size, MAX_PACKET_SIZE);
+  std::copy(data, data + slot.size, slot.data);
+  tail_.store(tail + 1);
+
+  // Pairs with the consumer setting waiting_ before its final empty check
+  if (waiting_.load()) {
+    std::lock_guard<std::mutex> lock(wait_lock_);
+    wakeup_.notify_one();
+  }
+  return true;
+}
+
+bool APS2RxQueue::pop(APS2EthernetPacket &packet,
+                      std::chrono::steady_clock::time_point deadline) {
+  size_t head = head_.load(std::memory_order_relaxed);
+  auto empty = [&]() { return tail_.load() == head; };
+
+  if (empty()) {
+    std::unique_lock<std::mutex> lock(wait_lock_);
+    waiting_ = true;
+    bool arrived = wakeup_.wait_until(lock, deadline, [&]() { return !empty(); });
+    waiting_ = false;
+    if (!arrived) {
+      return false;
+    }
+  }
+
+  if (packet.payload.capacity() == 0 && !spares_.empty()) {
+    packet.payload.swap(spares_.back());
+    spares_.pop_back();
+  }
+  const Slot &slot = slots_[head & (DEPTH - 1)];
+  packet.parse(slot.data, slot.size);
+  head_.store(head + 1, std::memory_order_release);
+  return true;
+}
+
+void APS2RxQueue::recycle(vector<uint32_t> &&payload) {
+  // no more than a ring's worth can be in use at once
+  if (payload.capacity() > 0 && spares_.size() < DEPTH) {
+    payload.clear();
+    spares_.push_back(std::move(payload));
+  }
+}
+
+size_t APS2RxQueue::dropped() const { return dropped_; }
@@ -0,0 +1,64 @@
+// Per-device queue of received UDP packets
+//
+// A single producer single consumer ring of preallocated packet slots. The
+// asio thread copies raw packets in without allocating or taking a lock
+// shared with other devices; receive() parses them out on the caller's thread.
+//
+// Copyright 2016, Raytheon BBN Technologies
+
+#ifndef APS2RXQUEUE_H
+#define APS2RXQUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+using std::vector;
+
+#include "APS2EthernetPacket.h"
+
+class APS2RxQueue {
+public:
+  static const size_t DEPTH = 64; // must be a power of 2
+  static const size_t MAX_PACKET_SIZE = 2048;
+
+  APS2RxQueue();
+
+  // Producer side: returns false and drops the packet if the ring is full
+  bool push(const uint8_t *, size_t);
+
+  // Consumer side: returns false if nothing arrived before the deadline. The
+  // slot is parsed straight into the packet and recycled. A packet without
+  // payload storage of its own is given a recycled payload buffer.
+  bool pop(APS2EthernetPacket &, std::chrono::steady_clock::time_point);
+  // Consumer side: keep a payload buffer the caller is done with for a later
+  // pop so steady reads stop allocating
+  void recycle(vector<uint32_t> &&);
+
+  size_t dropped() const;
+
+private:
+  struct Slot {
+    size_t size;
+    uint8_t data[MAX_PACKET_SIZE];
+  };
+  vector<Slot> slots_;
+
+  // head is only written by the consumer and tail only by the producer; keep
+  // them on separate cache lines
+  alignas(64) std::atomic<size_t> head_;
+  alignas(64) std::atomic<size_t> tail_;
+
+  // The consumer only blocks on the condition variable when the ring is empty
+  // so the producer only touches the mutex when someone is waiting
+  std::atomic<bool> waiting_;
+  std::atomic<size_t> dropped_;
+  std::mutex wait_lock_;
+  std::condition_variable wakeup_;
+
+  // only touched by the consumer
+  vector<vector<uint32_t>> spares_;
+};
+
+#endif
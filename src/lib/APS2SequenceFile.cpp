@@ -0,0 +1,371 @@
+// Sequence files: the original layout and the indexed version 2 container
+//
+// Copyright 2016, Raytheon BBN Technologies
+
+#include "APS2SequenceFile.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+
+#include "APS2_errno.h"
+#include "Channel.h"
+#include "constants.h"
+
+namespace {
+
+const char SEQFILE_MAGIC[8] = "APS2SEQ";
+// magic, version, number of sections, reserved
+const size_t HEADER_SIZE = 24;
+const size_t SECTION_ENTRY_SIZE = 40;
+// version 1 files count their channels in a uint16
+const uint32_t MAX_SECTION_CHANNEL = 0xffff;
+// bytes in the unused header of a version 1 file
+const size_t V1_HEADER_SIZE = 12;
+
+template <typename T> void append(vector<uint8_t> &buf, const T &val) {
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&val);
+  buf.insert(buf.end(), bytes, bytes + sizeof(T));
+}
+
+template <typename T> T extract(const uint8_t *&ptr) {
+  T val;
+  std::memcpy(&val, ptr, sizeof(T));
+  ptr += sizeof(T);
+  return val;
+}
+
+// count elements from a possibly unaligned place in the file
+template <typename T> vector<T> read_array(const uint8_t *data, size_t count) {
+  vector<T> out(count);
+  if (count > 0) {
+    std::memcpy(out.data(), data, sizeof(T) * count);
+  }
+  return out;
+}
+
+uint64_t round_up(uint64_t value, uint64_t multiple) {
+  return multiple * ((value + multiple - 1) / multiple);
+}
+
+bool known_type(APS2SectionType type) {
+  return type >= APS2SectionType::INSTRUCTIONS &&
+         type <= APS2SectionType::METADATA;
+}
+
+// Payload bytes a section of count elements takes
+uint64_t payload_bytes(APS2SectionType type, uint64_t count) {
+  switch (type) {
+  case APS2SectionType::INSTRUCTIONS:
+    return round_up(8 * count, 16);
+  case APS2SectionType::WAVEFORM:
+    // two samples a word of a waveform padded to WF_MODULUS
+    return round_up(2 * round_up(count, WF_MODULUS), 16);
+  case APS2SectionType::MARKERS:
+  case APS2SectionType::METADATA:
+    return round_up(count, 16);
+  }
+  return 0;
+}
+
+uint64_t hash_payload(const void *data, size_t numBytes) {
+  APS2ContentHash hash;
+  hash.update(data, numBytes);
+  return hash.digest();
+}
+
+struct FileCloser {
+  void operator()(FILE *file) const { std::fclose(file); }
+};
+
+std::unique_ptr<FILE, FileCloser> open_for_writing(const string &filename) {
+  std::unique_ptr<FILE, FileCloser> file(std::fopen(filename.c_str(), "wb"));
+  if (!file) {
+    LOG(plog::error) << "Unable to create sequence file " << filename;
+    throw APS2_SEQFILE_FAIL;
+  }
+  return file;
+}
+
+void write_bytes(FILE *file, const void *data, size_t numBytes) {
+  if (numBytes > 0 && std::fwrite(data, 1, numBytes, file) != numBytes) {
+    throw APS2_SEQFILE_FAIL;
+  }
+}
+
+} // namespace
+
+const uint32_t APS2SequenceFile::VERSION;
+const size_t APS2SequenceFile::ALIGNMENT;
+
+APS2ContentHash::APS2ContentHash() : numBytes_{0} {
+  const uint64_t basis = 0xcbf29ce484222325ull;
+  for (uint64_t lane = 0; lane < 4; lane++) {
+    lanes_[lane] = basis ^ lane;
+  }
+}
+
+void APS2ContentHash::update(const void *data, size_t numBytes) {
+  // the same interleaved FNV-1a as Channel::block_hashes
+  const uint64_t prime = 0x100000001b3ull;
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  size_t ct = 0;
+  for (; ct + 16 <= numBytes; ct += 16) {
+    uint32_t words[4];
+    std::memcpy(words, bytes + ct, sizeof(words));
+    for (size_t lane = 0; lane < 4; lane++) {
+      lanes_[lane] = (lanes_[lane] ^ words[lane]) * prime;
+    }
+  }
+  // a trailing part word is zero filled
+  for (; ct < numBytes; ct += 4) {
+    uint32_t word = 0;
+    std::memcpy(&word, bytes + ct, std::min<size_t>(4, numBytes - ct));
+    lanes_[0] = (lanes_[0] ^ word) * prime;
+  }
+  numBytes_ += numBytes;
+}
+
+uint64_t APS2ContentHash::digest() const {
+  const uint64_t prime = 0x100000001b3ull;
+  uint64_t hash = numBytes_;
+  for (auto lane : lanes_) {
+    hash = (hash ^ lane) * prime;
+  }
+  return hash;
+}
+
+bool APS2SequenceFile::is_v2(const APS2MappedFile &file) {
+  return file.size() >= HEADER_SIZE &&
+         std::memcmp(file.data(), SEQFILE_MAGIC, sizeof(SEQFILE_MAGIC)) == 0;
+}
+
+vector<APS2SequenceSection>
+APS2SequenceFile::read_sections(const APS2MappedFile &file) {
+  if (!is_v2(file)) {
+    throw APS2_SEQFILE_FAIL;
+  }
+  const uint8_t *ptr = file.data() + sizeof(SEQFILE_MAGIC);
+  uint32_t version = extract<uint32_t>(ptr);
+  uint32_t numSections = extract<uint32_t>(ptr);
+  if (version != VERSION) {
+    LOG(plog::error) << "Unsupported sequence file version " << version;
+    throw APS2_SEQFILE_FAIL;
+  }
+  if (numSections > (file.size() - HEADER_SIZE) / SECTION_ENTRY_SIZE) {
+    throw APS2_SEQFILE_FAIL;
+  }
+  ptr = file.data() + HEADER_SIZE;
+  vector<APS2SequenceSection> sections(numSections);
+  for (auto &section : sections) {
+    section.type = static_cast<APS2SectionType>(extract<uint32_t>(ptr));
+    section.channel = extract<uint32_t>(ptr);
+    section.offset = extract<uint64_t>(ptr);
+    section.numBytes = extract<uint64_t>(ptr);
+    section.count = extract<uint64_t>(ptr);
+    section.hash = extract<uint64_t>(ptr);
+    // counts that big cannot be in the file so this also keeps
+    // payload_bytes from overflowing
+    if (!known_type(section.type) || section.channel > MAX_SECTION_CHANNEL ||
+        section.count > file.size() ||
+        section.numBytes != payload_bytes(section.type, section.count) ||
+        section.offset % ALIGNMENT != 0 || section.offset > file.size() ||
+        section.numBytes > file.size() - section.offset) {
+      LOG(plog::error) << "Damaged section table in sequence file";
+      throw APS2_SEQFILE_FAIL;
+    }
+  }
+  return sections;
+}
+
+APS2SequenceFile::V1Layout
+APS2SequenceFile::read_v1_layout(const APS2MappedFile &file) {
+  // a header we don't need, the channel count, then the instructions and each
+  // channel's waveform as length prefixed arrays
+  size_t pos = V1_HEADER_SIZE;
+  auto read_header = [&](size_t numBytes) {
+    if (pos + numBytes > file.size()) {
+      throw APS2_SEQFILE_FAIL;
+    }
+    uint64_t val = 0;
+    std::memcpy(&val, file.data() + pos, numBytes);
+    pos += numBytes;
+    return val;
+  };
+  auto section = [&](size_t elementSize) {
+    uint64_t length = read_header(sizeof(uint64_t));
+    if (length > (file.size() - pos) / elementSize) {
+      throw APS2_SEQFILE_FAIL;
+    }
+    std::pair<size_t, size_t> range(pos, length);
+    pos += length * elementSize;
+    return range;
+  };
+  V1Layout layout;
+  uint16_t num_chans = static_cast<uint16_t>(read_header(sizeof(uint16_t)));
+  layout.instructions = section(sizeof(uint64_t));
+  for (int chanct = 0; chanct < num_chans; chanct++) {
+    layout.waveforms.push_back(section(sizeof(int16_t)));
+  }
+  return layout;
+}
+
+APS2SequenceData APS2SequenceFile::read(const string &filename) {
+  APS2MappedFile file(filename);
+  APS2SequenceData data;
+  if (!is_v2(file)) {
+    auto layout = read_v1_layout(file);
+    data.instructions = read_array<uint64_t>(
+        file.data() + layout.instructions.first, layout.instructions.second);
+    for (const auto &wf : layout.waveforms) {
+      data.waveforms.push_back(
+          read_array<int16_t>(file.data() + wf.first, wf.second));
+    }
+    data.markers.resize(data.waveforms.size());
+    return data;
+  }
+
+  for (const auto &section : read_sections(file)) {
+    const uint8_t *payload = file.data() + section.offset;
+    if (hash_payload(payload, section.numBytes) != section.hash) {
+      LOG(plog::error) << "Damaged section in sequence file " << filename;
+      throw APS2_SEQFILE_FAIL;
+    }
+    if ((section.type == APS2SectionType::WAVEFORM ||
+         section.type == APS2SectionType::MARKERS) &&
+        section.channel >= data.waveforms.size()) {
+      data.waveforms.resize(section.channel + 1);
+      data.markers.resize(section.channel + 1);
+    }
+    switch (section.type) {
+    case APS2SectionType::INSTRUCTIONS:
+      data.instructions = read_array<uint64_t>(payload, section.count);
+      break;
+    case APS2SectionType::WAVEFORM: {
+      auto &wf = data.waveforms[section.channel];
+      wf.resize(section.count);
+      for (size_t ct = 0; ct < wf.size(); ct++) {
+        uint16_t sample;
+        std::memcpy(&sample, payload + 2 * ct, sizeof(sample));
+        // drop the marker bits and sign extend the 14 bit sample
+        wf[ct] = static_cast<int16_t>(static_cast<int16_t>(sample << 2) >> 2);
+      }
+      break;
+    }
+    case APS2SectionType::MARKERS:
+      data.markers[section.channel].assign(payload, payload + section.count);
+      break;
+    case APS2SectionType::METADATA:
+      data.metadata.assign(reinterpret_cast<const char *>(payload),
+                           section.count);
+      break;
+    }
+  }
+  return data;
+}
+
+void APS2SequenceFile::write_v1(const string &filename,
+                                const APS2SequenceData &data) {
+  auto file = open_for_writing(filename);
+  vector<uint8_t> buf(V1_HEADER_SIZE, 0);
+  append(buf, static_cast<uint16_t>(data.waveforms.size()));
+  append(buf, static_cast<uint64_t>(data.instructions.size()));
+  write_bytes(file.get(), buf.data(), buf.size());
+  write_bytes(file.get(), data.instructions.data(),
+              sizeof(uint64_t) * data.instructions.size());
+  for (const auto &wf : data.waveforms) {
+    uint64_t length = wf.size();
+    write_bytes(file.get(), &length, sizeof(length));
+    write_bytes(file.get(), wf.data(), sizeof(int16_t) * wf.size());
+  }
+}
+
+void APS2SequenceFile::write_v2(const string &filename,
+                                const APS2SequenceData &data) {
+  // Lay out every payload in the device format first
+  struct Payload {
+    APS2SectionType type;
+    uint32_t channel;
+    uint64_t count;
+    vector<uint8_t> bytes;
+  };
+  vector<Payload> payloads;
+  auto add = [&](APS2SectionType type, uint32_t channel, uint64_t count,
+                 const void *data, size_t numBytes, uint8_t pad) {
+    Payload payload{type, channel, count,
+                    vector<uint8_t>(payload_bytes(type, count), pad)};
+    if (numBytes > 0) {
+      std::memcpy(payload.bytes.data(), data, numBytes);
+    }
+    payloads.push_back(std::move(payload));
+  };
+
+  // instructions low word first and padded with 0xffffffff as the APS2
+  // memory holds them
+  add(APS2SectionType::INSTRUCTIONS, 0, data.instructions.size(),
+      data.instructions.data(), sizeof(uint64_t) * data.instructions.size(),
+      0xff);
+  for (size_t ch = 0; ch < data.waveforms.size(); ch++) {
+    Channel channel(static_cast<int>(ch));
+    channel.set_waveform(data.waveforms[ch]);
+    bool hasMarkers = ch < data.markers.size() && !data.markers[ch].empty();
+    if (hasMarkers) {
+      channel.set_markers(data.markers[ch]);
+    }
+    const auto &packed = channel.packed_waveform();
+    add(APS2SectionType::WAVEFORM, static_cast<uint32_t>(ch),
+        data.waveforms[ch].size(), packed.data(),
+        sizeof(uint32_t) * packed.size(), 0xff);
+    if (hasMarkers) {
+      const auto &markers = data.markers[ch];
+      add(APS2SectionType::MARKERS, static_cast<uint32_t>(ch), markers.size(),
+          markers.data(), markers.size(), 0);
+    }
+  }
+  if (!data.metadata.empty()) {
+    add(APS2SectionType::METADATA, 0, data.metadata.size(),
+        data.metadata.data(), data.metadata.size(), 0);
+  }
+
+  vector<uint8_t> table(SEQFILE_MAGIC, SEQFILE_MAGIC + sizeof(SEQFILE_MAGIC));
+  append(table, VERSION);
+  append(table, static_cast<uint32_t>(payloads.size()));
+  append(table, uint64_t(0));
+  uint64_t offset =
+      round_up(HEADER_SIZE + SECTION_ENTRY_SIZE * payloads.size(), ALIGNMENT);
+  for (const auto &payload : payloads) {
+    append(table, static_cast<uint32_t>(payload.type));
+    append(table, payload.channel);
+    append(table, offset);
+    append(table, static_cast<uint64_t>(payload.bytes.size()));
+    append(table, payload.count);
+    append(table, hash_payload(payload.bytes.data(), payload.bytes.size()));
+    offset = round_up(offset + payload.bytes.size(), ALIGNMENT);
+  }
+
+  auto file = open_for_writing(filename);
+  write_bytes(file.get(), table.data(), table.size());
+  uint64_t pos = table.size();
+  const vector<uint8_t> zeros(ALIGNMENT, 0);
+  for (const auto &payload : payloads) {
+    uint64_t start = round_up(pos, ALIGNMENT);
+    write_bytes(file.get(), zeros.data(), start - pos);
+    write_bytes(file.get(), payload.bytes.data(), payload.bytes.size());
+    pos = start + payload.bytes.size();
+  }
+}
+
+void APS2SequenceFile::convert(const string &input, const string &output,
+                               uint32_t version) {
+  if (version != 1 && version != VERSION) {
+    LOG(plog::error) << "Unknown sequence file version " << version;
+    throw APS2_SEQFILE_FAIL;
+  }
+  auto data = read(input);
+  if (version == 1) {
+    write_v1(output, data);
+  } else {
+    write_v2(output, data);
+  }
+}
@@ -0,0 +1,102 @@
+// Sequence files: the original layout and the indexed version 2 container
+//
+// Version 1 files hold 12 unused header bytes, a uint16 channel count, the
+// instructions as a uint64 length and uint64 array, then each channel's
+// waveform as a uint64 length and int16 array. Nothing is aligned and a
+// section can neither be checked nor found without reading the ones before.
+//
+// Version 2 files start with a table of sections. Every payload starts on a
+// 4 kB boundary, is padded to whole 16 byte SDRAM words and is already in the
+// format the APS2 memory holds, so it can be mapped and sent as it is:
+//   header:  "APS2SEQ" magic with a trailing NUL, uint32 version, uint32
+//            number of sections, uint64 reserved
+//   section: uint32 type, uint32 channel, uint64 payload offset, uint64
+//            payload bytes, uint64 count, uint64 payload hash
+// Everything is little endian. Instructions are stored low word first,
+// waveforms two samples a word with the markers merged in, markers a byte a
+// sample and metadata as free text. The count is of instructions, samples,
+// markers or metadata bytes. The hash lets a loader skip sections the APS2
+// already holds and catch damaged ones.
+//
+// Copyright 2016, Raytheon BBN Technologies
+
+#ifndef APS2SEQUENCEFILE_H
+#define APS2SEQUENCEFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+using std::string;
+#include <utility>
+#include <vector>
+using std::vector;
+
+#include "APS2MappedFile.h"
+
+enum class APS2SectionType : uint32_t {
+  INSTRUCTIONS = 1,
+  WAVEFORM = 2,
+  MARKERS = 3,
+  METADATA = 4
+};
+
+struct APS2SequenceSection {
+  APS2SectionType type;
+  uint32_t channel;
+  uint64_t offset;
+  uint64_t numBytes;
+  uint64_t count;
+  uint64_t hash;
+};
+
+// FNV-1a over 32 bit words in four interleaved lanes. Every update but the
+// last must be a whole number of 16 byte SDRAM words.
+class APS2ContentHash {
+public:
+  APS2ContentHash();
+  void update(const void *data, size_t numBytes);
+  uint64_t digest() const;
+
+private:
+  uint64_t lanes_[4];
+  uint64_t numBytes_;
+};
+
+// Everything a sequence file of either version holds
+struct APS2SequenceData {
+  vector<uint64_t> instructions;
+  // 14 bit samples sign extended to 16
+  vector<vector<int16_t>> waveforms;
+  // per channel, empty if the channel has none
+  vector<vector<uint8_t>> markers;
+  string metadata;
+};
+
+class APS2SequenceFile {
+public:
+  static const uint32_t VERSION = 2;
+  static const size_t ALIGNMENT = 4096;
+
+  static bool is_v2(const APS2MappedFile &);
+  // The section table of a version 2 file with every payload checked to lie
+  // inside the file; throws APS2_SEQFILE_FAIL otherwise
+  static vector<APS2SequenceSection> read_sections(const APS2MappedFile &);
+
+  // (offset, count) of the instructions and each waveform of a version 1
+  // file; throws APS2_SEQFILE_FAIL if they run past its end
+  struct V1Layout {
+    std::pair<size_t, size_t> instructions;
+    vector<std::pair<size_t, size_t>> waveforms;
+  };
+  static V1Layout read_v1_layout(const APS2MappedFile &);
+
+  // Read either version, checking the hashes of a version 2 file
+  static APS2SequenceData read(const string &filename);
+  // Metadata and markers have no place in version 1 files and are dropped
+  static void write_v1(const string &filename, const APS2SequenceData &);
+  static void write_v2(const string &filename, const APS2SequenceData &);
+  static void convert(const string &input, const string &output,
+                      uint32_t version);
+};
+
+#endif
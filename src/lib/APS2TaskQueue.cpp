@@ -0,0 +1,55 @@
+// Runs tasks in submission order on a background thread
+//
+// Copyright 2016, Raytheon BBN Technologies
+
+#include "APS2TaskQueue.h"
+
+APS2TaskQueue::APS2TaskQueue() : busy_{false}, stop_{false} {}
+
+APS2TaskQueue::~APS2TaskQueue() {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    stop_ = true;
+  }
+  wakeup_.notify_all();
+  // the worker drains anything still queued before exiting
+  if (worker_.joinable()) {
+    worker_.join();
+  }
+}
+
+void APS2TaskQueue::push(std::function<void()> task) {
+  {
+    std::lock_guard<std::mutex> guard(lock_);
+    tasks_.push_back(std::move(task));
+    if (!worker_.joinable()) {
+      worker_ = std::thread([this]() { run(); });
+    }
+  }
+  wakeup_.notify_one();
+}
+
+void APS2TaskQueue::wait_idle() {
+  std::unique_lock<std::mutex> lock(lock_);
+  idle_.wait(lock, [this]() { return tasks_.empty() && !busy_; });
+}
+
+void APS2TaskQueue::run() {
+  std::unique_lock<std::mutex> lock(lock_);
+  while (true) {
+    wakeup_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+    if (tasks_.empty()) {
+      return;
+    }
+    auto task = std::move(tasks_.front());
+    tasks_.pop_front();
+    busy_ = true;
+    lock.unlock();
+    task();
+    lock.lock();
+    busy_ = false;
+    if (tasks_.empty()) {
+      idle_.notify_all();
+    }
+  }
+}
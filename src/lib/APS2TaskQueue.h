@@ -0,0 +1,51 @@
+// Runs tasks in submission order on a background thread
+//
+// Each APS2 owns one so asynchronous operations on a device are serialized
+// while operations on different devices overlap.
+//
+// Copyright 2016, Raytheon BBN Technologies
+
+#ifndef APS2TASKQUEUE_H
+#define APS2TASKQUEUE_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+class APS2TaskQueue {
+public:
+  APS2TaskQueue();
+  ~APS2TaskQueue();
+
+  // Queue a task and return a future for its result or exception
+  template <typename F> auto submit(F task) -> std::future<decltype(task())> {
+    typedef decltype(task()) R;
+    auto packaged = std::make_shared<std::packaged_task<R()>>(task);
+    auto result = packaged->get_future();
+    push([packaged]() { (*packaged)(); });
+    return result;
+  }
+
+  // Block until every queued task has finished
+  void wait_idle();
+
+private:
+  APS2TaskQueue(APS2TaskQueue const &) = delete;
+
+  void push(std::function<void()>);
+  void run();
+
+  std::deque<std::function<void()>> tasks_;
+  bool busy_;
+  bool stop_;
+  std::mutex lock_;
+  std::condition_variable wakeup_;
+  std::condition_variable idle_;
+  std::thread worker_; // started on the first submit
+};
+
+#endif
@@ -0,0 +1,181 @@
+// Wire-level trace of the datagrams and packets exchanged with APS2s
+//
+// Copyright 2016, Raytheon BBN Technologies
+
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+#include "APS2Trace.h"
+
+#include <cstring>
+
+#include "APS2_errno.h"
+#include "constants.h"
+
+namespace {
+
+const char TRACE_MAGIC[8] = "APS2TRC";
+// bytes in a record before the payload
+const size_t RECORD_HEADER_SIZE = 28;
+// hand the buffer to the writer thread once this much is waiting
+const size_t TRACE_FLUSH_SIZE = 1 << 20;
+
+template <typename T> void append(vector<uint8_t> &buf, const T &val) {
+  const uint8_t *bytes = reinterpret_cast<const uint8_t *>(&val);
+  buf.insert(buf.end(), bytes, bytes + sizeof(T));
+}
+
+template <typename T> T extract(const uint8_t *&ptr) {
+  T val;
+  std::memcpy(&val, ptr, sizeof(T));
+  ptr += sizeof(T);
+  return val;
+}
+
+} // namespace
+
+const uint32_t APS2TraceWriter::VERSION;
+
+APS2TraceWriter::APS2TraceWriter(const string &filename)
+    : start_(std::chrono::steady_clock::now()), stopping_(false) {
+  file_ = std::fopen(filename.c_str(), "wb");
+  if (!file_) {
+    LOG(plog::error) << "Unable to create trace file " << filename;
+    throw APS2_FILELOG_ERROR;
+  }
+  vector<uint8_t> header(TRACE_MAGIC, TRACE_MAGIC + sizeof(TRACE_MAGIC));
+  append(header, VERSION);
+  append(header, uint32_t(0));
+  append(header, static_cast<uint64_t>(
+                     std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::system_clock::now().time_since_epoch())
+                         .count()));
+  std::fwrite(header.data(), 1, header.size(), file_);
+  active_.reserve(TRACE_FLUSH_SIZE);
+  writerThread_ = std::thread(&APS2TraceWriter::write_loop, this);
+}
+
+APS2TraceWriter::~APS2TraceWriter() {
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    stopping_ = true;
+  }
+  wakeWriter_.notify_one();
+  writerThread_.join();
+  std::fclose(file_);
+}
+
+void APS2TraceWriter::record(uint32_t ipAddr, APS2TraceDirection direction,
+                             APS2TraceTransport transport, APS2Command cmd,
+                             uint32_t addr, const uint32_t *payload,
+                             size_t payloadSize, bool networkOrder) {
+  uint64_t timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now() - start_)
+                           .count();
+  bool wake;
+  {
+    std::lock_guard<std::mutex> lock(lock_);
+    size_t offset = active_.size();
+    active_.resize(offset + RECORD_HEADER_SIZE + 4 * payloadSize);
+    uint8_t *ptr = active_.data() + offset;
+    auto put = [&ptr](const void *src, size_t numBytes) {
+      std::memcpy(ptr, src, numBytes);
+      ptr += numBytes;
+    };
+    uint8_t flags[4] = {static_cast<uint8_t>(direction),
+                        static_cast<uint8_t>(transport), 0, 0};
+    uint32_t numWords = payloadSize;
+    put(&timestamp, 8);
+    put(&ipAddr, 4);
+    put(flags, 4);
+    put(&cmd.packed, 4);
+    put(&addr, 4);
+    put(&numWords, 4);
+    if (networkOrder) {
+      for (size_t ct = 0; ct < payloadSize; ct++) {
+        uint32_t val = ntohl(payload[ct]);
+        put(&val, 4);
+      }
+    } else if (payloadSize > 0) {
+      put(payload, 4 * payloadSize);
+    }
+    wake = active_.size() >= TRACE_FLUSH_SIZE;
+  }
+  if (wake) {
+    wakeWriter_.notify_one();
+  }
+}
+
+void APS2TraceWriter::write_loop() {
+  vector<uint8_t> draining;
+  draining.reserve(TRACE_FLUSH_SIZE);
+  bool stop = false;
+  while (!stop) {
+    {
+      std::unique_lock<std::mutex> lock(lock_);
+      wakeWriter_.wait_for(lock, std::chrono::milliseconds(100), [this]() {
+        return stopping_ || active_.size() >= TRACE_FLUSH_SIZE;
+      });
+      std::swap(active_, draining);
+      stop = stopping_;
+    }
+    if (!draining.empty()) {
+      std::fwrite(draining.data(), 1, draining.size(), file_);
+      draining.clear();
+    }
+  }
+  std::fflush(file_);
+}
+
+APS2TraceReader::APS2TraceReader(const string &filename) {
+  file_ = std::fopen(filename.c_str(), "rb");
+  if (!file_) {
+    LOG(plog::error) << "Unable to open trace file " << filename;
+    throw APS2_FILELOG_ERROR;
+  }
+  uint8_t header[24];
+  if (std::fread(header, 1, sizeof(header), file_) != sizeof(header) ||
+      std::memcmp(header, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0) {
+    LOG(plog::error) << filename << " is not an APS2 trace";
+    std::fclose(file_);
+    throw APS2_FILELOG_ERROR;
+  }
+  const uint8_t *ptr = header + sizeof(TRACE_MAGIC);
+  uint32_t version = extract<uint32_t>(ptr);
+  if (version != APS2TraceWriter::VERSION) {
+    LOG(plog::error) << filename << " has unsupported trace version "
+                     << version;
+    std::fclose(file_);
+    throw APS2_FILELOG_ERROR;
+  }
+}
+
+APS2TraceReader::~APS2TraceReader() { std::fclose(file_); }
+
+bool APS2TraceReader::next(APS2TraceRecord &record) {
+  uint8_t header[RECORD_HEADER_SIZE];
+  if (std::fread(header, 1, sizeof(header), file_) != sizeof(header)) {
+    return false;
+  }
+  const uint8_t *ptr = header;
+  record.timestamp = std::chrono::nanoseconds(extract<uint64_t>(ptr));
+  record.ipAddr = extract<uint32_t>(ptr);
+  record.direction = static_cast<APS2TraceDirection>(*ptr++);
+  record.transport = static_cast<APS2TraceTransport>(*ptr++);
+  ptr += 2;
+  record.datagram.cmd.packed = extract<uint32_t>(ptr);
+  record.datagram.addr = extract<uint32_t>(ptr);
+  uint32_t numWords = extract<uint32_t>(ptr);
+  record.datagram.payload.resize(numWords);
+  if (numWords > 0 &&
+      std::fread(record.datagram.payload.data(), 4, numWords, file_) !=
+          numWords) {
+    // a truncated trace, e.g. from a crashed session, ends at the last whole
+    // record
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,90 @@
+// Wire-level trace of the datagrams and packets exchanged with APS2s
+//
+// The writer appends each record to an in-memory buffer and a background
+// thread drains it to disk, so tracing costs the caller a copy rather than a
+// file write. Traces are read back with APS2TraceReader, e.g. by aps2_replay.
+//
+// File layout, all words in the byte order of the recording machine:
+//   header: "APS2TRC" magic with a trailing NUL, uint32 version, uint32
+//           reserved, uint64 wall clock start in ns since the epoch
+//   record: uint64 ns since the start of the trace, uint32 device IPv4
+//           address, uint8 direction, uint8 transport, uint16 reserved, uint32
+//           command word, uint32 address, uint32 payload length in words then
+//           the payload in host byte order
+//
+// Copyright 2016, Raytheon BBN Technologies
+
+#ifndef APS2TRACE_H
+#define APS2TRACE_H
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+using std::string;
+#include <thread>
+#include <vector>
+using std::vector;
+
+#include "APS2Datagram.h"
+
+enum class APS2TraceDirection : uint8_t { SENT = 0, RECEIVED = 1 };
+// TCP traffic is recorded per datagram and legacy UDP traffic per packet
+enum class APS2TraceTransport : uint8_t { TCP = 0, UDP = 1 };
+
+struct APS2TraceRecord {
+  std::chrono::nanoseconds timestamp;
+  uint32_t ipAddr;
+  APS2TraceDirection direction;
+  APS2TraceTransport transport;
+  APS2Datagram datagram;
+};
+
+class APS2TraceWriter {
+public:
+  // Throws APS2_FILELOG_ERROR if the file cannot be created
+  APS2TraceWriter(const string &filename);
+  // Flushes everything recorded so far
+  ~APS2TraceWriter();
+
+  // payload is converted from network byte order when networkOrder is set
+  void record(uint32_t ipAddr, APS2TraceDirection, APS2TraceTransport,
+              APS2Command, uint32_t addr, const uint32_t *payload,
+              size_t payloadSize, bool networkOrder = false);
+
+  static const uint32_t VERSION = 1;
+
+private:
+  APS2TraceWriter(APS2TraceWriter const &) = delete;
+
+  FILE *file_;
+  std::chrono::steady_clock::time_point start_;
+
+  // the recording threads fill active_ while the writer thread drains
+  // the other buffer
+  vector<uint8_t> active_;
+  std::mutex lock_;
+  std::condition_variable wakeWriter_;
+  bool stopping_;
+  std::thread writerThread_;
+
+  void write_loop();
+};
+
+class APS2TraceReader {
+public:
+  // Throws APS2_FILELOG_ERROR if the file is missing or not a trace
+  APS2TraceReader(const string &filename);
+  ~APS2TraceReader();
+
+  // Returns false at the end of the trace
+  bool next(APS2TraceRecord &);
+
+private:
+  APS2TraceReader(APS2TraceReader const &) = delete;
+  FILE *file_;
+};
+
+#endif
@@ -0,0 +1,115 @@
+// Collects CSR reads and read-modify-writes so they reach the APS2 as one
+// pipelined burst
+//
+// Copyright 2016, Raytheon BBN Technologies
+
+#include "APS2Transaction.h"
+
+#include <set>
+
+#include "APS2_errno.h"
+
+size_t APS2Transaction::read(uint32_t addr) {
+  ops_.push_back({OpType::READ, addr, 0, 0});
+  return numReads_++;
+}
+
+void APS2Transaction::write(uint32_t addr, uint32_t value) {
+  write_masked(addr, value, 0xffffffff);
+}
+
+void APS2Transaction::write_masked(uint32_t addr, uint32_t value,
+                                   uint32_t mask) {
+  ops_.push_back({OpType::WRITE, addr, value, mask});
+}
+
+void APS2Transaction::set_bits(uint32_t addr,
+                               std::initializer_list<size_t> bits) {
+  uint32_t mask = bit_mask(bits);
+  write_masked(addr, mask, mask);
+}
+
+void APS2Transaction::clear_bits(uint32_t addr,
+                                 std::initializer_list<size_t> bits) {
+  write_masked(addr, 0, bit_mask(bits));
+}
+
+void APS2Transaction::toggle_bits(uint32_t addr,
+                                  std::initializer_list<size_t> bits) {
+  ops_.push_back({OpType::TOGGLE, addr, 0, bit_mask(bits)});
+}
+
+void APS2Transaction::barrier() { ops_.push_back({OpType::BARRIER, 0, 0, 0}); }
+
+bool APS2Transaction::empty() const { return ops_.empty(); }
+
+uint32_t APS2Transaction::result(size_t handle) const {
+  if (handle >= results_.size()) {
+    throw APS2_UNKNOWN_ERROR;
+  }
+  return results_[handle];
+}
+
+vector<uint32_t> APS2Transaction::registers_to_read() const {
+  // A register only needs reading if something looks at its old value before
+  // a full write replaces it
+  vector<uint32_t> addrs;
+  std::set<uint32_t> seen;
+  for (const auto &op : ops_) {
+    if (op.type == OpType::BARRIER || seen.count(op.addr)) {
+      continue;
+    }
+    seen.insert(op.addr);
+    if (op.type != OpType::WRITE || op.mask != 0xffffffff) {
+      addrs.push_back(op.addr);
+    }
+  }
+  return addrs;
+}
+
+vector<std::pair<uint32_t, uint32_t>>
+APS2Transaction::resolve(const std::map<uint32_t, uint32_t> &deviceValues) {
+  std::map<uint32_t, uint32_t> current(deviceValues);
+  vector<std::pair<uint32_t, uint32_t>> writes;
+  // registers written since the last barrier and where their write sits
+  std::map<uint32_t, size_t> pending;
+
+  results_.clear();
+  for (const auto &op : ops_) {
+    switch (op.type) {
+    case OpType::READ:
+      results_.push_back(current.at(op.addr));
+      break;
+    case OpType::WRITE:
+    case OpType::TOGGLE: {
+      // a full write needs no prior value
+      uint32_t &val = current[op.addr];
+      if (op.type == OpType::WRITE) {
+        val = (val & ~op.mask) | (op.value & op.mask);
+      } else {
+        val ^= op.mask;
+      }
+      auto it = pending.find(op.addr);
+      if (it == pending.end()) {
+        pending[op.addr] = writes.size();
+        writes.emplace_back(op.addr, val);
+      } else {
+        writes[it->second].second = val;
+      }
+      break;
+    }
+    case OpType::BARRIER:
+      pending.clear();
+      break;
+    }
+  }
+  return writes;
+}
+
+uint32_t APS2Transaction::bit_mask(std::initializer_list<size_t> bits) {
+  uint32_t mask = 0;
+  for (auto bit : bits) {
+    mask |= (1u << bit);
+  }
+  return mask;
+}
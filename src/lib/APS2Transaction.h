@@ -0,0 +1,66 @@
+// Collects CSR reads and read-modify-writes so they reach the APS2 as one
+// pipelined burst
+//
+// All the register reads a transaction needs go out together, then the merged
+// writes go out together, so a transaction costs at most two round trips
+// however many registers it touches. Writes to the same register are merged
+// into one unless separated by a barrier, e.g. to pulse a reset bit.
+//
+// Copyright 2016, Raytheon BBN Technologies
+
+#ifndef APS2TRANSACTION_H
+#define APS2TRANSACTION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <map>
+#include <utility>
+#include <vector>
+using std::vector;
+
+class APS2Transaction {
+public:
+  // Queue a read of the register as it stands at this point in the
+  // transaction; the handle looks up the value once committed
+  size_t read(uint32_t addr);
+
+  void write(uint32_t addr, uint32_t value);
+  // Only the bits set in mask are changed
+  void write_masked(uint32_t addr, uint32_t value, uint32_t mask);
+  void set_bits(uint32_t addr, std::initializer_list<size_t> bits);
+  void clear_bits(uint32_t addr, std::initializer_list<size_t> bits);
+  void toggle_bits(uint32_t addr, std::initializer_list<size_t> bits);
+
+  // Writes queued after a barrier are sent after, and separately from, those
+  // queued before it
+  void barrier();
+
+  bool empty() const;
+  uint32_t result(size_t handle) const;
+
+  // Used by APS2::commit
+  // Registers whose current value has to be read from the device
+  vector<uint32_t> registers_to_read() const;
+  // Work through the queued operations starting from the device values and
+  // return the merged (address, value) writes in the order they must be sent
+  vector<std::pair<uint32_t, uint32_t>>
+  resolve(const std::map<uint32_t, uint32_t> &deviceValues);
+
+private:
+  enum class OpType { READ, WRITE, TOGGLE, BARRIER };
+  struct Op {
+    OpType type;
+    uint32_t addr;
+    uint32_t value;
+    uint32_t mask;
+  };
+
+  vector<Op> ops_;
+  vector<uint32_t> results_;
+  size_t numReads_ = 0;
+
+  static uint32_t bit_mask(std::initializer_list<size_t> bits);
+};
+
+#endif
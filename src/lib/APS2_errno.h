@@ -27,7 +27,11 @@ enum APS2_STATUS {
   APS2_BITFILE_VALIDATION_FAILURE = -22,
   APS2_BAD_PLL_VALUE = -23,
   APS2_NO_WFS = -24,
-  APS2_WAVEFORM_FREQ_OVERFLOW = -25
+  APS2_WAVEFORM_FREQ_OVERFLOW = -25,
+  APS2_INVALID_ASYNC_TOKEN = -26,
+  APS2_MEMORY_FULL = -27,
+  APS2_UNKNOWN_MEMORY_ENTRY = -28,
+  APS2_INSTRUCTION_FIELD_OVERFLOW = -29
 };
 
 #ifdef __cplusplus
@@ -73,7 +77,15 @@ static std::map<APS2_STATUS, std::string> messages = {
     {APS2_BAD_PLL_VALUE, "Unexpected PLL chip value"},
     {APS2_NO_WFS, "Asked for waveform mode with no waveforms loaded"},
     {APS2_WAVEFORM_FREQ_OVERFLOW,
-     "Waveform frequency must be in range [-600MHz, 600MHz)"}};
+     "Waveform frequency must be in range [-600MHz, 600MHz)"},
+    {APS2_INVALID_ASYNC_TOKEN,
+     "Unknown asynchronous operation token. Tokens are released by wait_async."},
+    {APS2_MEMORY_FULL, "No free block of waveform or instruction memory is "
+                       "large enough. Remove unused entries to make room."},
+    {APS2_UNKNOWN_MEMORY_ENTRY,
+     "No waveform or sequence segment of that name has been added."},
+    {APS2_INSTRUCTION_FIELD_OVERFLOW,
+     "A value does not fit its field of the APS2 instruction."}};
 
 #endif
 
@@ -7,10 +7,20 @@
 
 #include "Channel.h"
 
-Channel::Channel() : number{-1}, enabled_{true}, waveform_(0), trigDelay_{0} {}
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#endif
+
+Channel::Channel()
+    : number{-1}, enabled_{true}, length_{0}, uploadedLength_{0},
+      trigDelay_{0} {}
 
 Channel::Channel(int number)
-    : number{number}, enabled_{true}, waveform_(0), trigDelay_{0} {}
+    : number{number}, enabled_{true}, length_{0}, uploadedLength_{0},
+      trigDelay_{0} {}
 
 Channel::~Channel() {
   // TODO Auto-generated destructor stub
@@ -23,90 +33,471 @@ int Channel::set_enabled(const bool &enable) {
 
 bool Channel::get_enabled() const { return enabled_; }
 
-size_t Channel::get_length() const { return waveform_.size(); }
+size_t Channel::get_length() const { return length_; }
 
 void Channel::set_waveform(const vector<float> &data) {
-  // Check whether we need to resize the waveform vector
-  if (data.size() > size_t(MAX_WF_LENGTH)) {
-    LOG(plog::info)
-        << "Warning: waveform too large to fit into memory. Waveform length: "
-        << data.size();
-  }
-
-  // Copy over the waveform data
-  // Waveform length must be a integer multiple of WF_MODULUS so resize to that
-  waveform_.resize(size_t(WF_MODULUS * ceil(float(data.size()) / WF_MODULUS)),
-                   0);
-  markers_.resize(waveform_.size());
-  std::copy(data.begin(), data.end(), waveform_.begin());
+  set_waveform(data.data(), data.size());
 }
 
 void Channel::set_waveform(const vector<int16_t> &data) {
-  if (data.size() > size_t(MAX_WF_LENGTH)) {
+  set_waveform(data.data(), data.size());
+}
+
+void Channel::set_waveform(const float *data, size_t numPts) {
+  uint32_t *out = resize_waveform(numPts);
+  bool clippedHigh, clippedLow;
+  pack_samples(data, markers_.empty() ? nullptr : markers_.data(), numPts, out,
+               clippedHigh, clippedLow);
+  warn_clipped(clippedHigh, clippedLow);
+  pad_waveform(numPts);
+}
+
+void Channel::set_waveform(const int16_t *data, size_t numPts) {
+  // Integer data is already scaled to the DAC so it is only clipped
+  uint32_t *out = resize_waveform(numPts);
+  bool clippedHigh, clippedLow;
+  pack_samples(data, markers_.empty() ? nullptr : markers_.data(), numPts, out,
+               clippedHigh, clippedLow);
+  warn_clipped(clippedHigh, clippedLow);
+  pad_waveform(numPts);
+}
+
+void Channel::set_packed_waveform(const uint32_t *data, size_t numPts,
+                                  const uint8_t *markers) {
+  if (markers) {
+    markers_.assign(markers, markers + numPts);
+  } else {
+    markers_.clear();
+  }
+  uint32_t *out = resize_waveform(numPts);
+  std::copy_n(data, packed_.size(), out);
+}
+
+uint32_t *Channel::resize_waveform(size_t numPts) {
+  // Check whether we need to resize the waveform vector
+  if (numPts > size_t(MAX_WF_LENGTH)) {
     LOG(plog::info)
         << "Warning: waveform too large to fit into memory. Waveform length: "
-        << data.size();
+        << numPts;
   }
 
   // Waveform length must be a integer multiple of WF_MODULUS so resize to that
-  waveform_.resize(size_t(WF_MODULUS * ceil(float(data.size()) / WF_MODULUS)),
-                   0);
-  markers_.resize(waveform_.size());
+  length_ = size_t(WF_MODULUS * ceil(float(numPts) / WF_MODULUS));
+  if (!markers_.empty()) {
+    markers_.resize(length_);
+  }
+  // SDRAM writes must be multiples of 16 bytes
+  size_t numWords = length_ / 2;
+  packed_.resize(4 * ((numWords + 3) / 4));
+  return packed_.data();
+}
 
-  // Copy over the waveform data and convert to scaled floats
-  for (size_t ct = 0; ct < data.size(); ct++) {
-    waveform_[ct] = float(data[ct]) / MAX_WF_AMP;
+void Channel::pad_waveform(size_t numPts) {
+  // zeros up to the waveform length then all ones to the end of the SDRAM word
+  for (size_t ct = numPts; ct < length_; ct++) {
+    uint32_t shift = 16 * (ct % 2);
+    uint32_t sample = markers_.empty() ? 0 : (markers_[ct] & 0x3) << 14;
+    packed_[ct / 2] =
+        (packed_[ct / 2] & ~(0xffffu << shift)) | (sample << shift);
   }
+  std::fill(packed_.begin() + length_ / 2, packed_.end(), 0xffffffff);
 }
 
 int Channel::set_markers(const vector<uint8_t> &data) {
-  if (data.size() > markers_.size()) {
+  return set_markers(data.data(), data.size());
+}
+
+int Channel::set_markers(const uint8_t *data, size_t numPts) {
+  if (markers_.size() < length_) {
+    markers_.resize(length_, 0);
+  }
+  if (numPts > markers_.size()) {
     LOG(plog::debug) << "Marker data length does not match previously "
                           "uploaded waveform data: "
-                       << data.size();
-    markers_.resize(size_t(WF_MODULUS * ceil(float(data.size()) / WF_MODULUS)),
-                    0);
+                       << numPts;
+    markers_.resize(size_t(WF_MODULUS * ceil(float(numPts) / WF_MODULUS)), 0);
   }
 
-  std::copy(data.begin(), data.end(), markers_.begin());
+  std::copy(data, data + numPts, markers_.begin());
+  merge_markers();
   return 0;
 }
 
+void Channel::merge_markers() {
+  // rewrite bits 15-14 of every sample in place; like pack_samples only the
+  // low two bits of a marker are kept
+  for (size_t ct = 0; ct < length_ / 2; ct++) {
+    uint32_t marks = 0;
+    if (2 * ct + 1 < markers_.size()) {
+      marks = (static_cast<uint32_t>(markers_[2 * ct] & 0x3) << 14) |
+              (static_cast<uint32_t>(markers_[2 * ct + 1] & 0x3) << 30);
+    }
+    packed_[ct] = (packed_[ct] & 0x3FFF3FFF) | marks;
+  }
+}
+
 vector<int16_t> Channel::prep_waveform() const {
-  // Apply the scale,offset and covert to integer format
-  vector<int16_t> prepVec(waveform_.size());
+  vector<int16_t> prepVec(length_);
   for (size_t ct = 0; ct < prepVec.size(); ct++) {
-    prepVec[ct] = int16_t(MAX_WF_AMP * waveform_[ct]);
+    prepVec[ct] = static_cast<int16_t>(packed_[ct / 2] >> (16 * (ct % 2)));
   }
+  return prepVec;
+}
 
-  // Clip to the max and min values allowed
-  // Signed integer data is asymmetric: can go to -8192 but only up to 8191.
-  if ((prepVec.size() > 0) &&
-      (*max_element(prepVec.begin(), prepVec.end()) > MAX_WF_AMP)) {
-    LOG(plog::warning) << "Waveform element too positive. Clipping to max.";
-    for (int16_t &tmpVal : prepVec) {
-      if (tmpVal > MAX_WF_AMP)
-        tmpVal = MAX_WF_AMP;
+vector<uint32_t> Channel::prep_packed_waveform() const { return packed_; }
+
+const vector<uint32_t> &Channel::packed_waveform() const { return packed_; }
+
+void Channel::copy_waveform(const Channel &other) {
+  packed_ = other.packed_;
+  length_ = other.length_;
+  if (!markers_.empty()) {
+    markers_.resize(length_);
+  }
+  if (markers_ != other.markers_) {
+    merge_markers();
+  }
+}
+
+vector<uint64_t> Channel::block_hashes(const vector<uint32_t> &packed) {
+  // FNV-1a over whole words in four interleaved lanes so the multiplies
+  // overlap
+  const uint64_t basis = 0xcbf29ce484222325ull;
+  const uint64_t prime = 0x100000001b3ull;
+  vector<uint64_t> hashes((packed.size() + WF_UPLOAD_BLOCK_WORDS - 1) /
+                          WF_UPLOAD_BLOCK_WORDS);
+  for (size_t block = 0; block < hashes.size(); block++) {
+    size_t start = block * WF_UPLOAD_BLOCK_WORDS;
+    size_t end = std::min(start + WF_UPLOAD_BLOCK_WORDS, packed.size());
+    uint64_t lanes[4] = {basis, basis ^ 1, basis ^ 2, basis ^ 3};
+    size_t ct = start;
+    for (; ct + 4 <= end; ct += 4) {
+      for (size_t lane = 0; lane < 4; lane++) {
+        lanes[lane] = (lanes[lane] ^ packed[ct + lane]) * prime;
+      }
+    }
+    for (; ct < end; ct++) {
+      lanes[0] = (lanes[0] ^ packed[ct]) * prime;
+    }
+    uint64_t hash = end - start;
+    for (auto lane : lanes) {
+      hash = (hash ^ lane) * prime;
     }
+    hashes[block] = hash;
   }
-  if ((prepVec.size() > 0) &&
-      (*min_element(prepVec.begin(), prepVec.end()) < -(MAX_WF_AMP + 1))) {
+  return hashes;
+}
+
+vector<std::pair<size_t, size_t>>
+Channel::dirty_ranges(const vector<uint64_t> &hashes, size_t numWords) const {
+  return dirty_ranges(uploadedBlocks_, hashes, numWords);
+}
+
+vector<std::pair<size_t, size_t>>
+Channel::dirty_ranges(const vector<uint64_t> &uploaded,
+                      const vector<uint64_t> &hashes, size_t numWords) {
+  vector<std::pair<size_t, size_t>> ranges;
+  for (size_t block = 0; block < hashes.size(); block++) {
+    if (block < uploaded.size() && uploaded[block] == hashes[block]) {
+      continue;
+    }
+    size_t start = block * WF_UPLOAD_BLOCK_WORDS;
+    size_t count = std::min(WF_UPLOAD_BLOCK_WORDS, numWords - start);
+    if (!ranges.empty() &&
+        ranges.back().first + ranges.back().second == start) {
+      ranges.back().second += count;
+    } else {
+      ranges.emplace_back(start, count);
+    }
+  }
+  return ranges;
+}
+
+bool Channel::upload_current(const vector<uint64_t> &hashes,
+                             size_t length) const {
+  return !uploadedBlocks_.empty() && length == uploadedLength_ &&
+         hashes == uploadedBlocks_;
+}
+
+void Channel::set_uploaded(const vector<uint64_t> &hashes, size_t length) {
+  uploadedBlocks_ = hashes;
+  uploadedLength_ = length;
+}
+
+void Channel::invalidate_upload() { uploadedBlocks_.clear(); }
+
+void Channel::warn_clipped(bool clippedHigh, bool clippedLow) {
+  if (clippedHigh) {
+    LOG(plog::warning) << "Waveform element too positive. Clipping to max.";
+  }
+  if (clippedLow) {
     LOG(plog::warning) << "Waveform element too negative. Clipping to min.";
-    for (int16_t &tmpVal : prepVec) {
-      if (tmpVal < -MAX_WF_AMP)
-        tmpVal = -MAX_WF_AMP;
+  }
+}
+
+// Signed integer data is asymmetric: can go to -8192 but only up to 8191.
+// Anything beyond is clipped to +/-8191 before the 14 bit DAC data is merged
+// with the 2 bit marker data.
+namespace {
+
+const int MIN_WF_AMP = -(MAX_WF_AMP + 1);
+
+inline uint16_t prep_sample(float val, uint8_t marker, bool &clippedHigh,
+                            bool &clippedLow) {
+  // saturate to int16 before converting so large values clip rather than
+  // wrap; NaN goes to the bottom like the vector kernels
+  float scaled = MAX_WF_AMP * val;
+  if (!(scaled >= -32768.0f)) {
+    scaled = -32768.0f;
+  } else if (scaled > 32767.0f) {
+    scaled = 32767.0f;
+  }
+  int32_t sample = static_cast<int32_t>(scaled);
+  if (sample > MAX_WF_AMP) {
+    sample = MAX_WF_AMP;
+    clippedHigh = true;
+  } else if (sample < MIN_WF_AMP) {
+    sample = -MAX_WF_AMP;
+    clippedLow = true;
+  }
+  return (static_cast<uint16_t>(sample) & 0x3FFF) |
+         static_cast<uint16_t>(marker << 14);
+}
+
+inline uint16_t prep_sample(int16_t val, uint8_t marker, bool &clippedHigh,
+                            bool &clippedLow) {
+  int16_t sample = val;
+  if (sample > MAX_WF_AMP) {
+    sample = MAX_WF_AMP;
+    clippedHigh = true;
+  } else if (sample < MIN_WF_AMP) {
+    sample = -MAX_WF_AMP;
+    clippedLow = true;
+  }
+  return (static_cast<uint16_t>(sample) & 0x3FFF) |
+         static_cast<uint16_t>(marker << 14);
+}
+
+// Once anything has been clipped low the most negative value -8192 is clipped
+// to -8191 too, as it always has been
+void clip_most_negative(size_t numPts, uint32_t *out) {
+  for (size_t word = 0; word < numPts / 2; word++) {
+    if ((out[word] & 0x3FFF) == 0x2000) {
+      out[word] |= 0x1;
+    }
+    if ((out[word] & 0x3FFF0000) == 0x20000000) {
+      out[word] |= 0x10000;
     }
   }
-  // merge 14-bit DAC data with 2-bit marker data
-  for (size_t ct = 0; ct < prepVec.size(); ct++) {
-    prepVec[ct] =
-        (prepVec[ct] & 0x3FFF) | (static_cast<uint16_t>(markers_[ct]) << 14);
+  if ((numPts % 2) && (out[numPts / 2] & 0x3FFF) == 0x2000) {
+    out[numPts / 2] |= 0x1;
+  }
+}
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define APS2_PACK_SSE2
+// Eight samples to four little-endian words per step. Returns the number of
+// samples handled.
+size_t pack_samples_sse2(const float *data, const uint8_t *markers,
+                         size_t numPts, uint32_t *out, bool &clippedHigh,
+                         bool &clippedLow) {
+  const __m128 scale = _mm_set1_ps(static_cast<float>(MAX_WF_AMP));
+  const __m128 lowest = _mm_set1_ps(-32768.0f);
+  const __m128 highest = _mm_set1_ps(32767.0f);
+  const __m128i maxAmp = _mm_set1_epi16(MAX_WF_AMP);
+  const __m128i minAmp = _mm_set1_epi16(MIN_WF_AMP);
+  const __m128i lowClip = _mm_set1_epi16(-MAX_WF_AMP);
+  const __m128i dataMask = _mm_set1_epi16(0x3FFF);
+  const __m128i zero = _mm_setzero_si128();
+  __m128i high = zero, low = zero;
+
+  size_t ct = 0;
+  for (; ct + 8 <= numPts; ct += 8) {
+    __m128 a = _mm_mul_ps(_mm_loadu_ps(data + ct), scale);
+    __m128 b = _mm_mul_ps(_mm_loadu_ps(data + ct + 4), scale);
+    a = _mm_min_ps(_mm_max_ps(a, lowest), highest);
+    b = _mm_min_ps(_mm_max_ps(b, lowest), highest);
+    __m128i samples =
+        _mm_packs_epi32(_mm_cvttps_epi32(a), _mm_cvttps_epi32(b));
+
+    __m128i over = _mm_cmpgt_epi16(samples, maxAmp);
+    __m128i under = _mm_cmplt_epi16(samples, minAmp);
+    high = _mm_or_si128(high, over);
+    low = _mm_or_si128(low, under);
+    samples = _mm_min_epi16(samples, maxAmp);
+    samples = _mm_or_si128(_mm_andnot_si128(under, samples),
+                           _mm_and_si128(under, lowClip));
+
+    __m128i marks =
+        markers ? _mm_unpacklo_epi8(_mm_loadl_epi64(
+                                        reinterpret_cast<const __m128i *>(
+                                            markers + ct)),
+                                    zero)
+                : zero;
+    samples = _mm_or_si128(_mm_and_si128(samples, dataMask),
+                           _mm_slli_epi16(marks, 14));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + ct / 2), samples);
+  }
+  clippedHigh |= _mm_movemask_epi8(high) != 0;
+  clippedLow |= _mm_movemask_epi8(low) != 0;
+  return ct;
+}
+
+// The same saturation for integer samples, eight at a time
+size_t pack_samples_sse2(const int16_t *data, const uint8_t *markers,
+                         size_t numPts, uint32_t *out, bool &clippedHigh,
+                         bool &clippedLow) {
+  const __m128i maxAmp = _mm_set1_epi16(MAX_WF_AMP);
+  const __m128i minAmp = _mm_set1_epi16(MIN_WF_AMP);
+  const __m128i lowClip = _mm_set1_epi16(-MAX_WF_AMP);
+  const __m128i dataMask = _mm_set1_epi16(0x3FFF);
+  const __m128i zero = _mm_setzero_si128();
+  __m128i high = zero, low = zero;
+
+  size_t ct = 0;
+  for (; ct + 8 <= numPts; ct += 8) {
+    __m128i samples =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + ct));
+    __m128i over = _mm_cmpgt_epi16(samples, maxAmp);
+    __m128i under = _mm_cmplt_epi16(samples, minAmp);
+    high = _mm_or_si128(high, over);
+    low = _mm_or_si128(low, under);
+    samples = _mm_min_epi16(samples, maxAmp);
+    samples = _mm_or_si128(_mm_andnot_si128(under, samples),
+                           _mm_and_si128(under, lowClip));
+
+    __m128i marks =
+        markers ? _mm_unpacklo_epi8(_mm_loadl_epi64(
+                                        reinterpret_cast<const __m128i *>(
+                                            markers + ct)),
+                                    zero)
+                : zero;
+    samples = _mm_or_si128(_mm_and_si128(samples, dataMask),
+                           _mm_slli_epi16(marks, 14));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(out + ct / 2), samples);
+  }
+  clippedHigh |= _mm_movemask_epi8(high) != 0;
+  clippedLow |= _mm_movemask_epi8(low) != 0;
+  return ct;
+}
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define APS2_PACK_AVX2
+// Sixteen samples to eight words per step on CPUs that have AVX2
+__attribute__((target("avx2"))) size_t
+pack_samples_avx2(const float *data, const uint8_t *markers, size_t numPts,
+                  uint32_t *out, bool &clippedHigh, bool &clippedLow) {
+  const __m256 scale = _mm256_set1_ps(static_cast<float>(MAX_WF_AMP));
+  const __m256 lowest = _mm256_set1_ps(-32768.0f);
+  const __m256 highest = _mm256_set1_ps(32767.0f);
+  const __m256i maxAmp = _mm256_set1_epi16(MAX_WF_AMP);
+  const __m256i minAmp = _mm256_set1_epi16(MIN_WF_AMP);
+  const __m256i lowClip = _mm256_set1_epi16(-MAX_WF_AMP);
+  const __m256i dataMask = _mm256_set1_epi16(0x3FFF);
+  __m256i high = _mm256_setzero_si256(), low = _mm256_setzero_si256();
+
+  size_t ct = 0;
+  for (; ct + 16 <= numPts; ct += 16) {
+    __m256 a = _mm256_mul_ps(_mm256_loadu_ps(data + ct), scale);
+    __m256 b = _mm256_mul_ps(_mm256_loadu_ps(data + ct + 8), scale);
+    a = _mm256_min_ps(_mm256_max_ps(a, lowest), highest);
+    b = _mm256_min_ps(_mm256_max_ps(b, lowest), highest);
+    // packs works within 128 bit lanes so put the quarters back in order
+    __m256i samples = _mm256_permute4x64_epi64(
+        _mm256_packs_epi32(_mm256_cvttps_epi32(a), _mm256_cvttps_epi32(b)),
+        0xD8);
+
+    __m256i over = _mm256_cmpgt_epi16(samples, maxAmp);
+    __m256i under = _mm256_cmpgt_epi16(minAmp, samples);
+    high = _mm256_or_si256(high, over);
+    low = _mm256_or_si256(low, under);
+    samples = _mm256_min_epi16(samples, maxAmp);
+    samples = _mm256_blendv_epi8(samples, lowClip, under);
+
+    __m256i marks = markers ? _mm256_cvtepu8_epi16(_mm_loadu_si128(
+                                  reinterpret_cast<const __m128i *>(
+                                      markers + ct)))
+                            : _mm256_setzero_si256();
+    samples = _mm256_or_si256(_mm256_and_si256(samples, dataMask),
+                              _mm256_slli_epi16(marks, 14));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(out + ct / 2), samples);
+  }
+  clippedHigh |= _mm256_movemask_epi8(high) != 0;
+  clippedLow |= _mm256_movemask_epi8(low) != 0;
+  return ct;
+}
+
+bool have_avx2() {
+  static const bool avx2 = __builtin_cpu_supports("avx2");
+  return avx2;
+}
+#endif
+
+} // namespace
+
+void Channel::pack_samples(const float *data, const uint8_t *markers,
+                           size_t numPts, uint32_t *out, bool &clippedHigh,
+                           bool &clippedLow) {
+  clippedHigh = false;
+  clippedLow = false;
+  size_t ct = 0;
+#ifdef APS2_PACK_AVX2
+  if (have_avx2()) {
+    ct = pack_samples_avx2(data, markers, numPts, out, clippedHigh,
+                           clippedLow);
+  }
+#endif
+#ifdef APS2_PACK_SSE2
+  ct += pack_samples_sse2(data + ct, markers ? markers + ct : nullptr,
+                          numPts - ct, out + ct / 2, clippedHigh, clippedLow);
+#endif
+  // the rest a pair at a time; an odd last sample is paired with padding
+  for (; ct < numPts; ct += 2) {
+    uint32_t word = prep_sample(data[ct], markers ? markers[ct] : 0,
+                                clippedHigh, clippedLow);
+    word |= (ct + 1 < numPts)
+                ? static_cast<uint32_t>(
+                      prep_sample(data[ct + 1], markers ? markers[ct + 1] : 0,
+                                  clippedHigh, clippedLow))
+                      << 16
+                : 0xffff0000;
+    out[ct / 2] = word;
+  }
+  if (clippedLow) {
+    clip_most_negative(numPts, out);
+  }
+}
+
+void Channel::pack_samples(const int16_t *data, const uint8_t *markers,
+                           size_t numPts, uint32_t *out, bool &clippedHigh,
+                           bool &clippedLow) {
+  clippedHigh = false;
+  clippedLow = false;
+  size_t ct = 0;
+#ifdef APS2_PACK_SSE2
+  ct = pack_samples_sse2(data, markers, numPts, out, clippedHigh, clippedLow);
+#endif
+  // the rest a pair at a time; an odd last sample is paired with padding
+  for (; ct < numPts; ct += 2) {
+    uint32_t word = prep_sample(data[ct], markers ? markers[ct] : 0,
+                                clippedHigh, clippedLow);
+    word |= (ct + 1 < numPts)
+                ? static_cast<uint32_t>(
+                      prep_sample(data[ct + 1], markers ? markers[ct + 1] : 0,
+                                  clippedHigh, clippedLow))
+                      << 16
+                : 0xffff0000;
+    out[ct / 2] = word;
+  }
+  if (clippedLow) {
+    clip_most_negative(numPts, out);
   }
-  return prepVec;
 }
 
 int Channel::clear_data() {
-  waveform_.clear();
+  packed_.clear();
+  length_ = 0;
   return 0;
 }
 
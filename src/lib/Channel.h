@@ -14,6 +14,7 @@ using std::vector;
 #include <cstdint> //fixed width integers
 #include <string>
 using std::string;
+#include <utility>
 // #include "H5Cpp.h"
 #include <algorithm> //max_element
 #include <math.h>    //ceil
@@ -34,8 +35,52 @@ public:
 
   void set_waveform(const vector<float> &);
   void set_waveform(const vector<int16_t> &);
+  // The caller's samples are read once, straight into the device format
+  void set_waveform(const float *, size_t);
+  void set_waveform(const int16_t *, size_t);
+  // numPts samples already packed two a word with their markers merged in,
+  // and padded to whole SDRAM words, as a version 2 sequence file holds them;
+  // markers may be null
+  void set_packed_waveform(const uint32_t *, size_t numPts,
+                           const uint8_t *markers);
   int set_markers(const vector<uint8_t> &);
+  int set_markers(const uint8_t *, size_t);
   vector<int16_t> prep_waveform() const;
+  // prep_waveform packed two samples per word and padded with 0xffffffff to
+  // whole 16 byte SDRAM words, ready to upload
+  vector<uint32_t> prep_packed_waveform() const;
+  const vector<uint32_t> &packed_waveform() const;
+
+  // Fused kernel behind set_waveform: scales, saturates, clips and merges the
+  // markers of numPts samples into (numPts + 1) / 2 packed words in one pass.
+  // Reports which way anything was clipped so callers can warn once.
+  // Without markers they are taken to be zero.
+  static void pack_samples(const float *data, const uint8_t *markers,
+                           size_t numPts, uint32_t *out, bool &clippedHigh,
+                           bool &clippedLow);
+  // Integer samples are already scaled to the DAC so they are only clipped
+  // to the 14 bit range the same way before the markers are merged in.
+  static void pack_samples(const int16_t *data, const uint8_t *markers,
+                           size_t numPts, uint32_t *out, bool &clippedHigh,
+                           bool &clippedLow);
+
+  // Take over another channel's waveform keeping this channel's markers
+  void copy_waveform(const Channel &);
+
+  // Fingerprints of each WF_UPLOAD_BLOCK_WORDS block of packed words
+  static vector<uint64_t> block_hashes(const vector<uint32_t> &packed);
+  // Word (offset, count) ranges of numWords packed words whose blocks differ
+  // from the last upload, neighbouring blocks coalesced; all of it if the
+  // device contents are unknown
+  vector<std::pair<size_t, size_t>>
+  dirty_ranges(const vector<uint64_t> &hashes, size_t numWords) const;
+  // The same against any record of what the device holds
+  static vector<std::pair<size_t, size_t>>
+  dirty_ranges(const vector<uint64_t> &uploaded,
+               const vector<uint64_t> &hashes, size_t numWords);
+  bool upload_current(const vector<uint64_t> &hashes, size_t length) const;
+  void set_uploaded(const vector<uint64_t> &hashes, size_t length);
+  void invalidate_upload();
 
   int clear_data();
 
@@ -46,9 +91,22 @@ public:
   friend class BankBouncerThread;
 
 private:
+  uint32_t *resize_waveform(size_t numPts);
+  void pad_waveform(size_t numPts);
+  void merge_markers();
+  static void warn_clipped(bool clippedHigh, bool clippedLow);
+
   bool enabled_;
-  vector<float> waveform_;
+  // The waveform is held as the device holds it, two samples a word with the
+  // markers merged in, whether it was given as floats or integers, so neither
+  // the caller's data nor a float or int16 copy has to be kept around
+  vector<uint32_t> packed_;
+  size_t length_;
+  // empty until markers are set
   vector<uint8_t> markers_;
+  // what the device memory was last loaded with; empty if unknown
+  vector<uint64_t> uploadedBlocks_;
+  size_t uploadedLength_;
   int trigDelay_;
 };
 
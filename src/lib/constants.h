@@ -12,6 +12,8 @@ using std::vector;
 
 #include <plog/Log.h>
 
+#include "APS2Instruction.h"
+
 #ifndef CONSTANTS_H_
 #define CONSTANTS_H_
 
@@ -24,11 +26,39 @@ const size_t MAX_WF_LENGTH =
     1 << 26; // only use 256MB for now - 256MB / 2 channels / 2 bytes per sample
 const int MAX_WF_AMP = (1 << 13) - 1; // 14 bit signed DAC
 const int WF_MODULUS = 4;
+// Waveform re-uploads only send the 4kB blocks that changed
+const size_t WF_UPLOAD_BLOCK_WORDS = 1024;
+// Uploads from host memory are converted to network byte order and sent 1MB
+// at a time
+const size_t UPLOAD_CHUNK_WORDS = 1 << 18;
+// Sequence files are read from disk this far ahead of the upload
+const size_t SEQFILE_READAHEAD_BYTES = 16 << 20;
 const size_t MAX_LL_LENGTH = (1 << 24);
 const unsigned CORRECTION_MATRIX_SCALING = (1 << 13); //Q2.13
 
 const std::chrono::seconds COMMS_TIMEOUT = std::chrono::seconds(3);
 
+// Reads are split into requests of at most 1kB for the APS2 message processor
+// with up to READ_PIPELINE_DEPTH outstanding at once
+const uint32_t MAX_READ_WORDS = 256;
+const size_t READ_PIPELINE_DEPTH = 8;
+
+// Number of acknowledged TCP datagrams allowed in flight before waiting on acks
+const size_t DEFAULT_ACK_WINDOW = 4;
+// After a failed exchange, how long to wait for each response still in flight
+// before giving up on the stream and reconnecting
+const std::chrono::milliseconds DRAIN_TIMEOUT = std::chrono::milliseconds(500);
+
+// Longest wait for enumerate responses
+const std::chrono::milliseconds ENUMERATE_TIMEOUT = std::chrono::milliseconds(100);
+
+// Number of threads servicing socket completions in the ethernet interface
+const size_t DEFAULT_IO_THREADS = 4;
+
+// Number of log2 microsecond buckets in the transport latency histograms; the
+// last one collects everything from about 4s up
+const size_t LATENCY_HISTOGRAM_BUCKETS = 24;
+
 const int MAX_DAC_CLOCK_PHASE_TEST_TRIES = 20;
 
 // Chip config SPI commands for setting up DAC,PLL,VXCO
@@ -260,6 +290,7 @@ const uint32_t CH_B_WF_LENGTH_ADDR = CSR_AXI_OFFSET + 33 * 4;
 const uint32_t WF_SSB_FREQ_ADDR = CSR_AXI_OFFSET + 34 * 4;
 const uint32_t BITSLIP_A_ADDR = CSR_AXI_OFFSET + 35 * 4;
 const uint32_t BITSLIP_B_ADDR = CSR_AXI_OFFSET + 36 * 4;
+const uint32_t NUM_CSR_REGISTERS = 37;
 
 // TDM specific registers
 // .. none yet
@@ -269,6 +300,10 @@ const uint32_t MEMORY_ADDR = 0x00000000u;
 const uint32_t WFA_OFFSET = 0;
 const uint32_t WFB_OFFSET = 0x10000000u;
 const uint32_t SEQ_OFFSET = 0x20000000u;
+const uint32_t WF_REGION_SIZE = WFB_OFFSET - WFA_OFFSET;
+// What the 24 bit quad-sample address of a WAVEFORM instruction reaches
+const size_t WF_LIBRARY_SIZE = 2 * MAX_WF_LENGTH;
+const uint32_t SEQ_REGION_SIZE = 0x40000000u - SEQ_OFFSET;
 
 // sequencer control bits
 const unsigned SM_ENABLE_BIT = 0; // state machine enable
@@ -393,18 +428,25 @@ const vector<uint8_t> VCXO_INIT = {0x8, 0x60, 0x0, 0x4, 0x64, 0x91, 0x0, 0x61};
 
 // "waveform mode" sequence
 const vector<uint64_t> WF_SEQ_TRIG = {
-    0xa100610000000000L, // set NCO 0 frequency
-    0xa100210000000000L, // reset phase
-    0x2100400000000000L, // WAIT for trig
+    // set NCO 0 frequency
+    APS2Instruction::modulator(APS2Instruction::ModulatorOp::SET_FREQUENCY,
+                               0x1),
+    // reset phase
+    APS2Instruction::modulator(APS2Instruction::ModulatorOp::RESET_PHASE, 0x1),
+    // WAIT for trig
+    APS2Instruction::wait(),
     // insert waveform instructions here
-    0x6000000000000001L //  GOTO 1 to reset phase and wait for trigger again
-};
+    // GOTO 1 to reset phase and wait for trigger again
+    APS2Instruction::goto_(1)};
 
 const vector<uint64_t> WF_SEQ_CW = {
-    0xa100610000000000L, // set NCO 0 frequency
-    0x9100800000000000L, // WAIT for sync to implement NCO frequency update
+    // set NCO 0 frequency
+    APS2Instruction::modulator(APS2Instruction::ModulatorOp::SET_FREQUENCY,
+                               0x1),
+    // SYNC to implement NCO frequency update
+    APS2Instruction::sync(),
     // insert waveform instructions here
-    0x6000000000000002L //  GOTO 2 for continuous WF output
-};
+    // GOTO 2 for continuous WF output
+    APS2Instruction::goto_(2)};
 
 #endif /* CONSTANTS_H_ */
@@ -3,7 +3,11 @@
  *
  */
 
+#include <algorithm>
+#include <chrono>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <sstream>
 using std::weak_ptr;
 #include <map>
@@ -23,6 +27,18 @@ weak_ptr<APS2Ethernet>
 map<string, std::unique_ptr<APS2>> APSs; // map to hold on to the APS instances
 set<string>
     deviceSerials; // set of APSs that responded to an enumerate broadcast
+size_t ack_window =
+    DEFAULT_ACK_WINDOW; // TCP acknowledge window for the ethernet interface
+size_t io_threads =
+    DEFAULT_IO_THREADS; // io thread pool size for the ethernet interface
+vector<APS2 *> APSHandles; // connected APSs indexed by handle - 1; slots are
+                           // cleared on disconnect and never reused
+std::mutex APSs_lock; // guards APSs and APSHandles against connects and
+                      // disconnects on other threads
+map<APS2_ASYNC_TOKEN, std::future<APS2_STATUS>>
+    asyncOps; // outstanding asynchronous operations
+APS2_ASYNC_TOKEN nextAsyncToken = 1;
+std::mutex asyncOps_lock;
 
 // stub class to open loggers
 class InitAndCleanUp {
@@ -58,7 +74,9 @@ shared_ptr<APS2Ethernet> get_interface() {
 
   if (!myEthernetRM) {
     try {
-      myEthernetRM = std::make_shared<APS2Ethernet>();
+      myEthernetRM =
+          std::make_shared<APS2Ethernet>(UDP_PORT_OLD, UDP_PORT, io_threads);
+      myEthernetRM->set_ack_window(ack_window);
     } catch (APS2_STATUS e) {
       LOG(plog::error) << "Failed to create ethernet interface.";
       throw;
@@ -72,44 +90,47 @@ shared_ptr<APS2Ethernet> get_interface() {
   return myEthernetRM;
 }
 
-// Define a couple of templated wrapper functions to make library calls and
-// catch thrown errors
-// First one for void calls
-template <typename F, typename... Args>
-APS2_STATUS aps2_call(const char *deviceSerial, F func, Args... args) {
-  try {
-    // for some reason with "(APSs.at(deviceSerial)->*func)(args...);" the
-    // compiler doesn't like "->*"
-    (*(APSs.at(deviceSerial)).*func)(args...);
-    // Nothing thrown then assume OK
-    return APS2_OK;
-  } catch (std::out_of_range e) {
-    if (APSs.find(deviceSerial) == APSs.end()) {
-      return APS2_UNCONNECTED;
-    } else {
-      return APS2_UNKNOWN_ERROR;
+// Look up the APS2 instance by IP string or by handle from connect_APS_handle
+APS2 *get_APS(const char *deviceSerial) {
+  std::lock_guard<std::mutex> guard(APSs_lock);
+  auto it = APSs.find(deviceSerial);
+  if (it == APSs.end()) {
+    throw APS2_UNCONNECTED;
+  }
+  return it->second.get();
+}
+
+APS2 *get_APS(APS2_HANDLE handle) {
+  std::lock_guard<std::mutex> guard(APSs_lock);
+  if ((handle == 0) || (handle > APSHandles.size()) ||
+      (APSHandles[handle - 1] == nullptr)) {
+    throw APS2_UNCONNECTED;
+  }
+  return APSHandles[handle - 1];
+}
+
+// The IP string is still needed for a few calls that go straight to the
+// ethernet interface
+string get_serial(APS2_HANDLE handle) {
+  APS2 *aps = get_APS(handle);
+  std::lock_guard<std::mutex> guard(APSs_lock);
+  for (auto &kv : APSs) {
+    if (kv.second.get() == aps) {
+      return kv.first;
     }
-  } catch (APS2_STATUS status) {
-    return status;
-  } catch (...) {
-    return APS2_UNKNOWN_ERROR;
   }
+  throw APS2_UNCONNECTED;
 }
 
-// and one for to store getter values in pointer passed to library
-template <typename R, typename F, typename... Args>
-APS2_STATUS aps2_getter(const char *deviceSerial, F func, R *resPtr,
-                        Args... args) {
+// Define a couple of templated wrapper functions to make library calls and
+// catch thrown errors. The device can be either an IP string or a handle.
+// First one for void calls
+template <typename D, typename F, typename... Args>
+APS2_STATUS aps2_call(D device, F func, Args &&... args) {
   try {
-    *resPtr = (*(APSs.at(deviceSerial)).*func)(args...);
+    (get_APS(device)->*func)(args...);
     // Nothing thrown then assume OK
     return APS2_OK;
-  } catch (std::out_of_range e) {
-    if (APSs.find(deviceSerial) == APSs.end()) {
-      return APS2_UNCONNECTED;
-    } else {
-      return APS2_UNKNOWN_ERROR;
-    }
   } catch (APS2_STATUS status) {
     return status;
   } catch (...) {
@@ -117,25 +138,12 @@ APS2_STATUS aps2_getter(const char *deviceSerial, F func, R *resPtr,
   }
 }
 
-#ifdef __cplusplus
-extern "C" {
-#endif
-
-const char *get_error_msg(APS2_STATUS err) {
-  if (messages.count(err)) {
-    return messages[err].c_str();
-  } else {
-    return "No error message for this status number.";
-  }
-}
-
-APS2_STATUS get_numDevices(unsigned int *numDevices) {
-  /*
-  Returns the number of APS2s that respond to a broadcast status request.
-  */
+// and one for to store getter values in pointer passed to library
+template <typename D, typename R, typename F, typename... Args>
+APS2_STATUS aps2_getter(D device, F func, R *resPtr, Args &&... args) {
   try {
-    deviceSerials = get_interface()->enumerate();
-    *numDevices = deviceSerials.size();
+    *resPtr = (get_APS(device)->*func)(args...);
+    // Nothing thrown then assume OK
     return APS2_OK;
   } catch (APS2_STATUS status) {
     return status;
@@ -144,36 +152,12 @@ APS2_STATUS get_numDevices(unsigned int *numDevices) {
   }
 }
 
-APS2_STATUS get_device_IPs(const char **deviceSerialsOut) {
-  /*
-  Fill in an array of char* with null-terminated char arrays with the
-  enumerated device ip addresses.
-  Assumes sufficient memory has been allocated
-  */
-  size_t ct = 0;
-  for (auto &serial : deviceSerials) {
-    deviceSerialsOut[ct] = serial.c_str();
-    ct++;
-  }
-  return APS2_OK;
-}
-
-APS2_STATUS connect_APS(const char *deviceSerial) {
-  /*
-  Connect to a device specified by serial number string
-  */
-  string serial = string(deviceSerial);
-  // create the APS2 object if it is not already in the map
-  if (APSs.find(serial) == APSs.end()) {
-    // C++14 use std::make_unique
-    APSs.insert(
-        std::make_pair(serial, std::unique_ptr<APS2>(new APS2(serial))));
-  }
-  // Can't seem to bind the interface lvalue to
-  // ‘std::shared_ptr<APS2Ethernet>&&’
-  // return aps2_call(deviceSerial, &APS2::connect, get_interface());
+// and one to copy vector results into the array passed to library
+template <typename D, typename R, typename F, typename... Args>
+APS2_STATUS aps2_vector_getter(D device, F func, R *resPtr, Args... args) {
   try {
-    APSs.at(deviceSerial)->connect(get_interface());
+    auto res = (get_APS(device)->*func)(args...);
+    std::copy(res.begin(), res.end(), resPtr);
     return APS2_OK;
   } catch (APS2_STATUS status) {
     return status;
@@ -182,35 +166,9 @@ APS2_STATUS connect_APS(const char *deviceSerial) {
   }
 }
 
-APS2_STATUS disconnect_APS(const char *deviceSerial) {
-  /*
-  Tear-down connection to APS specified by serial number string.
-  */
-  APS2_STATUS status = aps2_call(deviceSerial, &APS2::disconnect);
-  APSs.erase(string(deviceSerial));
-  return status;
-}
-
-APS2_STATUS reset(const char *deviceSerial, APS2_RESET_MODE mode) {
-  switch (mode) {
-  case RESET_TCP:
-    // For TCP we may not have an APS2 device (we can't connect) so directly
-    // call APS2Ethernet method
-    get_interface()->reset_tcp(deviceSerial);
-    return APS2_OK;
-  default:
-    return aps2_call(deviceSerial, &APS2::reset, mode);
-  }
-}
-
-// Initialize an APS unit
-APS2_STATUS init_APS(const char *deviceSerial, int forceReload) {
-  return aps2_call(deviceSerial, &APS2::init, bool(forceReload), 0);
-}
-
-APS2_STATUS get_firmware_version(const char *ipAddr, uint32_t *version,
-                                 uint32_t *git_sha1, uint32_t *build_timestamp,
-                                 char *version_string) {
+template <typename D>
+APS2_STATUS firmware_version(D ipAddr, uint32_t *version, uint32_t *git_sha1,
+                             uint32_t *build_timestamp, char *version_string) {
   APS2_STATUS status = APS2_OK;
   if (version != nullptr) {
     status = aps2_getter(ipAddr, &APS2::get_firmware_version, version);
@@ -284,6 +242,430 @@ APS2_STATUS get_firmware_version(const char *ipAddr, uint32_t *version,
   return status;
 }
 
+template <typename D> APS2_STATUS ip_addr_getter(D device, char *ipAddrPtr) {
+  try {
+    uint32_t ipAddr = get_APS(device)->get_ip_addr();
+    string ipAddrStr = asio::ip::address_v4(ipAddr).to_string();
+    ipAddrStr.copy(ipAddrPtr, ipAddrStr.size(), 0);
+    return APS2_OK;
+  } catch (APS2_STATUS status) {
+    return status;
+  } catch (...) {
+    return APS2_UNKNOWN_ERROR;
+  }
+}
+
+static_assert(APS2_LATENCY_BUCKETS == LATENCY_HISTOGRAM_BUCKETS,
+              "C API histogram size must match the driver's");
+
+template <typename D>
+APS2_STATUS metrics_getter(D device, APS2_METRICS *metricsPtr) {
+  try {
+    auto metrics = get_APS(device)->get_transport_metrics();
+    auto load = [](const std::atomic<uint64_t> &counter) {
+      return counter.load(std::memory_order_relaxed);
+    };
+    metricsPtr->bytesSent = load(metrics->bytesSent);
+    metricsPtr->bytesReceived = load(metrics->bytesReceived);
+    metricsPtr->datagramsSent = load(metrics->datagramsSent);
+    metricsPtr->datagramsReceived = load(metrics->datagramsReceived);
+    metricsPtr->timeouts = load(metrics->timeouts);
+    metricsPtr->retries = load(metrics->retries);
+    metricsPtr->sendBlockedUS = load(metrics->sendBlockedNs) / 1000;
+    metricsPtr->readBlockedUS = load(metrics->readBlockedNs) / 1000;
+    metrics->ackLatency.snapshot(metricsPtr->ackLatency);
+    metrics->readLatency.snapshot(metricsPtr->readLatency);
+    return APS2_OK;
+  } catch (APS2_STATUS status) {
+    return status;
+  } catch (...) {
+    return APS2_UNKNOWN_ERROR;
+  }
+}
+
+template <typename D> APS2_STATUS metrics_reset(D device) {
+  try {
+    get_APS(device)->get_transport_metrics()->reset();
+    return APS2_OK;
+  } catch (APS2_STATUS status) {
+    return status;
+  } catch (...) {
+    return APS2_UNKNOWN_ERROR;
+  }
+}
+
+template <typename D, typename F, typename... Args>
+APS2_STATUS memory_usage_getter(D device, APS2_MEMORY_USAGE *usagePtr, F func,
+                                Args... args) {
+  try {
+    APS2MemoryUsage usage = (get_APS(device)->*func)(args...);
+    usagePtr->totalBytes = usage.totalBytes;
+    usagePtr->usedBytes = usage.usedBytes;
+    usagePtr->largestFreeBytes = usage.largestFreeBytes;
+    usagePtr->numEntries = static_cast<uint32_t>(usage.numAllocations);
+    usagePtr->numFreeBlocks = static_cast<uint32_t>(usage.numFreeBlocks);
+    return APS2_OK;
+  } catch (APS2_STATUS status) {
+    return status;
+  } catch (...) {
+    return APS2_UNKNOWN_ERROR;
+  }
+}
+
+// Run a group upload on the connected devices among deviceSerials and collect
+// each device's result in statuses. Returns APS2_OK or the first failure.
+template <typename F>
+APS2_STATUS aps2_many(const char **deviceSerials, unsigned int numDevices,
+                      APS2_STATUS *statuses, F upload) {
+  try {
+    vector<APS2 *> devices;
+    vector<unsigned int> indices;
+    {
+      std::lock_guard<std::mutex> guard(APSs_lock);
+      for (unsigned int ct = 0; ct < numDevices; ct++) {
+        auto it = APSs.find(deviceSerials[ct]);
+        if (it == APSs.end()) {
+          statuses[ct] = APS2_UNCONNECTED;
+          continue;
+        }
+        devices.push_back(it->second.get());
+        indices.push_back(ct);
+      }
+    }
+
+    auto results = upload(devices);
+    for (size_t ct = 0; ct < results.size(); ct++) {
+      APS2_STATUS &status = statuses[indices[ct]];
+      try {
+        results[ct].get();
+        status = APS2_OK;
+      } catch (APS2_STATUS e) {
+        status = e;
+      } catch (...) {
+        status = APS2_UNKNOWN_ERROR;
+      }
+    }
+
+    for (unsigned int ct = 0; ct < numDevices; ct++) {
+      if (statuses[ct] != APS2_OK) {
+        return statuses[ct];
+      }
+    }
+    return APS2_OK;
+  } catch (APS2_STATUS status) {
+    return status;
+  } catch (...) {
+    return APS2_UNKNOWN_ERROR;
+  }
+}
+
+// Adapt a C discovery callback, which may be null, for APS2Ethernet
+APS2Ethernet::DiscoveryCallback
+discovery_callback(APS2_DISCOVERY_CALLBACK callback) {
+  if (!callback) {
+    return nullptr;
+  }
+  return [callback](const string &ip) { callback(ip.c_str()); };
+}
+
+// Queue a call on the device's async worker and hand back a token for
+// poll_async/wait_async. The status is returned rather than thrown so it comes
+// back through the future.
+template <typename D, typename F>
+APS2_STATUS aps2_async(D device, APS2_ASYNC_TOKEN *token, F task) {
+  try {
+    APS2 *aps = get_APS(device);
+    auto result = aps->run_async([aps, task]() -> APS2_STATUS {
+      try {
+        task(aps);
+        return APS2_OK;
+      } catch (APS2_STATUS status) {
+        return status;
+      } catch (...) {
+        return APS2_UNKNOWN_ERROR;
+      }
+    });
+    std::lock_guard<std::mutex> guard(asyncOps_lock);
+    *token = nextAsyncToken++;
+    asyncOps[*token] = std::move(result);
+    return APS2_OK;
+  } catch (APS2_STATUS status) {
+    return status;
+  } catch (...) {
+    return APS2_UNKNOWN_ERROR;
+  }
+}
+
+// Data is copied when the call is queued so the caller can reuse the buffer
+template <typename D, typename T>
+APS2_STATUS queue_set_waveform(D device, int channelNum, T *data, int numPts,
+                               APS2_ASYNC_TOKEN *token) {
+  vector<T> waveform(data, data + numPts);
+  return aps2_async(device, token, [channelNum, waveform](APS2 *aps) {
+    aps->set_waveform(channelNum, waveform);
+  });
+}
+
+template <typename D>
+APS2_STATUS queue_write_sequence(D device, uint64_t *data, uint32_t numWords,
+                                 APS2_ASYNC_TOKEN *token) {
+  vector<uint64_t> sequence(data, data + numWords);
+  return aps2_async(device, token, [sequence](APS2 *aps) {
+    aps->write_sequence(sequence);
+  });
+}
+
+template <typename D>
+APS2_STATUS queue_write_memory(D device, uint32_t addr, uint32_t *data,
+                               uint32_t numWords, APS2_ASYNC_TOKEN *token) {
+  vector<uint32_t> words(data, data + numWords);
+  return aps2_async(device, token, [addr, words](APS2 *aps) {
+    aps->write_memory(addr, words);
+  });
+}
+
+// Read data is written as it arrives so the buffer must stay valid until
+// wait_async returns
+template <typename D>
+APS2_STATUS queue_read_memory(D device, uint32_t addr, uint32_t *data,
+                              uint32_t numWords, APS2_ASYNC_TOKEN *token) {
+  return aps2_async(device, token, [addr, data, numWords](APS2 *aps) {
+    aps->read_memory(addr, numWords, data);
+  });
+}
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+const char *get_error_msg(APS2_STATUS err) {
+  if (messages.count(err)) {
+    return messages[err].c_str();
+  } else {
+    return "No error message for this status number.";
+  }
+}
+
+APS2_STATUS get_numDevices(unsigned int *numDevices) {
+  /*
+  Returns the number of APS2s that respond to a broadcast status request.
+  */
+  try {
+    deviceSerials = get_interface()->enumerate();
+    *numDevices = deviceSerials.size();
+    return APS2_OK;
+  } catch (APS2_STATUS status) {
+    return status;
+  } catch (...) {
+    return APS2_UNKNOWN_ERROR;
+  }
+}
+
+APS2_STATUS enumerate_devices(unsigned int expectedCount,
+                              unsigned int timeoutMS,
+                              APS2_DISCOVERY_CALLBACK callback,
+                              unsigned int *numDevices) {
+  /*
+  Like get_numDevices but returns once expectedCount APS2s have responded
+  */
+  try {
+    deviceSerials = get_interface()->enumerate(
+        expectedCount, std::chrono::milliseconds(timeoutMS),
+        discovery_callback(callback));
+    *numDevices = deviceSerials.size();
+    return APS2_OK;
+  } catch (APS2_STATUS status) {
+    return status;
+  } catch (...) {
+    return APS2_UNKNOWN_ERROR;
+  }
+}
+
+APS2_STATUS enumerate_known_devices(const char **deviceIPs,
+                                    unsigned int numIPs,
+                                    unsigned int timeoutMS,
+                                    APS2_DISCOVERY_CALLBACK callback,
+                                    unsigned int *numDevices) {
+  /*
+  Like get_numDevices but returns once all the given APS2s have responded
+  */
+  try {
+    set<string> expected(deviceIPs, deviceIPs + numIPs);
+    deviceSerials = get_interface()->enumerate(
+        expected, std::chrono::milliseconds(timeoutMS),
+        discovery_callback(callback));
+    *numDevices = deviceSerials.size();
+    return APS2_OK;
+  } catch (APS2_STATUS status) {
+    return status;
+  } catch (...) {
+    return APS2_UNKNOWN_ERROR;
+  }
+}
+
+APS2_STATUS get_device_IPs(const char **deviceSerialsOut) {
+  /*
+  Fill in an array of char* with null-terminated char arrays with the
+  enumerated device ip addresses.
+  Assumes sufficient memory has been allocated
+  */
+  size_t ct = 0;
+  for (auto &serial : deviceSerials) {
+    deviceSerialsOut[ct] = serial.c_str();
+    ct++;
+  }
+  return APS2_OK;
+}
+
+APS2_STATUS connect_APS(const char *deviceSerial) {
+  /*
+  Connect to a device specified by serial number string
+  */
+  string serial = string(deviceSerial);
+  APS2 *aps;
+  {
+    // create the APS2 object if it is not already in the map
+    std::lock_guard<std::mutex> guard(APSs_lock);
+    if (APSs.find(serial) == APSs.end()) {
+      // C++14 use std::make_unique
+      APSs.insert(
+          std::make_pair(serial, std::unique_ptr<APS2>(new APS2(serial))));
+    }
+    aps = APSs.at(serial).get();
+  }
+  // Can't seem to bind the interface lvalue to
+  // ‘std::shared_ptr<APS2Ethernet>&&’
+  // return aps2_call(deviceSerial, &APS2::connect, get_interface());
+  try {
+    aps->connect(get_interface());
+    return APS2_OK;
+  } catch (APS2_STATUS status) {
+    return status;
+  } catch (...) {
+    return APS2_UNKNOWN_ERROR;
+  }
+}
+
+APS2_STATUS connect_and_init_many(const char **deviceSerials,
+                                  unsigned int numDevices,
+                                  APS2_STATUS *statuses) {
+  /*
+  Connect to and initialize several devices at once. Each device works through
+  its own steps in order on its async worker while the devices proceed in
+  parallel. Per device results go in statuses; the return value is APS2_OK or
+  the first failure.
+  */
+  try {
+    auto myEthernetRM = get_interface();
+    // Create the APS2 objects up front since the map is not thread safe
+    vector<APS2 *> devices;
+    {
+      std::lock_guard<std::mutex> guard(APSs_lock);
+      for (unsigned int ct = 0; ct < numDevices; ct++) {
+        string serial = string(deviceSerials[ct]);
+        if (APSs.find(serial) == APSs.end()) {
+          APSs.insert(std::make_pair(
+              serial, std::unique_ptr<APS2>(new APS2(serial))));
+        }
+        devices.push_back(APSs.at(serial).get());
+      }
+    }
+
+    vector<std::future<APS2_STATUS>> results;
+    for (auto aps : devices) {
+      results.push_back(
+          aps->run_async([aps, myEthernetRM]() -> APS2_STATUS {
+            try {
+              aps->connect(shared_ptr<APS2Ethernet>(myEthernetRM));
+              return aps->init(false, 0);
+            } catch (APS2_STATUS status) {
+              return status;
+            } catch (...) {
+              return APS2_UNKNOWN_ERROR;
+            }
+          }));
+    }
+
+    APS2_STATUS firstFailure = APS2_OK;
+    for (unsigned int ct = 0; ct < numDevices; ct++) {
+      statuses[ct] = results[ct].get();
+      if (statuses[ct] != APS2_OK && firstFailure == APS2_OK) {
+        firstFailure = statuses[ct];
+      }
+    }
+    return firstFailure;
+  } catch (APS2_STATUS status) {
+    return status;
+  } catch (...) {
+    return APS2_UNKNOWN_ERROR;
+  }
+}
+
+APS2_STATUS connect_APS_handle(const char *deviceSerial, APS2_HANDLE *handle) {
+  /*
+  Connect to a device specified by serial number string and return a handle
+  for the "_h" API. Connecting an already connected device returns its
+  existing handle.
+  */
+  APS2_STATUS status = connect_APS(deviceSerial);
+  if (status != APS2_OK) {
+    return status;
+  }
+  std::lock_guard<std::mutex> guard(APSs_lock);
+  auto aps_it = APSs.find(deviceSerial);
+  if (aps_it == APSs.end()) {
+    // disconnected on another thread meanwhile
+    return APS2_UNCONNECTED;
+  }
+  APS2 *aps = aps_it->second.get();
+  auto it = std::find(APSHandles.begin(), APSHandles.end(), aps);
+  if (it == APSHandles.end()) {
+    it = APSHandles.insert(APSHandles.end(), aps);
+  }
+  *handle = std::distance(APSHandles.begin(), it) + 1;
+  return APS2_OK;
+}
+
+APS2_STATUS disconnect_APS(const char *deviceSerial) {
+  /*
+  Tear-down connection to APS specified by serial number string.
+  */
+  APS2_STATUS status = aps2_call(deviceSerial, &APS2::disconnect);
+  std::lock_guard<std::mutex> guard(APSs_lock);
+  auto it = APSs.find(deviceSerial);
+  if (it != APSs.end()) {
+    // invalidate any handle to the device
+    std::replace(APSHandles.begin(), APSHandles.end(), it->second.get(),
+                 static_cast<APS2 *>(nullptr));
+    APSs.erase(it);
+  }
+  return status;
+}
+
+APS2_STATUS reset(const char *deviceSerial, APS2_RESET_MODE mode) {
+  switch (mode) {
+  case RESET_TCP:
+    // For TCP we may not have an APS2 device (we can't connect) so directly
+    // call APS2Ethernet method
+    get_interface()->reset_tcp(deviceSerial);
+    return APS2_OK;
+  default:
+    return aps2_call(deviceSerial, &APS2::reset, mode);
+  }
+}
+
+// Initialize an APS unit
+APS2_STATUS init_APS(const char *deviceSerial, int forceReload) {
+  return aps2_call(deviceSerial, &APS2::init, bool(forceReload), 0);
+}
+
+APS2_STATUS get_firmware_version(const char *ipAddr, uint32_t *version,
+                                 uint32_t *git_sha1, uint32_t *build_timestamp,
+                                 char *version_string) {
+  return firmware_version(ipAddr, version, git_sha1, build_timestamp,
+                          version_string);
+}
+
 APS2_STATUS get_uptime(const char *deviceSerial, double *upTime) {
   return aps2_getter(deviceSerial, &APS2::get_uptime, upTime);
 }
@@ -306,9 +688,9 @@ APS2_STATUS set_waveform_float(const char *deviceSerial, int channelNum,
   // specialize the templated APS2::set_waveform here
   return aps2_call(
       deviceSerial,
-      static_cast<void (APS2::*)(const int &, const vector<float> &)>(
+      static_cast<void (APS2::*)(int, const float *, size_t)>(
           &APS2::set_waveform),
-      channelNum, vector<float>(data, data + numPts));
+      channelNum, data, numPts);
 }
 
 // Load the waveform library as int16
@@ -317,21 +699,99 @@ APS2_STATUS set_waveform_int(const char *deviceSerial, int channelNum,
   // specialize the templated APS2::set_waveform here
   return aps2_call(
       deviceSerial,
-      static_cast<void (APS2::*)(const int &, const vector<int16_t> &)>(
+      static_cast<void (APS2::*)(int, const int16_t *, size_t)>(
           &APS2::set_waveform),
-      channelNum, vector<int16_t>(data, data + numPts));
+      channelNum, data, numPts);
 }
 
 APS2_STATUS set_markers(const char *deviceSerial, int channelNum, uint8_t *data,
                         int numPts) {
-  return aps2_call(deviceSerial, &APS2::set_markers, channelNum,
-                   vector<uint8_t>(data, data + numPts));
+  return aps2_call(deviceSerial,
+                   static_cast<void (APS2::*)(int, const uint8_t *, size_t)>(
+                       &APS2::set_markers),
+                   channelNum, data, numPts);
 }
 
 APS2_STATUS write_sequence(const char *deviceSerial, uint64_t *data,
                            uint32_t numWords) {
-  return aps2_call(deviceSerial, &APS2::write_sequence,
-                   vector<uint64_t>(data, data + numWords));
+  return aps2_call(deviceSerial,
+                   static_cast<void (APS2::*)(const uint64_t *, size_t)>(
+                       &APS2::write_sequence),
+                   data, numWords);
+}
+
+APS2_STATUS set_waveform_float_many(const char **deviceSerials,
+                                    unsigned int numDevices, int channelNum,
+                                    float *data, int numPts,
+                                    APS2_STATUS *statuses) {
+  return aps2_many(deviceSerials, numDevices, statuses,
+                   [channelNum, data, numPts](const vector<APS2 *> &devices) {
+                     return APS2::set_waveform_many(devices, channelNum, data,
+                                                    numPts);
+                   });
+}
+
+APS2_STATUS set_waveform_int_many(const char **deviceSerials,
+                                  unsigned int numDevices, int channelNum,
+                                  int16_t *data, int numPts,
+                                  APS2_STATUS *statuses) {
+  return aps2_many(deviceSerials, numDevices, statuses,
+                   [channelNum, data, numPts](const vector<APS2 *> &devices) {
+                     return APS2::set_waveform_many(devices, channelNum, data,
+                                                    numPts);
+                   });
+}
+
+APS2_STATUS write_sequence_many(const char **deviceSerials,
+                                unsigned int numDevices, uint64_t *data,
+                                uint32_t numWords, APS2_STATUS *statuses) {
+  return aps2_many(deviceSerials, numDevices, statuses,
+                   [data, numWords](const vector<APS2 *> &devices) {
+                     return APS2::write_sequence_many(devices, data,
+                                                      numWords);
+                   });
+}
+
+APS2_STATUS set_waveform_float_async(const char *deviceSerial, int channelNum,
+                                     float *data, int numPts,
+                                     APS2_ASYNC_TOKEN *token) {
+  return queue_set_waveform(deviceSerial, channelNum, data, numPts, token);
+}
+
+APS2_STATUS set_waveform_int_async(const char *deviceSerial, int channelNum,
+                                   int16_t *data, int numPts,
+                                   APS2_ASYNC_TOKEN *token) {
+  return queue_set_waveform(deviceSerial, channelNum, data, numPts, token);
+}
+
+APS2_STATUS write_sequence_async(const char *deviceSerial, uint64_t *data,
+                                 uint32_t numWords, APS2_ASYNC_TOKEN *token) {
+  return queue_write_sequence(deviceSerial, data, numWords, token);
+}
+
+APS2_STATUS poll_async(APS2_ASYNC_TOKEN token, int *done) {
+  std::lock_guard<std::mutex> guard(asyncOps_lock);
+  auto it = asyncOps.find(token);
+  if (it == asyncOps.end()) {
+    return APS2_INVALID_ASYNC_TOKEN;
+  }
+  *done = it->second.wait_for(std::chrono::seconds(0)) ==
+          std::future_status::ready;
+  return APS2_OK;
+}
+
+APS2_STATUS wait_async(APS2_ASYNC_TOKEN token) {
+  std::future<APS2_STATUS> result;
+  {
+    std::lock_guard<std::mutex> guard(asyncOps_lock);
+    auto it = asyncOps.find(token);
+    if (it == asyncOps.end()) {
+      return APS2_INVALID_ASYNC_TOKEN;
+    }
+    result = std::move(it->second);
+    asyncOps.erase(it);
+  }
+  return result.get();
 }
 
 APS2_STATUS load_sequence_file(const char *deviceSerial, const char *seqFile) {
@@ -452,7 +912,7 @@ APS2_STATUS get_channel_scale(const char *deviceSerial, int channelNum,
 }
 APS2_STATUS get_channel_enabled(const char *deviceSerial, int channelNum,
                                 int *enabled) {
-  return aps2_getter(deviceSerial, &APS2::get_channel_offset, enabled,
+  return aps2_getter(deviceSerial, &APS2::get_channel_enabled, enabled,
                      channelNum);
 }
 
@@ -479,16 +939,60 @@ APS2_STATUS set_mixer_correction_matrix(const char *deviceSerial, float *mat) {
 }
 
 APS2_STATUS get_mixer_correction_matrix(const char *deviceSerial, float *mat) {
-  try {
-    auto correction_mat =
-        APSs[string(deviceSerial)]->get_mixer_correction_matrix();
-    std::copy(correction_mat.begin(), correction_mat.end(), mat);
-  } catch (APS2_STATUS status) {
-    return status;
-  } catch (...) {
-    return APS2_UNKNOWN_ERROR;
-  }
-  return APS2_OK;
+  return aps2_vector_getter(deviceSerial, &APS2::get_mixer_correction_matrix,
+                            mat);
+}
+
+APS2_STATUS add_waveform_float(const char *deviceSerial, int channelNum,
+                               const char *name, float *data, uint8_t *markers,
+                               int numPts, uint32_t *address) {
+  return aps2_getter(
+      deviceSerial,
+      static_cast<uint32_t (APS2::*)(int, const string &, const float *,
+                                     size_t, const uint8_t *)>(
+          &APS2::add_waveform),
+      address, channelNum, string(name), data, numPts, markers);
+}
+
+APS2_STATUS add_waveform_int(const char *deviceSerial, int channelNum,
+                             const char *name, int16_t *data, uint8_t *markers,
+                             int numPts, uint32_t *address) {
+  return aps2_getter(
+      deviceSerial,
+      static_cast<uint32_t (APS2::*)(int, const string &, const int16_t *,
+                                     size_t, const uint8_t *)>(
+          &APS2::add_waveform),
+      address, channelNum, string(name), data, numPts, markers);
+}
+
+APS2_STATUS remove_waveform(const char *deviceSerial, int channelNum,
+                            const char *name) {
+  return aps2_call(deviceSerial, &APS2::remove_waveform, channelNum,
+                   string(name));
+}
+
+APS2_STATUS add_sequence_segment(const char *deviceSerial, const char *name,
+                                 uint64_t *data, uint32_t numWords,
+                                 uint32_t *address) {
+  return aps2_getter(deviceSerial, &APS2::add_sequence_segment, address,
+                     string(name), data, numWords);
+}
+
+APS2_STATUS remove_sequence_segment(const char *deviceSerial,
+                                    const char *name) {
+  return aps2_call(deviceSerial, &APS2::remove_sequence_segment, string(name));
+}
+
+APS2_STATUS get_waveform_memory_usage(const char *deviceSerial, int channelNum,
+                                      APS2_MEMORY_USAGE *usage) {
+  return memory_usage_getter(deviceSerial, usage,
+                             &APS2::get_waveform_memory_usage, channelNum);
+}
+
+APS2_STATUS get_sequence_memory_usage(const char *deviceSerial,
+                                      APS2_MEMORY_USAGE *usage) {
+  return memory_usage_getter(deviceSerial, usage,
+                             &APS2::get_sequence_memory_usage);
 }
 
 APS2_STATUS set_run_mode(const char *deviceSerial, APS2_RUN_MODE mode) {
@@ -514,21 +1018,74 @@ APS2_STATUS write_memory(const char *deviceSerial, uint32_t addr,
 
 APS2_STATUS read_memory(const char *deviceSerial, uint32_t addr, uint32_t *data,
                         uint32_t numWords) {
+  return aps2_call(
+      deviceSerial,
+      static_cast<void (APS2::*)(uint32_t, uint32_t, uint32_t *) const>(
+          &APS2::read_memory),
+      addr, numWords, data);
+}
+
+APS2_STATUS read_register(const char *deviceSerial, uint32_t addr,
+                          uint32_t *result) {
+  return read_memory(deviceSerial, addr, result, 1);
+}
+
+APS2_STATUS write_memory_async(const char *deviceSerial, uint32_t addr,
+                               uint32_t *data, uint32_t numWords,
+                               APS2_ASYNC_TOKEN *token) {
+  return queue_write_memory(deviceSerial, addr, data, numWords, token);
+}
+
+APS2_STATUS read_memory_async(const char *deviceSerial, uint32_t addr,
+                              uint32_t *data, uint32_t numWords,
+                              APS2_ASYNC_TOKEN *token) {
+  return queue_read_memory(deviceSerial, addr, data, numWords, token);
+}
+
+APS2_STATUS set_ack_window(unsigned int window) {
+  ack_window = window;
+  // update a live interface; otherwise it picks up the setting on creation
+  shared_ptr<APS2Ethernet> myEthernetRM = ethernetRM.lock();
+  if (myEthernetRM) {
+    myEthernetRM->set_ack_window(window);
+  }
+  return APS2_OK;
+}
+
+APS2_STATUS get_ack_window(unsigned int *window) {
+  *window = ack_window;
+  return APS2_OK;
+}
+
+APS2_STATUS set_io_threads(unsigned int numThreads) {
+  // the pool is sized when the interface is created
+  io_threads = numThreads;
+  return APS2_OK;
+}
+
+APS2_STATUS get_io_threads(unsigned int *numThreads) {
+  shared_ptr<APS2Ethernet> myEthernetRM = ethernetRM.lock();
+  *numThreads = myEthernetRM ? myEthernetRM->get_io_threads() : io_threads;
+  return APS2_OK;
+}
+
+APS2_STATUS start_trace(const char *filename) {
   try {
-    auto readData = APSs[string(deviceSerial)]->read_memory(addr, numWords);
-    std::copy(readData.begin(), readData.end(), data);
+    get_interface()->start_trace(filename);
+    return APS2_OK;
   } catch (APS2_STATUS status) {
     return status;
   } catch (...) {
     return APS2_UNKNOWN_ERROR;
   }
-
-  return APS2_OK;
 }
 
-APS2_STATUS read_register(const char *deviceSerial, uint32_t addr,
-                          uint32_t *result) {
-  return read_memory(deviceSerial, addr, result, 1);
+APS2_STATUS stop_trace() {
+  shared_ptr<APS2Ethernet> myEthernetRM = ethernetRM.lock();
+  if (myEthernetRM) {
+    myEthernetRM->stop_trace();
+  }
+  return APS2_OK;
 }
 
 APS2_STATUS write_bitfile(const char *deviceSerial, const char *bitFile,
@@ -549,16 +1106,10 @@ APS2_STATUS write_configuration_SDRAM(const char *ip_addr, uint32_t addr,
 
 APS2_STATUS read_configuration_SDRAM(const char *ip_addr, uint32_t addr,
                                      uint32_t num_words, uint32_t *data) {
-  try {
-    auto read_data =
-        APSs[string(ip_addr)]->read_configuration_SDRAM(addr, num_words);
-    std::copy(read_data.begin(), read_data.end(), data);
-  } catch (APS2_STATUS status) {
-    return status;
-  } catch (...) {
-    return APS2_UNKNOWN_ERROR;
-  }
-  return APS2_OK;
+  return aps2_call(ip_addr,
+                   static_cast<void (APS2::*)(uint32_t, uint32_t, uint32_t *)>(
+                       &APS2::read_configuration_SDRAM),
+                   addr, num_words, data);
 }
 
 APS2_STATUS write_flash(const char *deviceSerial, uint32_t addr, uint32_t *data,
@@ -569,32 +1120,28 @@ APS2_STATUS write_flash(const char *deviceSerial, uint32_t addr, uint32_t *data,
 
 APS2_STATUS read_flash(const char *deviceSerial, uint32_t addr,
                        uint32_t numWords, uint32_t *data) {
-  try {
-    auto readData = APSs[string(deviceSerial)]->read_flash(addr, numWords);
-    std::copy(readData.begin(), readData.end(), data);
-  } catch (APS2_STATUS status) {
-    return status;
-  } catch (...) {
-    return APS2_UNKNOWN_ERROR;
-  }
-  return APS2_OK;
+  return aps2_call(deviceSerial,
+                   static_cast<void (APS2::*)(uint32_t, uint32_t, uint32_t *)>(
+                       &APS2::read_flash),
+                   addr, numWords, data);
 }
 
 APS2_BITFILE_WRITING_TASK get_bitfile_writing_task(const char *deviceSerial) {
-  return APSs[string(deviceSerial)]->bitfile_writing_task;
+  return get_APS(deviceSerial)->bitfile_writing_task;
 }
 
 void clear_bitfile_writing_progress(const char *deviceSerial) {
-  APSs[string(deviceSerial)]->bitfile_writing_task = STARTING;
-  APSs[string(deviceSerial)]->bitfile_writing_task_progress = 0;
+  APS2 *aps = get_APS(deviceSerial);
+  aps->bitfile_writing_task = STARTING;
+  aps->bitfile_writing_task_progress = 0;
 }
 
 double get_flash_progress(const char *deviceSerial) {
-  return APSs[string(deviceSerial)]->bitfile_writing_task_progress;
+  return get_APS(deviceSerial)->bitfile_writing_task_progress;
 }
 
 uint64_t get_mac_addr(const char *deviceSerial) {
-  return APSs[string(deviceSerial)]->get_mac_addr();
+  return get_APS(deviceSerial)->get_mac_addr();
 }
 
 APS2_STATUS set_mac_addr(const char *deviceSerial, uint64_t mac) {
@@ -602,14 +1149,7 @@ APS2_STATUS set_mac_addr(const char *deviceSerial, uint64_t mac) {
 }
 
 APS2_STATUS get_ip_addr(const char *deviceSerial, char *ipAddrPtr) {
-  try {
-    uint32_t ipAddr = APSs[string(deviceSerial)]->get_ip_addr();
-    string ipAddrStr = asio::ip::address_v4(ipAddr).to_string();
-    ipAddrStr.copy(ipAddrPtr, ipAddrStr.size(), 0);
-    return APS2_OK;
-  } catch (...) {
-    return APS2_UNKNOWN_ERROR;
-  }
+  return ip_addr_getter(deviceSerial, ipAddrPtr);
 }
 
 APS2_STATUS set_ip_addr(const char *deviceSerial, const char *ipAddrStr) {
@@ -629,12 +1169,32 @@ APS2_STATUS set_dhcp_enable(const char *deviceSerial, const int enable) {
   return aps2_call(deviceSerial, &APS2::set_dhcp_enable, enable);
 }
 
+APS2_STATUS set_register_cache(const char *deviceSerial, const int enable) {
+  return aps2_call(deviceSerial, &APS2::set_register_cache, enable);
+}
+
+APS2_STATUS get_register_cache(const char *deviceSerial, int *enabled) {
+  return aps2_getter(deviceSerial, &APS2::get_register_cache, enabled);
+}
+
+APS2_STATUS resync_register_cache(const char *deviceSerial) {
+  return aps2_call(deviceSerial, &APS2::resync_register_cache);
+}
+
+APS2_STATUS get_transport_metrics(const char *deviceSerial,
+                                  APS2_METRICS *metrics) {
+  return metrics_getter(deviceSerial, metrics);
+}
+
+APS2_STATUS reset_transport_metrics(const char *deviceSerial) {
+  return metrics_reset(deviceSerial);
+}
+
 int run_DAC_BIST(const char *deviceSerial, const int dac, int16_t *data,
                  unsigned int length, uint32_t *results) {
   vector<int16_t> testVec(data, data + length);
   vector<uint32_t> tmpResults;
-  int passed =
-      APSs[string(deviceSerial)]->run_DAC_BIST(dac, testVec, tmpResults);
+  int passed = get_APS(deviceSerial)->run_DAC_BIST(dac, testVec, tmpResults);
   std::copy(tmpResults.begin(), tmpResults.end(), results);
   return passed;
 }
@@ -648,6 +1208,351 @@ APS2_STATUS toggle_DAC_clock(const char *deviceSerial, const int dac) {
   return aps2_call(deviceSerial, &APS2::toggle_DAC_clock, dac);
 }
 
+/* Handle based API mirroring the calls above without the per-call lookup of
+ * the device by IP string */
+
+APS2_STATUS disconnect_APS_h(APS2_HANDLE handle) {
+  try {
+    string serial = get_serial(handle);
+    return disconnect_APS(serial.c_str());
+  } catch (APS2_STATUS status) {
+    return status;
+  }
+}
+
+APS2_STATUS reset_h(APS2_HANDLE handle, APS2_RESET_MODE mode) {
+  switch (mode) {
+  case RESET_TCP:
+    try {
+      get_interface()->reset_tcp(get_serial(handle));
+      return APS2_OK;
+    } catch (APS2_STATUS status) {
+      return status;
+    }
+  default:
+    return aps2_call(handle, &APS2::reset, mode);
+  }
+}
+
+APS2_STATUS init_APS_h(APS2_HANDLE handle, int forceReload) {
+  return aps2_call(handle, &APS2::init, bool(forceReload), 0);
+}
+
+APS2_STATUS get_firmware_version_h(APS2_HANDLE handle, uint32_t *version,
+                                   uint32_t *git_sha1,
+                                   uint32_t *build_timestamp,
+                                   char *version_string) {
+  return firmware_version(handle, version, git_sha1, build_timestamp,
+                          version_string);
+}
+
+APS2_STATUS get_uptime_h(APS2_HANDLE handle, double *upTime) {
+  return aps2_getter(handle, &APS2::get_uptime, upTime);
+}
+
+APS2_STATUS get_fpga_temperature_h(APS2_HANDLE handle, float *temp) {
+  return aps2_getter(handle, &APS2::get_fpga_temperature, temp);
+}
+
+APS2_STATUS set_sampleRate_h(APS2_HANDLE handle, unsigned int freq) {
+  return aps2_call(handle, &APS2::set_sampleRate, freq);
+}
+
+APS2_STATUS get_sampleRate_h(APS2_HANDLE handle, unsigned int *freq) {
+  return aps2_getter(handle, &APS2::get_sampleRate, freq);
+}
+
+APS2_STATUS set_channel_offset_h(APS2_HANDLE handle, int channelNum,
+                                 float offset) {
+  return aps2_call(handle, &APS2::set_channel_offset, channelNum, offset);
+}
+
+APS2_STATUS get_channel_offset_h(APS2_HANDLE handle, int channelNum,
+                                 float *offset) {
+  return aps2_getter(handle, &APS2::get_channel_offset, offset, channelNum);
+}
+
+APS2_STATUS set_channel_scale_h(APS2_HANDLE handle, int channelNum,
+                                float scale) {
+  return aps2_call(handle, &APS2::set_channel_scale, channelNum, scale);
+}
+
+APS2_STATUS get_channel_scale_h(APS2_HANDLE handle, int channelNum,
+                                float *scale) {
+  return aps2_getter(handle, &APS2::get_channel_scale, scale, channelNum);
+}
+
+APS2_STATUS set_channel_enabled_h(APS2_HANDLE handle, int channelNum,
+                                  int enable) {
+  return aps2_call(handle, &APS2::set_channel_enabled, channelNum, enable);
+}
+
+APS2_STATUS get_channel_enabled_h(APS2_HANDLE handle, int channelNum,
+                                  int *enabled) {
+  return aps2_getter(handle, &APS2::get_channel_enabled, enabled, channelNum);
+}
+
+APS2_STATUS set_channel_delay_h(APS2_HANDLE handle, int channelNum,
+                                unsigned delay) {
+  return aps2_call(handle, &APS2::set_channel_bitslip, channelNum, delay);
+}
+
+APS2_STATUS get_channel_delay_h(APS2_HANDLE handle, int channelNum,
+                                unsigned *delay) {
+  return aps2_getter(handle, &APS2::get_channel_bitslip, delay, channelNum);
+}
+
+APS2_STATUS set_mixer_amplitude_imbalance_h(APS2_HANDLE handle, float amp) {
+  return aps2_call(handle, &APS2::set_mixer_amplitude_imbalance, amp);
+}
+
+APS2_STATUS get_mixer_amplitude_imbalance_h(APS2_HANDLE handle, float *amp) {
+  return aps2_getter(handle, &APS2::get_mixer_amplitude_imbalance, amp);
+}
+
+APS2_STATUS set_mixer_phase_skew_h(APS2_HANDLE handle, float skew) {
+  return aps2_call(handle, &APS2::set_mixer_phase_skew, skew);
+}
+
+APS2_STATUS get_mixer_phase_skew_h(APS2_HANDLE handle, float *skew) {
+  return aps2_getter(handle, &APS2::get_mixer_phase_skew, skew);
+}
+
+APS2_STATUS set_mixer_correction_matrix_h(APS2_HANDLE handle, float *mat) {
+  return aps2_call(handle, &APS2::set_mixer_correction_matrix,
+                   vector<float>(mat, mat + 4));
+}
+
+APS2_STATUS get_mixer_correction_matrix_h(APS2_HANDLE handle, float *mat) {
+  return aps2_vector_getter(handle, &APS2::get_mixer_correction_matrix, mat);
+}
+
+APS2_STATUS set_trigger_source_h(APS2_HANDLE handle, APS2_TRIGGER_SOURCE src) {
+  return aps2_call(handle, &APS2::set_trigger_source, src);
+}
+
+APS2_STATUS get_trigger_source_h(APS2_HANDLE handle,
+                                 APS2_TRIGGER_SOURCE *src) {
+  return aps2_getter(handle, &APS2::get_trigger_source, src);
+}
+
+APS2_STATUS set_trigger_interval_h(APS2_HANDLE handle, double interval) {
+  return aps2_call(handle, &APS2::set_trigger_interval, interval);
+}
+
+APS2_STATUS get_trigger_interval_h(APS2_HANDLE handle, double *interval) {
+  return aps2_getter(handle, &APS2::get_trigger_interval, interval);
+}
+
+APS2_STATUS trigger_h(APS2_HANDLE handle) {
+  return aps2_call(handle, &APS2::trigger);
+}
+
+APS2_STATUS set_waveform_float_h(APS2_HANDLE handle, int channelNum,
+                                 float *data, int numPts) {
+  return aps2_call(
+      handle,
+      static_cast<void (APS2::*)(int, const float *, size_t)>(
+          &APS2::set_waveform),
+      channelNum, data, numPts);
+}
+
+APS2_STATUS set_waveform_int_h(APS2_HANDLE handle, int channelNum,
+                               int16_t *data, int numPts) {
+  return aps2_call(
+      handle,
+      static_cast<void (APS2::*)(int, const int16_t *, size_t)>(
+          &APS2::set_waveform),
+      channelNum, data, numPts);
+}
+
+APS2_STATUS set_markers_h(APS2_HANDLE handle, int channelNum, uint8_t *data,
+                          int numPts) {
+  return aps2_call(handle,
+                   static_cast<void (APS2::*)(int, const uint8_t *, size_t)>(
+                       &APS2::set_markers),
+                   channelNum, data, numPts);
+}
+
+APS2_STATUS write_sequence_h(APS2_HANDLE handle, uint64_t *data,
+                             uint32_t numWords) {
+  return aps2_call(handle,
+                   static_cast<void (APS2::*)(const uint64_t *, size_t)>(
+                       &APS2::write_sequence),
+                   data, numWords);
+}
+
+APS2_STATUS set_waveform_float_async_h(APS2_HANDLE handle, int channelNum,
+                                       float *data, int numPts,
+                                       APS2_ASYNC_TOKEN *token) {
+  return queue_set_waveform(handle, channelNum, data, numPts, token);
+}
+
+APS2_STATUS set_waveform_int_async_h(APS2_HANDLE handle, int channelNum,
+                                     int16_t *data, int numPts,
+                                     APS2_ASYNC_TOKEN *token) {
+  return queue_set_waveform(handle, channelNum, data, numPts, token);
+}
+
+APS2_STATUS write_sequence_async_h(APS2_HANDLE handle, uint64_t *data,
+                                   uint32_t numWords, APS2_ASYNC_TOKEN *token) {
+  return queue_write_sequence(handle, data, numWords, token);
+}
+
+APS2_STATUS add_waveform_float_h(APS2_HANDLE handle, int channelNum,
+                                 const char *name, float *data,
+                                 uint8_t *markers, int numPts,
+                                 uint32_t *address) {
+  return aps2_getter(
+      handle,
+      static_cast<uint32_t (APS2::*)(int, const string &, const float *,
+                                     size_t, const uint8_t *)>(
+          &APS2::add_waveform),
+      address, channelNum, string(name), data, numPts, markers);
+}
+
+APS2_STATUS add_waveform_int_h(APS2_HANDLE handle, int channelNum,
+                               const char *name, int16_t *data,
+                               uint8_t *markers, int numPts,
+                               uint32_t *address) {
+  return aps2_getter(
+      handle,
+      static_cast<uint32_t (APS2::*)(int, const string &, const int16_t *,
+                                     size_t, const uint8_t *)>(
+          &APS2::add_waveform),
+      address, channelNum, string(name), data, numPts, markers);
+}
+
+APS2_STATUS remove_waveform_h(APS2_HANDLE handle, int channelNum,
+                              const char *name) {
+  return aps2_call(handle, &APS2::remove_waveform, channelNum, string(name));
+}
+
+APS2_STATUS add_sequence_segment_h(APS2_HANDLE handle, const char *name,
+                                   uint64_t *data, uint32_t numWords,
+                                   uint32_t *address) {
+  return aps2_getter(handle, &APS2::add_sequence_segment, address,
+                     string(name), data, numWords);
+}
+
+APS2_STATUS remove_sequence_segment_h(APS2_HANDLE handle, const char *name) {
+  return aps2_call(handle, &APS2::remove_sequence_segment, string(name));
+}
+
+APS2_STATUS get_waveform_memory_usage_h(APS2_HANDLE handle, int channelNum,
+                                        APS2_MEMORY_USAGE *usage) {
+  return memory_usage_getter(handle, usage, &APS2::get_waveform_memory_usage,
+                             channelNum);
+}
+
+APS2_STATUS get_sequence_memory_usage_h(APS2_HANDLE handle,
+                                        APS2_MEMORY_USAGE *usage) {
+  return memory_usage_getter(handle, usage, &APS2::get_sequence_memory_usage);
+}
+
+APS2_STATUS set_run_mode_h(APS2_HANDLE handle, APS2_RUN_MODE mode) {
+  return aps2_call(handle, &APS2::set_run_mode, mode);
+}
+
+APS2_STATUS set_waveform_frequency_h(APS2_HANDLE handle, float freq) {
+  return aps2_call(handle, &APS2::set_waveform_frequency, freq);
+}
+
+APS2_STATUS get_waveform_frequency_h(APS2_HANDLE handle, float *freq) {
+  return aps2_getter(handle, &APS2::get_waveform_frequency, freq);
+}
+
+APS2_STATUS load_sequence_file_h(APS2_HANDLE handle, const char *seqFile) {
+  return aps2_call(handle, &APS2::load_sequence_file, string(seqFile));
+}
+
+APS2_STATUS clear_channel_data_h(APS2_HANDLE handle) {
+  return aps2_call(handle, &APS2::clear_channel_data);
+}
+
+APS2_STATUS run_h(APS2_HANDLE handle) { return aps2_call(handle, &APS2::run); }
+
+APS2_STATUS stop_h(APS2_HANDLE handle) {
+  return aps2_call(handle, &APS2::stop);
+}
+
+APS2_STATUS get_runState_h(APS2_HANDLE handle, APS2_RUN_STATE *state) {
+  return aps2_getter(handle, &APS2::get_runState, state);
+}
+
+APS2_STATUS get_ip_addr_h(APS2_HANDLE handle, char *ipAddrPtr) {
+  return ip_addr_getter(handle, ipAddrPtr);
+}
+
+APS2_STATUS set_ip_addr_h(APS2_HANDLE handle, const char *ipAddrStr) {
+  uint32_t ipAddr = asio::ip::address_v4::from_string(ipAddrStr).to_ulong();
+  return aps2_call(handle, &APS2::set_ip_addr, ipAddr);
+}
+
+APS2_STATUS get_dhcp_enable_h(APS2_HANDLE handle, int *enabled) {
+  return aps2_getter(handle, &APS2::get_dhcp_enable, enabled);
+}
+
+APS2_STATUS set_dhcp_enable_h(APS2_HANDLE handle, const int enable) {
+  return aps2_call(handle, &APS2::set_dhcp_enable, enable);
+}
+
+APS2_STATUS set_register_cache_h(APS2_HANDLE handle, const int enable) {
+  return aps2_call(handle, &APS2::set_register_cache, enable);
+}
+
+APS2_STATUS get_register_cache_h(APS2_HANDLE handle, int *enabled) {
+  return aps2_getter(handle, &APS2::get_register_cache, enabled);
+}
+
+APS2_STATUS resync_register_cache_h(APS2_HANDLE handle) {
+  return aps2_call(handle, &APS2::resync_register_cache);
+}
+
+APS2_STATUS get_transport_metrics_h(APS2_HANDLE handle,
+                                    APS2_METRICS *metrics) {
+  return metrics_getter(handle, metrics);
+}
+
+APS2_STATUS reset_transport_metrics_h(APS2_HANDLE handle) {
+  return metrics_reset(handle);
+}
+
+APS2_STATUS write_memory_h(APS2_HANDLE handle, uint32_t addr, uint32_t *data,
+                           uint32_t numWords) {
+  return aps2_call(
+      handle,
+      static_cast<void (APS2::*)(const uint32_t &, const vector<uint32_t> &)>(
+          &APS2::write_memory),
+      addr, vector<uint32_t>(data, data + numWords));
+}
+
+APS2_STATUS read_memory_h(APS2_HANDLE handle, uint32_t addr, uint32_t *data,
+                          uint32_t numWords) {
+  return aps2_call(
+      handle,
+      static_cast<void (APS2::*)(uint32_t, uint32_t, uint32_t *) const>(
+          &APS2::read_memory),
+      addr, numWords, data);
+}
+
+APS2_STATUS read_register_h(APS2_HANDLE handle, uint32_t addr,
+                            uint32_t *result) {
+  return read_memory_h(handle, addr, result, 1);
+}
+
+APS2_STATUS write_memory_async_h(APS2_HANDLE handle, uint32_t addr,
+                                 uint32_t *data, uint32_t numWords,
+                                 APS2_ASYNC_TOKEN *token) {
+  return queue_write_memory(handle, addr, data, numWords, token);
+}
+
+APS2_STATUS read_memory_async_h(APS2_HANDLE handle, uint32_t addr,
+                                uint32_t *data, uint32_t numWords,
+                                APS2_ASYNC_TOKEN *token) {
+  return queue_read_memory(handle, addr, data, numWords, token);
+}
+
 #ifdef __cplusplus
 }
 #endif
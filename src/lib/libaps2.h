@@ -34,12 +34,63 @@ typedef enum APS2_BITFILE_STORAGE_MEDIA APS2_BITFILE_STORAGE_MEDIA;
 typedef enum APS2_BITFILE_WRITING_TASK APS2_BITFILE_WRITING_TASK;
 typedef enum APS2_RESET_MODE APS2_RESET_MODE;
 
+// Opaque handle to a connected APS2 for the "_h" variants of the API which
+// skip looking up the device by IP string on every call. Zero is never a
+// valid handle.
+typedef uint32_t APS2_HANDLE;
+
+// Token for an operation queued with one of the "_async" calls. Poll it with
+// poll_async and collect the result with wait_async, which releases it.
+typedef uint32_t APS2_ASYNC_TOKEN;
+
+// Called on the enumerating thread with the IP address of each APS2 that
+// answers an enumerate request, once its transport is known
+typedef void (*APS2_DISCOVERY_CALLBACK)(const char *);
+
+// Transport counters for one APS2 since it was first connected or last reset.
+// The latency histograms have log2 microsecond buckets: bucket 0 counts
+// latencies under 1us, bucket i those in [2^(i-1), 2^i) us and the last bucket
+// everything longer.
+#define APS2_LATENCY_BUCKETS 24
+typedef struct {
+  uint64_t bytesSent;
+  uint64_t bytesReceived;
+  uint64_t datagramsSent;
+  uint64_t datagramsReceived;
+  uint64_t timeouts;
+  uint64_t retries;
+  uint64_t sendBlockedUS;
+  uint64_t readBlockedUS;
+  uint64_t ackLatency[APS2_LATENCY_BUCKETS];
+  uint64_t readLatency[APS2_LATENCY_BUCKETS];
+} APS2_METRICS;
+
+// Occupancy of the waveform memory of one channel or of the instruction memory
+// as laid out by add_waveform and add_sequence_segment. Free memory outside
+// the largest free block is lost to fragmentation.
+typedef struct {
+  uint64_t totalBytes;
+  uint64_t usedBytes;
+  uint64_t largestFreeBytes;
+  uint32_t numEntries;
+  uint32_t numFreeBlocks;
+} APS2_MEMORY_USAGE;
+
 EXPORT const char *get_error_msg(APS2_STATUS);
 
 EXPORT APS2_STATUS get_numDevices(unsigned int *);
 EXPORT APS2_STATUS get_device_IPs(const char **);
+EXPORT APS2_STATUS enumerate_devices(unsigned int, unsigned int,
+                                     APS2_DISCOVERY_CALLBACK, unsigned int *);
+EXPORT APS2_STATUS enumerate_known_devices(const char **, unsigned int,
+                                           unsigned int,
+                                           APS2_DISCOVERY_CALLBACK,
+                                           unsigned int *);
 
 EXPORT APS2_STATUS connect_APS(const char *);
+EXPORT APS2_STATUS connect_APS_handle(const char *, APS2_HANDLE *);
+EXPORT APS2_STATUS connect_and_init_many(const char **, unsigned int,
+                                         APS2_STATUS *);
 EXPORT APS2_STATUS disconnect_APS(const char *);
 
 EXPORT APS2_STATUS reset(const char *, APS2_RESET_MODE);
@@ -80,6 +131,34 @@ EXPORT APS2_STATUS set_waveform_int(const char *, int, int16_t *, int);
 EXPORT APS2_STATUS set_markers(const char *, int, uint8_t *, int);
 
 EXPORT APS2_STATUS write_sequence(const char *, uint64_t *, uint32_t);
+EXPORT APS2_STATUS set_waveform_float_many(const char **, unsigned int, int,
+                                           float *, int, APS2_STATUS *);
+EXPORT APS2_STATUS set_waveform_int_many(const char **, unsigned int, int,
+                                         int16_t *, int, APS2_STATUS *);
+EXPORT APS2_STATUS write_sequence_many(const char **, unsigned int,
+                                       uint64_t *, uint32_t, APS2_STATUS *);
+
+EXPORT APS2_STATUS set_waveform_float_async(const char *, int, float *, int,
+                                            APS2_ASYNC_TOKEN *);
+EXPORT APS2_STATUS set_waveform_int_async(const char *, int, int16_t *, int,
+                                          APS2_ASYNC_TOKEN *);
+EXPORT APS2_STATUS write_sequence_async(const char *, uint64_t *, uint32_t,
+                                        APS2_ASYNC_TOKEN *);
+EXPORT APS2_STATUS poll_async(APS2_ASYNC_TOKEN, int *);
+EXPORT APS2_STATUS wait_async(APS2_ASYNC_TOKEN);
+
+EXPORT APS2_STATUS add_waveform_float(const char *, int, const char *, float *,
+                                      uint8_t *, int, uint32_t *);
+EXPORT APS2_STATUS add_waveform_int(const char *, int, const char *, int16_t *,
+                                    uint8_t *, int, uint32_t *);
+EXPORT APS2_STATUS remove_waveform(const char *, int, const char *);
+EXPORT APS2_STATUS add_sequence_segment(const char *, const char *, uint64_t *,
+                                        uint32_t, uint32_t *);
+EXPORT APS2_STATUS remove_sequence_segment(const char *, const char *);
+EXPORT APS2_STATUS get_waveform_memory_usage(const char *, int,
+                                             APS2_MEMORY_USAGE *);
+EXPORT APS2_STATUS get_sequence_memory_usage(const char *,
+                                             APS2_MEMORY_USAGE *);
 
 EXPORT APS2_STATUS set_run_mode(const char *, APS2_RUN_MODE);
 EXPORT APS2_STATUS set_waveform_frequency(const char *, float);
@@ -102,11 +181,29 @@ EXPORT APS2_STATUS set_ip_addr(const char *, const char *);
 EXPORT APS2_STATUS get_dhcp_enable(const char *, int *);
 EXPORT APS2_STATUS set_dhcp_enable(const char *, const int);
 
+EXPORT APS2_STATUS set_register_cache(const char *, const int);
+EXPORT APS2_STATUS get_register_cache(const char *, int *);
+EXPORT APS2_STATUS resync_register_cache(const char *);
+
+EXPORT APS2_STATUS get_transport_metrics(const char *, APS2_METRICS *);
+EXPORT APS2_STATUS reset_transport_metrics(const char *);
+
 /* private API methods */
 
 EXPORT APS2_STATUS write_memory(const char *, uint32_t, uint32_t *, uint32_t);
 EXPORT APS2_STATUS read_memory(const char *, uint32_t, uint32_t *, uint32_t);
 EXPORT APS2_STATUS read_register(const char *, uint32_t, uint32_t *);
+EXPORT APS2_STATUS write_memory_async(const char *, uint32_t, uint32_t *,
+                                      uint32_t, APS2_ASYNC_TOKEN *);
+EXPORT APS2_STATUS read_memory_async(const char *, uint32_t, uint32_t *,
+                                     uint32_t, APS2_ASYNC_TOKEN *);
+
+EXPORT APS2_STATUS set_ack_window(unsigned int);
+EXPORT APS2_STATUS get_ack_window(unsigned int *);
+EXPORT APS2_STATUS set_io_threads(unsigned int);
+EXPORT APS2_STATUS get_io_threads(unsigned int *);
+EXPORT APS2_STATUS start_trace(const char *);
+EXPORT APS2_STATUS stop_trace();
 
 EXPORT APS2_STATUS write_bitfile(const char *, const char *, uint32_t,
                                  APS2_BITFILE_STORAGE_MEDIA);
@@ -134,6 +231,101 @@ EXPORT int run_DAC_BIST(const char *, const int, int16_t *, unsigned int,
 EXPORT APS2_STATUS set_DAC_SD(const char *, const int, const uint8_t);
 EXPORT APS2_STATUS toggle_DAC_clock(const char *, const int);
 
+/* handle based API */
+
+EXPORT APS2_STATUS disconnect_APS_h(APS2_HANDLE);
+
+EXPORT APS2_STATUS reset_h(APS2_HANDLE, APS2_RESET_MODE);
+EXPORT APS2_STATUS init_APS_h(APS2_HANDLE, int);
+
+EXPORT APS2_STATUS get_firmware_version_h(APS2_HANDLE, uint32_t *, uint32_t *,
+                                          uint32_t *, char *);
+EXPORT APS2_STATUS get_uptime_h(APS2_HANDLE, double *);
+EXPORT APS2_STATUS get_fpga_temperature_h(APS2_HANDLE, float *);
+
+EXPORT APS2_STATUS set_sampleRate_h(APS2_HANDLE, unsigned int);
+EXPORT APS2_STATUS get_sampleRate_h(APS2_HANDLE, unsigned int *);
+
+EXPORT APS2_STATUS set_channel_offset_h(APS2_HANDLE, int, float);
+EXPORT APS2_STATUS get_channel_offset_h(APS2_HANDLE, int, float *);
+EXPORT APS2_STATUS set_channel_scale_h(APS2_HANDLE, int, float);
+EXPORT APS2_STATUS get_channel_scale_h(APS2_HANDLE, int, float *);
+EXPORT APS2_STATUS set_channel_enabled_h(APS2_HANDLE, int, int);
+EXPORT APS2_STATUS get_channel_enabled_h(APS2_HANDLE, int, int *);
+EXPORT APS2_STATUS set_channel_delay_h(APS2_HANDLE, int, unsigned int);
+EXPORT APS2_STATUS get_channel_delay_h(APS2_HANDLE, int, unsigned int *);
+
+EXPORT APS2_STATUS set_mixer_amplitude_imbalance_h(APS2_HANDLE, float);
+EXPORT APS2_STATUS get_mixer_amplitude_imbalance_h(APS2_HANDLE, float *);
+EXPORT APS2_STATUS set_mixer_phase_skew_h(APS2_HANDLE, float);
+EXPORT APS2_STATUS get_mixer_phase_skew_h(APS2_HANDLE, float *);
+EXPORT APS2_STATUS set_mixer_correction_matrix_h(APS2_HANDLE, float *);
+EXPORT APS2_STATUS get_mixer_correction_matrix_h(APS2_HANDLE, float *);
+
+EXPORT APS2_STATUS set_trigger_source_h(APS2_HANDLE, APS2_TRIGGER_SOURCE);
+EXPORT APS2_STATUS get_trigger_source_h(APS2_HANDLE, APS2_TRIGGER_SOURCE *);
+EXPORT APS2_STATUS set_trigger_interval_h(APS2_HANDLE, double);
+EXPORT APS2_STATUS get_trigger_interval_h(APS2_HANDLE, double *);
+EXPORT APS2_STATUS trigger_h(APS2_HANDLE);
+
+EXPORT APS2_STATUS set_waveform_float_h(APS2_HANDLE, int, float *, int);
+EXPORT APS2_STATUS set_waveform_int_h(APS2_HANDLE, int, int16_t *, int);
+EXPORT APS2_STATUS set_markers_h(APS2_HANDLE, int, uint8_t *, int);
+
+EXPORT APS2_STATUS write_sequence_h(APS2_HANDLE, uint64_t *, uint32_t);
+
+EXPORT APS2_STATUS set_waveform_float_async_h(APS2_HANDLE, int, float *, int,
+                                              APS2_ASYNC_TOKEN *);
+EXPORT APS2_STATUS set_waveform_int_async_h(APS2_HANDLE, int, int16_t *, int,
+                                            APS2_ASYNC_TOKEN *);
+EXPORT APS2_STATUS write_sequence_async_h(APS2_HANDLE, uint64_t *, uint32_t,
+                                          APS2_ASYNC_TOKEN *);
+
+EXPORT APS2_STATUS add_waveform_float_h(APS2_HANDLE, int, const char *,
+                                        float *, uint8_t *, int, uint32_t *);
+EXPORT APS2_STATUS add_waveform_int_h(APS2_HANDLE, int, const char *,
+                                      int16_t *, uint8_t *, int, uint32_t *);
+EXPORT APS2_STATUS remove_waveform_h(APS2_HANDLE, int, const char *);
+EXPORT APS2_STATUS add_sequence_segment_h(APS2_HANDLE, const char *,
+                                          uint64_t *, uint32_t, uint32_t *);
+EXPORT APS2_STATUS remove_sequence_segment_h(APS2_HANDLE, const char *);
+EXPORT APS2_STATUS get_waveform_memory_usage_h(APS2_HANDLE, int,
+                                               APS2_MEMORY_USAGE *);
+EXPORT APS2_STATUS get_sequence_memory_usage_h(APS2_HANDLE,
+                                               APS2_MEMORY_USAGE *);
+
+EXPORT APS2_STATUS set_run_mode_h(APS2_HANDLE, APS2_RUN_MODE);
+EXPORT APS2_STATUS set_waveform_frequency_h(APS2_HANDLE, float);
+EXPORT APS2_STATUS get_waveform_frequency_h(APS2_HANDLE, float *);
+
+EXPORT APS2_STATUS load_sequence_file_h(APS2_HANDLE, const char *);
+EXPORT APS2_STATUS clear_channel_data_h(APS2_HANDLE);
+
+EXPORT APS2_STATUS run_h(APS2_HANDLE);
+EXPORT APS2_STATUS stop_h(APS2_HANDLE);
+EXPORT APS2_STATUS get_runState_h(APS2_HANDLE, APS2_RUN_STATE *);
+
+EXPORT APS2_STATUS get_ip_addr_h(APS2_HANDLE, char *);
+EXPORT APS2_STATUS set_ip_addr_h(APS2_HANDLE, const char *);
+
+EXPORT APS2_STATUS get_dhcp_enable_h(APS2_HANDLE, int *);
+EXPORT APS2_STATUS set_dhcp_enable_h(APS2_HANDLE, const int);
+
+EXPORT APS2_STATUS set_register_cache_h(APS2_HANDLE, const int);
+EXPORT APS2_STATUS get_register_cache_h(APS2_HANDLE, int *);
+EXPORT APS2_STATUS resync_register_cache_h(APS2_HANDLE);
+
+EXPORT APS2_STATUS get_transport_metrics_h(APS2_HANDLE, APS2_METRICS *);
+EXPORT APS2_STATUS reset_transport_metrics_h(APS2_HANDLE);
+
+EXPORT APS2_STATUS write_memory_h(APS2_HANDLE, uint32_t, uint32_t *, uint32_t);
+EXPORT APS2_STATUS read_memory_h(APS2_HANDLE, uint32_t, uint32_t *, uint32_t);
+EXPORT APS2_STATUS read_register_h(APS2_HANDLE, uint32_t, uint32_t *);
+EXPORT APS2_STATUS write_memory_async_h(APS2_HANDLE, uint32_t, uint32_t *,
+                                        uint32_t, APS2_ASYNC_TOKEN *);
+EXPORT APS2_STATUS read_memory_async_h(APS2_HANDLE, uint32_t, uint32_t *,
+                                       uint32_t, APS2_ASYNC_TOKEN *);
+
 #ifdef __cplusplus
 }
 #endif
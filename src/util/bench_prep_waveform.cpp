@@ -0,0 +1,121 @@
+// Micro-benchmark for preparing waveform memory: the fused Channel kernel
+// against the original multi-pass preparation and packing
+//
+// Usage: aps2_bench_prep_waveform [numSamples]
+//
+// Copyright 2016, Raytheon BBN Technologies
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "Channel.h"
+#include "constants.h"
+
+using std::cout;
+using std::endl;
+using std::vector;
+
+namespace {
+
+// The preparation as it was before the fused kernel: convert, look for and
+// clip values out of range in separate passes, merge the markers, then pack
+// pairs of samples into words
+vector<uint32_t> multi_pass(const vector<float> &waveform,
+                            const vector<uint8_t> &markers) {
+  vector<int16_t> prepVec(waveform.size());
+  for (size_t ct = 0; ct < prepVec.size(); ct++) {
+    prepVec[ct] = int16_t(MAX_WF_AMP * waveform[ct]);
+  }
+  if ((prepVec.size() > 0) &&
+      (*std::max_element(prepVec.begin(), prepVec.end()) > MAX_WF_AMP)) {
+    for (int16_t &tmpVal : prepVec) {
+      if (tmpVal > MAX_WF_AMP)
+        tmpVal = MAX_WF_AMP;
+    }
+  }
+  if ((prepVec.size() > 0) &&
+      (*std::min_element(prepVec.begin(), prepVec.end()) <
+       -(MAX_WF_AMP + 1))) {
+    for (int16_t &tmpVal : prepVec) {
+      if (tmpVal < -MAX_WF_AMP)
+        tmpVal = -MAX_WF_AMP;
+    }
+  }
+  for (size_t ct = 0; ct < prepVec.size(); ct++) {
+    prepVec[ct] =
+        (prepVec[ct] & 0x3FFF) | (static_cast<uint16_t>(markers[ct]) << 14);
+  }
+
+  vector<uint32_t> packed_data;
+  for (size_t ct = 0; ct < prepVec.size(); ct += 2) {
+    packed_data.push_back(((uint32_t)prepVec[ct + 1] << 16) |
+                          (uint16_t)prepVec[ct]);
+  }
+  return packed_data;
+}
+
+template <typename F> double best_ms(F func, int repeats = 3) {
+  double best = 0;
+  for (int ct = 0; ct < repeats; ct++) {
+    auto start = std::chrono::steady_clock::now();
+    func();
+    double duration = std::chrono::duration<double, std::milli>(
+                          std::chrono::steady_clock::now() - start)
+                          .count();
+    best = (ct == 0) ? duration : std::min(best, duration);
+  }
+  return best;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  size_t numSamples = MAX_WF_LENGTH;
+  if (argc > 1) {
+    numSamples = std::strtoull(argv[1], nullptr, 10);
+  }
+  numSamples = WF_MODULUS * ((numSamples + WF_MODULUS - 1) / WF_MODULUS);
+
+  // a little beyond full scale so some samples clip
+  std::mt19937 gen(42);
+  std::uniform_real_distribution<float> amplitude(-1.05f, 1.05f);
+  std::uniform_int_distribution<int> marker(0, 3);
+  vector<float> waveform(numSamples);
+  vector<uint8_t> markers(numSamples);
+  for (size_t ct = 0; ct < numSamples; ct++) {
+    waveform[ct] = amplitude(gen);
+    markers[ct] = marker(gen);
+  }
+
+  vector<uint32_t> reference;
+  double multi_pass_ms =
+      best_ms([&]() { reference = multi_pass(waveform, markers); });
+
+  vector<uint32_t> packed(numSamples / 2);
+  bool clippedHigh, clippedLow;
+  double fused_ms = best_ms([&]() {
+    Channel::pack_samples(waveform.data(), markers.data(), numSamples,
+                          packed.data(), clippedHigh, clippedLow);
+  });
+
+  cout << std::fixed << std::setprecision(1);
+  cout << "Prepared " << numSamples << " samples ("
+       << 4 * numSamples / (1 << 20) << " MB of floats)" << endl;
+  cout << "  multi-pass: " << std::setw(8) << multi_pass_ms << " ms" << endl;
+  cout << "  fused:      " << std::setw(8) << fused_ms << " ms ("
+       << numSamples / fused_ms / 1e6 << " Gsamples/s)" << endl;
+  cout << "  speedup:    " << std::setw(8) << multi_pass_ms / fused_ms << "x"
+       << endl;
+
+  if (packed != reference) {
+    cout << "Fused kernel output differs from the multi-pass preparation!"
+         << endl;
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,103 @@
+// Convert APS2 sequence files between the original layout and the indexed
+// version 2 container
+//
+// Copyright 2016, Raytheon BBN Technologies
+
+#include <iostream>
+#include <plog/Log.h>
+
+#include "APS2SequenceFile.h"
+#include "libaps2.h"
+
+#include "../C++/helpers.h"
+#include "../C++/optionparser.h"
+
+#include <concol.h>
+
+using std::cout;
+using std::endl;
+
+enum optionIndex { UNKNOWN, HELP, INPUT, OUTPUT, VERSION, METADATA, LOG_LEVEL };
+const option::Descriptor usage[] = {
+    {UNKNOWN, 0, "", "", option::Arg::None,
+     "USAGE: convert_sequence [options]\n\n"
+     "Options:"},
+    {HELP, 0, "", "help", option::Arg::None,
+     "	--help	\tPrint usage and exit."},
+    {INPUT, 0, "", "input", option::Arg::NonEmpty,
+     "	--input	\tSequence file to convert, either version."},
+    {OUTPUT, 0, "", "output", option::Arg::NonEmpty,
+     "	--output	\tFile to write."},
+    {VERSION, 0, "", "version", option::Arg::Numeric,
+     "	--version	\tVersion to write, 1 or 2 (optional; default=2)."},
+    {METADATA, 0, "", "metadata", option::Arg::NonEmpty,
+     "	--metadata	\tText to store with a version 2 file, replacing any "
+     "in the input (optional)."},
+    {LOG_LEVEL, 0, "", "logLevel", option::Arg::Numeric,
+     "	--logLevel	\t(optional) Logging level level to print (optional; "
+     "default=2/INFO)."},
+
+    {UNKNOWN, 0, "", "", option::Arg::None,
+     "\nExamples:\n"
+     "	convert_sequence --input=ramsey.aps2 --output=ramsey.v2.aps2\n"
+     "	convert_sequence --input=ramsey.v2.aps2 --output=ramsey.aps2 "
+     "--version=1\n"},
+    {0, 0, 0, 0, 0, 0}};
+
+int main(int argc, char *argv[]) {
+
+  print_title("BBN APS2 Sequence File Converter");
+
+  argc -= (argc > 0);
+  argv += (argc > 0); // skip program name argv[0] if present
+  option::Stats stats(usage, argc, argv);
+  option::Option *options = new option::Option[stats.options_max];
+  option::Option *buffer = new option::Option[stats.buffer_max];
+  option::Parser parse(usage, argc, argv, options, buffer);
+
+  if (parse.error())
+    return -1;
+
+  if (options[HELP] || !options[INPUT] || !options[OUTPUT]) {
+    option::printUsage(std::cout, usage);
+    return options[HELP] ? 0 : -1;
+  }
+
+  plog::Severity logLevel = plog::info;
+  if (options[LOG_LEVEL]) {
+    logLevel = static_cast<plog::Severity>(atoi(options[LOG_LEVEL].arg));
+  }
+  set_file_logging_level(logLevel);
+  set_console_logging_level(plog::warning);
+
+  uint32_t version = APS2SequenceFile::VERSION;
+  if (options[VERSION]) {
+    version = static_cast<uint32_t>(atoi(options[VERSION].arg));
+  }
+  if (version != 1 && version != APS2SequenceFile::VERSION) {
+    std::cerr << concol::RED << "Unknown sequence file version " << version
+              << concol::RESET << endl;
+    return -1;
+  }
+
+  try {
+    auto data = APS2SequenceFile::read(options[INPUT].arg);
+    if (options[METADATA]) {
+      data.metadata = options[METADATA].arg;
+    }
+    if (version == 1) {
+      APS2SequenceFile::write_v1(options[OUTPUT].arg, data);
+    } else {
+      APS2SequenceFile::write_v2(options[OUTPUT].arg, data);
+    }
+    cout << "Wrote " << data.instructions.size() << " instructions and "
+         << data.waveforms.size() << " waveforms to " << options[OUTPUT].arg
+         << " (version " << version << ")" << endl;
+  } catch (APS2_STATUS status) {
+    std::cerr << concol::RED << "Conversion failed: " << get_error_msg(status)
+              << concol::RESET << endl;
+    return -1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,259 @@
+// Play an APS2 traffic trace recorded with start_trace back against a local
+// stand-in APS2 and report how long it took
+//
+// Copyright 2016, Raytheon BBN Technologies
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <plog/Log.h>
+#include <thread>
+
+#include "APS2Ethernet.h"
+#include "APS2StandIn.h"
+#include "APS2Trace.h"
+#include "constants.h"
+#include "libaps2.h"
+
+#include "../C++/helpers.h"
+#include "../C++/optionparser.h"
+
+#include <concol.h>
+
+using std::cout;
+using std::endl;
+
+enum optionIndex {
+  UNKNOWN,
+  HELP,
+  TRACE_FILE,
+  DEVICE,
+  STAND_IN,
+  LATENCY,
+  REAL_TIME,
+  LOG_LEVEL
+};
+const option::Descriptor usage[] = {
+    {UNKNOWN, 0, "", "", option::Arg::None, "USAGE: replay [options]\n\n"
+                                            "Options:"},
+    {HELP, 0, "", "help", option::Arg::None,
+     "	--help	\tPrint usage and exit."},
+    {TRACE_FILE, 0, "", "trace", option::Arg::NonEmpty,
+     "	--trace	\tTrace file recorded with start_trace."},
+    {DEVICE, 0, "", "device", option::Arg::NonEmpty,
+     "	--device	\tIP address of the device in the trace to replay "
+     "(optional; default=first in trace)."},
+    {STAND_IN, 0, "", "standIn", option::Arg::NonEmpty,
+     "	--standIn	\tLoopback address for the stand-in APS2 (optional; "
+     "default=127.0.0.2)."},
+    {LATENCY, 0, "", "latency", option::Arg::Numeric,
+     "	--latency	\tStand-in response latency in us (optional; "
+     "default=0)."},
+    {REAL_TIME, 0, "", "realTime", option::Arg::None,
+     "	--realTime	\tKeep the recorded idle time between bursts "
+     "(optional)."},
+    {LOG_LEVEL, 0, "", "logLevel", option::Arg::Numeric,
+     "	--logLevel	\t(optional) Logging level level to print (optional; "
+     "default=2/INFO)."},
+
+    {UNKNOWN, 0, "", "", option::Arg::None,
+     "\nExamples:\n"
+     "	replay --trace=session.aps2trace\n"
+     "	replay --trace=session.aps2trace --device=192.168.5.20 "
+     "--latency=200\n"},
+    {0, 0, 0, 0, 0, 0}};
+
+namespace {
+
+bool expects_ack(const APS2TraceRecord &record) {
+  if (record.transport == APS2TraceTransport::TCP) {
+    return record.datagram.cmd.ack;
+  }
+  // the top bit of the command nibble asks a legacy APS2 not to acknowledge
+  return !record.datagram.cmd.r_w && !(record.datagram.cmd.cmd & 0x8);
+}
+
+double to_ms(std::chrono::nanoseconds duration) {
+  return std::chrono::duration<double, std::milli>(duration).count();
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+
+  print_title("BBN APS2 Trace Replay");
+
+  argc -= (argc > 0);
+  argv += (argc > 0); // skip program name argv[0] if present
+  option::Stats stats(usage, argc, argv);
+  option::Option *options = new option::Option[stats.options_max];
+  option::Option *buffer = new option::Option[stats.buffer_max];
+  option::Parser parse(usage, argc, argv, options, buffer);
+
+  if (parse.error())
+    return -1;
+
+  if (options[HELP] || !options[TRACE_FILE]) {
+    option::printUsage(std::cout, usage);
+    return options[HELP] ? 0 : -1;
+  }
+
+  plog::Severity logLevel = plog::info;
+  if (options[LOG_LEVEL]) {
+    logLevel = static_cast<plog::Severity>(atoi(options[LOG_LEVEL].arg));
+  }
+  set_file_logging_level(logLevel);
+  set_console_logging_level(plog::warning);
+
+  // Pull out the traffic for one device
+  vector<APS2TraceRecord> records;
+  uint32_t device = 0;
+  if (options[DEVICE]) {
+    device = asio::ip::address_v4::from_string(options[DEVICE].arg).to_ulong();
+  }
+  try {
+    APS2TraceReader reader(options[TRACE_FILE].arg);
+    APS2TraceRecord record;
+    while (reader.next(record)) {
+      if (device == 0) {
+        device = record.ipAddr;
+      }
+      if (record.ipAddr == device) {
+        records.push_back(std::move(record));
+      }
+    }
+  } catch (APS2_STATUS status) {
+    std::cerr << concol::RED << "Unable to read trace "
+              << options[TRACE_FILE].arg << concol::RESET << endl;
+    return -1;
+  }
+  if (records.empty()) {
+    std::cerr << concol::RED << "No traffic to replay" << concol::RESET
+              << endl;
+    return -1;
+  }
+  bool supports_tcp = records.front().transport == APS2TraceTransport::TCP;
+  cout << "Replaying " << records.size() << " records for "
+       << asio::ip::address_v4(device).to_string() << " over "
+       << (supports_tcp ? "TCP" : "UDP") << endl;
+
+  string ip = options[STAND_IN] ? options[STAND_IN].arg : "127.0.0.2";
+  APS2StandIn standin(ip, supports_tcp);
+  if (options[LATENCY]) {
+    standin.set_latency(
+        std::chrono::microseconds(atoi(options[LATENCY].arg)));
+  }
+  auto ethernet = std::make_shared<APS2Ethernet>(0, 0);
+  ethernet->connect(ip);
+
+  // Sends are batched as the driver sent them up to the next response the
+  // caller waited on. Acknowledges are collected by the sends themselves.
+  vector<APS2Datagram> datagrams;
+  vector<APS2EthernetPacket> packets;
+  auto flush = [&]() {
+    if (!datagrams.empty()) {
+      ethernet->send(ip, datagrams);
+      datagrams.clear();
+    }
+    if (!packets.empty()) {
+      ethernet->send(ip, packets, 0);
+      packets.clear();
+    }
+  };
+
+  bool sentAny = false;
+  size_t pendingAcks = 0;
+  size_t responses = 0;
+  size_t mismatches = 0;
+  auto traceStart = records.front().timestamp;
+  auto start = std::chrono::steady_clock::now();
+  try {
+    for (const auto &record : records) {
+      const APS2Datagram &dg = record.datagram;
+      if (record.direction == APS2TraceDirection::RECEIVED) {
+        // responses to requests from before the trace started
+        if (!sentAny) {
+          continue;
+        }
+        if (pendingAcks > 0) {
+          pendingAcks--;
+          continue;
+        }
+        flush();
+        auto response = ethernet->read(ip, COMMS_TIMEOUT);
+        responses++;
+        if (response.payload.size() != dg.payload.size()) {
+          mismatches++;
+        }
+        continue;
+      }
+
+      if (options[REAL_TIME]) {
+        auto due = start + (record.timestamp - traceStart);
+        if (due > std::chrono::steady_clock::now()) {
+          flush();
+          std::this_thread::sleep_until(due);
+        }
+      }
+      sentAny = true;
+      if (expects_ack(record)) {
+        pendingAcks++;
+      }
+      if (supports_tcp) {
+        datagrams.push_back(dg);
+        continue;
+      }
+      APS2EthernetPacket packet(dg.cmd, dg.addr);
+      packet.payload = dg.payload;
+      if (dg.cmd.r_w) {
+        flush();
+        ethernet->send(ip, packet, false);
+      } else if (expects_ack(record)) {
+        packets.push_back(std::move(packet));
+        ethernet->send(ip, packets, packets.size());
+        packets.clear();
+      } else {
+        packets.push_back(std::move(packet));
+      }
+    }
+    flush();
+  } catch (APS2_STATUS status) {
+    std::cerr << concol::RED << "Replay failed: " << get_error_msg(status)
+              << concol::RESET << endl;
+    return -1;
+  }
+  auto replayDuration = std::chrono::steady_clock::now() - start;
+  auto recordedDuration = records.back().timestamp - traceStart;
+
+  auto metrics = ethernet->get_metrics(ip);
+  cout << std::fixed << std::setprecision(1);
+  cout << "Recorded session: " << to_ms(recordedDuration) << " ms" << endl;
+  cout << "Replay:           " << to_ms(replayDuration) << " ms" << endl;
+  cout << "Sent " << metrics->datagramsSent << " datagrams ("
+       << metrics->bytesSent / 1024 << " kB) and read " << responses
+       << " responses (" << metrics->bytesReceived / 1024 << " kB)" << endl;
+  if (mismatches > 0) {
+    cout << concol::YELLOW << mismatches
+         << " responses differed in length from the recording"
+         << concol::RESET << endl;
+  }
+
+  uint64_t counts[LATENCY_HISTOGRAM_BUCKETS];
+  metrics->ackLatency.snapshot(counts);
+  cout << "Acknowledge latency:" << endl;
+  for (size_t ct = 0; ct < LATENCY_HISTOGRAM_BUCKETS; ct++) {
+    if (counts[ct] == 0) {
+      continue;
+    }
+    if (ct < LATENCY_HISTOGRAM_BUCKETS - 1) {
+      cout << "  < " << std::setw(8) << (1u << ct) << " us: ";
+    } else {
+      cout << "  longer:      ";
+    }
+    cout << counts[ct] << endl;
+  }
+
+  ethernet->disconnect(ip);
+  return 0;
+}
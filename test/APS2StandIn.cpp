@@ -0,0 +1,410 @@
+// Stand-in APS2 that serves the ethernet protocol on a loopback address so the
+// driver can be exercised and benchmarked without hardware.
+
+#include "APS2StandIn.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "APS2EthernetPacket.h"
+#include "constants.h"
+
+using asio::ip::tcp;
+using asio::ip::udp;
+
+namespace {
+
+// The driver only expects an address word back for USERIO style commands
+bool response_has_address(const APS2Command &cmd) {
+  switch (APS_COMMANDS(cmd.cmd & 0x7)) {
+  case APS_COMMANDS::STATUS:
+  case APS_COMMANDS::FPGACONFIG_ACK:
+  case APS_COMMANDS::EPROMIO:
+  case APS_COMMANDS::CHIPCONFIGIO:
+    return false;
+  default:
+    return true;
+  }
+}
+
+uint32_t spi_key(uint32_t target, uint32_t addr) {
+  return (target << 16) | addr;
+}
+
+void push_word(vector<uint8_t> &bytes, uint32_t word) {
+  bytes.push_back(word >> 24);
+  bytes.push_back(word >> 16);
+  bytes.push_back(word >> 8);
+  bytes.push_back(word);
+}
+
+} // namespace
+
+APS2StandIn::APS2StandIn(const string &ip_addr, bool supports_tcp)
+    : ip_addr_{ip_addr}, supports_tcp_{supports_tcp}, latency_{0},
+      record_writes_{true}, num_datagrams_{0}, fail_addr_{NO_FAILURE},
+      enumerate_delay_{0}, spi_read_key_{0},
+      acceptor_(ios_), tcp_socket_(ios_), udp_socket_old_(ios_),
+      udp_socket_(ios_), response_timer_(ios_), enumerate_timer_(ios_) {
+
+  // PLL bypassed for the 1.2 GHz sample clock
+  spi_registers_[spi_key(CHIPCONFIG_IO_TARGET_PLL, 0x191)] = 0x80;
+
+  auto addr = asio::ip::address_v4::from_string(ip_addr);
+
+  if (supports_tcp_) {
+    acceptor_.open(tcp::v4());
+    acceptor_.set_option(asio::socket_base::reuse_address(true));
+    acceptor_.bind(tcp::endpoint(addr, TCP_PORT));
+    acceptor_.listen();
+    accept_tcp();
+
+    udp_socket_.open(udp::v4());
+    udp_socket_.bind(udp::endpoint(addr, UDP_PORT));
+    receive_udp();
+  }
+  // TCP firmware still answers status requests on the legacy port
+  udp_socket_old_.open(udp::v4());
+  udp_socket_old_.bind(udp::endpoint(addr, UDP_PORT_OLD));
+  receive_udp_old();
+
+  ioThread_ = std::thread([this]() { ios_.run(); });
+}
+
+APS2StandIn::~APS2StandIn() {
+  ios_.stop();
+  ioThread_.join();
+}
+
+void APS2StandIn::set_latency(std::chrono::microseconds latency) {
+  latency_ = latency.count();
+}
+
+void APS2StandIn::set_record_writes(bool record) { record_writes_ = record; }
+
+void APS2StandIn::fail_request(uint32_t addr) { fail_addr_ = addr; }
+
+void APS2StandIn::announce(const udp::endpoint &host) {
+  ios_.post([this, host]() {
+    APS2Command cmd;
+    cmd.r_w = 1;
+    cmd.cmd = static_cast<uint32_t>(APS_COMMANDS::STATUS);
+    cmd.mode_stat = APS_STATUS_HOST;
+    bool respond;
+    auto resp = handle_datagram({cmd, 0, {}}, !supports_tcp_, respond);
+    queue_udp_old_response(resp, 0, host);
+  });
+}
+
+void APS2StandIn::set_enumerate_delay(std::chrono::microseconds delay) {
+  enumerate_delay_ = delay.count();
+}
+
+vector<uint32_t> APS2StandIn::read_memory(uint32_t addr, size_t numWords) {
+  std::lock_guard<std::mutex> guard(memory_lock_);
+  vector<uint32_t> data(numWords, 0);
+  uint64_t key = (static_cast<uint64_t>(APS_COMMANDS::USERIO_ACK) << 32) | addr;
+  for (auto &val : data) {
+    auto it = memory_.find(key);
+    if (it != memory_.end()) {
+      val = it->second;
+    }
+    key += 4;
+  }
+  return data;
+}
+
+void APS2StandIn::write_memory(uint32_t addr, const vector<uint32_t> &data) {
+  std::lock_guard<std::mutex> guard(memory_lock_);
+  uint64_t key = (static_cast<uint64_t>(APS_COMMANDS::USERIO_ACK) << 32) | addr;
+  for (auto val : data) {
+    memory_[key] = val;
+    key += 4;
+  }
+}
+
+size_t APS2StandIn::num_datagrams() const { return num_datagrams_; }
+
+void APS2StandIn::accept_tcp() {
+  acceptor_.async_accept(tcp_socket_, [this](std::error_code ec) {
+    if (!ec) {
+      // answer straight away like the firmware TCP stack
+      tcp_socket_.set_option(tcp::no_delay(true));
+      read_tcp_header();
+    }
+  });
+}
+
+void APS2StandIn::restart_tcp() {
+  // Driver went away so drop what was due on its connection and wait for the
+  // next one
+  tcp_socket_.close();
+  responses_.erase(std::remove_if(responses_.begin(), responses_.end(),
+                                  [](const Response &r) { return !r.udp; }),
+                   responses_.end());
+  accept_tcp();
+}
+
+void APS2StandIn::read_tcp_header() {
+  // Every datagram from the driver starts with a command and address word
+  asio::async_read(
+      tcp_socket_, asio::buffer(tcp_header_, sizeof(tcp_header_)),
+      [this](std::error_code ec, std::size_t) {
+        if (ec) {
+          restart_tcp();
+          return;
+        }
+        APS2Command cmd;
+        cmd.packed = ntohl(tcp_header_[0]);
+        uint32_t addr = ntohl(tcp_header_[1]);
+        read_tcp_payload(cmd, addr);
+      });
+}
+
+void APS2StandIn::read_tcp_payload(APS2Command cmd, uint32_t addr) {
+  // Only writes carry a payload; reads use the count for the response length
+  tcp_payload_.resize(cmd.r_w ? 0 : cmd.cnt);
+  asio::async_read(
+      tcp_socket_,
+      asio::buffer(tcp_payload_.data(), 4 * tcp_payload_.size()),
+      [this, cmd, addr](std::error_code ec, std::size_t) {
+        if (ec) {
+          restart_tcp();
+          return;
+        }
+        for (auto &val : tcp_payload_) {
+          val = ntohl(val);
+        }
+        bool respond;
+        num_datagrams_++;
+        auto resp = handle_datagram({cmd, addr, tcp_payload_}, false, respond);
+        if (respond) {
+          Response r;
+          r.udp = false;
+          push_word(r.bytes, resp.cmd.packed);
+          if (response_has_address(resp.cmd)) {
+            push_word(r.bytes, resp.addr);
+          }
+          for (auto val : resp.payload) {
+            push_word(r.bytes, val);
+          }
+          queue_response(std::move(r));
+        }
+        read_tcp_header();
+      });
+}
+
+void APS2StandIn::receive_udp_old() {
+  udp_socket_old_.async_receive_from(
+      asio::buffer(udp_data_old_), udp_sender_old_,
+      [this](std::error_code ec, std::size_t bytesReceived) {
+        if (ec) {
+          return;
+        }
+        APS2EthernetPacket packet(
+            vector<uint8_t>(udp_data_old_, udp_data_old_ + bytesReceived));
+        // NOACK is signalled with the top bit of the command nibble
+        APS2Command cmd = packet.header.command;
+        bool noACK = (cmd.cmd & 0x8) == 0x8;
+        cmd.cmd &= 0x7;
+        cmd.ack = cmd.r_w ? 0 : !noACK;
+        // TCP firmware only answers the status request used to enumerate,
+        // which is not counted
+        bool respond = false;
+        APS2Datagram resp;
+        if (!supports_tcp_) {
+          num_datagrams_++;
+        }
+        if (!supports_tcp_ || APS_COMMANDS(cmd.cmd) == APS_COMMANDS::STATUS) {
+          resp = handle_datagram({cmd, packet.header.addr, packet.payload},
+                                 !supports_tcp_, respond);
+        }
+        if (respond) {
+          queue_udp_old_response(resp, packet.header.seqNum, udp_sender_old_);
+        }
+        receive_udp_old();
+      });
+}
+
+void APS2StandIn::queue_udp_old_response(const APS2Datagram &resp,
+                                         uint16_t seqNum,
+                                         const udp::endpoint &endpoint) {
+  // Responses carry the acknowledge flag so they skip the address
+  Response r;
+  r.udp = true;
+  r.endpoint = endpoint;
+  r.bytes.assign(12, 0xff); // destination and source MAC
+  push_word(r.bytes, (static_cast<uint32_t>(APS_PROTO) << 16) | seqNum);
+  push_word(r.bytes, resp.cmd.packed);
+  for (auto val : resp.payload) {
+    push_word(r.bytes, val);
+  }
+  queue_response(std::move(r));
+}
+
+void APS2StandIn::receive_udp() {
+  udp_socket_.async_receive_from(
+      asio::buffer(udp_data_), udp_sender_,
+      [this](std::error_code ec, std::size_t bytesReceived) {
+        if (ec) {
+          return;
+        }
+        if (bytesReceived == 1 && udp_data_[0] == 0x01) {
+          // enumerate request
+          auto sender = udp_sender_;
+          enumerate_timer_.expires_from_now(
+              std::chrono::microseconds(enumerate_delay_.load()));
+          enumerate_timer_.async_wait([this, sender](std::error_code ec) {
+            if (!ec) {
+              static const string response = "I am an APS2";
+              udp_socket_.send_to(asio::buffer(response), sender);
+            }
+          });
+        } else if (bytesReceived == 1 && udp_data_[0] == 0x02) {
+          // TCP reset request
+          asio::error_code ignored;
+          tcp_socket_.close(ignored);
+        }
+        receive_udp();
+      });
+}
+
+void APS2StandIn::handle_chip_config(const vector<uint32_t> &msg) {
+  // Walk the instruction list remembering the register a read asks for and
+  // storing single byte PLL and DAC writes
+  std::lock_guard<std::mutex> guard(memory_lock_);
+  for (auto word : msg) {
+    APSChipConfigCommand_t cmd;
+    cmd.packed = word;
+    switch (cmd.target) {
+    case CHIPCONFIG_IO_TARGET_PLL: {
+      PLLCommand_t instr;
+      instr.packed = cmd.instr;
+      if (instr.r_w) {
+        spi_read_key_ = spi_key(cmd.target, instr.addr);
+      } else if (instr.W == 0) {
+        spi_registers_[spi_key(cmd.target, instr.addr)] = cmd.spicnt_data;
+      }
+      break;
+    }
+    case CHIPCONFIG_IO_TARGET_DAC_0:
+    case CHIPCONFIG_IO_TARGET_DAC_1: {
+      DACCommand_t instr;
+      instr.packed = cmd.instr;
+      if (instr.r_w) {
+        spi_read_key_ = spi_key(cmd.target, instr.addr);
+      } else {
+        spi_registers_[spi_key(cmd.target, instr.addr)] = cmd.spicnt_data;
+      }
+      break;
+    }
+    case CHIPCONFIG_IO_TARGET_EOL:
+      return;
+    default:
+      break;
+    }
+  }
+}
+
+APS2Datagram APS2StandIn::handle_datagram(const APS2Datagram &dg,
+                                          bool legacy_firmware,
+                                          bool &respond) {
+  APS2Datagram resp{dg.cmd, dg.addr, {}};
+  resp.cmd.ack = 1;
+  uint64_t key = (static_cast<uint64_t>(dg.cmd.cmd) << 32) | dg.addr;
+  uint64_t fail_addr = dg.addr;
+  bool fail = fail_addr_.compare_exchange_strong(fail_addr, NO_FAILURE);
+
+  if (APS_COMMANDS(dg.cmd.cmd) == APS_COMMANDS::STATUS) {
+    APSStatusBank_t statusRegs;
+    std::memset(statusRegs.array, 0, sizeof(statusRegs.array));
+    statusRegs.userFirmwareVersion = legacy_firmware ? 0x00000a01 : 0xbadda555;
+    statusRegs.pllStatus = 0x3; // clock distribution PLL locked
+    resp.cmd.cnt = NUM_STATUS_REGISTERS;
+    resp.payload.assign(statusRegs.array,
+                        statusRegs.array + NUM_STATUS_REGISTERS);
+    respond = true;
+  } else if (APS_COMMANDS(dg.cmd.cmd) == APS_COMMANDS::CHIPCONFIGIO) {
+    if (dg.cmd.r_w) {
+      std::lock_guard<std::mutex> guard(memory_lock_);
+      resp.cmd.cnt = 1;
+      // the byte read comes back in the top of the word
+      resp.payload = {static_cast<uint32_t>(spi_registers_[spi_read_key_])
+                      << 24};
+      respond = true;
+    } else {
+      handle_chip_config(dg.payload);
+      resp.cmd.cnt = 0;
+      resp.cmd.mode_stat = 0;
+      respond = dg.cmd.ack;
+    }
+  } else if (dg.cmd.r_w) {
+    std::lock_guard<std::mutex> guard(memory_lock_);
+    if (fail) {
+      resp.cmd.cnt = 0;
+    }
+    resp.payload.resize(resp.cmd.cnt, 0);
+    for (auto &val : resp.payload) {
+      auto it = memory_.find(key);
+      if (it != memory_.end()) {
+        val = it->second;
+      }
+      key += 4;
+    }
+    respond = true;
+  } else {
+    if (record_writes_) {
+      std::lock_guard<std::mutex> guard(memory_lock_);
+      for (auto val : dg.payload) {
+        memory_[key] = val;
+        key += 4;
+      }
+    }
+    // the datamover reports its status/tag for USERIO writes
+    if (APS_COMMANDS(dg.cmd.cmd) == APS_COMMANDS::USERIO_ACK) {
+      resp.cmd.mode_stat = legacy_firmware ? 0x80 : 0x81;
+      if (fail) {
+        // datamover decode error
+        resp.cmd.mode_stat |= 0x20;
+      }
+      resp.addr = legacy_firmware ? 0 : dg.addr;
+    } else {
+      resp.cmd.mode_stat = 0;
+    }
+    resp.cmd.cnt = 0;
+    respond = dg.cmd.ack;
+  }
+  return resp;
+}
+
+void APS2StandIn::queue_response(Response resp) {
+  resp.due = std::chrono::steady_clock::now() +
+             std::chrono::microseconds(latency_.load());
+  responses_.push_back(std::move(resp));
+  if (responses_.size() == 1) {
+    send_due_responses();
+  }
+}
+
+void APS2StandIn::send_due_responses() {
+  // Responses all share the same latency so they come due in order
+  auto now = std::chrono::steady_clock::now();
+  while (!responses_.empty() && responses_.front().due <= now) {
+    auto &resp = responses_.front();
+    asio::error_code ec;
+    if (resp.udp) {
+      udp_socket_old_.send_to(asio::buffer(resp.bytes), resp.endpoint, 0, ec);
+    } else {
+      asio::write(tcp_socket_, asio::buffer(resp.bytes), ec);
+    }
+    responses_.pop_front();
+  }
+  if (!responses_.empty()) {
+    response_timer_.expires_at(responses_.front().due);
+    response_timer_.async_wait([this](std::error_code ec) {
+      if (!ec) {
+        send_due_responses();
+      }
+    });
+  }
+}
@@ -0,0 +1,113 @@
+// Stand-in APS2 that serves the ethernet protocol on a loopback address so the
+// driver can be exercised and benchmarked without hardware.
+//
+// Talk to it through an APS2Ethernet bound to ephemeral local ports, e.g.
+// std::make_shared<APS2Ethernet>(0, 0), since the stand-in owns the APS2 ports
+// on its address.
+
+#ifndef APS2StandIn_H
+#define APS2StandIn_H
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <string>
+using std::string;
+#include <thread>
+#include <unordered_map>
+#include <vector>
+using std::vector;
+
+#include "asio.hpp"
+
+#include "APS2Datagram.h"
+
+class APS2StandIn {
+public:
+  APS2StandIn(const string &ip_addr, bool supports_tcp = true);
+  ~APS2StandIn();
+
+  // Delay applied to every acknowledge and read response to simulate the
+  // network round trip and device processing time
+  void set_latency(std::chrono::microseconds);
+  // Throughput benchmarks can drop written data instead of storing it
+  void set_record_writes(bool);
+  // Fail the next request to addr: a write is acknowledged with a datamover
+  // error and a read answered with no data
+  void fail_request(uint32_t addr);
+  // Delay the TCP firmware's enumerate reply, which races the status reply
+  // it also sends from the legacy port
+  void set_enumerate_delay(std::chrono::microseconds);
+  // Send the legacy port status reply unasked, as a device does to a
+  // broadcast enumerate from the host at the endpoint
+  void announce(const asio::ip::udp::endpoint &host);
+
+  vector<uint32_t> read_memory(uint32_t addr, size_t numWords);
+  // Seed device registers, e.g. the clock status or init flag
+  void write_memory(uint32_t addr, const vector<uint32_t> &data);
+  size_t num_datagrams() const;
+
+private:
+  struct Response {
+    std::chrono::steady_clock::time_point due;
+    vector<uint8_t> bytes;
+    asio::ip::udp::endpoint endpoint; // only used for legacy UDP responses
+    bool udp;
+  };
+
+  string ip_addr_;
+  bool supports_tcp_;
+  std::atomic<std::chrono::microseconds::rep> latency_;
+  std::atomic<bool> record_writes_;
+  std::atomic<size_t> num_datagrams_;
+  // NO_FAILURE unless a request is to fail
+  static const uint64_t NO_FAILURE = ~0ull;
+  std::atomic<uint64_t> fail_addr_;
+  std::atomic<std::chrono::microseconds::rep> enumerate_delay_;
+
+  // device memory keyed by command and byte address
+  std::unordered_map<uint64_t, uint32_t> memory_;
+  std::mutex memory_lock_;
+
+  // PLL and DAC SPI registers keyed by CHIPCONFIGIO target and address; only
+  // single byte reads are modelled
+  std::unordered_map<uint32_t, uint8_t> spi_registers_;
+  uint32_t spi_read_key_;
+
+  asio::io_service ios_;
+  asio::ip::tcp::acceptor acceptor_;
+  asio::ip::tcp::socket tcp_socket_;
+  asio::ip::udp::socket udp_socket_old_;
+  asio::ip::udp::socket udp_socket_;
+  asio::steady_timer response_timer_;
+  asio::steady_timer enumerate_timer_;
+  std::deque<Response> responses_;
+
+  // receive buffers
+  uint32_t tcp_header_[2];
+  vector<uint32_t> tcp_payload_;
+  uint8_t udp_data_old_[2048];
+  uint8_t udp_data_[16];
+  asio::ip::udp::endpoint udp_sender_old_;
+  asio::ip::udp::endpoint udp_sender_;
+
+  std::thread ioThread_;
+
+  void accept_tcp();
+  void restart_tcp();
+  void read_tcp_header();
+  void read_tcp_payload(APS2Command, uint32_t);
+  void receive_udp_old();
+  void receive_udp();
+
+  void handle_chip_config(const vector<uint32_t> &);
+  APS2Datagram handle_datagram(const APS2Datagram &, bool legacy_firmware,
+                               bool &respond);
+  void queue_udp_old_response(const APS2Datagram &, uint16_t seqNum,
+                              const asio::ip::udp::endpoint &);
+  void queue_response(Response);
+  void send_due_responses();
+};
+
+#endif /* end of include guard: APS2StandIn_H */
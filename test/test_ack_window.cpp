@@ -0,0 +1,115 @@
+// Test and benchmark windowed TCP acknowledges against a loopback stand-in
+
+#include "catch.hpp"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+using std::cout;
+using std::endl;
+#include <memory>
+
+#include "APS2Ethernet.h"
+#include "APS2StandIn.h"
+#include "RandomHelpers.h"
+#include "constants.h"
+
+TEST_CASE("windowed TCP acknowledges", "[loopback]") {
+
+  const string standin_ip = "127.0.0.2";
+  APS2StandIn standin(standin_ip);
+  auto ethernetRM = std::make_shared<APS2Ethernet>(0, 0);
+  ethernetRM->connect(standin_ip);
+
+  APS2Command cmd;
+  cmd.ack = 1;
+  cmd.cmd = static_cast<uint32_t>(APS_COMMANDS::USERIO_ACK);
+
+  SECTION("acks are matched in order and data arrives intact") {
+    uint32_t addr = 0;
+    for (size_t window : {1, 3, 16}) {
+      ethernetRM->set_ack_window(window);
+      auto data = RandomHelpers::random_data(1 << 16);
+      ethernetRM->send(standin_ip, APS2Datagram::chunk(cmd, addr, data, 0x400));
+      CAPTURE(window);
+      REQUIRE(standin.read_memory(addr, data.size()) == data);
+      addr += 4 * data.size();
+    }
+  }
+
+  SECTION("a failed acknowledge mid window leaves the stream in step") {
+    ethernetRM->set_ack_window(8);
+    auto data = RandomHelpers::random_data(1 << 12);
+    auto dgs = APS2Datagram::chunk(cmd, 0, data, 0x100);
+    // the acks of the datagrams after it are already on their way
+    standin.fail_request(dgs[2].addr);
+    REQUIRE_THROWS_AS(ethernetRM->send(standin_ip, dgs), APS2_STATUS);
+
+    // the next read gets its own response rather than a stale acknowledge
+    APS2Command readCmd;
+    readCmd.cmd = static_cast<uint32_t>(APS_COMMANDS::USERIO_ACK);
+    readCmd.r_w = 1;
+    readCmd.cnt = 16;
+    ethernetRM->send(standin_ip, vector<APS2Datagram>{{readCmd, 0, {}}});
+    auto resp = ethernetRM->read(standin_ip, COMMS_TIMEOUT);
+    REQUIRE(resp.payload == vector<uint32_t>(data.begin(), data.begin() + 16));
+    ethernetRM->send(standin_ip, dgs);
+
+    // a response left unread goes with the connection it was sent on
+    ethernetRM->send(standin_ip, vector<APS2Datagram>{{readCmd, 0, {}}});
+    ethernetRM->reconnect_tcp(standin_ip);
+    readCmd.cnt = 4;
+    ethernetRM->send(standin_ip, vector<APS2Datagram>{{readCmd, 0, {}}});
+    resp = ethernetRM->read(standin_ip, COMMS_TIMEOUT);
+    REQUIRE(resp.payload == vector<uint32_t>(data.begin(), data.begin() + 4));
+  }
+
+  SECTION("a timed out read is over before the next one starts") {
+    auto data = RandomHelpers::random_data(16);
+    ethernetRM->send(standin_ip, APS2Datagram::chunk(cmd, 0, data, 0x100));
+    APS2Command readCmd;
+    readCmd.cmd = static_cast<uint32_t>(APS_COMMANDS::USERIO_ACK);
+    readCmd.r_w = 1;
+    readCmd.cnt = 16;
+    standin.set_latency(std::chrono::milliseconds(100));
+    ethernetRM->send(standin_ip, vector<APS2Datagram>{{readCmd, 0, {}}});
+    REQUIRE_THROWS_AS(
+        ethernetRM->read(standin_ip, std::chrono::milliseconds(10)),
+        APS2_STATUS);
+
+    // the late response is left for the next read rather than taken by the
+    // abandoned one
+    auto resp = ethernetRM->read(standin_ip, COMMS_TIMEOUT);
+    REQUIRE(resp.payload == data);
+    standin.set_latency(std::chrono::microseconds(0));
+  }
+
+  SECTION("upload throughput versus window and round trip time") {
+    standin.set_record_writes(false);
+    // 8MB in 256kB datagrams like APS2::write_memory
+    auto data = RandomHelpers::random_data(1 << 21);
+    auto dgs = APS2Datagram::chunk(cmd, 0, data, 0xfffc);
+    for (unsigned rtt : {0, 250, 1000}) {
+      standin.set_latency(std::chrono::microseconds(rtt));
+      double base_rate = 0;
+      for (size_t window : {1, 2, 4, 8, 16}) {
+        ethernetRM->set_ack_window(window);
+        auto start = std::chrono::steady_clock::now();
+        ethernetRM->send(standin_ip, dgs);
+        auto stop = std::chrono::steady_clock::now();
+        auto duration =
+            std::chrono::duration_cast<std::chrono::microseconds>(stop - start)
+                .count();
+        double rate = static_cast<double>(4 * data.size()) / duration;
+        if (window == 1) {
+          base_rate = rate;
+        }
+        cout << "rtt " << std::setw(4) << rtt << " us; window "
+             << std::setw(2) << window << ": " << std::fixed
+             << std::setprecision(1) << rate << " MB/s ("
+             << rate / base_rate << "x)" << endl;
+      }
+    }
+    REQUIRE(standin.num_datagrams() == 15 * dgs.size());
+  }
+}
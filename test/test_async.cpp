@@ -0,0 +1,188 @@
+// Check the asynchronous C API and compare overlapped uploads to several
+// devices with one after the other
+
+#include "catch.hpp"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+using std::cout;
+using std::endl;
+#include <memory>
+#include <thread>
+
+#include "APS2Ethernet.h"
+#include "APS2StandIn.h"
+#include "constants.h"
+#include "libaps2.h"
+
+extern std::weak_ptr<APS2Ethernet> ethernetRM;
+
+TEST_CASE("asynchronous API", "[loopback]") {
+
+  const vector<string> standin_ips = {"127.0.2.1", "127.0.2.2", "127.0.2.3",
+                                      "127.0.2.4"};
+  vector<std::unique_ptr<APS2StandIn>> standins;
+  for (auto ip : standin_ips) {
+    standins.emplace_back(new APS2StandIn(ip));
+    standins.back()->set_latency(std::chrono::microseconds(300));
+  }
+  auto myEthernetRM = std::make_shared<APS2Ethernet>(0, 0);
+  ethernetRM = myEthernetRM;
+
+  vector<APS2_HANDLE> handles;
+  for (auto ip : standin_ips) {
+    APS2_HANDLE handle;
+    REQUIRE(connect_APS_handle(ip.c_str(), &handle) == APS2_OK);
+    handles.push_back(handle);
+  }
+
+  SECTION("overlapped uploads") {
+    const size_t num_words = 1 << 18;
+    vector<vector<uint32_t>> data(handles.size());
+    for (size_t dev = 0; dev < handles.size(); dev++) {
+      data[dev].resize(num_words);
+      for (size_t ct = 0; ct < num_words; ct++) {
+        data[dev][ct] = (dev << 24) | ct;
+      }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t dev = 0; dev < handles.size(); dev++) {
+      REQUIRE(write_memory_h(handles[dev], MEMORY_ADDR, data[dev].data(),
+                             num_words) == APS2_OK);
+    }
+    auto sync_time = std::chrono::steady_clock::now() - start;
+
+    // make sure we check the async writes and not the sync ones
+    for (size_t dev = 0; dev < handles.size(); dev++) {
+      for (auto &val : data[dev]) {
+        val = ~val;
+      }
+    }
+
+    start = std::chrono::steady_clock::now();
+    vector<APS2_ASYNC_TOKEN> tokens(handles.size());
+    for (size_t dev = 0; dev < handles.size(); dev++) {
+      REQUIRE(write_memory_async_h(handles[dev], MEMORY_ADDR, data[dev].data(),
+                                   num_words, &tokens[dev]) == APS2_OK);
+    }
+    for (auto token : tokens) {
+      REQUIRE(wait_async(token) == APS2_OK);
+    }
+    auto async_time = std::chrono::steady_clock::now() - start;
+
+    using ms = std::chrono::duration<double, std::milli>;
+    cout << std::fixed << std::setprecision(1) << handles.size()
+         << " device upload: sequential " << ms(sync_time).count()
+         << " ms; async " << ms(async_time).count() << " ms" << endl;
+
+    for (size_t dev = 0; dev < handles.size(); dev++) {
+      REQUIRE(standins[dev]->read_memory(MEMORY_ADDR, num_words) == data[dev]);
+    }
+    CHECK(async_time < sync_time);
+  }
+
+  SECTION("read back and poll") {
+    vector<uint32_t> data = {1, 2, 3, 4};
+    APS2_ASYNC_TOKEN write_token, read_token;
+    REQUIRE(write_memory_async_h(handles[0], WFA_OFFSET_ADDR, data.data(),
+                                 data.size(), &write_token) == APS2_OK);
+    // operations on one device complete in order
+    vector<uint32_t> readback(data.size(), 0);
+    REQUIRE(read_memory_async(standin_ips[0].c_str(), WFA_OFFSET_ADDR,
+                              readback.data(), readback.size(),
+                              &read_token) == APS2_OK);
+    REQUIRE(wait_async(read_token) == APS2_OK);
+    REQUIRE(readback == data);
+    int done = 0;
+    REQUIRE(poll_async(write_token, &done) == APS2_OK);
+    REQUIRE(done == 1);
+    REQUIRE(wait_async(write_token) == APS2_OK);
+  }
+
+  SECTION("errors are reported on wait") {
+    uint32_t val = 0;
+    APS2_ASYNC_TOKEN token;
+    REQUIRE(write_memory_async_h(handles[0], MEMORY_ADDR + 2, &val, 1,
+                                 &token) == APS2_OK);
+    REQUIRE(wait_async(token) == APS2_UNALIGNED_MEMORY_ACCESS);
+    // tokens are released once waited on
+    REQUIRE(wait_async(token) == APS2_INVALID_ASYNC_TOKEN);
+    int done;
+    REQUIRE(poll_async(0, &done) == APS2_INVALID_ASYNC_TOKEN);
+  }
+
+  for (auto handle : handles) {
+    disconnect_APS_h(handle);
+  }
+}
+
+TEST_CASE("asynchronous and direct setters together", "[loopback]") {
+  const string ip = "127.0.11.8";
+  APS2StandIn standin(ip);
+  auto myEthernetRM = std::make_shared<APS2Ethernet>(0, 0);
+  ethernetRM = myEthernetRM;
+  REQUIRE(connect_APS(ip.c_str()) == APS2_OK);
+
+  // waveforms of changing length so the channel is resized under any setter
+  // not waiting its turn
+  const int num_waveforms = 20;
+  vector<vector<int16_t>> waveforms;
+  for (int ct = 0; ct < num_waveforms; ct++) {
+    waveforms.emplace_back(ct % 2 ? 4000 : 12000,
+                           static_cast<int16_t>(100 * (ct + 1)));
+  }
+  vector<uint8_t> markers(12000, 0x1);
+
+  // every sample of the last waveform with the markers merged in
+  auto check_device = [&](const vector<int16_t> &wf) {
+    uint32_t sample = (0x1u << 14) | static_cast<uint16_t>(wf[0]);
+    REQUIRE(standin.read_memory(CH_A_WF_LENGTH_ADDR, 1)[0] == wf.size());
+    auto words = standin.read_memory(MEMORY_ADDR + WFA_OFFSET, wf.size() / 2);
+    REQUIRE(words == vector<uint32_t>(wf.size() / 2, sample << 16 | sample));
+  };
+
+  SECTION("queued waveforms and direct markers") {
+    vector<APS2_ASYNC_TOKEN> tokens(num_waveforms);
+    for (int ct = 0; ct < num_waveforms; ct++) {
+      REQUIRE(set_waveform_int_async(ip.c_str(), 0, waveforms[ct].data(),
+                                     waveforms[ct].size(),
+                                     &tokens[ct]) == APS2_OK);
+    }
+    for (int ct = 0; ct < num_waveforms; ct++) {
+      REQUIRE(set_markers(ip.c_str(), 0, markers.data(), markers.size()) ==
+              APS2_OK);
+    }
+    for (auto token : tokens) {
+      REQUIRE(wait_async(token) == APS2_OK);
+    }
+    REQUIRE(set_markers(ip.c_str(), 0, markers.data(), markers.size()) ==
+            APS2_OK);
+    check_device(waveforms.back());
+  }
+
+  SECTION("group waveforms and direct markers") {
+    const char *ips[] = {ip.c_str()};
+    APS2_STATUS status = APS2_UNKNOWN_ERROR;
+    std::thread group([&]() {
+      for (auto &wf : waveforms) {
+        set_waveform_int_many(ips, 1, 0, wf.data(), wf.size(), &status);
+        if (status != APS2_OK) {
+          break;
+        }
+      }
+    });
+    for (int ct = 0; ct < num_waveforms; ct++) {
+      REQUIRE(set_markers(ip.c_str(), 0, markers.data(), markers.size()) ==
+              APS2_OK);
+    }
+    group.join();
+    REQUIRE(status == APS2_OK);
+    REQUIRE(set_markers(ip.c_str(), 0, markers.data(), markers.size()) ==
+            APS2_OK);
+    check_device(waveforms.back());
+  }
+
+  REQUIRE(disconnect_APS(ip.c_str()) == APS2_OK);
+}
@@ -52,39 +52,20 @@ TEST_CASE("cache initial state", "[cache]") {
     std::this_thread::sleep_for(std::chrono::milliseconds(1));
 
     // Check the waveform cache
-    // For legacy hardware breakup into 1kB chunks
     vector<uint32_t> check_vec(test_wf_a.size(), 0xdeadbeef);
-    uint32_t check_addr = 0xc4000000;
-    auto it = check_vec.begin();
-    while (check_addr < 0xc4000000 + (1 << 18)) {
-      read_memory(ip_addr.c_str(), check_addr, &*it,
-                  256); // ugly maybe std::pointer_from will exist some day
-      std::advance(it, 256);
-      check_addr += 256 * 4;
-    }
+    read_memory(ip_addr.c_str(), 0xc4000000, check_vec.data(),
+                check_vec.size());
     REQUIRE(check_vec == test_wf_a);
 
-    check_addr = 0xc6000000;
-    it = check_vec.begin();
-    while (check_addr < 0xc6000000 + (1 << 18)) {
-      read_memory(ip_addr.c_str(), check_addr, &*it,
-                  256); // ugly maybe std::pointer_from will exist some day
-      std::advance(it, 256);
-      check_addr += 256 * 4;
-    }
+    read_memory(ip_addr.c_str(), 0xc6000000, check_vec.data(),
+                check_vec.size());
     REQUIRE(check_vec == test_wf_b);
 
     // Check the sequence cache
     // Should have first two lines filled
-    check_addr = 0xc2000000;
     check_vec.resize(2 * 128 * 2);
-    it = check_vec.begin();
-    while (check_addr < 0xc2000000 + (1 << 11)) {
-      read_memory(ip_addr.c_str(), check_addr, &*it,
-                  256); // ugly maybe std::pointer_from will exist some day
-      std::advance(it, 256);
-      check_addr += 256 * 4;
-    }
+    read_memory(ip_addr.c_str(), 0xc2000000, check_vec.data(),
+                check_vec.size());
     test_seq.resize(check_vec.size());
     REQUIRE(check_vec == test_seq);
   }
@@ -0,0 +1,104 @@
+// Check connecting to and initializing a crate of APS2s in parallel
+
+#include "catch.hpp"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+using std::cout;
+using std::endl;
+#include <memory>
+
+#include "APS2Ethernet.h"
+#include "APS2StandIn.h"
+#include "constants.h"
+#include "libaps2.h"
+
+extern std::weak_ptr<APS2Ethernet> ethernetRM;
+
+namespace {
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+} // namespace
+
+TEST_CASE("connect and init many", "[loopback]") {
+
+  const size_t num_devices = 10;
+  vector<string> ips;
+  vector<std::unique_ptr<APS2StandIn>> standins;
+  for (size_t ct = 0; ct < num_devices; ct++) {
+    ips.push_back("127.0.6." + std::to_string(ct + 1));
+    standins.emplace_back(new APS2StandIn(ips.back()));
+    standins.back()->set_latency(std::chrono::milliseconds(1));
+    // clocks locked and already initialized so init only checks status
+    uint32_t clocks = (1u << MMCM_SYS_LOCK_BIT) | (1u << MMCM_CFG_LOCK_BIT) |
+                      (1u << MIG_C0_LOCK_BIT) | (1u << MIG_C0_CAL_BIT) |
+                      (1u << MIG_C1_LOCK_BIT) | (1u << MIG_C1_CAL_BIT);
+    standins.back()->write_memory(PLL_STATUS_ADDR, {clocks});
+    standins.back()->write_memory(INIT_STATUS_ADDR, {1});
+  }
+  vector<const char *> ip_ptrs;
+  for (auto &ip : ips) {
+    ip_ptrs.push_back(ip.c_str());
+  }
+
+  auto myEthernetRM = std::make_shared<APS2Ethernet>(0, 0);
+  ethernetRM = myEthernetRM;
+
+  // connect serially for comparison
+  auto start = std::chrono::steady_clock::now();
+  for (auto &ip : ips) {
+    REQUIRE(connect_APS(ip.c_str()) == APS2_OK);
+    REQUIRE(init_APS(ip.c_str(), 0) == APS2_OK);
+  }
+  double serial_duration = elapsed_ms(start);
+  for (auto &ip : ips) {
+    REQUIRE(disconnect_APS(ip.c_str()) == APS2_OK);
+  }
+
+  SECTION("every board connects and initializes") {
+    vector<APS2_STATUS> statuses(num_devices, APS2_UNKNOWN_ERROR);
+    start = std::chrono::steady_clock::now();
+    REQUIRE(connect_and_init_many(ip_ptrs.data(), num_devices,
+                                  statuses.data()) == APS2_OK);
+    double parallel_duration = elapsed_ms(start);
+    cout << std::fixed << std::setprecision(1) << num_devices
+         << " APS2s connected and initialized in " << serial_duration
+         << " ms serially, " << parallel_duration << " ms in parallel"
+         << endl;
+
+    for (size_t ct = 0; ct < num_devices; ct++) {
+      CHECK(statuses[ct] == APS2_OK);
+      // the boards are usable afterwards
+      unsigned int rate;
+      REQUIRE(get_sampleRate(ips[ct].c_str(), &rate) == APS2_OK);
+      CHECK(rate == 1200);
+    }
+    CHECK(parallel_duration < serial_duration);
+
+    for (auto &ip : ips) {
+      REQUIRE(disconnect_APS(ip.c_str()) == APS2_OK);
+    }
+  }
+
+  SECTION("failures are reported per board") {
+    // nothing answers at this address
+    vector<const char *> with_missing(ip_ptrs);
+    with_missing.insert(with_missing.begin() + 3, "127.0.6.99");
+    vector<APS2_STATUS> statuses(with_missing.size(), APS2_OK);
+    REQUIRE(connect_and_init_many(with_missing.data(), with_missing.size(),
+                                  statuses.data()) == APS2_FAILED_TO_CONNECT);
+    for (size_t ct = 0; ct < with_missing.size(); ct++) {
+      CHECK(statuses[ct] == (ct == 3 ? APS2_FAILED_TO_CONNECT : APS2_OK));
+    }
+
+    for (auto ip : with_missing) {
+      disconnect_APS(ip);
+    }
+  }
+}
@@ -1,5 +1,11 @@
 #include "catch.hpp"
 
+#ifdef _WIN32
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+
 #include "APS2Datagram.h"
 
 TEST_CASE("APS2Datagram chunking", "[datagram]") {
@@ -51,3 +57,26 @@ TEST_CASE("APS2Datagram data", "[datagram]") {
   REQUIRE(data[1] == 0xdeadbeef);
   REQUIRE(vector<uint32_t>(data.begin() + 2, data.end()) == payload);
 }
+
+TEST_CASE("APS2DatagramView chunking", "[datagram]") {
+
+  APS2Command cmd;
+  cmd.packed = 0xbaad0000;
+  vector<uint32_t> data{1, 2, 3, 4, 5};
+  auto network_data = APS2DatagramView::to_network_order(data);
+  REQUIRE(network_data[0] == htonl(1));
+
+  auto chunks = APS2DatagramView::chunk(cmd, 0xdeadbee0, network_data, 2);
+  REQUIRE(chunks.size() == 3);
+  REQUIRE(chunks[2].cmd.packed == 0xbaad0001);
+  REQUIRE(chunks[2].addr == 0xdeadbee0 + 16);
+  REQUIRE(chunks[2].header[0] == htonl(0xbaad0001));
+  REQUIRE(chunks[2].header[1] == htonl(0xdeadbee0 + 16));
+
+  // views point into the swapped buffer rather than copying it
+  REQUIRE(chunks[1].payload == network_data.data() + 2);
+  REQUIRE(chunks[1].payload_size == 2);
+
+  auto dg = chunks[1].to_datagram();
+  REQUIRE(dg.payload == vector<uint32_t>({3, 4}));
+}
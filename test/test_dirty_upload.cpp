@@ -0,0 +1,127 @@
+// Check waveform re-uploads only send the blocks that changed
+
+#include "catch.hpp"
+
+#include <iostream>
+using std::cout;
+using std::endl;
+#include <memory>
+
+#include "APS2.h"
+#include "APS2Ethernet.h"
+#include "APS2StandIn.h"
+#include "Channel.h"
+#include "constants.h"
+
+TEST_CASE("dirty block ranges", "[waveform]") {
+  Channel channel(0);
+  vector<uint32_t> packed(10 * WF_UPLOAD_BLOCK_WORDS + 8, 0x1234);
+  auto hashes = Channel::block_hashes(packed);
+  REQUIRE(hashes.size() == 11);
+
+  // nothing uploaded yet so everything is sent in one go
+  auto ranges = channel.dirty_ranges(hashes, packed.size());
+  REQUIRE(ranges.size() == 1);
+  REQUIRE(ranges[0] == std::make_pair(size_t(0), packed.size()));
+
+  channel.set_uploaded(hashes, 2 * packed.size());
+  REQUIRE(channel.upload_current(hashes, 2 * packed.size()));
+  REQUIRE(!channel.upload_current(hashes, 2 * packed.size() - 4));
+
+  // neighbouring blocks coalesce and the short last block is sent as is
+  packed[3 * WF_UPLOAD_BLOCK_WORDS + 5] = 0;
+  packed[4 * WF_UPLOAD_BLOCK_WORDS] = 0;
+  packed[10 * WF_UPLOAD_BLOCK_WORDS + 7] = 0;
+  ranges = channel.dirty_ranges(Channel::block_hashes(packed), packed.size());
+  REQUIRE(ranges.size() == 2);
+  REQUIRE(ranges[0] == std::make_pair(3 * WF_UPLOAD_BLOCK_WORDS,
+                                      2 * WF_UPLOAD_BLOCK_WORDS));
+  REQUIRE(ranges[1] == std::make_pair(10 * WF_UPLOAD_BLOCK_WORDS, size_t(8)));
+
+  // a longer waveform sends the new blocks
+  packed = vector<uint32_t>(12 * WF_UPLOAD_BLOCK_WORDS, 0x1234);
+  ranges = channel.dirty_ranges(Channel::block_hashes(packed), packed.size());
+  REQUIRE(ranges.size() == 1);
+  REQUIRE(ranges[0] == std::make_pair(10 * WF_UPLOAD_BLOCK_WORDS,
+                                      2 * WF_UPLOAD_BLOCK_WORDS));
+
+  channel.invalidate_upload();
+  REQUIRE(channel.dirty_ranges(hashes, packed.size()).size() == 1);
+}
+
+TEST_CASE("dirty block upload", "[loopback]") {
+  const string ip = "127.0.11.2";
+  APS2StandIn standin(ip);
+  auto myEthernetRM = std::make_shared<APS2Ethernet>(0, 0);
+  APS2 aps(ip);
+  aps.connect(std::shared_ptr<APS2Ethernet>(myEthernetRM));
+  auto metrics = myEthernetRM->get_metrics(ip);
+
+  vector<float> wf(1 << 20);
+  for (size_t ct = 0; ct < wf.size(); ct++) {
+    wf[ct] = static_cast<float>(ct % 1000) / 1000.0f - 0.5f;
+  }
+  aps.set_waveform(0, wf);
+  uint64_t full_bytes = metrics->bytesSent;
+  REQUIRE(full_bytes > 2 * wf.size());
+
+  auto check_memory = [&]() {
+    Channel expected(0);
+    expected.set_waveform(wf);
+    auto packed = expected.prep_packed_waveform();
+    REQUIRE(standin.read_memory(MEMORY_ADDR + WFA_OFFSET, packed.size()) ==
+            packed);
+    REQUIRE(standin.read_memory(CH_A_WF_LENGTH_ADDR, 1)[0] == wf.size());
+  };
+
+  SECTION("a few changed pulses send a few blocks") {
+    // tweak three pulses, two of them in neighbouring blocks
+    const size_t block_samples = 2 * WF_UPLOAD_BLOCK_WORDS;
+    wf[10 * block_samples - 1] = 0.9f;
+    wf[10 * block_samples + 3] = 0.9f;
+    wf[300 * block_samples + 17] = -0.9f;
+    uint64_t start_bytes = metrics->bytesSent;
+    aps.set_waveform(0, wf);
+    uint64_t incremental_bytes = metrics->bytesSent - start_bytes;
+    cout << "Re-uploaded a " << wf.size() << " sample waveform with "
+         << incremental_bytes << " bytes rather than " << full_bytes << endl;
+    // three blocks plus a few register reads and writes
+    REQUIRE(incremental_bytes < 3 * 4 * WF_UPLOAD_BLOCK_WORDS + 512);
+    check_memory();
+  }
+
+  SECTION("an unchanged waveform is not sent again") {
+    uint64_t start_bytes = metrics->bytesSent;
+    aps.set_waveform(0, wf);
+    REQUIRE(metrics->bytesSent == start_bytes);
+  }
+
+  SECTION("outside writes to the waveform memory force a full upload") {
+    aps.write_memory(MEMORY_ADDR + WFA_OFFSET + 0x1000, {0, 0, 0, 0});
+    uint64_t start_bytes = metrics->bytesSent;
+    aps.set_waveform(0, wf);
+    REQUIRE(metrics->bytesSent - start_bytes >= 2 * wf.size());
+    check_memory();
+  }
+
+  SECTION("reconnecting forgets what was uploaded") {
+    aps.disconnect();
+    standin.write_memory(MEMORY_ADDR + WFA_OFFSET, {0, 0, 0, 0});
+    aps.connect(std::shared_ptr<APS2Ethernet>(myEthernetRM));
+    metrics = myEthernetRM->get_metrics(ip);
+    uint64_t start_bytes = metrics->bytesSent;
+    aps.set_waveform(0, wf);
+    REQUIRE(metrics->bytesSent - start_bytes >= 2 * wf.size());
+    check_memory();
+  }
+
+  SECTION("other channel is independent") {
+    vector<int16_t> wfB(4096, 100);
+    aps.set_waveform(1, wfB);
+    uint64_t start_bytes = metrics->bytesSent;
+    aps.set_waveform(0, wf);
+    REQUIRE(metrics->bytesSent == start_bytes);
+  }
+
+  aps.disconnect();
+}
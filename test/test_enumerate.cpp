@@ -0,0 +1,217 @@
+// Check adaptive enumeration returns as soon as the expected devices answer
+// and have had the chance to report their transport
+
+#include "catch.hpp"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+using std::cout;
+using std::endl;
+#include <map>
+using std::map;
+#include <memory>
+#include <mutex>
+
+#include "APS2Ethernet.h"
+#include "APS2StandIn.h"
+#include "constants.h"
+#include "libaps2.h"
+
+extern std::weak_ptr<APS2Ethernet> ethernetRM;
+
+namespace {
+
+vector<string> discovered;
+std::mutex discovered_lock;
+
+void record_discovery(const char *ip) {
+  std::lock_guard<std::mutex> guard(discovered_lock);
+  discovered.push_back(ip);
+}
+
+// connect from the callback as a startup script might
+map<string, APS2_STATUS> connect_statuses;
+
+void connect_discovered(const char *ip) {
+  connect_statuses[ip] = connect_APS(ip);
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+} // namespace
+
+TEST_CASE("adaptive enumerate", "[loopback]") {
+
+  // a mix of TCP and legacy firmware devices
+  const set<string> tcp_ips = {"127.0.5.1", "127.0.5.2"};
+  const set<string> legacy_ips = {"127.0.5.3", "127.0.5.4"};
+  vector<std::unique_ptr<APS2StandIn>> standins;
+  for (auto ip : tcp_ips) {
+    standins.emplace_back(new APS2StandIn(ip));
+  }
+  for (auto ip : legacy_ips) {
+    standins.emplace_back(new APS2StandIn(ip, false));
+  }
+  set<string> all_ips(tcp_ips);
+  all_ips.insert(legacy_ips.begin(), legacy_ips.end());
+
+  // bind the driver to a known port so a stray device can answer it unasked
+  const uint16_t driver_port = 0xbb61;
+  auto myEthernetRM = std::make_shared<APS2Ethernet>(driver_port, 0);
+  ethernetRM = myEthernetRM;
+  discovered.clear();
+
+  SECTION("returns once the expected set has answered") {
+    auto start = std::chrono::steady_clock::now();
+    auto found = myEthernetRM->enumerate(tcp_ips, std::chrono::seconds(1));
+    double duration = elapsed_ms(start);
+    cout << std::fixed << std::setprecision(1) << tcp_ips.size()
+         << " expected TCP devices enumerated in " << duration << " ms"
+         << endl;
+    REQUIRE(found == tcp_ips);
+    CHECK(duration < 100);
+  }
+
+  SECTION("legacy devices are settled at the deadline") {
+    // only the deadline tells legacy firmware from a slow TCP reply
+    auto start = std::chrono::steady_clock::now();
+    auto found = myEthernetRM->enumerate(all_ips,
+                                         std::chrono::milliseconds(200),
+                                         [](const string &ip) {
+                                           record_discovery(ip.c_str());
+                                         });
+    double duration = elapsed_ms(start);
+    REQUIRE(found == all_ips);
+    CHECK(duration >= 200);
+    CHECK(duration < 300);
+
+    // every device is reported once as it answers
+    std::lock_guard<std::mutex> guard(discovered_lock);
+    REQUIRE(set<string>(discovered.begin(), discovered.end()) == all_ips);
+    REQUIRE(discovered.size() == all_ips.size());
+
+    // and the transport matches the firmware
+    for (auto ip : all_ips) {
+      myEthernetRM->connect(ip);
+      APS2Command cmd;
+      cmd.ack = 1;
+      cmd.cmd = static_cast<uint32_t>(APS_COMMANDS::USERIO_ACK);
+      cmd.cnt = 1;
+      myEthernetRM->send(ip, {{cmd, WFA_OFFSET_ADDR, {0x1234}}});
+    }
+    for (size_t ct = 0; ct < standins.size(); ct++) {
+      CAPTURE(ct);
+      REQUIRE(standins[ct]->read_memory(WFA_OFFSET_ADDR, 1)[0] == 0x1234);
+    }
+  }
+
+  SECTION("a late TCP reply is not taken for legacy firmware") {
+    // the status reply from the legacy port comes well before the TCP one
+    auto tcp_ip = *tcp_ips.begin();
+    standins[0]->set_enumerate_delay(std::chrono::milliseconds(50));
+    auto found = myEthernetRM->enumerate({tcp_ip},
+                                         std::chrono::milliseconds(500));
+    REQUIRE(found == set<string>{tcp_ip});
+
+    // TCP firmware ignores UDP writes so this only succeeds over TCP
+    myEthernetRM->connect(tcp_ip);
+    APS2Command cmd;
+    cmd.ack = 1;
+    cmd.cmd = static_cast<uint32_t>(APS_COMMANDS::USERIO_ACK);
+    cmd.cnt = 1;
+    myEthernetRM->send(tcp_ip, {{cmd, WFA_OFFSET_ADDR, {0x1234}}});
+    REQUIRE(standins[0]->read_memory(WFA_OFFSET_ADDR, 1)[0] == 0x1234);
+  }
+
+  SECTION("a stray legacy device does not hold up the expected set") {
+    // it answers a broadcast while the expected devices are still replying
+    APS2StandIn stray("127.0.5.6", false);
+    stray.set_latency(std::chrono::milliseconds(10));
+    standins[0]->set_enumerate_delay(std::chrono::milliseconds(30));
+    standins[1]->set_enumerate_delay(std::chrono::milliseconds(30));
+    stray.announce(udp::endpoint(
+        asio::ip::address_v4::from_string("127.0.0.1"), driver_port));
+    auto start = std::chrono::steady_clock::now();
+    auto found = myEthernetRM->enumerate(tcp_ips, std::chrono::seconds(1));
+    double duration = elapsed_ms(start);
+    set<string> expected(tcp_ips);
+    expected.insert("127.0.5.6");
+    REQUIRE(found == expected);
+    CHECK(duration < 100);
+  }
+
+  SECTION("the callback may connect to the device") {
+    vector<const char *> ips;
+    for (auto &ip : all_ips) {
+      ips.push_back(ip.c_str());
+    }
+    connect_statuses.clear();
+    unsigned int numDevices = 0;
+    REQUIRE(enumerate_known_devices(ips.data(), ips.size(), 200,
+                                    connect_discovered,
+                                    &numDevices) == APS2_OK);
+    REQUIRE(numDevices == all_ips.size());
+    REQUIRE(connect_statuses.size() == all_ips.size());
+    for (auto &kv : connect_statuses) {
+      CAPTURE(kv.first);
+      CHECK(kv.second == APS2_OK);
+    }
+
+    // and each was connected over the transport its firmware has
+    for (auto ip : all_ips) {
+      APS2Command cmd;
+      cmd.ack = 1;
+      cmd.cmd = static_cast<uint32_t>(APS_COMMANDS::USERIO_ACK);
+      cmd.cnt = 1;
+      myEthernetRM->send(ip, {{cmd, WFA_OFFSET_ADDR, {0x5678}}});
+      REQUIRE(disconnect_APS(ip.c_str()) == APS2_OK);
+    }
+    for (size_t ct = 0; ct < standins.size(); ct++) {
+      CAPTURE(ct);
+      REQUIRE(standins[ct]->read_memory(WFA_OFFSET_ADDR, 1)[0] == 0x5678);
+    }
+  }
+
+  SECTION("missing devices bound the wait") {
+    set<string> expected(all_ips);
+    expected.insert("127.0.5.5");
+    auto start = std::chrono::steady_clock::now();
+    auto found = myEthernetRM->enumerate(expected,
+                                         std::chrono::milliseconds(30));
+    double duration = elapsed_ms(start);
+    REQUIRE(found == all_ips);
+    CHECK(duration >= 30);
+    CHECK(duration < 100);
+  }
+
+  SECTION("C API and connecting to unknown devices") {
+    vector<const char *> ips = {"127.0.5.1"};
+    unsigned int numDevices = 0;
+    REQUIRE(enumerate_known_devices(ips.data(), ips.size(), 1000,
+                                    record_discovery,
+                                    &numDevices) == APS2_OK);
+    REQUIRE(numDevices == ips.size());
+
+    // connect asks an unknown device directly and goes as soon as it reports
+    // TCP support
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE(connect_APS("127.0.5.2") == APS2_OK);
+    REQUIRE(disconnect_APS("127.0.5.2") == APS2_OK);
+    double duration = elapsed_ms(start);
+    cout << std::fixed << std::setprecision(1)
+         << "connect to unknown TCP device took " << duration << " ms" << endl;
+    CHECK(duration < ENUMERATE_TIMEOUT.count());
+
+    // or waits out the timeout for one that never does
+    start = std::chrono::steady_clock::now();
+    REQUIRE(connect_APS(legacy_ips.begin()->c_str()) == APS2_OK);
+    duration = elapsed_ms(start);
+    CHECK(duration >= ENUMERATE_TIMEOUT.count());
+    REQUIRE(disconnect_APS(legacy_ips.begin()->c_str()) == APS2_OK);
+  }
+}
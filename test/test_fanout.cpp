@@ -0,0 +1,170 @@
+// Check group uploads put the same waveform and sequence on several devices
+// and compare them with uploading to each in turn
+
+#include "catch.hpp"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+using std::cout;
+using std::endl;
+#include <memory>
+
+#include "APS2Ethernet.h"
+#include "APS2StandIn.h"
+#include "constants.h"
+#include "libaps2.h"
+
+extern std::weak_ptr<APS2Ethernet> ethernetRM;
+
+namespace {
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// What the APS2 waveform memory should hold for a marker free waveform
+vector<uint32_t> packed_waveform(const vector<int16_t> &wf) {
+  vector<uint32_t> packed;
+  for (size_t ct = 0; ct < wf.size(); ct += 2) {
+    packed.push_back(((uint32_t)(wf[ct + 1] & 0x3fff) << 16) |
+                     (uint16_t)(wf[ct] & 0x3fff));
+  }
+  return packed;
+}
+
+} // namespace
+
+TEST_CASE("fan-out uploads", "[loopback]") {
+  const vector<string> standin_ips = {"127.0.10.1", "127.0.10.2", "127.0.10.3",
+                                      "127.0.10.4"};
+  vector<std::unique_ptr<APS2StandIn>> standins;
+  for (auto ip : standin_ips) {
+    standins.emplace_back(new APS2StandIn(ip));
+    standins.back()->set_latency(std::chrono::microseconds(300));
+    standins.back()->set_record_writes(false);
+  }
+  auto myEthernetRM = std::make_shared<APS2Ethernet>(0, 0);
+  ethernetRM = myEthernetRM;
+
+  vector<const char *> ips;
+  for (const auto &ip : standin_ips) {
+    REQUIRE(connect_APS(ip.c_str()) == APS2_OK);
+    ips.push_back(ip.c_str());
+  }
+  vector<APS2_STATUS> statuses(ips.size(), APS2_UNKNOWN_ERROR);
+
+  SECTION("every device gets the data") {
+    for (auto &standin : standins) {
+      standin->set_record_writes(true);
+    }
+    vector<int16_t> wf(1000);
+    for (size_t ct = 0; ct < wf.size(); ct++) {
+      wf[ct] = static_cast<int16_t>(8 * ct) - 4000;
+    }
+    REQUIRE(set_waveform_int_many(ips.data(), ips.size(), 1, wf.data(),
+                                  wf.size(), statuses.data()) == APS2_OK);
+    vector<uint64_t> seq(101);
+    for (size_t ct = 0; ct < seq.size(); ct++) {
+      seq[ct] = (uint64_t(ct) << 40) | ct;
+    }
+    REQUIRE(write_sequence_many(ips.data(), ips.size(), seq.data(), seq.size(),
+                                statuses.data()) == APS2_OK);
+
+    auto expected_wf = packed_waveform(wf);
+    for (size_t dev = 0; dev < standins.size(); dev++) {
+      REQUIRE(statuses[dev] == APS2_OK);
+      REQUIRE(standins[dev]->read_memory(MEMORY_ADDR + WFB_OFFSET,
+                                         expected_wf.size()) == expected_wf);
+      REQUIRE(standins[dev]->read_memory(CH_B_WF_LENGTH_ADDR, 1)[0] ==
+              wf.size());
+      auto words = standins[dev]->read_memory(MEMORY_ADDR + SEQ_OFFSET,
+                                              2 * seq.size());
+      for (size_t ct = 0; ct < seq.size(); ct++) {
+        REQUIRE(words[2 * ct] == (seq[ct] & 0xffffffff));
+        REQUIRE(words[2 * ct + 1] == (seq[ct] >> 32));
+      }
+    }
+  }
+
+  SECTION("devices with their own markers prepare their own waveform") {
+    for (auto &standin : standins) {
+      standin->set_record_writes(true);
+    }
+    vector<int16_t> wf(100, 0x100);
+    for (auto ip : ips) {
+      REQUIRE(set_waveform_int(ip, 0, wf.data(), wf.size()) == APS2_OK);
+    }
+    vector<uint8_t> markers(wf.size(), 0x1);
+    REQUIRE(set_markers(ips[2], 0, markers.data(), markers.size()) ==
+            APS2_OK);
+    REQUIRE(set_waveform_int_many(ips.data(), ips.size(), 0, wf.data(),
+                                  wf.size(), statuses.data()) == APS2_OK);
+    for (size_t dev = 0; dev < standins.size(); dev++) {
+      uint32_t word =
+          standins[dev]->read_memory(MEMORY_ADDR + WFA_OFFSET, 1)[0];
+      REQUIRE(word == (dev == 2 ? 0x41004100u : 0x01000100u));
+    }
+  }
+
+  SECTION("unconnected devices are reported") {
+    vector<const char *> some_ips = {ips[0], "127.0.10.99", ips[1]};
+    vector<float> wf(64, 0.5f);
+    REQUIRE(set_waveform_float_many(some_ips.data(), some_ips.size(), 0,
+                                    wf.data(), wf.size(),
+                                    statuses.data()) == APS2_UNCONNECTED);
+    REQUIRE(statuses[0] == APS2_OK);
+    REQUIRE(statuses[1] == APS2_UNCONNECTED);
+    REQUIRE(statuses[2] == APS2_OK);
+
+    // nothing left to upload to
+    REQUIRE(set_waveform_float_many(&some_ips[1], 1, 0, wf.data(), wf.size(),
+                                    statuses.data()) == APS2_UNCONNECTED);
+  }
+
+  SECTION("invalid channels are rejected") {
+    vector<float> wf(64, 0.5f);
+    REQUIRE(set_waveform_float_many(ips.data(), ips.size(), 2, wf.data(),
+                                    wf.size(), statuses.data()) ==
+            APS2_INVALID_DAC);
+    REQUIRE(set_waveform_float_many(ips.data(), ips.size(), -1, wf.data(),
+                                    wf.size(), statuses.data()) ==
+            APS2_INVALID_DAC);
+  }
+
+  SECTION("one preparation instead of one per device") {
+    vector<float> wf(1 << 20);
+    for (size_t ct = 0; ct < wf.size(); ct++) {
+      wf[ct] = static_cast<float>(ct % 1000) / 1000.0f - 0.5f;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    for (auto ip : ips) {
+      REQUIRE(set_waveform_float(ip, 0, wf.data(), wf.size()) == APS2_OK);
+    }
+    double serial_duration = elapsed_ms(start);
+
+    // a new waveform so the devices cannot skip unchanged blocks
+    for (auto &val : wf) {
+      val = -val;
+    }
+    start = std::chrono::steady_clock::now();
+    REQUIRE(set_waveform_float_many(ips.data(), ips.size(), 0, wf.data(),
+                                    wf.size(), statuses.data()) == APS2_OK);
+    double fanout_duration = elapsed_ms(start);
+
+    cout << std::fixed << std::setprecision(1) << "Loaded "
+         << wf.size() / (1 << 20) << "M sample waveform on " << ips.size()
+         << " devices in " << serial_duration << " ms one at a time and "
+         << fanout_duration << " ms fanned out" << endl;
+    // with the fused preparation kernel the transfers dominate and on a
+    // single core the loopback copies do not overlap
+    CHECK(fanout_duration < serial_duration);
+  }
+
+  for (auto ip : ips) {
+    REQUIRE(disconnect_APS(ip) == APS2_OK);
+  }
+}
@@ -0,0 +1,120 @@
+// Check the handle based C API and compare its per-call overhead with the IP
+// string API
+
+#include "catch.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+using std::cout;
+using std::endl;
+#include <memory>
+#include <thread>
+
+#include "APS2Ethernet.h"
+#include "APS2StandIn.h"
+#include "constants.h"
+#include "libaps2.h"
+
+// libaps2 holds the ethernet interface through a weak_ptr so a test can swap
+// in one bound to ephemeral ports to talk to the stand-in
+extern std::weak_ptr<APS2Ethernet> ethernetRM;
+
+TEST_CASE("handle based API", "[loopback]") {
+
+  const string standin_ip = "127.0.0.5";
+  APS2StandIn standin(standin_ip);
+  auto myEthernetRM = std::make_shared<APS2Ethernet>(0, 0);
+  ethernetRM = myEthernetRM;
+
+  APS2_HANDLE handle = 0;
+  REQUIRE(connect_APS_handle(standin_ip.c_str(), &handle) == APS2_OK);
+  REQUIRE(handle != 0);
+
+  SECTION("handles track connections") {
+    APS2_HANDLE same_handle;
+    REQUIRE(connect_APS_handle(standin_ip.c_str(), &same_handle) == APS2_OK);
+    REQUIRE(same_handle == handle);
+
+    uint32_t val = 0xdeadbeef;
+    REQUIRE(write_memory_h(handle, WFA_OFFSET_ADDR, &val, 1) == APS2_OK);
+    uint32_t readback = 0;
+    REQUIRE(read_register(standin_ip.c_str(), WFA_OFFSET_ADDR, &readback) ==
+            APS2_OK);
+    REQUIRE(readback == val);
+
+    REQUIRE(disconnect_APS_h(handle) == APS2_OK);
+    APS2_RUN_STATE state;
+    REQUIRE(get_runState_h(handle, &state) == APS2_UNCONNECTED);
+    REQUIRE(get_runState_h(0, &state) == APS2_UNCONNECTED);
+
+    // stale handles are not reused for new connections
+    APS2_HANDLE new_handle;
+    REQUIRE(connect_APS_handle(standin_ip.c_str(), &new_handle) == APS2_OK);
+    REQUIRE(new_handle != handle);
+    handle = new_handle;
+  }
+
+  SECTION("connections on other threads leave handles usable") {
+    const string other_ip = "127.0.11.9";
+    APS2StandIn other(other_ip);
+    std::atomic<bool> stop{false};
+    std::thread connector([&]() {
+      // every connect takes a new handle slot so the table keeps growing
+      while (!stop) {
+        APS2_HANDLE other_handle;
+        if (connect_APS_handle(other_ip.c_str(), &other_handle) == APS2_OK) {
+          disconnect_APS(other_ip.c_str());
+        }
+      }
+    });
+    APS2_RUN_STATE state;
+    APS2_STATUS status = APS2_OK;
+    for (size_t ct = 0; ct < 100000 && status == APS2_OK; ct++) {
+      status = get_runState_h(handle, &state);
+    }
+    stop = true;
+    connector.join();
+    REQUIRE(status == APS2_OK);
+  }
+
+  SECTION("per-call overhead") {
+    auto time_calls = [](size_t num_calls, std::function<void()> call) {
+      auto start = std::chrono::steady_clock::now();
+      for (size_t ct = 0; ct < num_calls; ct++) {
+        call();
+      }
+      auto stop = std::chrono::steady_clock::now();
+      return std::chrono::duration<double, std::nano>(stop - start).count() /
+             num_calls;
+    };
+
+    // get_runState does not touch the network so this is all dispatch
+    APS2_RUN_STATE state;
+    const size_t num_local_calls = 1000000;
+    double string_ns = time_calls(num_local_calls, [&]() {
+      get_runState(standin_ip.c_str(), &state);
+    });
+    double handle_ns =
+        time_calls(num_local_calls, [&]() { get_runState_h(handle, &state); });
+    cout << std::fixed << std::setprecision(1)
+         << "get_runState: string " << string_ns << " ns/call; handle "
+         << handle_ns << " ns/call" << endl;
+
+    // register round trip for context
+    const size_t num_remote_calls = 1000;
+    float offset;
+    string_ns = time_calls(num_remote_calls, [&]() {
+      get_channel_offset(standin_ip.c_str(), 0, &offset);
+    });
+    handle_ns = time_calls(num_remote_calls,
+                           [&]() { get_channel_offset_h(handle, 0, &offset); });
+    cout << "get_channel_offset: string " << string_ns / 1000
+         << " us/call; handle " << handle_ns / 1000 << " us/call" << endl;
+
+    REQUIRE(get_channel_offset_h(handle, 0, &offset) == APS2_OK);
+  }
+
+  REQUIRE(disconnect_APS_h(handle) == APS2_OK);
+}
@@ -0,0 +1,112 @@
+// Check the instruction encoders give the words of doc/instruction-set.rst
+
+#include "catch.hpp"
+
+#include <memory>
+
+#include "APS2Ethernet.h"
+#include "APS2Instruction.h"
+#include "APS2StandIn.h"
+#include "constants.h"
+#include "libaps2.h"
+
+extern std::weak_ptr<APS2Ethernet> ethernetRM;
+
+// sync and wait are qualified as POSIX has functions of the same name
+using namespace APS2Instruction;
+
+// built at compile time, so a field too wide here would not compile
+static_assert(modulator(ModulatorOp::SET_FREQUENCY, 0x1) == 0xa100610000000000,
+              "MODULATOR set frequency");
+static_assert(modulator(ModulatorOp::RESET_PHASE, 0x1) == 0xa100210000000000,
+              "MODULATOR reset phase");
+static_assert(APS2Instruction::wait() == 0x2100400000000000, "WAIT");
+static_assert(APS2Instruction::sync() == 0x9100800000000000, "SYNC");
+static_assert(goto_(1) == 0x6000000000000001, "GOTO");
+static_assert(marker(1, true, 99, false) == (0x1400000100000000 | 99),
+              "MARKER");
+static_assert(waveform(BOTH_CHANNELS, 0, 99, true) ==
+                  (0x0d00000000000000 | (99ull << 24)),
+              "WAVEFORM");
+
+TEST_CASE("instruction encoding", "[instruction]") {
+
+  SECTION("every op code") {
+    REQUIRE(waveform(CHANNEL_A, 0x123456, 0x1fffff, false, true) ==
+            0x04003fffff123456);
+    REQUIRE(waveform_prefetch(CHANNEL_B, 0x10, true) == 0x0900c00000000010);
+    REQUIRE(marker(3, false, 0xffffffff, true, 0xf) == 0x1d00001effffffff);
+    REQUIRE(APS2Instruction::wait(false) == 0x2000400000000000);
+    REQUIRE(load_repeat(0xffff) == 0x300000000000ffff);
+    REQUIRE(repeat(0x3ffffff) == 0x4000000003ffffff);
+    REQUIRE(cmp(CmpOp::NOT_EQUAL, 0) == 0x5000000000000100);
+    REQUIRE(cmp(CmpOp::LESS_THAN, 0xab) == 0x50000000000003ab);
+    REQUIRE(call(1024) == 0x7000000000000400);
+    REQUIRE(return_() == 0x8000000000000000);
+    REQUIRE(APS2Instruction::sync(false) == 0x9000800000000000);
+    REQUIRE(modulator(ModulatorOp::UPDATE_FRAME, 0x3, 0x02aaaaab, false) ==
+            0xa000e30002aaaaab);
+    REQUIRE(load_cmp() == 0xb000000000000000);
+    REQUIRE(prefetch(128) == 0xc000000000000080);
+  }
+
+  SECTION("fields too wide are rejected") {
+    REQUIRE_THROWS_AS(waveform(CHANNEL_A, 1 << 24, 0, true), APS2_STATUS);
+    REQUIRE_THROWS_AS(waveform(CHANNEL_A, 0, 1 << 21, true), APS2_STATUS);
+    REQUIRE_THROWS_AS(waveform(4, 0, 0, true), APS2_STATUS);
+    REQUIRE_THROWS_AS(marker(4, true, 0, true), APS2_STATUS);
+    REQUIRE_THROWS_AS(marker(0, true, 1ull << 32, true), APS2_STATUS);
+    REQUIRE_THROWS_AS(marker(0, true, 0, true, 0x10), APS2_STATUS);
+    REQUIRE_THROWS_AS(load_repeat(1 << 16), APS2_STATUS);
+    REQUIRE_THROWS_AS(goto_(1 << 26), APS2_STATUS);
+    REQUIRE_THROWS_AS(cmp(CmpOp::EQUAL, 0x100), APS2_STATUS);
+    REQUIRE_THROWS_AS(modulator(ModulatorOp::MODULATE, 0x10), APS2_STATUS);
+    REQUIRE_THROWS_AS(modulator(ModulatorOp::MODULATE, 0x1, 1ull << 32),
+                      APS2_STATUS);
+  }
+}
+
+TEST_CASE("waveform mode scaffolds", "[loopback]") {
+  const string ip = "127.0.11.7";
+  APS2StandIn standin(ip);
+  auto myEthernetRM = std::make_shared<APS2Ethernet>(0, 0);
+  ethernetRM = myEthernetRM;
+  REQUIRE(connect_APS(ip.c_str()) == APS2_OK);
+
+  vector<int16_t> wfA(400, 1000), wfB(200, -1000);
+  REQUIRE(set_waveform_int(ip.c_str(), 0, wfA.data(), wfA.size()) == APS2_OK);
+  REQUIRE(set_waveform_int(ip.c_str(), 1, wfB.data(), wfB.size()) == APS2_OK);
+  uint64_t freq = standin.read_memory(WF_SSB_FREQ_ADDR, 1)[0];
+
+  SECTION("triggered waveform") {
+    REQUIRE(set_run_mode(ip.c_str(), TRIG_WAVEFORM) == APS2_OK);
+    // the words set_run_mode used to build from literals
+    vector<uint64_t> expected = {
+        0xa100610000000000 | freq, 0xa100210000000000, 0x2100400000000000,
+        0x1000000100000000 | 99,   0x1400000100000000 | 49,
+        0x0400000000000000 | (99ull << 24),
+        0x0900000000000000 | (49ull << 24), 0x6000000000000001};
+    auto words = standin.read_memory(MEMORY_ADDR + SEQ_OFFSET,
+                                     2 * expected.size());
+    for (size_t ct = 0; ct < expected.size(); ct++) {
+      CHECK((uint64_t(words[2 * ct + 1]) << 32 | words[2 * ct]) ==
+            expected[ct]);
+    }
+  }
+
+  SECTION("continuous waveform") {
+    REQUIRE(set_run_mode(ip.c_str(), CW_WAVEFORM) == APS2_OK);
+    vector<uint64_t> expected = {0xa100610000000000 | freq, 0x9100800000000000,
+                                 0x0400000000000000 | (99ull << 24),
+                                 0x0900000000000000 | (49ull << 24),
+                                 0x6000000000000002};
+    auto words = standin.read_memory(MEMORY_ADDR + SEQ_OFFSET,
+                                     2 * expected.size());
+    for (size_t ct = 0; ct < expected.size(); ct++) {
+      CHECK((uint64_t(words[2 * ct + 1]) << 32 | words[2 * ct]) ==
+            expected[ct]);
+    }
+  }
+
+  REQUIRE(disconnect_APS(ip.c_str()) == APS2_OK);
+}
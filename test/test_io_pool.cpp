@@ -0,0 +1,101 @@
+// Check the io thread pool with many devices and benchmark aggregate upload
+// throughput as the crate grows
+
+#include "catch.hpp"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+using std::cout;
+using std::endl;
+#include <memory>
+#include <thread>
+
+#include "APS2Ethernet.h"
+#include "APS2StandIn.h"
+#include "RandomHelpers.h"
+#include "constants.h"
+
+TEST_CASE("io thread pool", "[loopback]") {
+
+  const size_t max_devices = 16;
+  vector<string> standin_ips;
+  vector<std::unique_ptr<APS2StandIn>> standins;
+  for (size_t ct = 1; ct <= max_devices; ct++) {
+    standin_ips.push_back("127.0.3." + std::to_string(ct));
+    standins.emplace_back(new APS2StandIn(standin_ips.back()));
+  }
+
+  APS2Command cmd;
+  cmd.ack = 1;
+  cmd.cmd = static_cast<uint32_t>(APS_COMMANDS::USERIO_ACK);
+
+  // Upload to the first numDevices stand-ins from one thread each like the
+  // async API does and return the aggregate rate in MB/s
+  auto upload = [&](std::shared_ptr<APS2Ethernet> ethernetRM,
+                    size_t numDevices,
+                    const vector<vector<APS2Datagram>> &dgs) {
+    vector<std::thread> senders;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t dev = 0; dev < numDevices; dev++) {
+      senders.emplace_back([&, dev]() {
+        ethernetRM->send(standin_ips[dev], dgs[dev]);
+      });
+    }
+    for (auto &sender : senders) {
+      sender.join();
+    }
+    auto stop = std::chrono::steady_clock::now();
+    size_t bytes = 0;
+    for (size_t dev = 0; dev < numDevices; dev++) {
+      for (const auto &dg : dgs[dev]) {
+        bytes += 4 * dg.payload.size();
+      }
+    }
+    return bytes / std::chrono::duration<double, std::micro>(stop - start)
+                       .count();
+  };
+
+  SECTION("per-device ordering is preserved") {
+    auto ethernetRM = std::make_shared<APS2Ethernet>(0, 0, 4);
+    REQUIRE(ethernetRM->get_io_threads() == 4);
+    vector<vector<uint32_t>> data;
+    vector<vector<APS2Datagram>> dgs;
+    for (size_t dev = 0; dev < max_devices; dev++) {
+      ethernetRM->connect(standin_ips[dev]);
+      data.push_back(RandomHelpers::random_data(1 << 14));
+      // small datagrams so many acks from different devices interleave
+      dgs.push_back(APS2Datagram::chunk(cmd, 0, data.back(), 0x100));
+    }
+    upload(ethernetRM, max_devices, dgs);
+    for (size_t dev = 0; dev < max_devices; dev++) {
+      CAPTURE(dev);
+      REQUIRE(standins[dev]->read_memory(0, data[dev].size()) == data[dev]);
+    }
+  }
+
+  SECTION("aggregate upload throughput") {
+    for (auto &standin : standins) {
+      standin->set_record_writes(false);
+      standin->set_latency(std::chrono::microseconds(250));
+    }
+    // 2MB per device in 256kB datagrams like APS2::write_memory
+    auto data = RandomHelpers::random_data(1 << 19);
+    vector<vector<APS2Datagram>> dgs(
+        max_devices, APS2Datagram::chunk(cmd, 0, data, 0xfffc));
+    for (size_t numThreads : {1, 4}) {
+      auto ethernetRM = std::make_shared<APS2Ethernet>(0, 0, numThreads);
+      for (auto ip : standin_ips) {
+        ethernetRM->connect(ip);
+      }
+      for (size_t numDevices : {1, 4, 16}) {
+        double rate = upload(ethernetRM, numDevices, dgs);
+        cout << std::fixed << std::setprecision(1) << numThreads
+             << " io thread" << (numThreads > 1 ? "s" : " ") << "; "
+             << std::setw(2) << numDevices << " devices: " << rate
+             << " MB/s aggregate" << endl;
+        CHECK(rate > 0);
+      }
+    }
+  }
+}
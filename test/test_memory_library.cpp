@@ -0,0 +1,214 @@
+// Check named waveforms and sequence segments are placed, replaced and
+// removed individually and only new or changed entries are uploaded
+
+#include "catch.hpp"
+
+#include <iostream>
+using std::cout;
+using std::endl;
+#include <memory>
+
+#include "APS2.h"
+#include "APS2Ethernet.h"
+#include "APS2MemoryAllocator.h"
+#include "APS2StandIn.h"
+#include "Channel.h"
+#include "constants.h"
+#include "libaps2.h"
+
+extern std::weak_ptr<APS2Ethernet> ethernetRM;
+
+TEST_CASE("memory allocator", "[memory]") {
+  APS2MemoryAllocator memory(1024);
+
+  SECTION("first fit in 16 byte blocks") {
+    REQUIRE(memory.allocate(100) == 0);
+    REQUIRE(memory.allocate(16) == 112);
+    REQUIRE(memory.allocate(0) == 128);
+    REQUIRE(memory.extent() == 144);
+    auto usage = memory.usage();
+    REQUIRE(usage.totalBytes == 1024);
+    REQUIRE(usage.usedBytes == 144);
+    REQUIRE(usage.numAllocations == 3);
+    REQUIRE(usage.fragmentation() == 0);
+    REQUIRE_THROWS_AS(memory.allocate(1024), APS2_STATUS);
+  }
+
+  SECTION("freed blocks are reused and merged") {
+    size_t a = memory.allocate(256);
+    size_t b = memory.allocate(256);
+    size_t c = memory.allocate(256);
+    memory.release(a);
+    memory.release(c);
+    // 256 free at the start and 512 at the end
+    auto usage = memory.usage();
+    REQUIRE(usage.numFreeBlocks == 2);
+    REQUIRE(usage.largestFreeBytes == 512);
+    REQUIRE(usage.fragmentation() == Approx(1.0 / 3));
+    REQUIRE(memory.allocate(128) == 0);
+    REQUIRE(memory.allocate(512) == 512);
+    memory.release(b);
+    REQUIRE(memory.usage().largestFreeBytes == 384);
+    REQUIRE_THROWS_AS(memory.release(b), APS2_STATUS);
+  }
+
+  SECTION("resizing stays in place when it can") {
+    APS2MemoryAllocator larger(2048);
+    size_t a = larger.allocate(256);
+    size_t b = larger.allocate(256);
+    REQUIRE(larger.reallocate(b, 512) == b);
+    REQUIRE(larger.reallocate(a, 128) == a);
+    REQUIRE(larger.reallocate(a, 256) == a);
+    // no room after a any more so it moves past b
+    REQUIRE(larger.reallocate(a, 384) == 768);
+    // and stays put if it fits nowhere
+    REQUIRE_THROWS_AS(larger.reallocate(b, 1024), APS2_STATUS);
+    REQUIRE(larger.usage().usedBytes == 896);
+    REQUIRE(larger.allocate(256) == 0);
+  }
+}
+
+TEST_CASE("waveform and sequence library", "[loopback]") {
+  const string ip = "127.0.11.4";
+  APS2StandIn standin(ip);
+  auto myEthernetRM = std::make_shared<APS2Ethernet>(0, 0);
+  APS2 aps(ip);
+  aps.connect(std::shared_ptr<APS2Ethernet>(myEthernetRM));
+  auto metrics = myEthernetRM->get_metrics(ip);
+
+  auto pulse = [](size_t numPts, float amp) {
+    vector<float> wf(numPts);
+    for (size_t ct = 0; ct < numPts; ct++) {
+      wf[ct] = amp * static_cast<float>(ct % 100) / 100.0f;
+    }
+    return wf;
+  };
+  auto check_memory = [&](uint32_t quadAddr, const vector<float> &wf) {
+    Channel expected(0);
+    expected.set_waveform(wf);
+    auto packed = expected.prep_packed_waveform();
+    REQUIRE(standin.read_memory(MEMORY_ADDR + WFA_OFFSET + 8 * quadAddr,
+                                packed.size()) == packed);
+  };
+
+  auto gaussian = pulse(1000, 0.5f);
+  auto drag = pulse(64 * WF_UPLOAD_BLOCK_WORDS, -0.25f);
+  uint32_t gaussianAddr = aps.add_waveform(0, "gaussian", gaussian.data(),
+                                           gaussian.size());
+  uint32_t dragAddr = aps.add_waveform(0, "drag", drag.data(), drag.size());
+  REQUIRE(gaussianAddr == 0);
+  REQUIRE(dragAddr == 250);
+  REQUIRE(aps.get_waveform_address(0, "drag") == dragAddr);
+  check_memory(gaussianAddr, gaussian);
+  check_memory(dragAddr, drag);
+  // the length register covers every entry
+  REQUIRE(standin.read_memory(CH_A_WF_LENGTH_ADDR, 1)[0] ==
+          4 * dragAddr + drag.size());
+
+  SECTION("unchanged entries are not uploaded") {
+    auto datagrams = standin.num_datagrams();
+    REQUIRE(aps.add_waveform(0, "drag", drag.data(), drag.size()) ==
+            dragAddr);
+    REQUIRE(standin.num_datagrams() == datagrams);
+  }
+
+  SECTION("replacing an entry sends the blocks that changed") {
+    drag[10 * WF_UPLOAD_BLOCK_WORDS] = 0.75f;
+    uint64_t start_bytes = metrics->bytesSent;
+    REQUIRE(aps.add_waveform(0, "drag", drag.data(), drag.size()) ==
+            dragAddr);
+    uint64_t bytes = metrics->bytesSent - start_bytes;
+    cout << "Replacing one sample of a " << 2 * drag.size() / 1024
+         << " kB waveform sent " << bytes << " bytes" << endl;
+    REQUIRE(bytes < 4 * WF_UPLOAD_BLOCK_WORDS + 1024);
+    check_memory(dragAddr, drag);
+  }
+
+  SECTION("a longer entry moves and a shorter one stays put") {
+    auto longer = pulse(2000, 0.5f);
+    uint32_t longerAddr = aps.add_waveform(0, "gaussian", longer.data(),
+                                           longer.size());
+    REQUIRE(longerAddr == dragAddr + drag.size() / 4);
+    check_memory(longerAddr, longer);
+    // the gap it left takes the next waveform that fits
+    auto square = pulse(800, 1.0f);
+    REQUIRE(aps.add_waveform(0, "square", square.data(), square.size()) == 0);
+    check_memory(0, square);
+    auto shorter = pulse(400, 0.1f);
+    REQUIRE(aps.add_waveform(0, "gaussian", shorter.data(), shorter.size()) ==
+            longerAddr);
+    check_memory(longerAddr, shorter);
+  }
+
+  SECTION("removing frees the memory") {
+    aps.remove_waveform(0, "gaussian");
+    REQUIRE_THROWS_AS(aps.get_waveform_address(0, "gaussian"), APS2_STATUS);
+    REQUIRE_THROWS_AS(aps.remove_waveform(0, "gaussian"), APS2_STATUS);
+    auto usage = aps.get_waveform_memory_usage(0);
+    REQUIRE(usage.numAllocations == 1);
+    REQUIRE(usage.usedBytes == 2 * drag.size());
+    REQUIRE(usage.numFreeBlocks == 2);
+    REQUIRE(usage.fragmentation() > 0);
+  }
+
+  SECTION("other writes force a re-upload") {
+    // someone overwrites the start of the drag pulse
+    vector<uint32_t> zeros(4, 0);
+    aps.write_memory(MEMORY_ADDR + WFA_OFFSET + 8 * dragAddr, zeros);
+    aps.add_waveform(0, "drag", drag.data(), drag.size());
+    check_memory(dragAddr, drag);
+
+    // the whole channel waveform takes over the region
+    aps.set_waveform(0, gaussian);
+    REQUIRE_THROWS_AS(aps.get_waveform_address(0, "drag"), APS2_STATUS);
+    REQUIRE(aps.get_waveform_memory_usage(0).usedBytes == 0);
+  }
+
+  SECTION("sequence segments are addressed in instructions") {
+    vector<uint64_t> main(5, 0x1234567890abcdefull);
+    vector<uint64_t> sub(3, 0xfedcba0987654321ull);
+    REQUIRE(aps.add_sequence_segment("main", main.data(), main.size()) == 0);
+    REQUIRE(aps.add_sequence_segment("sub", sub.data(), sub.size()) == 6);
+    auto words = standin.read_memory(MEMORY_ADDR + SEQ_OFFSET + 8 * 6, 8);
+    REQUIRE(words[0] == 0x87654321);
+    REQUIRE(words[1] == 0xfedcba09);
+    REQUIRE(words[6] == 0xffffffff);
+    auto datagrams = standin.num_datagrams();
+    REQUIRE(aps.add_sequence_segment("sub", sub.data(), sub.size()) == 6);
+    REQUIRE(standin.num_datagrams() == datagrams);
+    REQUIRE(aps.get_sequence_memory_usage().usedBytes == 48 + 32);
+  }
+
+  aps.disconnect();
+}
+
+TEST_CASE("waveform library C API", "[loopback]") {
+  const string ip = "127.0.11.4";
+  APS2StandIn standin(ip);
+  auto myEthernetRM = std::make_shared<APS2Ethernet>(0, 0);
+  ethernetRM = myEthernetRM;
+  REQUIRE(connect_APS(ip.c_str()) == APS2_OK);
+
+  vector<int16_t> wf(100, 0x1000);
+  vector<uint8_t> markers(100, 0);
+  markers[0] = 1;
+  uint32_t addr = 1;
+  REQUIRE(add_waveform_int(ip.c_str(), 1, "pulse", wf.data(), markers.data(),
+                           wf.size(), &addr) == APS2_OK);
+  REQUIRE(addr == 0);
+  REQUIRE(standin.read_memory(MEMORY_ADDR + WFB_OFFSET, 1)[0] ==
+          0x10005000u);
+  REQUIRE(add_waveform_int(ip.c_str(), 1, "next", wf.data(), nullptr,
+                           wf.size(), &addr) == APS2_OK);
+  REQUIRE(addr == 26);
+
+  APS2_MEMORY_USAGE usage;
+  REQUIRE(get_waveform_memory_usage(ip.c_str(), 1, &usage) == APS2_OK);
+  REQUIRE(usage.numEntries == 2);
+  REQUIRE(usage.totalBytes == WF_LIBRARY_SIZE);
+  REQUIRE(remove_waveform(ip.c_str(), 1, "missing") ==
+          APS2_UNKNOWN_MEMORY_ENTRY);
+  REQUIRE(remove_waveform(ip.c_str(), 2, "pulse") == APS2_INVALID_DAC);
+
+  REQUIRE(disconnect_APS(ip.c_str()) == APS2_OK);
+}
@@ -0,0 +1,141 @@
+// Check the per-device transport counters and latency histograms
+
+#include "catch.hpp"
+
+#include <chrono>
+#include <memory>
+#include <numeric>
+
+#include "APS2Ethernet.h"
+#include "APS2Metrics.h"
+#include "APS2StandIn.h"
+#include "RandomHelpers.h"
+#include "constants.h"
+#include "libaps2.h"
+
+extern std::weak_ptr<APS2Ethernet> ethernetRM;
+
+namespace {
+
+uint64_t total(const uint64_t *counts) {
+  return std::accumulate(counts, counts + APS2_LATENCY_BUCKETS, uint64_t(0));
+}
+
+} // namespace
+
+TEST_CASE("latency histogram buckets", "[metrics]") {
+  using std::chrono::microseconds;
+  using std::chrono::nanoseconds;
+  REQUIRE(LatencyHistogram::bucket(nanoseconds(0)) == 0);
+  REQUIRE(LatencyHistogram::bucket(nanoseconds(999)) == 0);
+  REQUIRE(LatencyHistogram::bucket(microseconds(1)) == 1);
+  REQUIRE(LatencyHistogram::bucket(microseconds(3)) == 2);
+  REQUIRE(LatencyHistogram::bucket(microseconds(4)) == 3);
+  REQUIRE(LatencyHistogram::bucket(microseconds(1000)) == 10);
+  REQUIRE(LatencyHistogram::bucket(std::chrono::hours(1)) ==
+          LATENCY_HISTOGRAM_BUCKETS - 1);
+
+  LatencyHistogram hist;
+  hist.record(microseconds(5));
+  hist.record(microseconds(6));
+  hist.record(microseconds(100));
+  uint64_t counts[LATENCY_HISTOGRAM_BUCKETS];
+  hist.snapshot(counts);
+  REQUIRE(counts[3] == 2);
+  REQUIRE(counts[7] == 1);
+  hist.reset();
+  hist.snapshot(counts);
+  REQUIRE(std::accumulate(counts, counts + LATENCY_HISTOGRAM_BUCKETS,
+                          uint64_t(0)) == 0);
+}
+
+TEST_CASE("transport metrics", "[loopback]") {
+  auto myEthernetRM = std::make_shared<APS2Ethernet>(0, 0);
+  ethernetRM = myEthernetRM;
+
+  SECTION("TCP traffic is counted per datagram") {
+    const string ip = "127.0.9.1";
+    APS2StandIn standin(ip);
+    standin.set_latency(std::chrono::microseconds(200));
+    APS2_HANDLE handle;
+    REQUIRE(connect_APS_handle(ip.c_str(), &handle) == APS2_OK);
+    REQUIRE(reset_transport_metrics(ip.c_str()) == APS2_OK);
+
+    APS2_METRICS metrics;
+    REQUIRE(get_transport_metrics(ip.c_str(), &metrics) == APS2_OK);
+    REQUIRE(metrics.datagramsSent == 0);
+    REQUIRE(metrics.bytesReceived == 0);
+    REQUIRE(total(metrics.ackLatency) == 0);
+
+    // one acknowledged write then one read
+    const uint32_t num_words = 100;
+    auto data = RandomHelpers::random_data(num_words);
+    REQUIRE(write_memory(ip.c_str(), 0, data.data(), num_words) == APS2_OK);
+    vector<uint32_t> check(num_words);
+    REQUIRE(read_memory(ip.c_str(), 0, check.data(), num_words) == APS2_OK);
+    REQUIRE(check == data);
+
+    REQUIRE(get_transport_metrics_h(handle, &metrics) == APS2_OK);
+    // headers are a command and address word each
+    REQUIRE(metrics.datagramsSent == 2);
+    REQUIRE(metrics.bytesSent == (8 + 4 * num_words) + 8);
+    REQUIRE(metrics.datagramsReceived == 2);
+    REQUIRE(metrics.bytesReceived == 8 + (8 + 4 * num_words));
+    REQUIRE(metrics.timeouts == 0);
+    REQUIRE(metrics.retries == 0);
+    REQUIRE(total(metrics.ackLatency) == 1);
+    REQUIRE(total(metrics.readLatency) == 2);
+    // the stand-in's latency shows up in the ack round trip and blocked time
+    size_t first_ack_bucket = 0;
+    while (metrics.ackLatency[first_ack_bucket] == 0) {
+      first_ack_bucket++;
+    }
+    CHECK(first_ack_bucket >= LatencyHistogram::bucket(
+                                  std::chrono::microseconds(200)));
+    CHECK(metrics.sendBlockedUS >= 200);
+    CHECK(metrics.readBlockedUS >= 200);
+
+    // counters survive a reconnect until reset
+    REQUIRE(disconnect_APS(ip.c_str()) == APS2_OK);
+    REQUIRE(connect_APS(ip.c_str()) == APS2_OK);
+    REQUIRE(get_transport_metrics(ip.c_str(), &metrics) == APS2_OK);
+    REQUIRE(metrics.datagramsSent >= 2);
+    REQUIRE(reset_transport_metrics_h(handle) == APS2_UNCONNECTED);
+    REQUIRE(reset_transport_metrics(ip.c_str()) == APS2_OK);
+    REQUIRE(get_transport_metrics(ip.c_str(), &metrics) == APS2_OK);
+    REQUIRE(metrics.datagramsSent == 0);
+    REQUIRE(metrics.datagramsReceived == 0);
+    REQUIRE(metrics.sendBlockedUS == 0);
+    REQUIRE(total(metrics.readLatency) == 0);
+    REQUIRE(disconnect_APS(ip.c_str()) == APS2_OK);
+  }
+
+  SECTION("UDP traffic is counted per packet") {
+    const string ip = "127.0.9.2";
+    APS2StandIn standin(ip, false);
+    REQUIRE(connect_APS(ip.c_str()) == APS2_OK);
+    REQUIRE(reset_transport_metrics(ip.c_str()) == APS2_OK);
+
+    const uint32_t num_words = 100;
+    auto data = RandomHelpers::random_data(num_words);
+    REQUIRE(write_memory(ip.c_str(), 0, data.data(), num_words) == APS2_OK);
+    vector<uint32_t> check(num_words);
+    REQUIRE(read_memory(ip.c_str(), 0, check.data(), num_words) == APS2_OK);
+    REQUIRE(check == data);
+
+    APS2_METRICS metrics;
+    REQUIRE(get_transport_metrics(ip.c_str(), &metrics) == APS2_OK);
+    REQUIRE(metrics.datagramsSent == 2);
+    REQUIRE(metrics.bytesSent > 4 * num_words);
+    REQUIRE(metrics.datagramsReceived == 2);
+    REQUIRE(metrics.bytesReceived > 4 * num_words);
+    REQUIRE(total(metrics.ackLatency) == 1);
+    REQUIRE(total(metrics.readLatency) == 2);
+    REQUIRE(disconnect_APS(ip.c_str()) == APS2_OK);
+  }
+
+  SECTION("unconnected devices have no metrics") {
+    APS2_METRICS metrics;
+    REQUIRE(get_transport_metrics("127.0.9.3", &metrics) == APS2_UNCONNECTED);
+  }
+}
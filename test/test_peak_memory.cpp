@@ -0,0 +1,111 @@
+// Check large uploads through the C API do not copy the caller's data
+
+#include "catch.hpp"
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+using std::cout;
+using std::endl;
+#include <memory>
+#include <string>
+
+#include "APS2Ethernet.h"
+#include "APS2StandIn.h"
+#include "constants.h"
+#include "libaps2.h"
+
+extern std::weak_ptr<APS2Ethernet> ethernetRM;
+
+namespace {
+
+// Peak resident set in kB since the last reset_peak_rss
+size_t peak_rss() {
+  std::ifstream status("/proc/self/status");
+  string line;
+  while (std::getline(status, line)) {
+    if (line.compare(0, 6, "VmHWM:") == 0) {
+      return std::stoul(line.substr(6));
+    }
+  }
+  return 0;
+}
+
+bool reset_peak_rss() {
+  std::ofstream clear_refs("/proc/self/clear_refs");
+  clear_refs << "5";
+  clear_refs.close();
+  return !clear_refs.fail();
+}
+
+// Extra memory, in MB, the upload needed at its peak
+template <typename F> double upload_peak_mb(F upload) {
+  size_t start = peak_rss();
+  upload();
+  return (peak_rss() - start) / 1024.0;
+}
+
+} // namespace
+
+TEST_CASE("upload peak memory", "[loopback]") {
+#if defined(__SANITIZE_ADDRESS__) || defined(__SANITIZE_THREAD__)
+  WARN("Sanitizer shadow memory swamps the measurement; skipping");
+  return;
+#endif
+  if (!reset_peak_rss()) {
+    WARN("Peak RSS cannot be reset on this platform; skipping");
+    return;
+  }
+
+  const string ip = "127.0.11.3";
+  APS2StandIn standin(ip);
+  standin.set_record_writes(false);
+  auto myEthernetRM = std::make_shared<APS2Ethernet>(0, 0);
+  ethernetRM = myEthernetRM;
+  REQUIRE(connect_APS(ip.c_str()) == APS2_OK);
+
+  const size_t num_points = 1 << 24;
+  cout << std::fixed << std::setprecision(1);
+
+  SECTION("float waveforms") {
+    vector<float> wf(num_points, 0.25f);
+    double caller_mb = wf.size() * sizeof(float) / double(1 << 20);
+    reset_peak_rss();
+    double peak_mb = upload_peak_mb([&]() {
+      REQUIRE(set_waveform_float(ip.c_str(), 0, wf.data(), wf.size()) ==
+              APS2_OK);
+    });
+    cout << "Uploading a " << caller_mb << " MB float waveform took "
+         << peak_mb << " MB more memory" << endl;
+    // only the packed device words: two bytes a sample
+    CHECK(peak_mb < 0.75 * caller_mb);
+  }
+
+  SECTION("integer waveforms") {
+    vector<int16_t> wf(num_points, 0x100);
+    double caller_mb = wf.size() * sizeof(int16_t) / double(1 << 20);
+    reset_peak_rss();
+    double peak_mb = upload_peak_mb([&]() {
+      REQUIRE(set_waveform_int(ip.c_str(), 1, wf.data(), wf.size()) ==
+              APS2_OK);
+    });
+    cout << "Uploading a " << caller_mb << " MB integer waveform took "
+         << peak_mb << " MB more memory" << endl;
+    CHECK(peak_mb < 1.25 * caller_mb);
+  }
+
+  SECTION("sequences") {
+    vector<uint64_t> seq(num_points / 2, 0x1234);
+    double caller_mb = seq.size() * sizeof(uint64_t) / double(1 << 20);
+    reset_peak_rss();
+    double peak_mb = upload_peak_mb([&]() {
+      REQUIRE(write_sequence(ip.c_str(), seq.data(), seq.size()) == APS2_OK);
+    });
+    cout << "Uploading a " << caller_mb << " MB sequence took " << peak_mb
+         << " MB more memory" << endl;
+    // streamed a chunk at a time
+    CHECK(peak_mb < 0.1 * caller_mb);
+  }
+
+  REQUIRE(disconnect_APS(ip.c_str()) == APS2_OK);
+}
@@ -0,0 +1,112 @@
+// Check long reads are split up and pipelined by the driver
+
+#include "catch.hpp"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+using std::cout;
+using std::endl;
+#include <memory>
+
+#include "APS2Ethernet.h"
+#include "APS2StandIn.h"
+#include "RandomHelpers.h"
+#include "constants.h"
+#include "libaps2.h"
+
+extern std::weak_ptr<APS2Ethernet> ethernetRM;
+
+namespace {
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+} // namespace
+
+TEST_CASE("pipelined reads", "[loopback]") {
+
+  auto myEthernetRM = std::make_shared<APS2Ethernet>(0, 0);
+  ethernetRM = myEthernetRM;
+
+  SECTION("long reads are reassembled in order") {
+    for (bool supports_tcp : {true, false}) {
+      string ip = supports_tcp ? "127.0.7.1" : "127.0.7.2";
+      APS2StandIn standin(ip, supports_tcp);
+      // not a whole number of requests
+      auto data = RandomHelpers::random_data(10 * MAX_READ_WORDS + 17);
+      standin.write_memory(0, data);
+
+      REQUIRE(connect_APS(ip.c_str()) == APS2_OK);
+      vector<uint32_t> check(data.size(), 0xdeadbeef);
+      REQUIRE(read_memory(ip.c_str(), 0, check.data(), check.size()) ==
+              APS2_OK);
+      REQUIRE(check == data);
+
+      // short reads still work and leave nothing behind
+      uint32_t word;
+      REQUIRE(read_memory(ip.c_str(), 4 * 100, &word, 1) == APS2_OK);
+      REQUIRE(word == data[100]);
+      REQUIRE(disconnect_APS(ip.c_str()) == APS2_OK);
+    }
+  }
+
+  SECTION("a failed response mid pipeline leaves the stream in step") {
+    for (bool supports_tcp : {true, false}) {
+      string ip = supports_tcp ? "127.0.7.4" : "127.0.7.5";
+      APS2StandIn standin(ip, supports_tcp);
+      auto data = RandomHelpers::random_data(10 * MAX_READ_WORDS);
+      standin.write_memory(0, data);
+      REQUIRE(connect_APS(ip.c_str()) == APS2_OK);
+
+      // the responses to the requests behind it are already on their way
+      standin.fail_request(4 * 2 * MAX_READ_WORDS);
+      vector<uint32_t> check(data.size(), 0);
+      REQUIRE(read_memory(ip.c_str(), 0, check.data(), check.size()) ==
+              APS2_COMMS_ERROR);
+
+      uint32_t word;
+      REQUIRE(read_memory(ip.c_str(), 4 * 100, &word, 1) == APS2_OK);
+      REQUIRE(word == data[100]);
+      REQUIRE(read_memory(ip.c_str(), 0, check.data(), check.size()) ==
+              APS2_OK);
+      REQUIRE(check == data);
+      REQUIRE(disconnect_APS(ip.c_str()) == APS2_OK);
+    }
+  }
+
+  SECTION("pipelining hides the round trip") {
+    const string ip = "127.0.7.3";
+    APS2StandIn standin(ip);
+    standin.set_latency(std::chrono::microseconds(500));
+    auto data = RandomHelpers::random_data(1 << 16);
+    standin.write_memory(0, data);
+    REQUIRE(connect_APS(ip.c_str()) == APS2_OK);
+
+    // the old way splitting into 1kB reads by hand
+    vector<uint32_t> check(data.size(), 0);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t idx = 0; idx < check.size(); idx += MAX_READ_WORDS) {
+      REQUIRE(read_memory(ip.c_str(), 4 * idx, check.data() + idx,
+                          MAX_READ_WORDS) == APS2_OK);
+    }
+    double split_duration = elapsed_ms(start);
+    REQUIRE(check == data);
+
+    std::fill(check.begin(), check.end(), 0);
+    start = std::chrono::steady_clock::now();
+    REQUIRE(read_memory(ip.c_str(), 0, check.data(), check.size()) ==
+            APS2_OK);
+    double pipelined_duration = elapsed_ms(start);
+    REQUIRE(check == data);
+
+    cout << std::fixed << std::setprecision(1) << "Read " << 4 * data.size() / 1024
+         << " kB in " << split_duration << " ms with 1kB reads and "
+         << pipelined_duration << " ms pipelined" << endl;
+    CHECK(pipelined_duration < split_duration / 2);
+    REQUIRE(disconnect_APS(ip.c_str()) == APS2_OK);
+  }
+}
@@ -0,0 +1,291 @@
+// Check the fused waveform preparation matches the original multi-pass one
+
+#include "catch.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <random>
+
+#include "APS2Ethernet.h"
+#include "APS2StandIn.h"
+#include "Channel.h"
+#include "constants.h"
+#include "libaps2.h"
+
+extern std::weak_ptr<APS2Ethernet> ethernetRM;
+
+namespace {
+
+// The preparation as it was before the fused kernel
+vector<uint32_t> multi_pass(const vector<float> &waveform,
+                            const vector<uint8_t> &markers) {
+  vector<int16_t> prepVec(waveform.size());
+  for (size_t ct = 0; ct < prepVec.size(); ct++) {
+    prepVec[ct] = int16_t(MAX_WF_AMP * waveform[ct]);
+  }
+  for (int16_t &tmpVal : prepVec) {
+    if (tmpVal > MAX_WF_AMP)
+      tmpVal = MAX_WF_AMP;
+  }
+  if ((prepVec.size() > 0) &&
+      (*std::min_element(prepVec.begin(), prepVec.end()) <
+       -(MAX_WF_AMP + 1))) {
+    for (int16_t &tmpVal : prepVec) {
+      if (tmpVal < -MAX_WF_AMP)
+        tmpVal = -MAX_WF_AMP;
+    }
+  }
+  for (size_t ct = 0; ct < prepVec.size(); ct++) {
+    prepVec[ct] =
+        (prepVec[ct] & 0x3FFF) | (static_cast<uint16_t>(markers[ct]) << 14);
+  }
+  vector<uint32_t> packed;
+  for (size_t ct = 0; ct < prepVec.size(); ct += 2) {
+    uint32_t high = (ct + 1 < prepVec.size()) ? (uint16_t)prepVec[ct + 1]
+                                              : 0xffff;
+    packed.push_back((high << 16) | (uint16_t)prepVec[ct]);
+  }
+  return packed;
+}
+
+void random_waveform(size_t numPts, float amplitude, vector<float> &waveform,
+                     vector<uint8_t> &markers) {
+  static std::mt19937 gen(1234);
+  std::uniform_real_distribution<float> value(-amplitude, amplitude);
+  std::uniform_int_distribution<int> marker(0, 3);
+  waveform.resize(numPts);
+  markers.resize(numPts);
+  for (size_t ct = 0; ct < numPts; ct++) {
+    waveform[ct] = value(gen);
+    markers[ct] = marker(gen);
+  }
+}
+
+vector<uint32_t> fused(const vector<float> &waveform,
+                       const vector<uint8_t> &markers, bool &clippedHigh,
+                       bool &clippedLow) {
+  vector<uint32_t> packed((waveform.size() + 1) / 2);
+  Channel::pack_samples(waveform.data(), markers.data(), waveform.size(),
+                        packed.data(), clippedHigh, clippedLow);
+  return packed;
+}
+
+// Every 14 bit DAC value with random markers
+void random_int_waveform(size_t numPts, vector<int16_t> &waveform,
+                         vector<uint8_t> &markers) {
+  static std::mt19937 gen(5678);
+  std::uniform_int_distribution<int> value(-(MAX_WF_AMP + 1), MAX_WF_AMP);
+  std::uniform_int_distribution<int> marker(0, 3);
+  waveform.resize(numPts);
+  markers.resize(numPts);
+  for (size_t ct = 0; ct < numPts; ct++) {
+    waveform[ct] = static_cast<int16_t>(value(gen));
+    markers[ct] = marker(gen);
+  }
+}
+
+uint16_t dac_word(int16_t sample, uint8_t marker) {
+  return (static_cast<uint16_t>(sample) & 0x3FFF) | (marker << 14);
+}
+
+} // namespace
+
+TEST_CASE("fused waveform preparation", "[waveform]") {
+  vector<float> waveform;
+  vector<uint8_t> markers;
+  bool clippedHigh, clippedLow;
+
+  SECTION("matches the multi-pass preparation at every length") {
+    // covers the vector bodies, their remainders and odd lengths
+    for (size_t numPts = 0; numPts <= 40; numPts++) {
+      random_waveform(numPts, 1.2f, waveform, markers);
+      REQUIRE(fused(waveform, markers, clippedHigh, clippedLow) ==
+              multi_pass(waveform, markers));
+    }
+    random_waveform(100003, 3.9f, waveform, markers);
+    REQUIRE(fused(waveform, markers, clippedHigh, clippedLow) ==
+            multi_pass(waveform, markers));
+  }
+
+  SECTION("reports clipping in either direction") {
+    random_waveform(1000, 0.99f, waveform, markers);
+    fused(waveform, markers, clippedHigh, clippedLow);
+    REQUIRE(!clippedHigh);
+    REQUIRE(!clippedLow);
+
+    // the most negative value is still in range...
+    waveform[17] = -8192.5f / MAX_WF_AMP;
+    auto packed = fused(waveform, markers, clippedHigh, clippedLow);
+    REQUIRE(!clippedLow);
+    REQUIRE((packed[8] >> 16 & 0x3FFF) == 0x2000);
+
+    waveform[999] = 1.01f;
+    fused(waveform, markers, clippedHigh, clippedLow);
+    REQUIRE(clippedHigh);
+    REQUIRE(!clippedLow);
+
+    waveform[999] = 0.0f;
+    waveform[3] = -1.01f;
+    packed = fused(waveform, markers, clippedHigh, clippedLow);
+    REQUIRE(!clippedHigh);
+    REQUIRE(clippedLow);
+    // ...until anything else is clipped low
+    REQUIRE((packed[8] >> 16 & 0x3FFF) == 0x2001);
+    REQUIRE(packed == multi_pass(waveform, markers));
+  }
+
+  SECTION("saturates values far out of range") {
+    waveform = {100.0f, -100.0f, std::numeric_limits<float>::infinity(),
+                -std::numeric_limits<float>::infinity()};
+    markers = {0, 1, 2, 3};
+    auto packed = fused(waveform, markers, clippedHigh, clippedLow);
+    REQUIRE(clippedHigh);
+    REQUIRE(clippedLow);
+    REQUIRE(packed[0] == (((0x4000u | (-MAX_WF_AMP & 0x3FFF)) << 16) |
+                          MAX_WF_AMP));
+    REQUIRE(packed[1] == (((0xC000u | (-MAX_WF_AMP & 0x3FFF)) << 16) |
+                          0x8000u | MAX_WF_AMP));
+  }
+
+  SECTION("channel waveforms") {
+    Channel channel(0);
+    random_waveform(1004, 1.0f, waveform, markers);
+    channel.set_waveform(waveform);
+    channel.set_markers(markers);
+
+    auto expected = multi_pass(waveform, markers);
+    auto prepVec = channel.prep_waveform();
+    REQUIRE(prepVec.size() == waveform.size());
+    for (size_t ct = 0; ct < prepVec.size(); ct++) {
+      REQUIRE(static_cast<uint16_t>(prepVec[ct]) ==
+              static_cast<uint16_t>(expected[ct / 2] >> (16 * (ct % 2))));
+    }
+
+    // padded out to whole 16 byte SDRAM words
+    auto packed = channel.prep_packed_waveform();
+    REQUIRE(packed.size() == 504);
+    REQUIRE(std::equal(expected.begin(), expected.end(), packed.begin()));
+    REQUIRE(std::all_of(packed.begin() + expected.size(), packed.end(),
+                        [](uint32_t word) { return word == 0xffffffff; }));
+  }
+
+  SECTION("markers out of range keep their low two bits in either order") {
+    // the padding samples past the waveform carry markers too
+    random_waveform(1001, 1.0f, waveform, markers);
+    markers.resize(1004);
+    for (size_t ct = 0; ct < markers.size(); ct++) {
+      markers[ct] = static_cast<uint8_t>(4 * ct + ct % 4);
+    }
+    Channel waveformFirst(0), markersFirst(1);
+    waveformFirst.set_waveform(waveform);
+    waveformFirst.set_markers(markers);
+    markersFirst.set_markers(markers);
+    markersFirst.set_waveform(waveform);
+
+    waveform.resize(markers.size(), 0.0f);
+    auto expected = multi_pass(waveform, markers);
+    auto packed = waveformFirst.prep_packed_waveform();
+    REQUIRE(std::equal(expected.begin(), expected.end(), packed.begin()));
+    REQUIRE(markersFirst.prep_packed_waveform() == packed);
+  }
+}
+
+TEST_CASE("integer waveforms pass straight through", "[waveform]") {
+  vector<int16_t> waveform;
+  vector<uint8_t> markers;
+  Channel channel(0);
+
+  for (size_t numPts : {4, 8, 1000, 1004}) {
+    random_int_waveform(numPts, waveform, markers);
+    channel.set_waveform(waveform);
+    channel.set_markers(markers);
+    REQUIRE(channel.get_length() == numPts);
+
+    auto prepVec = channel.prep_waveform();
+    auto packed = channel.prep_packed_waveform();
+    REQUIRE(packed.size() == 4 * ((numPts / 2 + 3) / 4));
+    for (size_t ct = 0; ct < numPts; ct++) {
+      REQUIRE(static_cast<uint16_t>(prepVec[ct]) ==
+              dac_word(waveform[ct], markers[ct]));
+      REQUIRE(static_cast<uint16_t>(packed[ct / 2] >> (16 * (ct % 2))) ==
+              dac_word(waveform[ct], markers[ct]));
+    }
+  }
+
+  // odd lengths are padded like the float kernel
+  vector<uint32_t> words(2);
+  bool clippedHigh, clippedLow;
+  waveform = {1, -1, 0x1000};
+  markers = {0, 1, 3};
+  Channel::pack_samples(waveform.data(), markers.data(), waveform.size(),
+                        words.data(), clippedHigh, clippedLow);
+  REQUIRE(words[0] == 0x7fff0001u);
+  REQUIRE(words[1] == 0xffffd000u);
+  REQUIRE(!clippedHigh);
+  REQUIRE(!clippedLow);
+
+  // a float waveform replaces an integer one in the same packed words
+  channel.set_waveform(vector<float>(8, 0.5f));
+  REQUIRE(channel.get_length() == 8);
+  REQUIRE((channel.prep_waveform()[0] & 0x3FFF) == 4095);
+}
+
+TEST_CASE("integer waveforms are clipped", "[waveform]") {
+  // long enough for the vector body and the scalar remainder
+  vector<int16_t> waveform(21, 100);
+  waveform[3] = 9000;
+  waveform[12] = -8192;
+  waveform[19] = -32768;
+  waveform[20] = 32767;
+  vector<uint32_t> words((waveform.size() + 1) / 2);
+  bool clippedHigh, clippedLow;
+  Channel::pack_samples(waveform.data(), nullptr, waveform.size(),
+                        words.data(), clippedHigh, clippedLow);
+  REQUIRE(clippedHigh);
+  REQUIRE(clippedLow);
+  auto sample = [&](size_t ct) {
+    return static_cast<uint16_t>(words[ct / 2] >> (16 * (ct % 2)));
+  };
+  REQUIRE(sample(3) == MAX_WF_AMP);
+  // -8192 goes to -8191 too once anything was clipped low
+  REQUIRE(sample(12) == (-MAX_WF_AMP & 0x3FFF));
+  REQUIRE(sample(19) == (-MAX_WF_AMP & 0x3FFF));
+  REQUIRE(sample(20) == MAX_WF_AMP);
+  REQUIRE(sample(0) == 100);
+
+  // in range the most negative value is kept
+  waveform.assign(16, -8192);
+  Channel::pack_samples(waveform.data(), nullptr, waveform.size(),
+                        words.data(), clippedHigh, clippedLow);
+  REQUIRE(!clippedLow);
+  REQUIRE(sample(15) == 0x2000);
+}
+
+TEST_CASE("integer waveform upload", "[loopback]") {
+  const string ip = "127.0.11.1";
+  APS2StandIn standin(ip);
+  auto myEthernetRM = std::make_shared<APS2Ethernet>(0, 0);
+  ethernetRM = myEthernetRM;
+  REQUIRE(connect_APS(ip.c_str()) == APS2_OK);
+
+  vector<int16_t> waveform;
+  vector<uint8_t> markers;
+  random_int_waveform(1 << 16, waveform, markers);
+  // the marker upload writes the waveform again with the markers merged in
+  REQUIRE(set_waveform_int(ip.c_str(), 1, waveform.data(), waveform.size()) ==
+          APS2_OK);
+  REQUIRE(set_markers(ip.c_str(), 1, markers.data(), markers.size()) ==
+          APS2_OK);
+
+  auto words =
+      standin.read_memory(MEMORY_ADDR + WFB_OFFSET, waveform.size() / 2);
+  for (size_t ct = 0; ct < waveform.size(); ct++) {
+    REQUIRE(static_cast<uint16_t>(words[ct / 2] >> (16 * (ct % 2))) ==
+            dac_word(waveform[ct], markers[ct]));
+  }
+  REQUIRE(standin.read_memory(CH_B_WF_LENGTH_ADDR, 1)[0] == waveform.size());
+
+  REQUIRE(disconnect_APS(ip.c_str()) == APS2_OK);
+}
@@ -0,0 +1,103 @@
+// Check the CSR shadow register cache serves reads locally and stays coherent
+
+#include "catch.hpp"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+using std::cout;
+using std::endl;
+#include <memory>
+
+#include "APS2Ethernet.h"
+#include "APS2StandIn.h"
+#include "constants.h"
+#include "libaps2.h"
+
+extern std::weak_ptr<APS2Ethernet> ethernetRM;
+
+namespace {
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// Step the channel scale and offset like a calibration sweep
+double sweep(const string &ip, size_t num_points) {
+  auto start = std::chrono::steady_clock::now();
+  for (size_t ct = 0; ct < num_points; ct++) {
+    float val = 0.5f + 0.01f * ct;
+    REQUIRE(set_channel_scale(ip.c_str(), 0, val) == APS2_OK);
+    REQUIRE(set_channel_offset(ip.c_str(), 0, 0.1f * val) == APS2_OK);
+    float check;
+    REQUIRE(get_channel_scale(ip.c_str(), 0, &check) == APS2_OK);
+    REQUIRE(check == val);
+  }
+  return elapsed_ms(start);
+}
+
+} // namespace
+
+TEST_CASE("register cache", "[loopback]") {
+  const string ip = "127.0.8.2";
+  APS2StandIn standin(ip);
+  standin.set_latency(std::chrono::microseconds(500));
+  auto myEthernetRM = std::make_shared<APS2Ethernet>(0, 0);
+  ethernetRM = myEthernetRM;
+  REQUIRE(connect_APS(ip.c_str()) == APS2_OK);
+
+  int enabled = 1;
+  REQUIRE(get_register_cache(ip.c_str(), &enabled) == APS2_OK);
+  REQUIRE(enabled == 0);
+
+  SECTION("sweeps skip redundant reads") {
+    const size_t num_points = 20;
+    double uncached_duration = sweep(ip, num_points);
+    auto uncached_datagrams = standin.num_datagrams();
+
+    REQUIRE(set_register_cache(ip.c_str(), 1) == APS2_OK);
+    REQUIRE(get_register_cache(ip.c_str(), &enabled) == APS2_OK);
+    REQUIRE(enabled == 1);
+    auto start_datagrams = standin.num_datagrams();
+    double cached_duration = sweep(ip, num_points);
+    auto cached_datagrams = standin.num_datagrams() - start_datagrams;
+
+    cout << std::fixed << std::setprecision(1) << num_points
+         << " point scale/offset sweep took " << uncached_duration << " ms ("
+         << uncached_datagrams << " datagrams) uncached and "
+         << cached_duration << " ms (" << cached_datagrams
+         << " datagrams) cached" << endl;
+    CHECK(cached_duration < uncached_duration / 2);
+
+    // writes still reach the device
+    float scale = 0.5f + 0.01f * (num_points - 1);
+    REQUIRE(standin.read_memory(CH_A_SCALE_ADDR, 1)[0] ==
+            reinterpret_cast<uint32_t &>(scale));
+  }
+
+  SECTION("status registers are always read from the device") {
+    REQUIRE(set_register_cache(ip.c_str(), 1) == APS2_OK);
+    standin.write_memory(TEMPERATURE_ADDR, {0x1234});
+    uint32_t val;
+    REQUIRE(read_register(ip.c_str(), TEMPERATURE_ADDR, &val) == APS2_OK);
+    REQUIRE(val == 0x1234);
+  }
+
+  SECTION("resync picks up outside changes") {
+    REQUIRE(set_register_cache(ip.c_str(), 1) == APS2_OK);
+    uint32_t val = 0x55;
+    REQUIRE(write_memory(ip.c_str(), TRIGGER_INTERVAL_ADDR, &val, 1) ==
+            APS2_OK);
+    // another client changes the register behind our back
+    standin.write_memory(TRIGGER_INTERVAL_ADDR, {0x66});
+    REQUIRE(read_register(ip.c_str(), TRIGGER_INTERVAL_ADDR, &val) == APS2_OK);
+    REQUIRE(val == 0x55);
+    REQUIRE(resync_register_cache(ip.c_str()) == APS2_OK);
+    REQUIRE(read_register(ip.c_str(), TRIGGER_INTERVAL_ADDR, &val) == APS2_OK);
+    REQUIRE(val == 0x66);
+  }
+
+  REQUIRE(disconnect_APS(ip.c_str()) == APS2_OK);
+}
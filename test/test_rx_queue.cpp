@@ -0,0 +1,146 @@
+#include "catch.hpp"
+
+#include <chrono>
+#include <iostream>
+using std::cout;
+using std::endl;
+#include <memory>
+#include <numeric>
+#include <thread>
+
+#include "APS2Ethernet.h"
+#include "APS2RxQueue.h"
+#include "APS2StandIn.h"
+#include "constants.h"
+
+namespace {
+vector<uint8_t> make_packet(uint16_t seqNum) {
+  APS2Command cmd;
+  cmd.ack = 1;
+  APS2EthernetPacket packet(cmd);
+  packet.header.seqNum = seqNum;
+  return packet.serialize();
+}
+} // namespace
+
+TEST_CASE("APS2RxQueue", "[rxqueue]") {
+
+  APS2RxQueue rxQueue;
+  auto deadline = []() {
+    return std::chrono::steady_clock::now() + std::chrono::milliseconds(100);
+  };
+
+  SECTION("packets come out in order") {
+    for (uint16_t ct = 0; ct < 10; ct++) {
+      auto bytes = make_packet(ct);
+      REQUIRE(rxQueue.push(bytes.data(), bytes.size()));
+    }
+    APS2EthernetPacket packet;
+    for (uint16_t ct = 0; ct < 10; ct++) {
+      REQUIRE(rxQueue.pop(packet, deadline()));
+      REQUIRE(packet.header.seqNum == ct);
+    }
+  }
+
+  SECTION("recycled payload buffers are reused") {
+    APS2Command cmd;
+    cmd.ack = 1;
+    // long enough not to be padded out to the minimum frame
+    cmd.cnt = 16;
+    APS2EthernetPacket sent(cmd);
+    sent.payload.resize(16);
+    std::iota(sent.payload.begin(), sent.payload.end(), 1);
+    auto bytes = sent.serialize();
+    REQUIRE(rxQueue.push(bytes.data(), bytes.size()));
+    REQUIRE(rxQueue.push(bytes.data(), bytes.size()));
+
+    APS2EthernetPacket first, second;
+    REQUIRE(rxQueue.pop(first, deadline()));
+    REQUIRE(first.payload == sent.payload);
+    const uint32_t *storage = first.payload.data();
+    rxQueue.recycle(std::move(first.payload));
+    REQUIRE(rxQueue.pop(second, deadline()));
+    REQUIRE(second.payload == sent.payload);
+    REQUIRE(second.payload.data() == storage);
+  }
+
+  SECTION("empty queue times out") {
+    APS2EthernetPacket packet;
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE_FALSE(rxQueue.pop(packet, deadline()));
+    REQUIRE(std::chrono::steady_clock::now() - start >=
+            std::chrono::milliseconds(100));
+  }
+
+  SECTION("full queue drops packets") {
+    auto bytes = make_packet(0);
+    for (size_t ct = 0; ct < APS2RxQueue::DEPTH; ct++) {
+      REQUIRE(rxQueue.push(bytes.data(), bytes.size()));
+    }
+    REQUIRE_FALSE(rxQueue.push(bytes.data(), bytes.size()));
+    REQUIRE(rxQueue.dropped() == 1);
+  }
+
+  SECTION("waiting consumer is woken by producer") {
+    const uint16_t num_packets = 10000;
+    std::thread producer([&]() {
+      for (uint16_t ct = 0; ct < num_packets; ct++) {
+        auto bytes = make_packet(ct);
+        while (!rxQueue.push(bytes.data(), bytes.size())) {
+          std::this_thread::yield();
+        }
+      }
+    });
+    APS2EthernetPacket packet;
+    for (uint16_t ct = 0; ct < num_packets; ct++) {
+      REQUIRE(rxQueue.pop(packet, deadline()));
+      REQUIRE(packet.header.seqNum == ct);
+    }
+    producer.join();
+  }
+}
+
+TEST_CASE("crate of legacy UDP devices", "[loopback]") {
+
+  // nine legacy firmware boards all acknowledging at once
+  vector<std::unique_ptr<APS2StandIn>> standins;
+  vector<string> ips;
+  for (int ct = 0; ct < 9; ct++) {
+    ips.push_back("127.0.1." + std::to_string(ct + 1));
+    standins.emplace_back(new APS2StandIn(ips.back(), false));
+  }
+  auto ethernetRM = std::make_shared<APS2Ethernet>(0, 0);
+  for (auto &ip : ips) {
+    ethernetRM->connect(ip);
+  }
+
+  APS2Command cmd;
+  cmd.ack = 1;
+  cmd.cmd = static_cast<uint32_t>(APS_COMMANDS::USERIO_ACK);
+  cmd.cnt = 1;
+
+  const uint32_t num_writes = 500;
+  auto start = std::chrono::steady_clock::now();
+  vector<std::thread> threads;
+  for (auto &ip : ips) {
+    threads.emplace_back([&, ip]() {
+      for (uint32_t ct = 0; ct < num_writes; ct++) {
+        ethernetRM->send(ip, {{cmd, 4 * ct, {ct}}});
+      }
+    });
+  }
+  for (auto &t : threads) {
+    t.join();
+  }
+  auto stop = std::chrono::steady_clock::now();
+  auto duration =
+      std::chrono::duration_cast<std::chrono::microseconds>(stop - start)
+          .count();
+  cout << ips.size() * num_writes << " acknowledged writes across "
+       << ips.size() << " devices in " << duration / 1000 << " ms" << endl;
+
+  for (auto &standin : standins) {
+    REQUIRE(standin->read_memory(4 * (num_writes - 1), 1)[0] ==
+            num_writes - 1);
+  }
+}
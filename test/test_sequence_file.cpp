@@ -0,0 +1,319 @@
+// Check sequence files are loaded straight from the mapped file and convert
+// between versions
+
+#include "catch.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+using std::cout;
+using std::endl;
+#include <memory>
+
+#include "APS2Ethernet.h"
+#include "APS2SequenceFile.h"
+#include "APS2StandIn.h"
+#include "Channel.h"
+#include "constants.h"
+#include "libaps2.h"
+
+extern std::weak_ptr<APS2Ethernet> ethernetRM;
+
+namespace {
+
+template <typename T>
+void write_array(std::ofstream &file, const vector<T> &data) {
+  uint64_t length = data.size();
+  file.write(reinterpret_cast<const char *>(&length), sizeof(length));
+  file.write(reinterpret_cast<const char *>(data.data()),
+             data.size() * sizeof(T));
+}
+
+// The original layout: 12 unused header bytes, the channel count, then length
+// prefixed instruction and waveform arrays
+void write_v1_file(const string &filename, const vector<uint64_t> &instructions,
+                   const vector<vector<int16_t>> &waveforms) {
+  std::ofstream file(filename, std::ios::binary | std::ios::out);
+  char header[12] = "APS2 seqfil";
+  file.write(header, sizeof(header));
+  uint16_t num_chans = static_cast<uint16_t>(waveforms.size());
+  file.write(reinterpret_cast<const char *>(&num_chans), sizeof(num_chans));
+  write_array(file, instructions);
+  for (const auto &wf : waveforms) {
+    write_array(file, wf);
+  }
+}
+
+vector<char> read_bytes(const string &filename) {
+  std::ifstream in(filename, std::ios::binary);
+  return vector<char>(std::istreambuf_iterator<char>(in),
+                      std::istreambuf_iterator<char>());
+}
+
+void write_bytes(const string &filename, const vector<char> &bytes) {
+  std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+  out.write(bytes.data(), bytes.size());
+}
+
+// Instructions, two waveforms of odd length and markers on the second
+APS2SequenceData make_sequence(size_t numInstructions, size_t numPts,
+                               int16_t scale) {
+  APS2SequenceData data;
+  for (size_t ct = 0; ct < numInstructions; ct++) {
+    data.instructions.push_back((0xabcdull << 48) | ct);
+  }
+  data.waveforms.assign(2, vector<int16_t>(numPts));
+  for (size_t ct = 0; ct < numPts; ct++) {
+    data.waveforms[0][ct] = static_cast<int16_t>(scale * (ct % 8192));
+    data.waveforms[1][ct] = static_cast<int16_t>(-scale * (ct % 8192));
+  }
+  data.markers.resize(2);
+  for (size_t ct = 0; ct < numPts; ct++) {
+    data.markers[1].push_back(static_cast<uint8_t>(ct % 4));
+  }
+  return data;
+}
+
+vector<uint32_t> packed_sequence(const vector<uint64_t> &instructions) {
+  vector<uint32_t> words;
+  for (auto instr : instructions) {
+    words.push_back(static_cast<uint32_t>(instr));
+    words.push_back(static_cast<uint32_t>(instr >> 32));
+  }
+  words.resize(4 * ((words.size() + 3) / 4), 0xffffffff);
+  return words;
+}
+
+vector<uint32_t> packed_waveform(const APS2SequenceData &data, int ch) {
+  Channel channel(ch);
+  channel.set_waveform(data.waveforms[ch]);
+  if (!data.markers[ch].empty()) {
+    channel.set_markers(data.markers[ch]);
+  }
+  return channel.packed_waveform();
+}
+
+} // namespace
+
+TEST_CASE("sequence file loading", "[loopback]") {
+  const string ip = "127.0.11.5";
+  APS2StandIn standin(ip);
+  auto myEthernetRM = std::make_shared<APS2Ethernet>(0, 0);
+  ethernetRM = myEthernetRM;
+  REQUIRE(connect_APS(ip.c_str()) == APS2_OK);
+  const string filename = "test_sequence_file.aps2";
+
+  // odd lengths so the instructions and samples sit unaligned in the file
+  vector<uint64_t> instructions(3 * UPLOAD_CHUNK_WORDS / 2 + 3);
+  for (size_t ct = 0; ct < instructions.size(); ct++) {
+    instructions[ct] = (0x1234ull << 48) | ct;
+  }
+  // the waveforms are packed a chunk at a time on the way out so make them
+  // span more than one, with a sample to clip
+  vector<vector<int16_t>> waveforms(
+      2, vector<int16_t>(2 * UPLOAD_CHUNK_WORDS + 1001));
+  for (size_t ct = 0; ct < waveforms[0].size(); ct++) {
+    waveforms[0][ct] = static_cast<int16_t>(ct % 8192);
+    waveforms[1][ct] = static_cast<int16_t>(-(ct % 8192));
+  }
+  waveforms[1][UPLOAD_CHUNK_WORDS] = -9000;
+  write_v1_file(filename, instructions, waveforms);
+
+  SECTION("sections reach the device memory") {
+    auto start = std::chrono::steady_clock::now();
+    REQUIRE(load_sequence_file(ip.c_str(), filename.c_str()) == APS2_OK);
+    double elapsed = std::chrono::duration<double, std::milli>(
+                         std::chrono::steady_clock::now() - start)
+                         .count();
+    cout << std::fixed << std::setprecision(1) << "Loaded a "
+         << (8 * instructions.size() + 4 * waveforms[0].size()) / (1 << 20)
+         << " MB sequence file in " << elapsed << " ms" << endl;
+
+    vector<uint32_t> expected;
+    for (auto instr : instructions) {
+      expected.push_back(static_cast<uint32_t>(instr));
+      expected.push_back(static_cast<uint32_t>(instr >> 32));
+    }
+    expected.resize(expected.size() + 2, 0xffffffff);
+    REQUIRE(standin.read_memory(MEMORY_ADDR + SEQ_OFFSET, expected.size()) ==
+            expected);
+
+    for (int ch = 0; ch < 2; ch++) {
+      Channel expected(ch);
+      expected.set_waveform(waveforms[ch]);
+      auto packed = expected.prep_packed_waveform();
+      REQUIRE(standin.read_memory(ch == 0 ? WFA_OFFSET : WFB_OFFSET,
+                                  packed.size()) == packed);
+    }
+  }
+
+  SECTION("damaged files are rejected") {
+    REQUIRE(load_sequence_file(ip.c_str(), "no/such/file.aps2") ==
+            APS2_SEQFILE_FAIL);
+    // cut off in the middle of the second waveform
+    std::ifstream in(filename, std::ios::binary | std::ios::ate);
+    size_t size = static_cast<size_t>(in.tellg());
+    in.seekg(0);
+    vector<char> bytes(size - 1000);
+    in.read(bytes.data(), bytes.size());
+    in.close();
+    std::ofstream out(filename, std::ios::binary | std::ios::trunc);
+    out.write(bytes.data(), bytes.size());
+    out.close();
+    REQUIRE(load_sequence_file(ip.c_str(), filename.c_str()) ==
+            APS2_SEQFILE_FAIL);
+  }
+
+  std::remove(filename.c_str());
+  REQUIRE(disconnect_APS(ip.c_str()) == APS2_OK);
+}
+
+TEST_CASE("sequence file conversion", "[seqfile]") {
+  const string v1 = "test_sequence_convert.aps2";
+  const string v2 = "test_sequence_convert.v2.aps2";
+  auto data = make_sequence(1001, 30001, 1);
+  data.metadata = "ramsey sweep";
+
+  SECTION("version 2 files keep everything") {
+    APS2SequenceFile::write_v2(v2, data);
+    auto back = APS2SequenceFile::read(v2);
+    REQUIRE(back.instructions == data.instructions);
+    REQUIRE(back.waveforms == data.waveforms);
+    REQUIRE(back.markers == data.markers);
+    REQUIRE(back.metadata == data.metadata);
+
+    APS2MappedFile file(v2);
+    REQUIRE(APS2SequenceFile::is_v2(file));
+    auto sections = APS2SequenceFile::read_sections(file);
+    REQUIRE(sections.size() == 5);
+    for (const auto &section : sections) {
+      CHECK(section.offset % APS2SequenceFile::ALIGNMENT == 0);
+      CHECK(section.numBytes % 16 == 0);
+    }
+    // the waveform payloads are exactly what the device memory holds
+    for (const auto &section : sections) {
+      if (section.type != APS2SectionType::WAVEFORM) {
+        continue;
+      }
+      auto expected = packed_waveform(data, section.channel);
+      REQUIRE(section.numBytes == 4 * expected.size());
+      vector<uint32_t> payload(expected.size());
+      std::memcpy(payload.data(), file.data() + section.offset,
+                  section.numBytes);
+      REQUIRE(payload == expected);
+    }
+  }
+
+  SECTION("version 1 files round trip through version 2") {
+    data.markers.assign(2, vector<uint8_t>());
+    data.metadata.clear();
+    APS2SequenceFile::write_v1(v1, data);
+    auto original = read_bytes(v1);
+    APS2SequenceFile::convert(v1, v2, 2);
+    APS2SequenceFile::convert(v2, v1, 1);
+    REQUIRE(read_bytes(v1) == original);
+
+    auto back = APS2SequenceFile::read(v2);
+    REQUIRE(back.instructions == data.instructions);
+    REQUIRE(back.waveforms == data.waveforms);
+  }
+
+  SECTION("damaged version 2 files are rejected") {
+    APS2SequenceFile::write_v2(v2, data);
+    auto bytes = read_bytes(v2);
+    vector<char> damaged = bytes;
+    // the first payload
+    damaged[APS2SequenceFile::ALIGNMENT] ^= 1;
+    write_bytes(v2, damaged);
+    REQUIRE_THROWS_AS(APS2SequenceFile::read(v2), APS2_STATUS);
+
+    damaged = bytes;
+    damaged.resize(damaged.size() - 100);
+    write_bytes(v2, damaged);
+    REQUIRE_THROWS_AS(APS2SequenceFile::read(v2), APS2_STATUS);
+
+    damaged = bytes;
+    damaged[8] = 3; // version
+    write_bytes(v2, damaged);
+    REQUIRE_THROWS_AS(APS2SequenceFile::read(v2), APS2_STATUS);
+  }
+
+  std::remove(v1.c_str());
+  std::remove(v2.c_str());
+}
+
+TEST_CASE("version 2 sequence file loading", "[loopback]") {
+  const string ip = "127.0.11.6";
+  APS2StandIn standin(ip);
+  auto myEthernetRM = std::make_shared<APS2Ethernet>(0, 0);
+  ethernetRM = myEthernetRM;
+  REQUIRE(connect_APS(ip.c_str()) == APS2_OK);
+  auto metrics = myEthernetRM->get_metrics(ip);
+  const string filename = "test_sequence_file.v2.aps2";
+
+  auto data = make_sequence(UPLOAD_CHUNK_WORDS + 5, 100001, 1);
+  APS2SequenceFile::write_v2(filename, data);
+  REQUIRE(load_sequence_file(ip.c_str(), filename.c_str()) == APS2_OK);
+
+  auto check_memory = [&](const APS2SequenceData &expected) {
+    auto sequence = packed_sequence(expected.instructions);
+    REQUIRE(standin.read_memory(MEMORY_ADDR + SEQ_OFFSET, sequence.size()) ==
+            sequence);
+    for (int ch = 0; ch < 2; ch++) {
+      auto packed = packed_waveform(expected, ch);
+      REQUIRE(standin.read_memory(ch == 0 ? WFA_OFFSET : WFB_OFFSET,
+                                  packed.size()) == packed);
+    }
+  };
+
+  SECTION("sections reach the device memory") { check_memory(data); }
+
+  SECTION("unchanged sections are skipped") {
+    uint64_t start_bytes = metrics->bytesSent;
+    REQUIRE(load_sequence_file(ip.c_str(), filename.c_str()) == APS2_OK);
+    REQUIRE(metrics->bytesSent == start_bytes);
+
+    // only the changed waveform goes out again
+    auto changed = data;
+    changed.waveforms[1] = data.waveforms[0];
+    APS2SequenceFile::write_v2(filename, changed);
+    start_bytes = metrics->bytesSent;
+    REQUIRE(load_sequence_file(ip.c_str(), filename.c_str()) == APS2_OK);
+    uint64_t sent = metrics->bytesSent - start_bytes;
+    CHECK(sent >= 2 * changed.waveforms[1].size());
+    CHECK(sent < 8 * changed.instructions.size());
+    check_memory(changed);
+  }
+
+  SECTION("sections changed behind the file's back are loaded again") {
+    vector<int16_t> other(1000, 42);
+    REQUIRE(set_waveform_int(ip.c_str(), 0, other.data(), other.size()) ==
+            APS2_OK);
+    vector<uint64_t> instructions(10, 0x1234);
+    REQUIRE(write_sequence(ip.c_str(), instructions.data(),
+                           instructions.size()) == APS2_OK);
+    REQUIRE(load_sequence_file(ip.c_str(), filename.c_str()) == APS2_OK);
+    check_memory(data);
+  }
+
+  SECTION("damaged sections are rejected") {
+    // a payload no longer matching its hash; changing the hash rather than
+    // the payload keeps the section from being skipped as already loaded
+    auto bytes = read_bytes(filename);
+    bytes[24 + 32] ^= 1;
+    write_bytes(filename, bytes);
+    uint64_t start_bytes = metrics->bytesSent;
+    REQUIRE(load_sequence_file(ip.c_str(), filename.c_str()) ==
+            APS2_SEQFILE_FAIL);
+    // caught before any of the instructions went out
+    CHECK(metrics->bytesSent == start_bytes);
+    check_memory(data);
+  }
+
+  std::remove(filename.c_str());
+  REQUIRE(disconnect_APS(ip.c_str()) == APS2_OK);
+}
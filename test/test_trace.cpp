@@ -0,0 +1,121 @@
+// Check traffic traces record what goes over the wire
+
+#include "catch.hpp"
+
+#include <cstdio>
+#include <memory>
+
+#include "APS2Ethernet.h"
+#include "APS2StandIn.h"
+#include "APS2Trace.h"
+#include "RandomHelpers.h"
+#include "constants.h"
+#include "libaps2.h"
+
+extern std::weak_ptr<APS2Ethernet> ethernetRM;
+
+namespace {
+
+vector<APS2TraceRecord> read_trace(const string &filename) {
+  vector<APS2TraceRecord> records;
+  APS2TraceReader reader(filename);
+  APS2TraceRecord record;
+  while (reader.next(record)) {
+    records.push_back(record);
+  }
+  return records;
+}
+
+} // namespace
+
+TEST_CASE("trace file round trip", "[trace]") {
+  const string filename = "test_trace_round_trip.aps2trace";
+  auto data = RandomHelpers::random_data(300);
+  {
+    APS2TraceWriter writer(filename);
+    APS2Command cmd;
+    cmd.cmd = static_cast<uint32_t>(APS_COMMANDS::USERIO_ACK);
+    cmd.cnt = data.size();
+    // enough records to hand several buffers to the writer thread
+    for (size_t ct = 0; ct < 2000; ct++) {
+      writer.record(0x7f000001, APS2TraceDirection::SENT,
+                    APS2TraceTransport::TCP, cmd, 4 * ct, data.data(),
+                    data.size());
+    }
+    auto network = APS2DatagramView::to_network_order(data);
+    writer.record(0x7f000002, APS2TraceDirection::RECEIVED,
+                  APS2TraceTransport::UDP, cmd, 0x100, network.data(),
+                  network.size(), true);
+  }
+
+  auto records = read_trace(filename);
+  REQUIRE(records.size() == 2001);
+  for (size_t ct = 0; ct < 2000; ct++) {
+    REQUIRE(records[ct].datagram.addr == 4 * ct);
+  }
+  REQUIRE(records[0].direction == APS2TraceDirection::SENT);
+  REQUIRE(records[0].transport == APS2TraceTransport::TCP);
+  REQUIRE(records[0].datagram.payload == data);
+  REQUIRE(records[1].timestamp >= records[0].timestamp);
+  auto &last = records.back();
+  REQUIRE(last.ipAddr == 0x7f000002);
+  REQUIRE(last.direction == APS2TraceDirection::RECEIVED);
+  REQUIRE(last.transport == APS2TraceTransport::UDP);
+  REQUIRE(last.datagram.payload == data);
+
+  // not a trace
+  {
+    FILE *file = std::fopen(filename.c_str(), "wb");
+    std::fputs("not a trace at all", file);
+    std::fclose(file);
+  }
+  REQUIRE_THROWS(APS2TraceReader(filename));
+  std::remove(filename.c_str());
+}
+
+TEST_CASE("trace recording", "[loopback]") {
+  auto myEthernetRM = std::make_shared<APS2Ethernet>(0, 0);
+  ethernetRM = myEthernetRM;
+
+  for (bool supports_tcp : {true, false}) {
+    string ip = supports_tcp ? "127.0.9.4" : "127.0.9.5";
+    const string filename = "test_trace_recording.aps2trace";
+    APS2StandIn standin(ip, supports_tcp);
+    REQUIRE(connect_APS(ip.c_str()) == APS2_OK);
+
+    REQUIRE(start_trace(filename.c_str()) == APS2_OK);
+    const uint32_t num_words = 100;
+    auto data = RandomHelpers::random_data(num_words);
+    REQUIRE(write_memory(ip.c_str(), 0x40, data.data(), num_words) == APS2_OK);
+    vector<uint32_t> check(num_words);
+    REQUIRE(read_memory(ip.c_str(), 0x40, check.data(), num_words) ==
+            APS2_OK);
+    REQUIRE(stop_trace() == APS2_OK);
+    // nothing after the stop is recorded
+    REQUIRE(read_memory(ip.c_str(), 0x40, check.data(), num_words) ==
+            APS2_OK);
+    REQUIRE(disconnect_APS(ip.c_str()) == APS2_OK);
+
+    // write, its acknowledge, the read request and the response
+    auto records = read_trace(filename);
+    REQUIRE(records.size() == 4);
+    auto transport =
+        supports_tcp ? APS2TraceTransport::TCP : APS2TraceTransport::UDP;
+    uint32_t ip_addr = asio::ip::address_v4::from_string(ip).to_ulong();
+    for (const auto &record : records) {
+      REQUIRE(record.ipAddr == ip_addr);
+      REQUIRE(record.transport == transport);
+    }
+    REQUIRE(records[0].direction == APS2TraceDirection::SENT);
+    REQUIRE(records[0].datagram.addr == 0x40);
+    REQUIRE(records[0].datagram.payload == data);
+    REQUIRE(records[1].direction == APS2TraceDirection::RECEIVED);
+    REQUIRE(records[2].direction == APS2TraceDirection::SENT);
+    REQUIRE(records[2].datagram.cmd.r_w == 1);
+    REQUIRE(records[3].direction == APS2TraceDirection::RECEIVED);
+    REQUIRE(records[3].datagram.payload == data);
+    std::remove(filename.c_str());
+  }
+
+  REQUIRE(start_trace("no/such/directory/trace") == APS2_FILELOG_ERROR);
+}
@@ -0,0 +1,141 @@
+// Check CSR transactions merge register updates and batch the round trips
+
+#include "catch.hpp"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+using std::cout;
+using std::endl;
+#include <memory>
+
+#include "APS2.h"
+#include "APS2Ethernet.h"
+#include "APS2StandIn.h"
+#include "APS2Transaction.h"
+#include "constants.h"
+
+namespace {
+
+double elapsed_ms(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+} // namespace
+
+TEST_CASE("transaction resolution", "[transaction]") {
+
+  SECTION("full writes need no read") {
+    APS2Transaction txn;
+    txn.write(0x10, 0x1234);
+    txn.set_bits(0x10, {0});
+    REQUIRE(txn.registers_to_read().empty());
+    auto writes = txn.resolve({});
+    REQUIRE(writes.size() == 1);
+    REQUIRE(writes[0] == std::make_pair(0x10u, 0x1235u));
+  }
+
+  SECTION("masked writes to a register merge into one") {
+    APS2Transaction txn;
+    txn.set_bits(0x10, {1, 3});
+    txn.write_masked(0x20, 0xab00, 0xff00);
+    txn.clear_bits(0x10, {0});
+    txn.toggle_bits(0x10, {4});
+    REQUIRE(txn.registers_to_read() == vector<uint32_t>({0x10, 0x20}));
+    auto writes = txn.resolve({{0x10, 0x1}, {0x20, 0xffff}});
+    REQUIRE(writes.size() == 2);
+    REQUIRE(writes[0] == std::make_pair(0x10u, 0x1au));
+    REQUIRE(writes[1] == std::make_pair(0x20u, 0xabffu));
+  }
+
+  SECTION("barriers keep pulses") {
+    APS2Transaction txn;
+    txn.set_bits(0x10, {2});
+    txn.barrier();
+    txn.clear_bits(0x10, {2});
+    auto writes = txn.resolve({{0x10, 0x1}});
+    REQUIRE(writes.size() == 2);
+    REQUIRE(writes[0] == std::make_pair(0x10u, 0x5u));
+    REQUIRE(writes[1] == std::make_pair(0x10u, 0x1u));
+  }
+
+  SECTION("reads see earlier operations") {
+    APS2Transaction txn;
+    size_t before = txn.read(0x10);
+    txn.set_bits(0x10, {8});
+    size_t after = txn.read(0x10);
+    txn.resolve({{0x10, 0x1}});
+    REQUIRE(txn.result(before) == 0x1);
+    REQUIRE(txn.result(after) == 0x101);
+    REQUIRE_THROWS(txn.result(2));
+  }
+}
+
+TEST_CASE("transaction commit", "[loopback]") {
+  const string ip = "127.0.8.1";
+  APS2StandIn standin(ip);
+  standin.set_latency(std::chrono::milliseconds(1));
+  auto myEthernetRM = std::make_shared<APS2Ethernet>(0, 0);
+  APS2 aps(ip);
+  aps.connect(std::shared_ptr<APS2Ethernet>(myEthernetRM));
+
+  // registers in the CSR space to update one bit each
+  const size_t num_registers = 8;
+  vector<uint32_t> addrs;
+  for (size_t ct = 0; ct < num_registers; ct++) {
+    addrs.push_back(CSR_AXI_OFFSET + 4 * (32 + ct));
+    standin.write_memory(addrs.back(), {0x100});
+  }
+
+  SECTION("one burst instead of a round trip per update") {
+    // read-modify-write each register in turn
+    auto start = std::chrono::steady_clock::now();
+    for (auto addr : addrs) {
+      uint32_t val = aps.read_memory(addr, 1)[0];
+      aps.write_memory(addr, val | 0x1);
+    }
+    double separate_duration = elapsed_ms(start);
+
+    APS2Transaction txn;
+    vector<size_t> handles;
+    for (auto addr : addrs) {
+      txn.set_bits(addr, {1});
+      txn.clear_bits(addr, {8});
+      handles.push_back(txn.read(addr));
+    }
+    start = std::chrono::steady_clock::now();
+    aps.commit(txn);
+    double batched_duration = elapsed_ms(start);
+
+    cout << std::fixed << std::setprecision(1) << "Updated " << num_registers
+         << " registers in " << separate_duration << " ms one at a time and "
+         << batched_duration << " ms batched" << endl;
+    for (size_t ct = 0; ct < num_registers; ct++) {
+      REQUIRE(standin.read_memory(addrs[ct], 1)[0] == 0x3);
+      REQUIRE(txn.result(handles[ct]) == 0x3);
+    }
+    CHECK(batched_duration < separate_duration / 2);
+  }
+
+  SECTION("run and stop") {
+    aps.run();
+    uint32_t control = standin.read_memory(CONTROL_REG_ADDR, 1)[0];
+    REQUIRE(((control >> SM_ENABLE_BIT) & 0x1) == 1);
+    REQUIRE(((control >> TRIGGER_ENABLE_BIT) & 0x1) == 1);
+    REQUIRE(((standin.read_memory(CACHE_CONTROL_ADDR, 1)[0] >>
+              CACHE_ENABLE_BIT) &
+             0x1) == 1);
+
+    aps.stop();
+    control = standin.read_memory(CONTROL_REG_ADDR, 1)[0];
+    REQUIRE(((control >> SM_ENABLE_BIT) & 0x1) == 0);
+    REQUIRE(((control >> TRIGGER_ENABLE_BIT) & 0x1) == 0);
+    REQUIRE(((standin.read_memory(CACHE_CONTROL_ADDR, 1)[0] >>
+              CACHE_ENABLE_BIT) &
+             0x1) == 0);
+  }
+
+  aps.disconnect();
+}
@@ -0,0 +1,62 @@
+// Check batched legacy UDP transmit and benchmark the packet rate of bulk
+// writes to a legacy firmware stand-in
+
+#include "catch.hpp"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+using std::cout;
+using std::endl;
+#include <memory>
+
+#include "APS2Ethernet.h"
+#include "APS2StandIn.h"
+#include "RandomHelpers.h"
+#include "constants.h"
+
+TEST_CASE("batched legacy UDP transmit", "[loopback]") {
+
+  const string standin_ip = "127.0.4.1";
+  APS2StandIn standin(standin_ip, false);
+  auto ethernetRM = std::make_shared<APS2Ethernet>(0, 0);
+  ethernetRM->connect(standin_ip);
+
+  APS2Command cmd;
+  cmd.ack = 1;
+  cmd.cmd = static_cast<uint32_t>(APS_COMMANDS::USERIO_ACK);
+
+  SECTION("data arrives intact across packet and ack boundaries") {
+    // the legacy path splits into 256 word packets and acks every 20
+    uint32_t addr = 0;
+    for (size_t numWords : {1, 255, 256, 257, 20 * 256, 20 * 256 + 3}) {
+      auto data = RandomHelpers::random_data(numWords);
+      ethernetRM->send(standin_ip, {{cmd, addr, data}});
+      CAPTURE(numWords);
+      REQUIRE(standin.read_memory(addr, numWords) == data);
+      addr += 4 * numWords;
+    }
+  }
+
+  SECTION("bulk write packet rate") {
+    standin.set_record_writes(false);
+    // 4MB in 256 word packets
+    auto data = RandomHelpers::random_data(1 << 20);
+    const size_t num_packets = data.size() / 256;
+    const size_t num_trials = 3;
+    double best = 0;
+    for (size_t ct = 0; ct < num_trials; ct++) {
+      auto start = std::chrono::steady_clock::now();
+      ethernetRM->send(standin_ip, {{cmd, 0, data}});
+      auto stop = std::chrono::steady_clock::now();
+      double rate =
+          num_packets /
+          std::chrono::duration<double>(stop - start).count();
+      best = std::max(best, rate);
+    }
+    cout << std::fixed << std::setprecision(0)
+         << "legacy UDP bulk write: " << best << " packets/s ("
+         << std::setprecision(1) << best * 1024 / 1e6 << " MB/s)" << endl;
+    CHECK(best > 0);
+  }
+}
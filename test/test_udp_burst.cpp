@@ -0,0 +1,83 @@
+// Check that bursts of legacy UDP responses from many devices are sorted to
+// the right receive queues in order and benchmark the receive rate
+
+#include "catch.hpp"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+using std::cout;
+using std::endl;
+#include <memory>
+
+#include "APS2Ethernet.h"
+#include "APS2StandIn.h"
+#include "constants.h"
+
+TEST_CASE("legacy UDP burst receive", "[loopback]") {
+
+  // bind the driver to a known port so the test can aim bursts at it
+  const uint16_t driver_port = 0xbb60;
+  const size_t num_devices = 8;
+  vector<string> standin_ips;
+  vector<std::unique_ptr<APS2StandIn>> standins;
+  for (size_t ct = 1; ct <= num_devices; ct++) {
+    standin_ips.push_back("127.0.4." + std::to_string(ct + 1));
+    standins.emplace_back(new APS2StandIn(standin_ips.back(), false));
+  }
+  auto ethernetRM = std::make_shared<APS2Ethernet>(driver_port, 0);
+  for (auto ip : standin_ips) {
+    ethernetRM->connect(ip);
+  }
+
+  // Pretend to be the devices by sending from their addresses
+  asio::io_service ios;
+  vector<std::unique_ptr<udp::socket>> senders;
+  for (auto ip : standin_ips) {
+    senders.emplace_back(new udp::socket(ios));
+    senders.back()->open(udp::v4());
+    senders.back()->bind(
+        udp::endpoint(asio::ip::address_v4::from_string(ip), 0));
+  }
+  udp::endpoint driver(asio::ip::address_v4::from_string("127.0.0.1"),
+                       driver_port);
+
+  // read responses carry an address word ahead of the payload
+  APS2Command cmd;
+  cmd.r_w = 1;
+  cmd.cmd = static_cast<uint32_t>(APS_COMMANDS::USERIO_ACK);
+
+  // interleave bursts from all devices before draining any of them
+  const size_t burst = 16;
+  const size_t num_rounds = 200;
+  vector<uint8_t> bytes;
+  size_t num_received = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (size_t round = 0; round < num_rounds; round++) {
+    for (size_t ct = 0; ct < burst; ct++) {
+      for (size_t dev = 0; dev < num_devices; dev++) {
+        APS2EthernetPacket packet(cmd);
+        packet.header.seqNum = ct;
+        packet.payload = {static_cast<uint32_t>(dev),
+                          static_cast<uint32_t>(round)};
+        senders[dev]->send_to(asio::buffer(packet.serialize()), driver);
+      }
+    }
+    for (size_t dev = 0; dev < num_devices; dev++) {
+      auto packets = ethernetRM->receive(standin_ips[dev], burst);
+      for (size_t ct = 0; ct < burst; ct++) {
+        REQUIRE(packets[ct].header.seqNum == ct);
+        REQUIRE(packets[ct].payload.size() >= 2);
+        REQUIRE(packets[ct].payload[0] == dev);
+        REQUIRE(packets[ct].payload[1] == round);
+      }
+      num_received += packets.size();
+    }
+  }
+  auto stop = std::chrono::steady_clock::now();
+  REQUIRE(num_received == num_rounds * burst * num_devices);
+  cout << std::fixed << std::setprecision(0) << num_devices
+       << " device burst receive: "
+       << num_received / std::chrono::duration<double>(stop - start).count()
+       << " packets/s" << endl;
+}
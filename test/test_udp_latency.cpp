@@ -0,0 +1,69 @@
+// Benchmark the round trip latency of legacy UDP acknowledges against a
+// loopback stand-in
+
+#include "catch.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+using std::cout;
+using std::endl;
+#include <memory>
+
+#include "APS2Ethernet.h"
+#include "APS2StandIn.h"
+#include "constants.h"
+
+TEST_CASE("legacy UDP acknowledge latency", "[loopback]") {
+
+  const string standin_ip = "127.0.0.4";
+  APS2StandIn standin(standin_ip, false);
+  auto ethernetRM = std::make_shared<APS2Ethernet>(0, 0);
+  ethernetRM->connect(standin_ip);
+
+  APS2Command cmd;
+  cmd.ack = 1;
+  cmd.cmd = static_cast<uint32_t>(APS_COMMANDS::USERIO_ACK);
+  cmd.cnt = 1;
+
+  // single word acknowledged writes so every send waits on one ack
+  const size_t num_trials = 200;
+  vector<double> latencies;
+  for (size_t ct = 0; ct < num_trials; ct++) {
+    uint32_t addr = 4 * static_cast<uint32_t>(ct);
+    auto start = std::chrono::steady_clock::now();
+    ethernetRM->send(standin_ip, {{cmd, addr, {static_cast<uint32_t>(ct)}}});
+    auto stop = std::chrono::steady_clock::now();
+    latencies.push_back(
+        std::chrono::duration<double, std::micro>(stop - start).count());
+  }
+  REQUIRE(standin.read_memory(4 * (num_trials - 1), 1)[0] == num_trials - 1);
+
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double p) {
+    return latencies[static_cast<size_t>(p * (latencies.size() - 1))];
+  };
+
+  // log2 histogram in microseconds
+  cout << "acknowledge round trip histogram:" << endl;
+  vector<size_t> bins(16, 0);
+  for (auto latency : latencies) {
+    size_t bin = 0;
+    while ((bin < bins.size() - 1) && (latency >= (2 << bin))) {
+      bin++;
+    }
+    bins[bin]++;
+  }
+  for (size_t bin = 0; bin < bins.size(); bin++) {
+    if (bins[bin]) {
+      cout << "  < " << std::setw(5) << (2 << bin) << " us: " << bins[bin]
+           << endl;
+    }
+  }
+  cout << std::fixed << std::setprecision(1) << "p50: " << percentile(0.5)
+       << " us; p99: " << percentile(0.99) << " us" << endl;
+
+  // polling used to add up to 10ms to every acknowledge
+  REQUIRE(percentile(0.5) < 5000);
+}
@@ -0,0 +1,119 @@
+// Check that large TCP uploads are sent without copying the payload per
+// datagram and compare against the copying path
+
+#include "catch.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+using std::cout;
+using std::endl;
+#include <memory>
+#include <new>
+
+#include "APS2Ethernet.h"
+#include "APS2StandIn.h"
+#include "RandomHelpers.h"
+#include "constants.h"
+
+// Count heap allocations made by the thread under test only so the driver's
+// receive thread and the stand-in don't muddy the numbers
+namespace {
+thread_local bool count_allocations = false;
+thread_local size_t num_allocations = 0;
+thread_local size_t bytes_allocated = 0;
+
+struct AllocationCounter {
+  AllocationCounter() {
+    num_allocations = 0;
+    bytes_allocated = 0;
+    count_allocations = true;
+  }
+  ~AllocationCounter() { count_allocations = false; }
+};
+} // namespace
+
+void *operator new(std::size_t size) {
+  if (count_allocations) {
+    num_allocations++;
+    bytes_allocated += size;
+  }
+  void *ptr = std::malloc(size ? size : 1);
+  if (!ptr) {
+    throw std::bad_alloc();
+  }
+  return ptr;
+}
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+TEST_CASE("zero copy TCP sends", "[loopback]") {
+
+  const string standin_ip = "127.0.0.3";
+  APS2StandIn standin(standin_ip);
+  standin.set_record_writes(false);
+  auto ethernetRM = std::make_shared<APS2Ethernet>(0, 0);
+  ethernetRM->connect(standin_ip);
+
+  APS2Command cmd;
+  cmd.ack = 1;
+  cmd.cmd = static_cast<uint32_t>(APS_COMMANDS::USERIO_ACK);
+
+  // 16MB in 256kB datagrams like APS2::write_memory
+  auto data = RandomHelpers::random_data(1 << 22);
+  auto network_data = APS2DatagramView::to_network_order(data);
+  auto views = APS2DatagramView::chunk(cmd, 0, network_data, 0xfffc);
+  auto dgs = APS2Datagram::chunk(cmd, 0, data, 0xfffc);
+
+  SECTION("payload is never copied") {
+    size_t payload_bytes = 4 * data.size();
+    {
+      AllocationCounter counter;
+      ethernetRM->send(standin_ip, views);
+    }
+    cout << "zero copy send: " << num_allocations << " allocations of "
+         << bytes_allocated << " bytes for " << views.size() << " datagrams"
+         << endl;
+    // only small bookkeeping allocations for the write/read futures and the
+    // ack datagrams remain
+    REQUIRE(bytes_allocated < payload_bytes / 16);
+
+    {
+      AllocationCounter counter;
+      ethernetRM->send(standin_ip, dgs);
+    }
+    cout << "copying send: " << num_allocations << " allocations of "
+         << bytes_allocated << " bytes for " << dgs.size() << " datagrams"
+         << endl;
+    REQUIRE(bytes_allocated >= payload_bytes);
+  }
+
+  SECTION("throughput") {
+    auto time_send = [&](std::function<void()> send) {
+      auto start = std::chrono::steady_clock::now();
+      send();
+      auto stop = std::chrono::steady_clock::now();
+      auto duration =
+          std::chrono::duration_cast<std::chrono::microseconds>(stop - start)
+              .count();
+      return static_cast<double>(4 * data.size()) / duration;
+    };
+
+    // include the one time swap in the zero copy time to be fair
+    double zero_copy_rate = time_send([&]() {
+      auto network_data = APS2DatagramView::to_network_order(data);
+      ethernetRM->send(standin_ip,
+                       APS2DatagramView::chunk(cmd, 0, network_data, 0xfffc));
+    });
+    double copying_rate = time_send([&]() {
+      ethernetRM->send(standin_ip, APS2Datagram::chunk(cmd, 0, data, 0xfffc));
+    });
+    cout << std::fixed << std::setprecision(1)
+         << "zero copy send: " << zero_copy_rate << " MB/s; copying send: "
+         << copying_rate << " MB/s" << endl;
+    REQUIRE(standin.num_datagrams() == 2 * views.size());
+  }
+}